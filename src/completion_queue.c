@@ -0,0 +1,81 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "completion_queue.h"
+
+int completion_queue_init(completion_queue_t *queue) {
+  assert(queue != NULL);
+
+  memset(queue, 0, sizeof(*queue));
+  if (pipe(queue->wake) != 0) {
+    fprintf(stderr, "completion_queue_init: unable to make a pipe: %s\n", strerror(errno));
+    queue->wake[0] = queue->wake[1] = -1;
+    return 0;
+  }
+  for (int i = 0; i < 2; i++) {
+    fcntl(queue->wake[i], F_SETFL, O_NONBLOCK);
+    fcntl(queue->wake[i], F_SETFD, FD_CLOEXEC);
+  }
+  pthread_mutex_init(&queue->lock, NULL);
+  return 1;
+}
+
+void completion_queue_free(completion_queue_t *queue) {
+  assert(queue != NULL);
+
+  if (queue->wake[0] < 0) {
+    return; // never started
+  }
+  pthread_mutex_destroy(&queue->lock);
+  close(queue->wake[0]);
+  close(queue->wake[1]);
+  memset(queue, 0, sizeof(*queue));
+  queue->wake[0] = queue->wake[1] = -1;
+}
+
+int completion_queue_fd(completion_queue_t *queue) {
+  assert(queue != NULL);
+  return queue->wake[0];
+}
+
+void completion_queue_push(completion_queue_t *queue, completion_t *completion) {
+  assert(queue != NULL);
+  assert(completion != NULL);
+
+  completion->next = NULL;
+  pthread_mutex_lock(&queue->lock);
+  int wake = queue->head == NULL;
+  if (queue->tail != NULL) {
+    queue->tail->next = completion;
+  } else {
+    queue->head = completion;
+  }
+  queue->tail = completion;
+  pthread_mutex_unlock(&queue->lock);
+
+  if (wake) {
+    char c = 0;
+    // if the pipe is full, there is a wakeup pending anyway
+    ssize_t ret = write(queue->wake[1], &c, 1);
+    (void)ret;
+  }
+}
+
+completion_t *completion_queue_take(completion_queue_t *queue) {
+  assert(queue != NULL);
+
+  char buffer[64];
+  while (read(queue->wake[0], buffer, sizeof(buffer)) > 0) {
+    // consume all wakeups: they are all answered below
+  }
+
+  pthread_mutex_lock(&queue->lock);
+  completion_t *head = queue->head;
+  queue->head = queue->tail = NULL;
+  pthread_mutex_unlock(&queue->lock);
+  return head;
+}
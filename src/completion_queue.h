@@ -0,0 +1,35 @@
+#ifndef __COMPLETION_QUEUE_H__
+#define __COMPLETION_QUEUE_H__
+
+#include <pthread.h>
+
+// results of tasks run on the workers, handed back to the thread of the event loop:
+// any thread pushes them, and the owner polls a pipe to learn there are some (as for
+// the crawler), then takes them all at once, in the order they were pushed. results
+// embed a completion_t (as their first member, say) to be linked in.
+
+typedef struct completion_s {
+  struct completion_s *next;
+} completion_t;
+
+typedef struct completion_queue_s {
+  pthread_mutex_t lock;
+  completion_t *head, *tail;
+  int wake[2]; // pipe: readable when there is something to take
+} completion_queue_t;
+
+// returns zero on failure
+int completion_queue_init(completion_queue_t *queue);
+// whatever was not taken is left to its owner
+void completion_queue_free(completion_queue_t *queue);
+
+// the descriptor to poll for reading
+int completion_queue_fd(completion_queue_t *queue);
+
+// from any thread
+void completion_queue_push(completion_queue_t *queue, completion_t *completion);
+// all results pushed so far, oldest first (NULL if none); the pipe is readable again
+// as soon as there is another one
+completion_t *completion_queue_take(completion_queue_t *queue);
+
+#endif /* !__COMPLETION_QUEUE_H__ */
@@ -0,0 +1,422 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "crawler.h"
+#include "xxhash64.h"
+
+typedef struct crawl_job_s {
+  crawler_t *crawler;
+  char path[]; // NUL-terminated
+} crawl_job_t;
+
+static const char *crawler_extensions[] = {".dats", ".sats", ".hats", ".cats"};
+
+int crawler_is_source(const char *name, size_t length) {
+  assert(name != NULL);
+
+  for (size_t i = 0; i < sizeof(crawler_extensions) / sizeof(crawler_extensions[0]); i++) {
+    size_t ext_length = strlen(crawler_extensions[i]);
+    if (length > ext_length && !memcmp(name + length - ext_length, crawler_extensions[i], ext_length)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void crawler_wake(crawler_t *crawler) {
+  char c = 0;
+  // if the pipe is full, there is a wakeup pending anyway
+  ssize_t ret = write(crawler->wake[1], &c, 1);
+  (void)ret;
+}
+
+/* ****** ****** */
+
+static void crawler_visit_directory(void *arg);
+static void crawler_read_source(void *arg);
+
+// queue a job for [path]; the crawl is not over until it is done
+static void crawler_submit(crawler_t *crawler, const char *path, size_t length, thread_pool_task_t task) {
+  crawl_job_t *job = malloc(sizeof(crawl_job_t) + length + 1);
+  if (job == NULL) {
+    fprintf(stderr, "crawler_submit: out of memory\n");
+    return;
+  }
+  job->crawler = crawler;
+  memcpy(job->path, path, length);
+  job->path[length] = '\0';
+
+  pthread_mutex_lock(&crawler->lock);
+  crawler->pending++;
+  if (task == crawler_read_source) {
+    crawler->found++;
+  }
+  pthread_mutex_unlock(&crawler->lock);
+
+  if (!thread_pool_submit(&crawler->pool, task, job)) {
+    pthread_mutex_lock(&crawler->lock);
+    crawler->pending--;
+    pthread_mutex_unlock(&crawler->lock);
+    free(job);
+  }
+}
+
+// the job is over: hand over its result (if any)
+static void crawler_finish(crawler_t *crawler, crawl_job_t *job, crawl_result_t *result) {
+  int wake = 0;
+
+  pthread_mutex_lock(&crawler->lock);
+  if (result != NULL) {
+    if (crawler->results_tail != NULL) {
+      crawler->results_tail->next = result;
+    } else {
+      crawler->results = result;
+      wake = 1;
+    }
+    crawler->results_tail = result;
+    if (!result->is_directory) {
+      crawler->read++;
+    }
+  }
+  crawler->pending--;
+  if (crawler->pending == 0) {
+    wake = 1;
+  }
+  pthread_mutex_unlock(&crawler->lock);
+
+  if (wake) {
+    crawler_wake(crawler);
+  }
+  free(job);
+}
+
+static int crawler_stopped(crawler_t *crawler) {
+  pthread_mutex_lock(&crawler->lock);
+  int stop = crawler->stop;
+  pthread_mutex_unlock(&crawler->lock);
+  return stop;
+}
+
+static void crawler_visit_directory(void *arg) {
+  crawl_job_t *job = (crawl_job_t *)arg;
+  crawler_t *crawler = job->crawler;
+
+  DIR *dir = crawler_stopped(crawler) ? NULL : opendir(job->path);
+  if (dir == NULL) {
+    crawler_finish(crawler, job, NULL);
+    return;
+  }
+
+  char path[FILE_URI_MAX];
+  size_t dir_length = strlen(job->path);
+  // the root has a trailing slash already
+  if (dir_length > 0 && job->path[dir_length - 1] == '/') {
+    dir_length--;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL && !crawler_stopped(crawler)) {
+    if (entry->d_name[0] == '.') {
+      continue; // hidden, or the directory itself or its parent
+    }
+    size_t name_length = strlen(entry->d_name);
+    if (dir_length + 1 + name_length + 1 > sizeof(path)) {
+      continue;
+    }
+    memcpy(path, job->path, dir_length);
+    path[dir_length] = '/';
+    memcpy(path + dir_length + 1, entry->d_name, name_length + 1);
+    size_t length = dir_length + 1 + name_length;
+
+    unsigned char type = entry->d_type;
+    if (type == DT_UNKNOWN) {
+      struct stat st;
+      if (lstat(path, &st) != 0) {
+        continue;
+      }
+      type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+    }
+
+    if (type == DT_DIR) {
+      crawler_submit(crawler, path, length, crawler_visit_directory);
+    } else if (type == DT_REG && crawler_is_source(entry->d_name, name_length)) {
+      crawler_submit(crawler, path, length, crawler_read_source);
+    }
+  }
+  closedir(dir);
+
+  crawl_result_t *result = malloc(sizeof(crawl_result_t) + strlen(job->path) + 1);
+  if (result != NULL) {
+    memset(result, 0, sizeof(crawl_result_t));
+    result->is_directory = 1;
+    strcpy(result->path, job->path);
+  }
+  crawler_finish(crawler, job, result);
+}
+
+// read the [length] bytes of the file into [*text] (to be freed). it is read rather than
+// mapped: that takes none of the mappings the file system needs, and can not fault if
+// the file is truncated meanwhile (reading it all also brings it into the page cache
+// for mapping it later)
+static int crawler_read(int fd, size_t length, char **text) {
+  char *buffer = malloc(length + 1);
+  if (buffer == NULL) {
+    errno = ENOMEM;
+    return 0;
+  }
+  size_t total = 0;
+  while (total < length) {
+    ssize_t n = read(fd, buffer + total, length - total);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      if (n == 0) {
+        errno = EIO; // shorter than it was: changed meanwhile
+      }
+      free(buffer);
+      return 0;
+    }
+    total += n;
+  }
+  *text = buffer;
+  return 1;
+}
+
+static void crawler_read_source(void *arg) {
+  crawl_job_t *job = (crawl_job_t *)arg;
+  crawler_t *crawler = job->crawler;
+
+  int fd = crawler_stopped(crawler) ? -1 : open(job->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    crawler_finish(crawler, job, NULL);
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    crawler_finish(crawler, job, NULL);
+    return;
+  }
+
+  size_t length = strlen(job->path);
+  file_digest_t digest;
+  digest.length = st.st_size;
+  digest.mtime = st.st_mtim;
+  digest.hash = 0;
+  dep_directives_t directives = {NULL, 0};
+  char *found = NULL; // directives found here (else, those of the index)
+  int scanned = 0;
+  int hashed = 0;
+
+  file_digest_t known;
+  if (crawler->known != NULL && workspace_index_find(crawler->known, job->path, length, &known)
+      && known.length == (size_t)st.st_size
+      && known.mtime.tv_sec == st.st_mtim.tv_sec && known.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+    // unchanged since the last run
+    digest.hash = known.hash;
+    hashed = 1;
+    scanned = workspace_index_directives(crawler->known, job->path, length, digest.hash, &directives);
+    pthread_mutex_lock(&crawler->lock);
+    crawler->reused++;
+    pthread_mutex_unlock(&crawler->lock);
+  }
+  if (!scanned) {
+    char *text;
+    if (!crawler_read(fd, st.st_size, &text)) {
+      fprintf(stderr, "crawler_read_source(%s): unable to read: %s\n", job->path, strerror(errno));
+    } else {
+      if (!hashed) {
+        digest.hash = xxh64(text, st.st_size, 0);
+        hashed = 1;
+      }
+      // (the same text, touched since, need not be scanned again)
+      scanned = crawler->known != NULL && workspace_index_directives(crawler->known, job->path, length, digest.hash, &directives);
+      if (!scanned) {
+        scanned = dep_directives_find(text, st.st_size, &found, &directives.size);
+        directives.data = found;
+        pthread_mutex_lock(&crawler->lock);
+        crawler->scanned++;
+        pthread_mutex_unlock(&crawler->lock);
+      }
+      free(text);
+    }
+  }
+  close(fd);
+
+  crawl_result_t *result = NULL;
+  if (hashed) {
+    result = malloc(sizeof(crawl_result_t) + length + 1 + directives.size);
+  }
+  if (result != NULL) {
+    result->next = NULL;
+    result->is_directory = 0;
+    result->digest = digest;
+    result->scanned = scanned;
+    result->directives.data = NULL;
+    result->directives.size = directives.size;
+    memcpy(result->path, job->path, length + 1);
+    if (directives.size > 0) {
+      memcpy(result->path + length + 1, directives.data, directives.size);
+      result->directives.data = result->path + length + 1;
+    }
+  }
+  free(found);
+
+  crawler_finish(crawler, job, result);
+}
+
+/* ****** ****** */
+
+int crawler_start(crawler_t *crawler, const char *root, size_t num_threads, const workspace_index_t *known) {
+  assert(crawler != NULL);
+  assert(root != NULL);
+
+  memset(crawler, 0, sizeof(*crawler));
+  crawler->wake[0] = crawler->wake[1] = -1;
+  crawler->known = known;
+
+  size_t length = strlen(root);
+  if (length == 0 || root[0] != '/' || length + 1 >= FILE_URI_MAX) {
+    fprintf(stderr, "crawler_start: not an absolute path or too long\n");
+    return 0;
+  }
+  if (pipe(crawler->wake) != 0) {
+    fprintf(stderr, "crawler_start: unable to make a pipe: %s\n", strerror(errno));
+    crawler->wake[0] = crawler->wake[1] = -1;
+    return 0;
+  }
+  for (int i = 0; i < 2; i++) {
+    fcntl(crawler->wake[i], F_SETFL, O_NONBLOCK);
+    fcntl(crawler->wake[i], F_SETFD, FD_CLOEXEC);
+  }
+  if (!thread_pool_init(&crawler->pool, num_threads)) {
+    close(crawler->wake[0]);
+    close(crawler->wake[1]);
+    crawler->wake[0] = crawler->wake[1] = -1;
+    return 0;
+  }
+  pthread_mutex_init(&crawler->lock, NULL);
+
+  crawler_submit(crawler, root, length, crawler_visit_directory);
+  pthread_mutex_lock(&crawler->lock);
+  if (crawler->pending == 0) {
+    crawler_wake(crawler); // nothing to wait for
+  }
+  pthread_mutex_unlock(&crawler->lock);
+  return 1;
+}
+
+void crawler_free(crawler_t *crawler) {
+  assert(crawler != NULL);
+
+  if (crawler->wake[0] < 0) {
+    return; // never started
+  }
+  pthread_mutex_lock(&crawler->lock);
+  crawler->stop = 1;
+  pthread_mutex_unlock(&crawler->lock);
+  // the jobs still queued see [stop], and return right away
+  thread_pool_free(&crawler->pool);
+
+  crawl_result_t *result = crawler->results;
+  while (result != NULL) {
+    crawl_result_t *next = result->next;
+    free(result);
+    result = next;
+  }
+  pthread_mutex_destroy(&crawler->lock);
+  close(crawler->wake[0]);
+  close(crawler->wake[1]);
+  memset(crawler, 0, sizeof(*crawler));
+  crawler->wake[0] = crawler->wake[1] = -1;
+}
+
+int crawler_fd(crawler_t *crawler) {
+  assert(crawler != NULL);
+  return crawler->wake[0];
+}
+
+static void crawler_consume_wakeups(crawler_t *crawler) {
+  char buffer[64];
+  while (read(crawler->wake[0], buffer, sizeof(buffer)) > 0) {
+    // consume all wakeups: the caller answers them
+  }
+}
+
+int crawler_has_results(crawler_t *crawler) {
+  assert(crawler != NULL);
+
+  crawler_consume_wakeups(crawler);
+  pthread_mutex_lock(&crawler->lock);
+  int has_results = crawler->results != NULL;
+  pthread_mutex_unlock(&crawler->lock);
+  return has_results;
+}
+
+size_t crawler_drain(crawler_t *crawler, size_t max, crawler_visit_t visit, void *state) {
+  assert(crawler != NULL);
+  assert(visit != NULL);
+
+  crawler_consume_wakeups(crawler);
+
+  pthread_mutex_lock(&crawler->lock);
+  crawl_result_t *result = crawler->results;
+  crawl_result_t *last = result;
+  for (size_t taken = 1; max > 0 && last != NULL && taken < max; taken++) {
+    last = last->next;
+  }
+  int left = 0;
+  if (max > 0 && last != NULL && last->next != NULL) {
+    // the rest waits for the next call
+    crawler->results = last->next;
+    last->next = NULL;
+    left = 1;
+  } else {
+    crawler->results = crawler->results_tail = NULL;
+  }
+  pthread_mutex_unlock(&crawler->lock);
+  if (left) {
+    crawler_wake(crawler);
+  }
+
+  size_t count = 0;
+  while (result != NULL) {
+    crawl_result_t *next = result->next;
+    visit(result->path, result->is_directory ? NULL : &result->digest,
+          result->scanned ? &result->directives : NULL, state);
+    free(result);
+    result = next;
+    count++;
+  }
+  return count;
+}
+
+int crawler_done(crawler_t *crawler) {
+  assert(crawler != NULL);
+
+  pthread_mutex_lock(&crawler->lock);
+  int done = crawler->pending == 0 && crawler->results == NULL;
+  pthread_mutex_unlock(&crawler->lock);
+  return done;
+}
+
+void crawler_progress(crawler_t *crawler, size_t *num_read, size_t *found) {
+  assert(crawler != NULL);
+
+  pthread_mutex_lock(&crawler->lock);
+  if (num_read != NULL) {
+    *num_read = crawler->read;
+  }
+  if (found != NULL) {
+    *found = crawler->found;
+  }
+  pthread_mutex_unlock(&crawler->lock);
+}
@@ -0,0 +1,73 @@
+#ifndef __CRAWLER_H__
+#define __CRAWLER_H__
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "thread_pool.h"
+#include "file_system.h"
+#include "workspace_index.h"
+#include "dep_graph.h"
+
+// walks a workspace in the background, looking for ATS sources (.dats, .sats, .hats, .cats).
+// each directory is listed, and each source read and fingerprinted, as a separate job on
+// a thread pool. results pile up until the owner drains them (on its own thread), so the
+// file system is never touched by the workers.
+// - hidden entries (".git", ...) and symbolic links are skipped
+// - the directories walked are handed over as well (e.g. to watch them)
+// - sources found unchanged in the index of the last run are not read again
+// - the directives of sources read are found as well (unless the index has those of
+//   the same text), so that the owner need not read them again
+
+typedef struct crawl_result_s {
+  struct crawl_result_s *next;
+  int is_directory;
+  file_digest_t digest; // only for sources
+  int scanned; // the directives of the source are known
+  dep_directives_t directives; // (kept after the path)
+  char path[]; // NUL-terminated
+} crawl_result_t;
+
+typedef struct crawler_s {
+  thread_pool_t pool;
+
+  pthread_mutex_t lock;
+  crawl_result_t *results, *results_tail; // not drained yet
+  size_t pending; // directories and sources not done yet
+  size_t found; // sources found so far
+  size_t read; // sources read so far
+  size_t reused; // ... of which were unchanged since the last run
+  size_t scanned; // sources scanned for directives
+  int stop;
+  const workspace_index_t *known; // may be NULL
+
+  int wake[2]; // pipe: readable when there is something to drain, or the crawl is over
+} crawler_t;
+
+int crawler_is_source(const char *name, size_t length);
+
+// start crawling from the absolute path [root]; [num_threads] of zero means one per core.
+// [known] (if not NULL) has to stay around until the crawler is freed.
+// returns zero on failure
+int crawler_start(crawler_t *crawler, const char *root, size_t num_threads, const workspace_index_t *known);
+// stop crawling (if not done yet), and drop all results not drained
+void crawler_free(crawler_t *crawler);
+
+// the descriptor to poll for reading
+int crawler_fd(crawler_t *crawler);
+
+// [digest] is NULL for directories; [directives] is NULL unless known (see dep_directives_t)
+typedef
+void (*crawler_visit_t)(const char *path, const file_digest_t *digest, const dep_directives_t *directives, void *state);
+
+// hand the results gathered so far to [visit], at most [max] of them (zero: all); returns
+// how many. if some are left, the descriptor stays readable
+size_t crawler_drain(crawler_t *crawler, size_t max, crawler_visit_t visit, void *state);
+// some results wait to be drained (this answers the wakeups so far: the descriptor is
+// readable again once another result comes)
+int crawler_has_results(crawler_t *crawler);
+// all sources were read, and drained
+int crawler_done(crawler_t *crawler);
+void crawler_progress(crawler_t *crawler, size_t *num_read, size_t *found);
+
+#endif /* !__CRAWLER_H__ */
@@ -0,0 +1,870 @@
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dep_graph.h"
+
+static int dep_is_ident_start(char c) {
+  return isalpha((unsigned char)c) || c == '_';
+}
+
+static int dep_is_ident(char c) {
+  return isalnum((unsigned char)c) || c == '_' || c == '\'' || c == '$';
+}
+
+static int dep_starts_with(const char *text, size_t length, size_t i, const char *prefix) {
+  size_t prefix_length = strlen(prefix);
+  return i + prefix_length <= length && !memcmp(text + i, prefix, prefix_length);
+}
+
+// past the end of [closing], or the end of the text
+static size_t dep_skip_until(const char *text, size_t length, size_t i, const char *closing) {
+  for (; i < length; i++) {
+    if (dep_starts_with(text, length, i, closing)) {
+      return i + strlen(closing);
+    }
+  }
+  return length;
+}
+
+// past the end of the (* ... *) comment at [i]; they nest
+static size_t dep_skip_comment(const char *text, size_t length, size_t i) {
+  size_t depth = 0;
+  while (i < length) {
+    if (dep_starts_with(text, length, i, "(*")) {
+      depth++;
+      i += 2;
+    } else if (dep_starts_with(text, length, i, "*)")) {
+      i += 2;
+      if (--depth == 0) {
+        return i;
+      }
+    } else {
+      i++;
+    }
+  }
+  return length;
+}
+
+// past the end of the string at [i] (at the opening quote), or the end of the text
+// if it is not closed (then [closed] is zero)
+static size_t dep_skip_string(const char *text, size_t length, size_t i, int *closed) {
+  *closed = 0;
+  for (i++; i < length; i++) {
+    if (text[i] == '\\') {
+      i++;
+    } else if (text[i] == '"') {
+      *closed = 1;
+      return i + 1;
+    }
+  }
+  return length;
+}
+
+static dep_kind_t dep_keyword(const char *word, size_t length) {
+  static const struct {
+    const char *name;
+    dep_kind_t kind;
+  } keywords[] = {
+    {"staload", DEP_STALOAD}, {"#staload", DEP_STALOAD},
+    {"dynload", DEP_DYNLOAD}, {"#dynload", DEP_DYNLOAD},
+    {"#include", DEP_INCLUDE}
+  };
+  for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+    if (strlen(keywords[i].name) == length && !memcmp(keywords[i].name, word, length)) {
+      return keywords[i].kind;
+    }
+  }
+  return DEP_OTHER;
+}
+
+static size_t dep_skip_space(const char *text, size_t length, size_t i) {
+  while (i < length && isspace((unsigned char)text[i])) {
+    i++;
+  }
+  return i;
+}
+
+// the string of the directive whose keyword ends at [i] (maybe after "NAME ="),
+// if there is one: the directive ends past it
+static int dep_directive_string(const char *text, size_t length, size_t i, dep_directive_t *directive) {
+  i = dep_skip_space(text, length, i);
+  if (i < length && dep_is_ident_start(text[i])) {
+    while (i < length && dep_is_ident(text[i])) {
+      i++;
+    }
+    i = dep_skip_space(text, length, i);
+    if (i >= length || text[i] != '=') {
+      return 0;
+    }
+    i = dep_skip_space(text, length, i + 1);
+  }
+  if (i >= length || text[i] != '"') {
+    return 0;
+  }
+  int closed;
+  size_t end = dep_skip_string(text, length, i, &closed);
+  if (!closed) {
+    return 0;
+  }
+  directive->spec_offset = i + 1;
+  directive->spec_length = end - i - 2;
+  directive->end = end;
+  return 1;
+}
+
+void dep_scan(const char *text, size_t length, dep_scan_visit_t visit, void *state) {
+  assert(text != NULL || length == 0);
+  assert(visit != NULL);
+
+  dep_directive_t directive;
+  int closed;
+  size_t i = 0;
+  while (i < length) {
+    char c = text[i];
+    size_t start = i;
+
+    if (dep_starts_with(text, length, i, "(*")) {
+      i = dep_skip_comment(text, length, i);
+    } else if (dep_starts_with(text, length, i, "/*")) {
+      i = dep_skip_until(text, length, i + 2, "*/");
+    } else if (dep_starts_with(text, length, i, "////")) {
+      i = length; // the rest of the file is a comment
+    } else if (dep_starts_with(text, length, i, "//")) {
+      i = dep_skip_until(text, length, i + 2, "\n");
+    } else if (dep_starts_with(text, length, i, "%{")) {
+      i = dep_skip_until(text, length, i + 2, "%}");
+    } else if (c == '"') {
+      i = dep_skip_string(text, length, i, &closed);
+    } else if (c == '\'' && (i == 0 || !dep_is_ident(text[i - 1]))) {
+      // a character ('c' or '\n'), or some other use of the quote
+      if (i + 2 < length && text[i + 1] != '\\' && text[i + 2] == '\'') {
+        i += 3;
+      } else if (i + 1 < length && text[i + 1] == '\\') {
+        size_t end = i + 2;
+        while (end < length && end < i + 8 && text[end] != '\'') {
+          end++;
+        }
+        if (end >= length || text[end] != '\'') {
+          i++;
+          continue;
+        }
+        i = end + 1;
+      } else {
+        i++;
+        continue;
+      }
+    } else if (dep_is_ident_start(c) || (c == '#' && i + 1 < length && dep_is_ident_start(text[i + 1]))) {
+      size_t end = i + 1;
+      while (end < length && dep_is_ident(text[end])) {
+        end++;
+      }
+      i = end;
+      directive.kind = dep_keyword(text + start, end - start);
+      if (directive.kind == DEP_OTHER || !dep_directive_string(text, length, end, &directive)) {
+        continue;
+      }
+      directive.start = start;
+      visit(&directive, state);
+      i = directive.end;
+      continue;
+    } else {
+      i++;
+      continue;
+    }
+
+    directive.kind = DEP_OTHER;
+    directive.start = start;
+    directive.end = i;
+    directive.spec_offset = directive.spec_length = 0;
+    visit(&directive, state);
+  }
+}
+
+/* ****** ****** */
+
+void dep_graph_init(dep_graph_t *graph, file_system_t *fs, path_resolver_t *resolver) {
+  assert(graph != NULL);
+  assert(fs != NULL);
+  assert(resolver != NULL);
+
+  memset(graph, 0, sizeof(*graph));
+  graph->fs = fs;
+  graph->resolver = resolver;
+}
+
+void dep_graph_free(dep_graph_t *graph) {
+  assert(graph != NULL);
+
+  for (size_t i = 0; i < graph->nodes_capacity; i++) {
+    free(graph->nodes[i].deps);
+    free(graph->nodes[i].dependents);
+    free(graph->nodes[i].spans);
+    free(graph->nodes[i].directives);
+  }
+  free(graph->nodes);
+  free(graph->queue);
+  free(graph->text);
+  free(graph->found);
+  free(graph->packed);
+  memset(graph, 0, sizeof(*graph));
+}
+
+// make room for [count] elements of [size] bytes (keeping those already there)
+static int dep_reserve(void **array, size_t *capacity, size_t count, size_t size) {
+  if (count <= *capacity) {
+    return 1;
+  }
+  size_t new_capacity = *capacity > 0 ? *capacity : DEP_GRAPH_MIN_CAPACITY;
+  while (new_capacity < count) {
+    new_capacity *= 2;
+  }
+  void *grown = realloc(*array, new_capacity * size);
+  if (grown == NULL) {
+    fprintf(stderr, "dep_graph: out of memory\n");
+    return 0;
+  }
+  *array = grown;
+  *capacity = new_capacity;
+  return 1;
+}
+
+/* ****** ****** */
+
+#define DEP_PACKED_HEADER 5 // kind, length of the path
+
+// add [directive] (of [text]) to the [*size] bytes packed in [*data]; returns zero if out of memory
+static int dep_directives_append(char **data, size_t *size, size_t *capacity, const dep_directive_t *directive, const char *text) {
+  uint32_t length = (uint32_t)directive->spec_length;
+  if (!dep_reserve((void **)data, capacity, *size + DEP_PACKED_HEADER + length, 1)) {
+    return 0;
+  }
+  (*data)[*size] = (char)directive->kind;
+  memcpy(*data + *size + 1, &length, sizeof(length));
+  memcpy(*data + *size + DEP_PACKED_HEADER, text + directive->spec_offset, length);
+  *size += DEP_PACKED_HEADER + length;
+  return 1;
+}
+
+// the directive at [*offset] of [directives] (which moves past it); returns zero at the
+// end, or if what is left is malformed (then [*offset] stays before it)
+static int dep_directives_next(const dep_directives_t *directives, size_t *offset, const char **spec, size_t *length) {
+  if (*offset >= directives->size || directives->size - *offset < DEP_PACKED_HEADER) {
+    return 0;
+  }
+  uint32_t spec_length;
+  memcpy(&spec_length, directives->data + *offset + 1, sizeof(spec_length));
+  if (spec_length > directives->size - *offset - DEP_PACKED_HEADER) {
+    return 0;
+  }
+  *spec = directives->data + *offset + DEP_PACKED_HEADER;
+  *length = spec_length;
+  *offset += DEP_PACKED_HEADER + spec_length;
+  return 1;
+}
+
+typedef struct dep_pack_s {
+  const char *text;
+  char *data;
+  size_t size, capacity;
+  int failed;
+} dep_pack_t;
+
+static void dep_packed(const dep_directive_t *directive, void *state) {
+  dep_pack_t *pack = (dep_pack_t *)state;
+  if (directive->kind != DEP_OTHER && !pack->failed) {
+    pack->failed = !dep_directives_append(&pack->data, &pack->size, &pack->capacity, directive, pack->text);
+  }
+}
+
+int dep_directives_find(const char *text, size_t length, char **data, size_t *size) {
+  assert(data != NULL);
+  assert(size != NULL);
+
+  dep_pack_t pack;
+  memset(&pack, 0, sizeof(pack));
+  pack.text = text;
+  dep_scan(text, length, dep_packed, &pack);
+  if (pack.failed) {
+    free(pack.data);
+    return 0;
+  }
+  *data = pack.data;
+  *size = pack.size;
+  return 1;
+}
+
+/* ****** ****** */
+
+// NULL if out of memory
+static dep_node_t *dep_graph_node(dep_graph_t *graph, path_id_t id) {
+  assert(id != PATH_ID_NONE);
+
+  if (id >= graph->nodes_capacity) {
+    size_t old_capacity = graph->nodes_capacity;
+    if (!dep_reserve((void **)&graph->nodes, &graph->nodes_capacity, (size_t)id + 1, sizeof(dep_node_t))) {
+      return NULL;
+    }
+    memset(graph->nodes + old_capacity, 0, (graph->nodes_capacity - old_capacity) * sizeof(dep_node_t));
+  }
+  return &graph->nodes[id];
+}
+
+// make room for one more dependent of [node]
+static int dep_reserve_dependent(dep_node_t *node) {
+  if (node->num_dependents == node->dependents_capacity) {
+    uint32_t capacity = node->dependents_capacity > 0 ? node->dependents_capacity * 2 : 4;
+    path_id_t *dependents = realloc(node->dependents, capacity * sizeof(path_id_t));
+    if (dependents == NULL) {
+      fprintf(stderr, "dep_graph: out of memory\n");
+      return 0;
+    }
+    node->dependents = dependents;
+    node->dependents_capacity = capacity;
+  }
+  return 1;
+}
+
+// (room made already)
+static void dep_add_dependent(dep_node_t *node, path_id_t id) {
+  assert(node->num_dependents < node->dependents_capacity);
+  node->dependents[node->num_dependents++] = id;
+}
+
+static void dep_remove_dependent(dep_node_t *node, path_id_t id) {
+  for (uint32_t i = 0; i < node->num_dependents; i++) {
+    if (node->dependents[i] == id) {
+      node->dependents[i] = node->dependents[--node->num_dependents];
+      return;
+    }
+  }
+}
+
+static int dep_compare_ids(const void *a, const void *b) {
+  path_id_t x = *(const path_id_t *)a;
+  path_id_t y = *(const path_id_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// replace the edges out of [id] with the [count] sorted ones in [found]; returns non-zero if they changed.
+// out of memory, the edges are left as they were, and the node is scanned again next time
+static int dep_graph_set_deps(dep_graph_t *graph, path_id_t id, const path_id_t *found, size_t count) {
+  dep_node_t *node = &graph->nodes[id];
+  if (count == node->num_deps && (count == 0 || !memcmp(node->deps, found, count * sizeof(path_id_t)))) {
+    return 0;
+  }
+
+  // make room for all of it first, so that both ends of each edge change together
+  int failed = 0;
+  if (count > node->deps_capacity) {
+    path_id_t *deps = realloc(node->deps, count * sizeof(path_id_t));
+    if (deps == NULL) {
+      fprintf(stderr, "dep_graph: out of memory\n");
+      failed = 1;
+    } else {
+      node->deps = deps;
+      node->deps_capacity = count;
+    }
+  }
+  size_t i = 0, j = 0;
+  while (!failed && j < count) {
+    if (i < node->num_deps && node->deps[i] < found[j]) {
+      i++;
+    } else if (i >= node->num_deps || found[j] < node->deps[i]) {
+      dep_node_t *target = dep_graph_node(graph, found[j]);
+      node = &graph->nodes[id]; // (may have moved)
+      failed = target == NULL || !dep_reserve_dependent(target);
+      j++;
+    } else {
+      i++;
+      j++;
+    }
+  }
+  if (failed) {
+    graph->nodes[id].scanned = 0;
+    return 0;
+  }
+
+  // merge the old and new lists: drop the reverse edges of the old ones only, add those of the new ones only
+  i = 0, j = 0;
+  while (i < node->num_deps || j < count) {
+    if (j >= count || (i < node->num_deps && node->deps[i] < found[j])) {
+      dep_remove_dependent(&graph->nodes[node->deps[i]], id);
+      i++;
+    } else if (i >= node->num_deps || found[j] < node->deps[i]) {
+      dep_add_dependent(&graph->nodes[found[j]], id);
+      j++;
+    } else {
+      i++;
+      j++;
+    }
+  }
+
+  if (count > 0) {
+    memcpy(node->deps, found, count * sizeof(path_id_t));
+  }
+  node->num_deps = count;
+  return 1;
+}
+
+/* ****** ****** */
+
+typedef struct dep_scan_state_s {
+  dep_graph_t *graph;
+  path_id_t id; // of the file scanned
+  const char *text;
+  size_t num_found;
+  size_t num_spans;
+  size_t unresolved;
+  int pack; // keep the directives (of a text from disk), in graph->packed
+  size_t packed_size;
+  int failed;
+} dep_scan_state_t;
+
+// a directive naming [spec] was found
+static void dep_graph_named(dep_scan_state_t *ss, const char *spec, size_t length) {
+  dep_graph_t *graph = ss->graph;
+  path_id_t target = path_resolve(graph->resolver, ss->id, spec, length);
+  if (target == PATH_ID_NONE) {
+    ss->unresolved++;
+    return;
+  }
+  if (target == ss->id) {
+    return; // it is already up to date with itself
+  }
+  if (!dep_reserve((void **)&graph->found, &graph->found_capacity, ss->num_found + 1, sizeof(path_id_t))) {
+    ss->failed = 1;
+    return;
+  }
+  graph->found[ss->num_found++] = target;
+}
+
+static void dep_graph_scanned(const dep_directive_t *directive, void *state) {
+  dep_scan_state_t *ss = (dep_scan_state_t *)state;
+  dep_graph_t *graph = ss->graph;
+
+  dep_node_t *node = &graph->nodes[ss->id];
+  if (!dep_reserve((void **)&node->spans, &node->spans_capacity, ss->num_spans + 1, sizeof(dep_span_t))) {
+    ss->failed = 1;
+    return;
+  }
+  node->spans[ss->num_spans].start = directive->start;
+  node->spans[ss->num_spans].end = directive->end;
+  ss->num_spans++;
+
+  if (directive->kind == DEP_OTHER) {
+    return;
+  }
+  if (ss->pack && !dep_directives_append(&graph->packed, &ss->packed_size, &graph->packed_capacity, directive, ss->text)) {
+    ss->failed = 1;
+    return;
+  }
+  dep_graph_named(ss, ss->text + directive->spec_offset, directive->spec_length);
+}
+
+// keep a copy of the [size] bytes of directives at [data] in the node; returns zero if out of memory
+static int dep_node_keep(dep_node_t *node, const char *data, size_t size) {
+  char *directives = NULL;
+  if (size > 0) {
+    directives = malloc(size);
+    if (directives == NULL) {
+      fprintf(stderr, "dep_graph: out of memory\n");
+      return 0;
+    }
+    memcpy(directives, data, size);
+  }
+  free(node->directives);
+  node->directives = directives;
+  node->directives_size = size;
+  return 1;
+}
+
+// the edges found (in graph->found) replace those out of the file
+static int dep_graph_found(dep_graph_t *graph, dep_scan_state_t *ss) {
+  qsort(graph->found, ss->num_found, sizeof(path_id_t), dep_compare_ids);
+  size_t count = 0;
+  for (size_t i = 0; i < ss->num_found; i++) {
+    if (count == 0 || graph->found[count - 1] != graph->found[i]) {
+      graph->found[count++] = graph->found[i];
+    }
+  }
+  return dep_graph_set_deps(graph, ss->id, graph->found, count);
+}
+
+typedef struct dep_read_s {
+  dep_graph_t *graph;
+  size_t length;
+  int failed;
+} dep_read_t;
+
+static int dep_graph_read(char *buffer, size_t length, void *state) {
+  dep_read_t *read = (dep_read_t *)state;
+  dep_graph_t *graph = read->graph;
+  if (!dep_reserve((void **)&graph->text, &graph->text_capacity, read->length + length, 1)) {
+    read->failed = 1;
+    return 0;
+  }
+  memcpy(graph->text + read->length, buffer, length);
+  read->length += length;
+  return 1;
+}
+
+// scan all of the text of the file again; returns non-zero if the edges changed
+static int dep_graph_scan(dep_graph_t *graph, file_t *file) {
+  dep_read_t read = {graph, 0, 0};
+  if (!file_read(graph->fs, file, dep_graph_read, &read) && file->backing == FILE_BACKING_TEXT) {
+    // still frozen (out of memory): the edges stay as they were, until scanned again
+    graph->nodes[file->path_id].scanned = 0;
+    return 0;
+  }
+  graph->scans++;
+
+  dep_scan_state_t ss;
+  memset(&ss, 0, sizeof(ss));
+  ss.graph = graph;
+  ss.id = file->path_id;
+  ss.text = graph->text;
+  ss.pack = file->backing != FILE_BACKING_TEXT;
+  ss.failed = read.failed;
+  dep_scan(graph->text, read.length, dep_graph_scanned, &ss);
+
+  dep_node_t *node = &graph->nodes[file->path_id];
+  if (!ss.failed) {
+    ss.failed = !dep_node_keep(node, graph->packed, ss.pack ? ss.packed_size : 0);
+  }
+  node->num_spans = ss.num_spans;
+  node->unresolved = ss.unresolved;
+  node->scanned = !ss.failed; // (else: scanned again next time)
+  node->scanned_text = file->backing == FILE_BACKING_TEXT;
+  node->version = file->version;
+  node->fingerprint = node->scanned_text ? 0 : file_fingerprint(file);
+  return dep_graph_found(graph, &ss);
+}
+
+/* ****** ****** */
+
+// replaying the journal: spans are moved along, and [lo, hi) covers all the new text
+typedef struct dep_replay_s {
+  dep_node_t *node;
+  int rescan;
+  int dirty;
+  size_t lo, hi;
+} dep_replay_t;
+
+static size_t dep_map_offset(size_t offset, size_t start, size_t old_end, size_t new_end, int is_end) {
+  if (offset <= start) {
+    return offset;
+  }
+  if (offset >= old_end) {
+    return offset - old_end + new_end;
+  }
+  return is_end ? new_end : start;
+}
+
+static int dep_replay_change(const file_change_t *change, void *state) {
+  dep_replay_t *replay = (dep_replay_t *)state;
+  dep_node_t *node = replay->node;
+
+  size_t start = change->start_offset;
+  size_t old_end = start + change->old_length;
+  size_t new_end = start + change->new_length;
+
+  // the spans are in order: find the first one not before the change
+  size_t lo = 0, hi = node->num_spans;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (node->spans[mid].end < start) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo < node->num_spans && node->spans[lo].start <= old_end) {
+    replay->rescan = 1; // touches one
+    return 0;
+  }
+  for (size_t i = lo; i < node->num_spans; i++) {
+    node->spans[i].start = node->spans[i].start - old_end + new_end;
+    node->spans[i].end = node->spans[i].end - old_end + new_end;
+  }
+
+  if (!replay->dirty) {
+    replay->lo = start;
+    replay->hi = new_end;
+    replay->dirty = 1;
+  } else {
+    size_t dirty_lo = dep_map_offset(replay->lo, start, old_end, new_end, 0);
+    size_t dirty_hi = dep_map_offset(replay->hi, start, old_end, new_end, 1);
+    replay->lo = dirty_lo < start ? dirty_lo : start;
+    replay->hi = dirty_hi > new_end ? dirty_hi : new_end;
+  }
+  return 1;
+}
+
+// is [start, end) inside one of the (untouched) regions of the node?
+static int dep_node_covers(const dep_node_t *node, size_t start, size_t end) {
+  size_t lo = 0, hi = node->num_spans;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (node->spans[mid].end < end) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < node->num_spans && node->spans[lo].start <= start;
+}
+
+// could the text at [offset] (around an edit) start or end a region, or form a directive?
+// (those already in a region were there before)
+static int dep_window_significant(const dep_node_t *node, const char *text, size_t length, size_t offset) {
+  static const char *markers[] = {"\"", "'", "(*", "*)", "/*", "*/", "//", "%{", "%}", "staload", "dynload", "include"};
+
+  for (size_t i = 0; i < sizeof(markers) / sizeof(markers[0]); i++) {
+    size_t marker_length = strlen(markers[i]);
+    for (size_t j = 0; j + marker_length <= length; j++) {
+      if (!memcmp(text + j, markers[i], marker_length)
+          && !dep_node_covers(node, offset + j, offset + j + marker_length)) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// try to take the edits of the client since the last scan without scanning again;
+// returns zero if it has to be scanned again (the spans, moved along part of the way,
+// are of no use then)
+static int dep_graph_replay(dep_graph_t *graph, file_t *file, dep_node_t *node) {
+  dep_replay_t replay;
+  memset(&replay, 0, sizeof(replay));
+  replay.node = node;
+
+  if (!file_journal_changes(file, node->version, dep_replay_change, &replay) || replay.rescan) {
+    return 0;
+  }
+  if (replay.dirty) {
+    // a keyword (or "////") may be formed with the text on either side
+    size_t lo = replay.lo > 8 ? replay.lo - 8 : 0;
+    size_t hi = replay.hi + 8;
+    if (hi - lo > DEP_GRAPH_WINDOW_MAX) {
+      return 0;
+    }
+    if (!dep_reserve((void **)&graph->text, &graph->text_capacity, hi - lo, 1) || !text_buffer_thaw(&file->text)) {
+      return 0;
+    }
+    size_t length = text_buffer_copy(&file->text, lo, graph->text, hi - lo);
+    if (dep_window_significant(node, graph->text, length, lo)) {
+      return 0;
+    }
+  }
+  node->version = file->version;
+  return 1;
+}
+
+int dep_graph_settled(dep_graph_t *graph, file_t *file) {
+  assert(graph != NULL);
+  assert(file != NULL);
+
+  if (file->path_id >= graph->nodes_capacity || !graph->nodes[file->path_id].scanned) {
+    return 0;
+  }
+  dep_node_t *node = &graph->nodes[file->path_id];
+  if (file->backing == FILE_BACKING_TEXT && node->scanned_text) {
+    if (file->version == node->version) {
+      return 1;
+    }
+    // the outcome is kept: replayed, the node is of the new version; if not, it is
+    // left to be scanned (so the journal is not replayed twice over the same spans)
+    if (!dep_graph_replay(graph, file, node)) {
+      node->scanned = 0;
+      return 0;
+    }
+    return 1;
+  }
+  return file->backing != FILE_BACKING_TEXT && !node->scanned_text
+    && file_fingerprint(file) == node->fingerprint;
+}
+
+int dep_graph_update(dep_graph_t *graph, file_t *file) {
+  assert(graph != NULL);
+  assert(file != NULL);
+
+  if (dep_graph_settled(graph, file)) {
+    graph->skipped++;
+    return 0;
+  }
+  if (dep_graph_node(graph, file->path_id) == NULL) {
+    return 0;
+  }
+  return dep_graph_scan(graph, file);
+}
+
+int dep_graph_load(dep_graph_t *graph, file_t *file, uint64_t hash, const dep_directives_t *directives) {
+  assert(graph != NULL);
+  assert(file != NULL);
+  assert(directives != NULL);
+  assert(file->backing != FILE_BACKING_TEXT);
+
+  if (file->path_id < graph->nodes_capacity) {
+    dep_node_t *node = &graph->nodes[file->path_id];
+    if (node->scanned && !node->scanned_text && node->fingerprint == hash) {
+      graph->skipped++;
+      return 0;
+    }
+  }
+  if (dep_graph_node(graph, file->path_id) == NULL) {
+    return 0;
+  }
+
+  dep_scan_state_t ss;
+  memset(&ss, 0, sizeof(ss));
+  ss.graph = graph;
+  ss.id = file->path_id;
+  const char *spec;
+  size_t offset = 0, length;
+  while (dep_directives_next(directives, &offset, &spec, &length)) {
+    dep_graph_named(&ss, spec, length);
+  }
+  if (offset != directives->size) {
+    fprintf(stderr, "dep_graph_load: malformed directives\n");
+    return dep_graph_scan(graph, file);
+  }
+  graph->loads++;
+
+  dep_node_t *node = &graph->nodes[file->path_id];
+  if (!ss.failed) {
+    ss.failed = !dep_node_keep(node, directives->data, directives->size);
+  }
+  node->num_spans = 0; // (only those of a text of the client are used)
+  node->unresolved = ss.unresolved;
+  node->scanned = !ss.failed;
+  node->scanned_text = 0;
+  node->version = file->version;
+  node->fingerprint = hash;
+  return dep_graph_found(graph, &ss);
+}
+
+int dep_graph_directives(dep_graph_t *graph, path_id_t id, uint64_t hash, dep_directives_t *directives) {
+  assert(graph != NULL);
+  assert(directives != NULL);
+
+  if (id >= graph->nodes_capacity) {
+    return 0;
+  }
+  dep_node_t *node = &graph->nodes[id];
+  if (!node->scanned || node->scanned_text || node->fingerprint != hash) {
+    return 0;
+  }
+  directives->data = node->directives;
+  directives->size = node->directives_size;
+  return 1;
+}
+
+void dep_graph_remove(dep_graph_t *graph, path_id_t id) {
+  assert(graph != NULL);
+
+  if (id >= graph->nodes_capacity) {
+    return;
+  }
+  dep_graph_set_deps(graph, id, NULL, 0);
+  dep_node_t *node = &graph->nodes[id];
+  node->num_spans = 0;
+  node->unresolved = 0;
+  node->scanned = 0;
+  free(node->directives);
+  node->directives = NULL;
+  node->directives_size = 0;
+}
+
+size_t dep_graph_retry_unresolved(dep_graph_t *graph) {
+  assert(graph != NULL);
+
+  size_t changed = 0;
+  for (size_t id = 0; id < graph->nodes_capacity; id++) {
+    if (graph->nodes[id].unresolved == 0) {
+      continue;
+    }
+    file_t *file = file_system_find(graph->fs, (path_id_t)id);
+    if (file == NULL) {
+      continue;
+    }
+    graph->nodes[id].scanned = 0;
+    changed += dep_graph_update(graph, file) != 0;
+  }
+  return changed;
+}
+
+size_t dep_graph_dependencies(dep_graph_t *graph, path_id_t id, const path_id_t **deps) {
+  assert(graph != NULL);
+  assert(deps != NULL);
+
+  if (id >= graph->nodes_capacity) {
+    *deps = NULL;
+    return 0;
+  }
+  *deps = graph->nodes[id].deps;
+  return graph->nodes[id].num_deps;
+}
+
+size_t dep_graph_dependents(dep_graph_t *graph, path_id_t id, const path_id_t **dependents) {
+  assert(graph != NULL);
+  assert(dependents != NULL);
+
+  if (id >= graph->nodes_capacity) {
+    *dependents = NULL;
+    return 0;
+  }
+  *dependents = graph->nodes[id].dependents;
+  return graph->nodes[id].num_dependents;
+}
+
+size_t dep_graph_affected(dep_graph_t *graph, const path_id_t *ids, size_t count, dep_graph_visit_t visit, void *state) {
+  assert(graph != NULL);
+  assert(ids != NULL || count == 0);
+  assert(visit != NULL);
+
+  // marks are not cleared between walks: each walk has its own
+  if (++graph->walk == 0) {
+    for (size_t i = 0; i < graph->nodes_capacity; i++) {
+      graph->nodes[i].mark = 0;
+    }
+    graph->walk = 1;
+  }
+
+  // every file enters the queue once
+  size_t head = 0, tail = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (ids[i] >= graph->nodes_capacity || graph->nodes[ids[i]].mark == graph->walk) {
+      continue;
+    }
+    if (!dep_reserve((void **)&graph->queue, &graph->queue_capacity, tail + 1, sizeof(path_id_t))) {
+      return 0;
+    }
+    graph->nodes[ids[i]].mark = graph->walk;
+    graph->queue[tail++] = ids[i];
+  }
+
+  size_t visited = 0;
+  while (head < tail) {
+    dep_node_t *node = &graph->nodes[graph->queue[head++]];
+    for (uint32_t i = 0; i < node->num_dependents; i++) {
+      path_id_t dependent = node->dependents[i];
+      if (graph->nodes[dependent].mark == graph->walk) {
+        continue;
+      }
+      if (!dep_reserve((void **)&graph->queue, &graph->queue_capacity, tail + 1, sizeof(path_id_t))) {
+        return visited;
+      }
+      graph->nodes[dependent].mark = graph->walk;
+      graph->queue[tail++] = dependent;
+      visited++;
+      if (!visit(dependent, state)) {
+        return visited;
+      }
+    }
+  }
+  return visited;
+}
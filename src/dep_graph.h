@@ -0,0 +1,138 @@
+#ifndef __DEP_GRAPH_H__
+#define __DEP_GRAPH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "file_system.h"
+#include "path_resolver.h"
+
+/*
+ * which file depends on which, through #staload, #include and #dynload directives
+ * (staload and dynload may go without the #; a name may be bound, as in
+ * staload M = "m.sats"). edges go both ways, by path id, so finding all files
+ * affected by a change to one is a walk over its dependents.
+ *
+ * the directives are found by a lexical scan that knows about comments, strings
+ * and external code blocks, so commented out directives do not count. every such
+ * region is recorded; edits of client-opened files (replayed from the journal)
+ * that stay clear of all of them, and do not bring in text that could start one,
+ * can not change the directives, and do not need another scan.
+ */
+
+typedef enum {
+  DEP_OTHER, // a comment, a string or external code: no dependency
+  DEP_STALOAD,
+  DEP_INCLUDE,
+  DEP_DYNLOAD
+} dep_kind_t;
+
+typedef struct dep_directive_s {
+  dep_kind_t kind;
+  size_t start, end; // of the whole region (a directive ends with its string)
+  size_t spec_offset, spec_length; // of the path, inside the quotes
+} dep_directive_t;
+
+typedef
+void (*dep_scan_visit_t)(const dep_directive_t *directive, void *state);
+
+// report all directives and other regions of the text, in order
+void dep_scan(const char *text, size_t length, dep_scan_visit_t visit, void *state);
+
+// the directives of a text, packed to be kept apart from it (found on another thread,
+// or kept in the index of the workspace): for each, its kind (one byte) and the length
+// of its path (4 bytes, host order), then the path
+typedef struct dep_directives_s {
+  const char *data; // NULL if none
+  size_t size;
+} dep_directives_t;
+
+// scan [text] for its directives (on any thread), packed into [*data] (to be freed; NULL
+// if none); returns zero if out of memory
+int dep_directives_find(const char *text, size_t length, char **data, size_t *size);
+
+/* ****** ****** */
+
+typedef struct dep_span_s {
+  size_t start, end;
+} dep_span_t;
+
+typedef struct dep_node_s {
+  path_id_t *deps; // files it depends on (sorted)
+  uint32_t num_deps, deps_capacity;
+  path_id_t *dependents; // files depending on it (in no particular order)
+  uint32_t num_dependents, dependents_capacity;
+
+  dep_span_t *spans; // all regions of the text scanned, in order (see above)
+  size_t num_spans, spans_capacity;
+  size_t unresolved; // directives naming no file (yet)
+  int scanned;
+  int scanned_text; // scanned the text of the client (else, from disk)
+  int version; // of the text scanned, if of the client
+  uint64_t fingerprint; // of the text scanned, if from disk
+  char *directives; // found in the text from disk (packed, see dep_directives_t)
+  size_t directives_size;
+
+  uint32_t mark; // of the last walk that reached it
+} dep_node_t;
+
+// edits farther apart than this are not checked one by one
+#define DEP_GRAPH_WINDOW_MAX 4096
+#define DEP_GRAPH_MIN_CAPACITY 64
+
+typedef struct dep_graph_s {
+  file_system_t *fs;
+  path_resolver_t *resolver;
+  dep_node_t *nodes; // by path id
+  size_t nodes_capacity;
+
+  uint32_t walk; // mark of the current walk
+  path_id_t *queue;
+  size_t queue_capacity;
+  char *text; // scratch space for scanning
+  size_t text_capacity;
+  path_id_t *found; // scratch space for the edges found
+  size_t found_capacity;
+  char *packed; // scratch space for the directives found
+  size_t packed_capacity;
+
+  size_t scans; // of whole files
+  size_t loads; // of directives found elsewhere
+  size_t skipped; // updates that did not need a scan
+} dep_graph_t;
+
+void dep_graph_init(dep_graph_t *graph, file_system_t *fs, path_resolver_t *resolver);
+void dep_graph_free(dep_graph_t *graph);
+
+// bring the edges out of [file] up to date with its text; returns non-zero if they changed
+int dep_graph_update(dep_graph_t *graph, file_t *file);
+// the edges out of [file] are up to date without a scan (replaying its journal, if need
+// be); then dep_graph_update only touches the node of the file itself. the replay is
+// kept either way: dep_graph_update after it does not replay the journal again
+int dep_graph_settled(dep_graph_t *graph, file_t *file);
+// take the edges out of [file], on disk, from the [directives] found in its text of
+// fingerprint [hash] (e.g. by the crawler), without reading it; returns non-zero if they
+// changed
+int dep_graph_load(dep_graph_t *graph, file_t *file, uint64_t hash, const dep_directives_t *directives);
+// the directives found in the file [id] on disk, if of the text of fingerprint [hash];
+// returns zero if not known
+int dep_graph_directives(dep_graph_t *graph, path_id_t id, uint64_t hash, dep_directives_t *directives);
+// the file is gone: drop the edges out of it (those into it are kept, for when it is back)
+void dep_graph_remove(dep_graph_t *graph, path_id_t id);
+// a file showed up: scan again those with directives that named nothing;
+// returns how many got new edges
+size_t dep_graph_retry_unresolved(dep_graph_t *graph);
+
+// direct dependencies of the file and dependents (the arrays are owned by the graph)
+size_t dep_graph_dependencies(dep_graph_t *graph, path_id_t id, const path_id_t **deps);
+size_t dep_graph_dependents(dep_graph_t *graph, path_id_t id, const path_id_t **dependents);
+
+// return 0 to stop
+typedef
+int (*dep_graph_visit_t)(path_id_t id, void *state);
+
+// visit each file depending on any of [ids], directly or not (but not [ids] themselves),
+// once, nearest first; returns how many were visited
+size_t dep_graph_affected(dep_graph_t *graph, const path_id_t *ids, size_t count, dep_graph_visit_t visit, void *state);
+
+#endif /* !__DEP_GRAPH_H__ */
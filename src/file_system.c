@@ -1,11 +1,22 @@
 #include <assert.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "uriparse.h"
 #include "uri_encode.h"
 
 #include "file_system.h"
+#include "xxhash64.h"
+
+// mappings dropped when mapping a file fails for lack of them
+#define FILE_MAP_SHED 64
 
 /*
 
@@ -22,6 +33,14 @@ virtual file system
   - apply structured edit operations (only if it is client-opened)
   - refresh from disk (only if it is server-held)
 
+server-held files are backed by a read-only mapping of the file on disk: no copy
+is made until the client opens the file (and then, its text is authoritative);
+once the client closes it, we go back to the mapping.
+- NOTE: truncating a file on disk while it is mapped makes reading past its new
+  end fault: the size (and modification time) is checked again right before each
+  read of the mapping, and the file mapped again if it changed. it is also hashed
+  as it is mapped, so the fingerprint never reads an old mapping
+
 set of files
 - lookup file by document URI, returning a NULL if not found
 - insert new file, it is client-opened: input is document URI and text, output is that we create a new file record
@@ -65,16 +84,6 @@ int file_uri_parse(const char *src, char output[FILE_URI_MAX]) {
     fprintf(stderr, "URI path contains literal spaces\n");
     return 0;
   }
-  p = strstr(result.path, "../");
-  if (p != NULL) {
-    fprintf(stderr, "URI path contains relative path\n");
-    return 0;
-  }
-  p = strstr(result.path, "./");
-  if (p != NULL) {
-    fprintf(stderr, "URI path contains relative path\n");
-    return 0;
-  }
   
   size_t len = strlen(result.path);
   if (len + 1 >= FILE_URI_MAX) {
@@ -82,41 +91,656 @@ int file_uri_parse(const char *src, char output[FILE_URI_MAX]) {
     return 0; // not enough space!
   }
 
-  uri_decode(result.path, len, output);
+  char decoded[FILE_URI_MAX];
+  uri_decode(result.path, len, decoded);
+  len = strlen(decoded);
 
+  // "." components are dropped, but ".." may not be what the client meant (through links)
+  for (const char *q = decoded; (q = strstr(q, "..")) != NULL; q += 2) {
+    if ((q == decoded || q[-1] == '/') && (q[2] == '/' || q[2] == '\0')) {
+      fprintf(stderr, "URI path contains relative path\n");
+      return 0;
+    }
+  }
+  len = path_canonicalize(decoded, len, output, FILE_URI_MAX);
+  if (len == 0) {
+    fprintf(stderr, "URI path is not absolute\n");
+  }
   return len;
 }
 
-static unsigned long hash_filename(const char *fname, int hash_size) {
-  unsigned long hash = 5381;
-  while (*fname != '\0') {
-    int c = *fname;
-    fname++;
-    hash = hash * 33 + c;
+size_t file_uri_make(const char *path, char *buffer, size_t size) {
+  static const char hex[] = "0123456789ABCDEF";
+  assert(path != NULL);
+  assert(buffer != NULL);
+
+  const char *scheme = "file://";
+  size_t used = strlen(scheme);
+  if (path[0] != '/' || used + 1 > size) {
+    return 0;
+  }
+  memcpy(buffer, scheme, used);
+  for (const unsigned char *p = (const unsigned char *)path; *p != '\0'; p++) {
+    if (isalnum(*p) || strchr("-._~/", *p) != NULL) {
+      if (used + 2 > size) {
+        return 0;
+      }
+      buffer[used++] = *p;
+    } else {
+      if (used + 4 > size) {
+        return 0;
+      }
+      buffer[used++] = '%';
+      buffer[used++] = hex[*p >> 4];
+      buffer[used++] = hex[*p & 15];
+    }
   }
-  hash &= hash_size - 1;
-  return hash;
+  buffer[used] = '\0';
+  return used;
 }
 
-int file_path_of_uri(const char *uri, int hash_size_pow2, file_path_t *p) {
-  assert(p != NULL);
-  assert(hash_size_pow2 > 0 && (hash_size_pow2 & (hash_size_pow2 - 1)) == 0); // it is really a power of two
+// the path named by the URI (if [intern], added to the path table unless there already);
+// PATH_ID_NONE if it can not be parsed, or is not known
+static path_id_t file_path_of_uri(file_system_t *fs, const char *uri, int intern) {
+  char path[FILE_URI_MAX];
 
-  memset(p, 0, sizeof(*p));
-  int ret = file_uri_parse(uri, p->path);
-  if (ret > 0) {
-    p->path_hash = hash_filename(p->path, hash_size_pow2);
+  if (file_uri_parse(uri, path) == 0) {
+    return PATH_ID_NONE;
   }
-  
-  return ret;
+  size_t length = strlen(path);
+  return intern ? path_table_intern(&fs->paths, path, length) : path_table_find(&fs->paths, path, length);
+}
+
+size_t file_path(file_system_t *fs, const file_t *file, char *buffer, size_t size) {
+  assert(fs != NULL);
+  assert(file != NULL);
+
+  return path_table_get(&fs->paths, file->path_id, buffer, size);
+}
+
+/* ****** ****** */
+
+static void file_journal_init(file_journal_t *journal, int version) {
+  assert(journal != NULL);
+
+  memset(journal, 0, sizeof(*journal));
+  journal->base_version = version;
+}
+
+static void file_journal_free(file_journal_t *journal) {
+  assert(journal != NULL);
+
+  free(journal->changes);
+  memset(journal, 0, sizeof(*journal));
+}
+
+// forget all changes: nothing before [version] can be mapped anymore
+static void file_journal_reset(file_journal_t *journal, int version) {
+  assert(journal != NULL);
+
+  journal->first = 0;
+  journal->count = 0;
+  journal->base_version = version;
+}
+
+static file_change_t *file_journal_at(file_journal_t *journal, size_t index) {
+  assert(index < journal->count);
+
+  return &journal->changes[(journal->first + index) % journal->capacity];
+}
+
+static void file_journal_record(file_journal_t *journal, const file_change_t *change) {
+  assert(journal != NULL);
+  assert(change != NULL);
+
+  if (journal->count == journal->capacity) {
+    if (journal->capacity < FILE_JOURNAL_MAX) {
+      // grow, unrolling the ring buffer
+      size_t capacity = journal->capacity > 0 ? journal->capacity * 2 : 16;
+      file_change_t *changes = malloc(capacity * sizeof(file_change_t));
+      if (changes == NULL) {
+        fprintf(stderr, "file_journal_record: unable to grow the journal, forgetting it\n");
+        file_journal_reset(journal, change->version);
+        return;
+      }
+      for (size_t i = 0; i < journal->count; i++) {
+        changes[i] = *file_journal_at(journal, i);
+      }
+      free(journal->changes);
+      journal->changes = changes;
+      journal->capacity = capacity;
+      journal->first = 0;
+    } else {
+      // full: forget the oldest change; its version is now the oldest one
+      // that all the remaining changes can be applied to
+      journal->base_version = journal->changes[journal->first].version;
+      journal->first = (journal->first + 1) % journal->capacity;
+      journal->count--;
+    }
+  }
+
+  journal->changes[(journal->first + journal->count) % journal->capacity] = *change;
+  journal->count++;
+}
+
+int file_journal_changes(file_t *file, int version, file_change_visit_t visit, void *state) {
+  assert(file != NULL);
+  assert(visit != NULL);
+
+  file_journal_t *journal = &file->journal;
+  if (version < journal->base_version) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < journal->count; i++) {
+    file_change_t *change = file_journal_at(journal, i);
+
+    if (change->version > version && !visit(change, state)) {
+      break;
+    }
+  }
+  return 1;
+}
+
+static int file_change_map_position(const file_change_t *change, void *state) {
+  text_position_t *pos = (text_position_t *)state;
+
+  if (text_position_cmp(pos, &change->start) <= 0) {
+    // before the change: unaffected
+  } else if (text_position_cmp(pos, &change->old_end) < 0) {
+    // inside the replaced range
+    *pos = change->start;
+  } else {
+    // after the change: shift; the char only moves if on the same line as the end
+    if (pos->line_num == change->old_end.line_num) {
+      pos->char_num = change->new_end.char_num + (pos->char_num - change->old_end.char_num);
+    }
+    pos->line_num = pos->line_num - change->old_end.line_num + change->new_end.line_num;
+  }
+  return 1;
+}
+
+int file_journal_map_position(file_t *file, int version, text_position_t *pos) {
+  assert(pos != NULL);
+
+  return file_journal_changes(file, version, file_change_map_position, pos);
+}
+
+static int file_change_map_offset(const file_change_t *change, void *state) {
+  size_t *offset = (size_t *)state;
+  size_t old_end = change->start_offset + change->old_length;
+
+  if (*offset <= change->start_offset) {
+    // before the change: unaffected
+  } else if (*offset < old_end) {
+    // inside the replaced range
+    *offset = change->start_offset;
+  } else {
+    *offset = *offset - old_end + change->start_offset + change->new_length;
+  }
+  return 1;
+}
+
+int file_journal_map_offset(file_t *file, int version, size_t *offset) {
+  assert(offset != NULL);
+
+  return file_journal_changes(file, version, file_change_map_offset, offset);
+}
+
+/* ****** ****** */
+
+static int file_lru_linked(file_system_t *fs, const file_t *file) {
+  return file->lru_prev != NULL || fs->lru_head == file;
+}
+
+static void file_lru_unlink(file_system_t *fs, file_t *file) {
+  if (!file_lru_linked(fs, file)) {
+    return;
+  }
+  if (file->lru_prev != NULL) {
+    file->lru_prev->lru_next = file->lru_next;
+  } else {
+    fs->lru_head = file->lru_next;
+  }
+  if (file->lru_next != NULL) {
+    file->lru_next->lru_prev = file->lru_prev;
+  } else {
+    fs->lru_tail = file->lru_prev;
+  }
+  file->lru_next = file->lru_prev = NULL;
+  fs->held_memory -= file->mapped_length;
+  fs->held_mappings -= file->mapped != NULL;
+}
+
+static void file_lru_push(file_system_t *fs, file_t *file) {
+  assert(!file_lru_linked(fs, file));
+
+  file->lru_prev = NULL;
+  file->lru_next = fs->lru_head;
+  if (fs->lru_head != NULL) {
+    fs->lru_head->lru_prev = file;
+  } else {
+    fs->lru_tail = file;
+  }
+  fs->lru_head = file;
+  fs->held_memory += file->mapped_length;
+  fs->held_mappings += file->mapped != NULL;
+}
+
+// the mapping is being used: it is the last to go
+static void file_lru_touch(file_system_t *fs, file_t *file) {
+  if (file_lru_linked(fs, file) && fs->lru_head != file) {
+    file_lru_unlink(fs, file);
+    file_lru_push(fs, file);
+  }
+}
+
+// drop the mapping, but keep everything else (including the fingerprint)
+static void file_evict(file_system_t *fs, file_t *file) {
+  assert(file->backing == FILE_BACKING_MAPPED);
+  assert(file->open_count == 0);
+
+  file_lru_unlink(fs, file);
+  if (file->mapped != NULL) {
+    munmap((void *)file->mapped, file->mapped_length);
+  }
+  file->mapped = NULL;
+  // NOTE: [mapped_length] is kept to tell whether the file changed when mapping it again
+  file->backing = FILE_BACKING_EVICTED;
+
+  fs->metrics.evictions++;
+  fs->metrics.evicted_bytes += file->mapped_length;
+}
+
+static int file_system_over_budget(file_system_t *fs) {
+  return (fs->memory_budget > 0 && fs->held_memory > fs->memory_budget)
+    || (fs->max_mappings > 0 && fs->held_mappings > fs->max_mappings);
+}
+
+// evict the least recently used mappings until within the budget, sparing [keep]
+static void file_system_trim(file_system_t *fs, file_t *keep) {
+  while (file_system_over_budget(fs) && fs->lru_tail != NULL && fs->lru_tail != keep) {
+    file_evict(fs, fs->lru_tail);
+  }
+}
+
+// out of mappings anyway (e.g. taken by others): make room for a few
+static size_t file_system_shed(file_system_t *fs, file_t *keep) {
+  size_t count = 0;
+  while (count < FILE_MAP_SHED && fs->lru_tail != NULL && fs->lru_tail != keep) {
+    file_evict(fs, fs->lru_tail);
+    count++;
+  }
+  return count;
+}
+
+// the file on disk is as described by [digest]
+static int file_digest_matches(const file_digest_t *digest, const struct stat *st) {
+  return digest->length == (size_t)st->st_size
+    && digest->mtime.tv_sec == st->st_mtim.tv_sec && digest->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/* ****** ****** */
+
+// files backed by text, in the order they were last used: those that may go cold are
+// found from the tail, without a walk over all files. a file leaves the list once
+// compressed (or if it can not be), and is back once used again
+
+static int file_idle_linked(file_system_t *fs, const file_t *file) {
+  return file->idle_prev != NULL || fs->idle_head == file;
+}
+
+static void file_idle_unlink(file_system_t *fs, file_t *file) {
+  if (!file_idle_linked(fs, file)) {
+    return;
+  }
+  if (file->idle_prev != NULL) {
+    file->idle_prev->idle_next = file->idle_next;
+  } else {
+    fs->idle_head = file->idle_next;
+  }
+  if (file->idle_next != NULL) {
+    file->idle_next->idle_prev = file->idle_prev;
+  } else {
+    fs->idle_tail = file->idle_prev;
+  }
+  file->idle_next = file->idle_prev = NULL;
+}
+
+// the text of the file is being used (on the thread owning [fs])
+static void file_touch(file_system_t *fs, file_t *file) {
+  clock_gettime(CLOCK_MONOTONIC, &file->last_access);
+  file_idle_unlink(fs, file);
+  file->idle_prev = NULL;
+  file->idle_next = fs->idle_head;
+  if (fs->idle_head != NULL) {
+    fs->idle_head->idle_prev = file;
+  } else {
+    fs->idle_tail = file;
+  }
+  fs->idle_head = file;
+}
+
+/* ****** ****** */
+
+// map the file from disk, replacing the previous mapping (if any), and take its
+// fingerprint: from [known] if the file is still as described there (else, hashed now)
+static int file_map(file_system_t *fs, file_t *file, const file_digest_t *known) {
+  assert(file != NULL);
+  assert(file->open_count == 0);
+
+  char path[FILE_URI_MAX];
+  if (file_path(fs, file, path, sizeof(path)) == 0) {
+    fprintf(stderr, "file_map: path too long\n");
+    return 0;
+  }
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "file_map(%s): unable to open: %s\n", path, strerror(errno));
+    return 0;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    fprintf(stderr, "file_map(%s): not a regular file\n", path);
+    close(fd);
+    return 0;
+  }
+
+  // empty files can not be mapped
+  const char *mapped = NULL;
+  if (st.st_size > 0) {
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED && errno == ENOMEM && file_system_shed(fs, file) > 0) {
+      addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (addr == MAP_FAILED) {
+      fprintf(stderr, "file_map(%s): unable to map: %s\n", path, strerror(errno));
+      close(fd);
+      return 0;
+    }
+    mapped = addr;
+  }
+  close(fd);
+  uint64_t hash;
+  if (known != NULL && file_digest_matches(known, &st)) {
+    hash = known->hash;
+  } else {
+    hash = xxh64(mapped, st.st_size, 0);
+  }
+
+  file_lru_unlink(fs, file);
+  if (file->mapped != NULL) {
+    munmap((void *)file->mapped, file->mapped_length);
+  }
+  file->mapped = mapped;
+  file->mapped_length = st.st_size;
+  file->mapped_hash = hash;
+  file->mapped_hash_valid = 1;
+  file->mtime = st.st_mtim;
+  file->backing = FILE_BACKING_MAPPED;
+  file_lru_push(fs, file);
+
+  file_system_trim(fs, file);
+  return 1;
+}
+
+// map an evicted file again; if it did not change on disk in the meantime,
+// the document version and fingerprint stay the same
+static int file_reload(file_system_t *fs, file_t *file) {
+  assert(file->backing == FILE_BACKING_EVICTED);
+
+  file_digest_t known;
+  known.length = file->mapped_length;
+  known.mtime = file->mtime;
+  known.hash = file->mapped_hash;
+
+  if (!file_map(fs, file, &known)) {
+    return 0;
+  }
+  fs->metrics.reloads++;
+  if (file->mtime.tv_sec != known.mtime.tv_sec || file->mtime.tv_nsec != known.mtime.tv_nsec
+      || file->mapped_length != known.length) {
+    file->version++;
+    file_journal_reset(&file->journal, file->version);
+  }
+  return 1;
+}
+
+static void file_unmap(file_t *file) {
+  assert(file != NULL);
+
+  if (file->mapped != NULL) {
+    munmap((void *)file->mapped, file->mapped_length);
+  }
+  file->mapped = NULL;
+  file->mapped_length = 0;
+  file->mapped_hash_valid = 0;
+}
+
+// release whatever currently holds the text
+static void file_release_text(file_system_t *fs, file_t *file) {
+  assert(file != NULL);
+
+  if (file->backing == FILE_BACKING_TEXT) {
+    file_idle_unlink(fs, file);
+    text_buffer_free(&file->text);
+  } else {
+    file_lru_unlink(fs, file);
+    file_unmap(file);
+  }
+}
+
+/* ****** ****** */
+
+// how far the entry in [index] is from its home slot
+static size_t file_slot_distance(const file_slot_t *slots, size_t capacity, size_t index) {
+  return (index - (slots[index].hash & (capacity - 1))) & (capacity - 1);
+}
+
+static file_slot_t *file_slots_find(file_slot_t *slots, size_t capacity, path_id_t id, uint64_t hash) {
+  if (capacity == 0) {
+    return NULL;
+  }
+
+  size_t mask = capacity - 1;
+  size_t index = hash & mask;
+
+  // with Robin Hood probing, the search can stop at any entry closer to home than we are
+  for (size_t distance = 0; ; distance++, index = (index + 1) & mask) {
+    file_slot_t *slot = &slots[index];
+    if (slot->file == NULL || file_slot_distance(slots, capacity, index) < distance) {
+      return NULL;
+    }
+    if (slot->hash == hash && slot->file->path_id == id) {
+      return slot;
+    }
+  }
+}
+
+// NOTE: there must be room
+static void file_slots_insert(file_slot_t *slots, size_t capacity, uint64_t hash, file_t *file) {
+  size_t mask = capacity - 1;
+  size_t index = hash & mask;
+  file_slot_t entry = {hash, file};
+
+  for (size_t distance = 0; ; distance++, index = (index + 1) & mask) {
+    file_slot_t *slot = &slots[index];
+    if (slot->file == NULL) {
+      *slot = entry;
+      return;
+    }
+    // take from the rich: the resident is closer to home, so it moves on instead
+    size_t resident = file_slot_distance(slots, capacity, index);
+    if (resident < distance) {
+      file_slot_t tmp = *slot;
+      *slot = entry;
+      entry = tmp;
+      distance = resident;
+    }
+  }
+}
+
+// remove the entry in [index], shifting the following ones back towards home
+static void file_slots_remove(file_slot_t *slots, size_t capacity, size_t index) {
+  size_t mask = capacity - 1;
+  size_t next = (index + 1) & mask;
+
+  while (slots[next].file != NULL && file_slot_distance(slots, capacity, next) > 0) {
+    slots[index] = slots[next];
+    index = next;
+    next = (next + 1) & mask;
+  }
+  slots[index].file = NULL;
+  slots[index].hash = 0;
+}
+
+static void file_table_migrate(file_table_t *table, size_t steps) {
+  while (table->old_count > 0 && steps > 0) {
+    file_slot_t *slot = &table->old_slots[table->old_index];
+
+    if (slot->file != NULL) {
+      file_slots_insert(table->slots, table->capacity, slot->hash, slot->file);
+      table->count++;
+      // the next entries may shift into this slot, so stay here
+      file_slots_remove(table->old_slots, table->old_capacity, table->old_index);
+      table->old_count--;
+      steps--;
+    } else {
+      table->old_index = (table->old_index + 1) & (table->old_capacity - 1);
+    }
+  }
+  if (table->old_slots != NULL && table->old_count == 0) {
+    free(table->old_slots);
+    table->old_slots = NULL;
+    table->old_capacity = 0;
+    table->old_index = 0;
+  }
+}
+
+static void file_table_free(file_table_t *table) {
+  free(table->slots);
+  free(table->old_slots);
+  memset(table, 0, sizeof(*table));
+}
+
+static file_t *file_table_find(file_table_t *table, path_id_t id, uint64_t hash) {
+  file_slot_t *slot = file_slots_find(table->slots, table->capacity, id, hash);
+  if (slot == NULL) {
+    slot = file_slots_find(table->old_slots, table->old_capacity, id, hash);
+  }
+  return slot != NULL ? slot->file : NULL;
+}
+
+// NOTE: the file must not be in the table yet. returns zero if there is no room for it
+static int file_table_insert(file_table_t *table, file_t *file, uint64_t hash) {
+  // keep the load factor at most 7/8
+  if ((table->count + 1) * 8 > table->capacity * 7) {
+    // in the unlikely case the old table is not drained yet, finish that first
+    file_table_migrate(table, table->old_count);
+
+    size_t capacity = table->capacity > 0 ? table->capacity * 2 : FILE_TABLE_MIN_CAPACITY;
+    file_slot_t *slots = calloc(capacity, sizeof(file_slot_t));
+    if (slots == NULL) {
+      // fuller than it should be will do, as long as a slot stays empty (it ends the probes)
+      fprintf(stderr, "file_table_insert: out of memory\n");
+      if (table->count + 2 > table->capacity) {
+        return 0;
+      }
+      file_slots_insert(table->slots, table->capacity, hash, file);
+      table->count++;
+      return 1;
+    }
+
+    table->old_slots = table->slots;
+    table->old_capacity = table->capacity;
+    table->old_count = table->count;
+    table->old_index = 0;
+    table->slots = slots;
+    table->capacity = capacity;
+    table->count = 0;
+  }
+
+  file_slots_insert(table->slots, table->capacity, hash, file);
+  table->count++;
+  file_table_migrate(table, FILE_TABLE_MIGRATE);
+  return 1;
+}
+
+static void file_table_remove(file_table_t *table, file_t *file, uint64_t hash) {
+  file_slot_t *slot = file_slots_find(table->slots, table->capacity, file->path_id, hash);
+
+  if (slot != NULL) {
+    file_slots_remove(table->slots, table->capacity, slot - table->slots);
+    table->count--;
+  } else {
+    slot = file_slots_find(table->old_slots, table->old_capacity, file->path_id, hash);
+    assert(slot != NULL && slot->file == file);
+    file_slots_remove(table->old_slots, table->old_capacity, slot - table->old_slots);
+    table->old_count--;
+  }
+  file_table_migrate(table, FILE_TABLE_MIGRATE);
+}
+
+/* ****** ****** */
+
+static file_uri_cache_entry_t *file_uri_cache_slot(file_system_t *fs, const char *uri, size_t length, uint64_t *hash) {
+  *hash = xxh64(uri, length, 0);
+  return &fs->uri_cache[*hash & (FILE_URI_CACHE_SIZE - 1)];
+}
+
+static file_t *file_uri_cache_find(file_system_t *fs, const char *uri, size_t length) {
+  uint64_t hash;
+  file_uri_cache_entry_t *entry = file_uri_cache_slot(fs, uri, length, &hash);
+
+  if (entry->file != NULL && entry->hash == hash && entry->length == length && !memcmp(entry->uri, uri, length)) {
+    return entry->file;
+  }
+  return NULL;
+}
+
+static void file_uri_cache_put(file_system_t *fs, const char *uri, size_t length, file_t *file) {
+  uint64_t hash;
+  file_uri_cache_entry_t *entry = file_uri_cache_slot(fs, uri, length, &hash);
+
+  if (entry->capacity < length) {
+    char *copy = realloc(entry->uri, length);
+    if (copy == NULL) {
+      entry->file = NULL;
+      return; // just not cached
+    }
+    entry->uri = copy;
+    entry->capacity = length;
+  }
+  memcpy(entry->uri, uri, length);
+  entry->hash = hash;
+  entry->length = length;
+  entry->file = file;
+}
+
+// forget all URIs naming the file
+static void file_uri_cache_drop(file_system_t *fs, file_t *file) {
+  for (size_t i = 0; i < FILE_URI_CACHE_SIZE; i++) {
+    if (fs->uri_cache[i].file == file) {
+      fs->uri_cache[i].file = NULL;
+    }
+  }
+}
+
+static void file_uri_cache_free(file_system_t *fs) {
+  for (size_t i = 0; i < FILE_URI_CACHE_SIZE; i++) {
+    free(fs->uri_cache[i].uri);
+  }
+  memset(fs->uri_cache, 0, sizeof(fs->uri_cache));
 }
 
+/* ****** ****** */
+
 file_t *file_system_remove(file_system_t *fs, file_t *file) {
   assert(fs != NULL);
   assert(file != NULL);
   
-  unsigned long hash = file->fpath.path_hash;
-
   file_t *next = file->next;
 
   // unlink
@@ -129,16 +753,11 @@ file_t *file_system_remove(file_system_t *fs, file_t *file) {
     file->next->prev = file->prev;
   }
 
-  if (file->hash_prev != NULL) {
-    file->hash_prev->hash_next = file->hash_next;
-  } else {
-    fs->files_hash_table[file->fpath.path_hash] = file->hash_next;
-  }
-  if (file->hash_next != NULL) {
-    file->hash_next->hash_prev = file->hash_prev;
-  }
+  file_table_remove(&fs->table, file, path_table_hash(&fs->paths, file->path_id));
+  file_uri_cache_drop(fs, file);
 
-  text_buffer_free(&file->text);
+  file_release_text(fs, file);
+  file_journal_free(&file->journal);
 
   free(file);
 
@@ -149,6 +768,12 @@ void file_system_init(file_system_t *fs) {
   assert(fs != NULL);
   
   memset(fs, 0, sizeof(*fs));
+  fs->cold_after = FILE_COLD_AFTER;
+  fs->memory_budget = FILE_MEMORY_BUDGET;
+  fs->max_mappings = FILE_MAPPINGS_MAX;
+  int ret = path_table_init(&fs->paths);
+  assert(ret); // TODO: handle this case
+  (void)ret;
 }
 
 void file_system_free(file_system_t *fs) {
@@ -159,28 +784,66 @@ void file_system_free(file_system_t *fs) {
   while (file != NULL) {
     file = file_system_remove(fs, file);
   }
+  file_table_free(&fs->table);
+  file_uri_cache_free(fs);
+  path_table_free(&fs->paths);
   memset(fs, 0, sizeof(*fs));
 }
 
-file_t *file_system_lookup(file_system_t *fs, const char *uri) {
+file_t *file_system_find(file_system_t *fs, path_id_t id) {
   assert(fs != NULL);
-  assert(uri != NULL);
-  
-  file_path_t filename;
-  int uri_okay = file_path_of_uri(uri, FILE_HASH_SIZE, &filename);
-  if (uri_okay == 0) {
-    // unable to parse
+
+  if (id == PATH_ID_NONE) {
     return NULL;
   }
-  unsigned long hash = filename.path_hash;
+  return file_table_find(&fs->table, id, path_table_hash(&fs->paths, id));
+}
 
-  file_t *file = fs->files_hash_table[hash];
-  while (file != NULL) {
-    if (!strcmp(file->fpath.path, filename.path)) {
-      return file;
-    }
+// create a new record, with no text yet (NULL if out of memory)
+static file_t *file_system_insert(file_system_t *fs, path_id_t id, int version) {
+  file_t *file = malloc(sizeof(file_t));
+  if (file == NULL) {
+    fprintf(stderr, "file_system_insert: out of memory\n");
+    return NULL;
   }
-  return NULL;
+  memset(file, 0, sizeof(file_t));
+  file->path_id = id;
+  file->version = version;
+  file->open_count = 0;
+  file->backing = FILE_BACKING_MAPPED;
+  if (!file_table_insert(&fs->table, file, path_table_hash(&fs->paths, id))) {
+    free(file);
+    return NULL;
+  }
+
+  file_journal_init(&file->journal, version);
+
+  file->next = fs->files;
+  if (fs->files != NULL) {
+    fs->files->prev = file;
+  }
+  file->prev = NULL;
+  fs->files = file;
+
+  return file;
+}
+
+file_t *file_system_lookup(file_system_t *fs, const char *uri) {
+  assert(fs != NULL);
+  assert(uri != NULL);
+
+  size_t length = strlen(uri);
+  file_t *file = file_uri_cache_find(fs, uri, length);
+  if (file != NULL) {
+    return file;
+  }
+  
+  // unknown paths are not interned
+  file = file_system_find(fs, file_path_of_uri(fs, uri, 0));
+  if (file != NULL) {
+    file_uri_cache_put(fs, uri, length, file);
+  }
+  return file;
 }
 
 void file_system_open(file_system_t *fs, const char *uri, int version, const char *contents, size_t len) {
@@ -188,58 +851,295 @@ void file_system_open(file_system_t *fs, const char *uri, int version, const cha
   assert(uri != NULL);
   assert(contents != NULL);
   
-  file_path_t filename;
-  int uri_okay = file_path_of_uri(uri, FILE_HASH_SIZE, &filename);
-  if (uri_okay == 0) {
+  path_id_t id = file_path_of_uri(fs, uri, 1);
+  if (id == PATH_ID_NONE) {
     // unable to parse
     return;
   }
-  unsigned long hash = filename.path_hash;
 
-  file_t *file = fs->files_hash_table[hash];
-  while (file != NULL) {
-    if (!strcmp(file->fpath.path, filename.path)) {
-      text_buffer_clear(&file->text);
-      text_buffer_insert(&file->text, contents, len);
-      
-      assert(file->open_count == 0); // it's a protocol breach otherwise!
-      file->open_count++;
-      file->version = version;
-      return;
-    }
+  file_t *file = file_system_find(fs, id);
+  if (file == NULL) {
+    file = file_system_insert(fs, id, version);
   }
-  assert(file == NULL);
-
-  file = malloc(sizeof(file_t)); // TODO: handle failure
-  memcpy(&file->fpath, &filename, sizeof(filename));
-  file->version = version;
-  file->open_count = 1;
+  if (file == NULL) {
+    return;
+  }
+  // the same URI is bound to come back in every change
+  file_uri_cache_put(fs, uri, strlen(uri), file);
 
+  // from now on, the client owns the text: drop the disk contents (if any)
+  file_release_text(fs, file);
   text_buffer_init(&file->text, TEXT_BUFFER_CHUNK_SIZE);
   text_buffer_insert(&file->text, contents, len);
+  file->backing = FILE_BACKING_TEXT;
 
-  file->next = fs->files;
-  if (fs->files != NULL) {
-    fs->files->prev = file;
+  file->open_count++;
+  file->version = version;
+  file_journal_reset(&file->journal, version);
+  file_touch(fs, file);
+}
+
+// (see file_map for [known])
+static file_t *file_system_load_digest(file_system_t *fs, const char *path, const file_digest_t *known) {
+  assert(fs != NULL);
+  assert(path != NULL);
+
+  size_t length = strlen(path);
+  if (length == 0 || path[0] != '/' || length + 1 >= FILE_URI_MAX) {
+    fprintf(stderr, "file_system_load: not an absolute path or too long\n");
+    return NULL;
   }
-  file->prev = NULL;
-  fs->files = file;
+  path_id_t id = path_table_intern(&fs->paths, path, length);
+  if (id == PATH_ID_NONE) {
+    return NULL;
+  }
+
+  file_t *file = file_system_find(fs, id);
+  if (file != NULL) {
+    // already known: the client's text (if opened) is authoritative
+    file->on_disk = 1;
+    file_lru_touch(fs, file);
+    return file;
+  }
+
+  file = file_system_insert(fs, id, 0);
+  if (file == NULL) {
+    return NULL;
+  }
+  file->on_disk = 1;
+  if (!file_map(fs, file, known)) {
+    file_system_remove(fs, file);
+    return NULL;
+  }
+  return file;
+}
+
+file_t *file_system_load(file_system_t *fs, const char *path) {
+  return file_system_load_digest(fs, path, NULL);
+}
+
+file_t *file_system_load_known(file_system_t *fs, const char *path, const file_digest_t *digest) {
+  assert(fs != NULL);
+  assert(path != NULL);
+  assert(digest != NULL);
 
-  file->hash_next = fs->files_hash_table[hash];
-  if (fs->files_hash_table[hash]) {
-    fs->files_hash_table[hash]->hash_prev = file;
+  // known already, or changed since it was read: mapped right away
+  size_t length = strlen(path);
+  struct stat st;
+  if (length == 0 || path[0] != '/' || length + 1 >= FILE_URI_MAX || file_system_find_path(fs, path) != NULL
+      || stat(path, &st) != 0 || !S_ISREG(st.st_mode) || !file_digest_matches(digest, &st)) {
+    return file_system_load_digest(fs, path, digest);
   }
-  file->hash_prev = NULL;
-  fs->files_hash_table[hash] = file;
+  path_id_t id = path_table_intern(&fs->paths, path, length);
+  if (id == PATH_ID_NONE) {
+    return NULL;
+  }
+  file_t *file = file_system_insert(fs, id, 0);
+  if (file == NULL) {
+    return NULL;
+  }
+  file->on_disk = 1;
+  file->backing = FILE_BACKING_EVICTED;
+  file->mapped_length = digest->length;
+  file->mtime = digest->mtime;
+  file->mapped_hash = digest->hash;
+  file->mapped_hash_valid = 1;
+  return file;
+}
+
+int file_system_refresh(file_system_t *fs, file_t *file) {
+  assert(fs != NULL);
+  assert(file != NULL);
+
+  if (file->open_count > 0 || !file->on_disk) {
+    return 0; // only server-held files come from disk
+  }
+  if (!file_map(fs, file, NULL)) {
+    return 0;
+  }
+  // the journal can not describe this change
+  file->version++;
+  file_journal_reset(&file->journal, file->version);
+  return 1;
+}
+
+// the file on disk still has the size (and modification time) it had when mapped: a
+// file truncated in place would fault past its new end
+static int file_mapping_current(file_system_t *fs, file_t *file) {
+  char path[FILE_URI_MAX];
+  struct stat st;
+  return file_path(fs, file, path, sizeof(path)) > 0 && stat(path, &st) == 0
+    && (size_t)st.st_size == file->mapped_length
+    && st.st_mtim.tv_sec == file->mtime.tv_sec && st.st_mtim.tv_nsec == file->mtime.tv_nsec;
+}
+
+int file_read(file_system_t *fs, file_t *file, text_buffer_read_t read, void *state) {
+  assert(fs != NULL);
+  assert(file != NULL);
+  assert(read != NULL);
+
+  if (file->backing == FILE_BACKING_TEXT) {
+    if (!text_buffer_thaw(&file->text)) {
+      return 0; // (frozen still: read once there is memory again)
+    }
+    file_touch(fs, file);
+    text_buffer_read(&file->text, read, state);
+    return 1;
+  }
+  if (file->backing == FILE_BACKING_EVICTED) {
+    if (!file_reload(fs, file)) {
+      return 0; // gone from disk: nothing to read
+    }
+  } else if (!file_mapping_current(fs, file) && !file_system_refresh(fs, file)) {
+    // gone (or unreadable): the old mapping must not be read anymore
+    file_evict(fs, file);
+    return 0;
+  }
+  file_lru_touch(fs, file);
+  if (file->mapped_length > 0) {
+    // NOTE: the text buffer reader interface is not const, but the mapping is read-only
+    read((char *)file->mapped, file->mapped_length, state);
+  }
+  return 1;
+}
+
+int file_system_unload(file_system_t *fs, file_t *file) {
+  assert(fs != NULL);
+  assert(file != NULL);
+
+  file->on_disk = 0;
+  if (file->open_count > 0) {
+    return 0;
+  }
+  file_system_remove(fs, file);
+  return 1;
+}
+
+file_t *file_system_find_path(file_system_t *fs, const char *path) {
+  assert(fs != NULL);
+  assert(path != NULL);
+
+  return file_system_find(fs, path_table_find(&fs->paths, path, strlen(path)));
+}
+
+uint64_t file_fingerprint(file_t *file) {
+  assert(file != NULL);
+
+  if (file->backing == FILE_BACKING_TEXT) {
+    return text_buffer_fingerprint(&file->text);
+  }
+  assert(file->mapped_hash_valid); // taken when mapped
+  return file->mapped_hash;
 }
 
 static int
-file_edit_range_not_empty(const file_edit_t *edit) {
+file_edit_replaces_all(const file_edit_t *edit) {
   assert(edit != NULL);
 
-  return edit->start_line < edit->end_line
-    || edit->start_line == edit->end_line
-    && edit->start_char < edit->end_char;
+  return edit->start_line < 0 && edit->start_char < 0 && edit->end_line < 0 && edit->end_char < 0;
+}
+
+static void
+file_edit_range(const file_edit_t *edit, text_position_t *start, text_position_t *end) {
+  start->line_num = edit->start_line;
+  start->char_num = edit->start_char;
+  end->line_num = edit->end_line;
+  end->char_num = edit->end_char;
+}
+
+// apply a single edit of the given range; the point is moved as needed
+// (returns non-zero if succeeded)
+static int
+file_apply_edit(file_t *file, const char *uri, int version, const file_edit_t *edit, text_position_t *start_pos, text_position_t *end_pos) {
+  file_change_t change;
+
+  memset(&change, 0, sizeof(change));
+  change.version = version;
+
+  if (file_edit_replaces_all(edit)) {
+    // only replace what actually differs: the unchanged prefix and suffix (and
+    // the gapbuffers holding them) stay in place
+    size_t prefix = 0, suffix = 0;
+    const char *text = edit->text != NULL ? edit->text : "";
+
+    text_buffer_common_affixes(&file->text, text, edit->text_length, &prefix, &suffix);
+    if (!text_buffer_set_offset(&file->text, prefix)) {
+      fprintf(stderr, "file_system_change(%s): unable to locate the given offset %ld!\n", uri, prefix);
+      return 0;
+    }
+    text_buffer_get_point(&file->text, &change.start);
+    change.start_offset = prefix;
+    change.old_length = text_buffer_delete_bytes(&file->text, text_buffer_length(&file->text) - prefix - suffix, &change.old_end);
+
+    change.new_length = edit->text_length - prefix - suffix;
+    if (change.new_length > 0) {
+      text_buffer_insert(&file->text, text + prefix, change.new_length);
+    }
+  } else {
+    // move the point
+    if (!text_buffer_set_point(&file->text, start_pos)) {
+      // TODO: perhaps handle it in some way?
+      fprintf(stderr, "file_system_change(%s): unable to locate the given position %ld,%ld!\n", uri, start_pos->line_num, start_pos->char_num);
+      return 0;
+    }
+    change.start = *start_pos;
+    change.start_offset = text_buffer_get_offset(&file->text);
+    change.old_end = *start_pos;
+
+    // delete the range
+    if (text_position_cmp(start_pos, end_pos) < 0) {
+      text_position_t end = *end_pos;
+
+      change.old_length = text_buffer_delete(&file->text, &end);
+      change.old_end = end;
+    }
+
+    // insert, assuming we are already in position
+    if (edit->text != NULL && edit->text_length > 0) {
+      text_buffer_insert(&file->text, edit->text, edit->text_length);
+      change.new_length = edit->text_length;
+    }
+  }
+
+  if (change.old_length > 0 || change.new_length > 0) {
+    text_buffer_get_point(&file->text, &change.new_end);
+    file_journal_record(&file->journal, &change);
+  }
+  return 1;
+}
+
+// true if every edit ends before the previous one starts: then applying
+// an edit never moves the text any later edit refers to, so all of
+// them are in terms of the text before the batch
+static int
+file_edits_descending(const file_edit_t *edits, size_t num_edits) {
+  if (num_edits < 2) {
+    return 0;
+  }
+  for (size_t i = 1; i < num_edits; i++) {
+    text_position_t prev_start, prev_end, start, end;
+
+    if (file_edit_replaces_all(&edits[i-1]) || file_edit_replaces_all(&edits[i])) {
+      return 0;
+    }
+    file_edit_range(&edits[i-1], &prev_start, &prev_end);
+    file_edit_range(&edits[i], &start, &end);
+    if (text_position_cmp(&end, &prev_start) > 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// shift a position in terms of the text before the batch (at or after [old_end])
+// by the edits applied so far, the last of which ended at [old_end] before
+// and ends at [new_end] now
+static void
+file_position_shift(text_position_t *pos, const text_position_t *old_end, const text_position_t *new_end) {
+  if (pos->line_num == old_end->line_num) {
+    pos->char_num = new_end->char_num + (pos->char_num - old_end->char_num);
+  }
+  pos->line_num = pos->line_num - old_end->line_num + new_end->line_num;
 }
 
 int file_system_change(file_system_t *fs, const char *uri, int version, const file_edit_t *edits, size_t num_edits) {
@@ -250,37 +1150,49 @@ int file_system_change(file_system_t *fs, const char *uri, int version, const fi
   if (file == NULL) {
     return 0; // FIXME! unknown file!
   }
+  if (file->backing != FILE_BACKING_TEXT) {
+    return 0; // only client-opened files can be edited
+  }
+  if (!text_buffer_thaw(&file->text)) {
+    fprintf(stderr, "file_system_change(%s): unable to thaw the text\n", uri);
+    return 0;
+  }
+  file_touch(fs, file);
 
-  for (size_t i = 0; i < num_edits; i++) {
-    const file_edit_t *edit = &edits[i];
+  // LSP applies the edits of a batch one after another; the point only has to be rewound
+  // if an edit starts before the previous one, so batches in document order take a
+  // single forward sweep over the text.
+  //
+  // batches in reverse document order (as sent by many clients) are applied back to front
+  // instead, shifting each edit by the ones applied before it.
+  if (file_edits_descending(edits, num_edits)) {
+    text_position_t old_end, new_end;
+    int shifted = 0;
 
-    if (edit->start_line < 0 && edit->start_char < 0 && edit->end_line < 0 && edit->end_char < 0) {
-      text_buffer_clear(&file->text);
-    } else {
-      text_position_t start_pos;
-      start_pos.line_num = edit->start_line;
-      start_pos.char_num = edit->start_char;
-
-      // move the point
-      if (!text_buffer_set_point(&file->text, &start_pos)) {
-        // TODO: perhaps handle it in some way?
-        fprintf(stderr, "file_system_change(%s): unable to locate the given position %ld,%ld!\n", uri, start_pos.line_num, start_pos.char_num);
+    for (size_t i = num_edits; i-- > 0; ) {
+      const file_edit_t *edit = &edits[i];
+      text_position_t start_pos, end_pos;
+
+      file_edit_range(edit, &start_pos, &end_pos);
+      if (shifted) {
+        file_position_shift(&start_pos, &old_end, &new_end);
+        file_position_shift(&end_pos, &old_end, &new_end);
+      }
+      if (!file_apply_edit(file, uri, version, edit, &start_pos, &end_pos)) {
         continue;
       }
 
-      // delete the range
-      if (file_edit_range_not_empty(edit)) {
-        text_position_t end_pos;
-        end_pos.line_num = edit->end_line;
-        end_pos.char_num = edit->end_char;
-        
-        text_buffer_delete(&file->text, &end_pos);
-      }
+      file_edit_range(edit, &start_pos, &old_end);
+      text_buffer_get_point(&file->text, &new_end);
+      shifted = 1;
     }
+  } else {
+    for (size_t i = 0; i < num_edits; i++) {
+      const file_edit_t *edit = &edits[i];
+      text_position_t start_pos, end_pos;
 
-    // insert, assuming we are already in position
-    if (edit->text != NULL && edit->text_length > 0) {
-      text_buffer_insert(&file->text, edit->text, edit->text_length);
+      file_edit_range(edit, &start_pos, &end_pos);
+      file_apply_edit(file, uri, version, edit, &start_pos, &end_pos);
     }
   }
 
@@ -297,8 +1209,191 @@ void file_system_close(file_system_t *fs, const char *uri) {
   if (file == NULL) {
     return;
   }
-  assert(file->open_count == 1); // it's a protocol breach otherwise!
+  file_system_close_file(fs, file);
+}
+
+void file_system_close_file(file_system_t *fs, file_t *file) {
+  assert(fs != NULL);
+  assert(file != NULL);
+  assert(file->open_count > 0); // it's a protocol breach otherwise!
+
   file->open_count--;
+  if (file->open_count > 0) {
+    return; // another client still has it open
+  }
 
+  if (file->on_disk) {
+    // server-held: go back to the disk contents
+    file_release_text(fs, file);
+    file->backing = FILE_BACKING_MAPPED;
+    if (file_system_refresh(fs, file)) {
+      return;
+    }
+  }
   file_system_remove(fs, file);
 }
+
+/* ****** ****** */
+
+size_t file_system_compress_idle(file_system_t *fs) {
+  assert(fs != NULL);
+
+  if (fs->cold_after <= 0) {
+    return 0;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  size_t compressed = 0;
+  file_t *file;
+  while ((file = fs->idle_tail) != NULL && now.tv_sec - file->last_access.tv_sec >= fs->cold_after) {
+    assert(file->backing == FILE_BACKING_TEXT);
+    file_idle_unlink(fs, file);
+    if (text_buffer_freeze(&file->text)) {
+      compressed++;
+    }
+  }
+  return compressed;
+}
+
+int file_system_idle_timeout(file_system_t *fs) {
+  assert(fs != NULL);
+
+  if (fs->cold_after <= 0 || fs->idle_tail == NULL) {
+    return -1;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  // (cold from the start of the second it is due, as counted above)
+  long timeout = (long)(fs->idle_tail->last_access.tv_sec + fs->cold_after - now.tv_sec) * 1000 - now.tv_nsec / 1000000;
+  return timeout > 0 ? (int)timeout : 0;
+}
+
+/* ****** ****** */
+
+typedef struct file_search_job_s {
+  pthread_mutex_t lock; // protects everything below, and serializes [found]
+  file_t **files;
+  size_t num_files;
+  size_t next_file;
+  int stopped;
+  size_t total;
+
+  const char *pattern;
+  size_t length;
+  file_search_t found;
+  void *state;
+} file_search_job_t;
+
+typedef struct file_search_task_s {
+  file_search_job_t *job;
+  file_t *file;
+} file_search_task_t;
+
+static int file_search_found(const text_match_t *matches, size_t count, void *state) {
+  file_search_task_t *task = (file_search_task_t *)state;
+  file_search_job_t *job = task->job;
+
+  pthread_mutex_lock(&job->lock);
+  if (!job->stopped) {
+    job->total += count;
+    job->stopped = !job->found(task->file, matches, count, job->state);
+  }
+  int more = !job->stopped;
+  pthread_mutex_unlock(&job->lock);
+  return more;
+}
+
+static void *file_search_worker(void *arg) {
+  file_search_job_t *job = (file_search_job_t *)arg;
+
+  while (1) {
+    file_t *file = NULL;
+
+    pthread_mutex_lock(&job->lock);
+    if (!job->stopped && job->next_file < job->num_files) {
+      file = job->files[job->next_file++];
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    if (file == NULL) {
+      break;
+    }
+    file_search_task_t task = {job, file};
+    text_buffer_search(&file->text, job->pattern, job->length, file_search_found, &task);
+  }
+  return NULL;
+}
+
+size_t file_system_search(file_system_t *fs, const char *pattern, size_t length, file_search_t found, void *state) {
+  assert(fs != NULL);
+  assert(pattern != NULL);
+  assert(found != NULL);
+
+  size_t num_files = 0;
+  for (file_t *file = fs->files; file != NULL; file = file->next) {
+    if (file->backing == FILE_BACKING_TEXT) {
+      num_files++;
+    }
+  }
+  if (num_files == 0 || length == 0) {
+    return 0;
+  }
+
+  file_t **files = malloc(num_files * sizeof(file_t *));
+  if (files == NULL) {
+    fprintf(stderr, "file_system_search: out of memory\n");
+    return 0;
+  }
+  size_t i = 0;
+  for (file_t *file = fs->files; file != NULL; file = file->next) {
+    if (file->backing == FILE_BACKING_TEXT) {
+      files[i++] = file;
+    }
+  }
+
+  file_search_job_t job;
+  pthread_mutex_init(&job.lock, NULL);
+  job.files = files;
+  job.num_files = num_files;
+  job.next_file = 0;
+  job.stopped = 0;
+  job.total = 0;
+  job.pattern = pattern;
+  job.length = length;
+  job.found = found;
+  job.state = state;
+
+  // the calling thread is a worker too
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t num_threads = cpus > 1 ? (size_t)cpus - 1 : 0;
+  if (num_threads > num_files - 1) {
+    num_threads = num_files - 1;
+  }
+  if (num_threads > FILE_SEARCH_THREADS_MAX - 1) {
+    num_threads = FILE_SEARCH_THREADS_MAX - 1;
+  }
+
+  pthread_t threads[FILE_SEARCH_THREADS_MAX];
+  size_t started = 0;
+  while (started < num_threads) {
+    if (pthread_create(&threads[started], NULL, file_search_worker, &job) != 0) {
+      break; // fewer threads will do
+    }
+    started++;
+  }
+  file_search_worker(&job);
+  for (size_t t = 0; t < started; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  // (the order of use does not matter among them)
+  for (i = 0; i < job.next_file; i++) {
+    file_touch(fs, files[i]);
+  }
+
+  pthread_mutex_destroy(&job.lock);
+  free(files);
+  return job.total;
+}
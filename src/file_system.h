@@ -2,7 +2,9 @@
 #define __FILE_SYSTEM_H__
 
 #include <stdlib.h>
+#include <time.h>
 #include "text_buffer.h"
+#include "path_table.h"
 
 /*
  * according to LSP, all documents are identified by URIs.
@@ -14,31 +16,142 @@
 
 #define FILE_URI_MAX 1024
 
-typedef struct file_path_t {
-  char           path[FILE_URI_MAX];
-  unsigned long  path_hash;
-} file_path_t;
+// write out the path named by a file:// URI, canonicalized (see path_canonicalize; ".."
+// is not allowed); returns its length, or zero if not supported
+int file_uri_parse(const char *src, char output[FILE_URI_MAX]);
+// the other way around: write out the file:// URI of an absolute path (NUL-terminated),
+// percent-encoding all but unreserved characters and slashes; returns its length, or
+// zero if it does not fit
+size_t file_uri_make(const char *path, char *buffer, size_t size);
 
-// returns length of path if successful, zero if failed;
-// all arguments are required
-int file_path_of_uri(const char *uri, int hash_size_pow2, file_path_t *path);
+// all paths are interned in the path table of the file system
+
+/*
+ * every edit applied to a file is recorded in its journal, so that consumers
+ * holding results computed against an older version (token streams, symbol
+ * tables, diagnostic ranges) can patch them instead of starting over.
+ *
+ * each change is described in the coordinates of the text right before
+ * it was applied: the range [start, old_end) was replaced by text
+ * spanning [start, new_end).
+ */
+
+typedef struct file_change_s {
+  int             version; // document version produced by this change
+  size_t          start_offset; // byte offset of the replaced range
+  size_t          old_length; // bytes removed
+  size_t          new_length; // bytes inserted
+  text_position_t start;
+  text_position_t old_end;
+  text_position_t new_end;
+} file_change_t;
+
+// at most this many changes are kept; older ones are forgotten
+#define FILE_JOURNAL_MAX 1024
+
+typedef struct file_journal_s {
+  file_change_t *changes; // ring buffer, allocated on first change
+  size_t         capacity;
+  size_t         first;
+  size_t         count;
+  // the oldest version from which all later changes are still recorded
+  int            base_version;
+} file_journal_t;
+
+typedef enum {
+  FILE_BACKING_MAPPED, // read-only mapping of the file on disk (may be empty)
+  FILE_BACKING_TEXT,   // text buffer holding the client's text
+  FILE_BACKING_EVICTED // server-held, but the mapping was dropped to stay within the memory budget
+} file_backing_t;
 
 typedef struct file_s {
-  file_path_t fpath;
+  path_id_t path_id;
   
   int   version;
   int   open_count;
-  text_buffer_t text;
+  int   on_disk; // server-held: once closed by the client, refreshed from disk
+
+  file_backing_t backing;
+  text_buffer_t text; // only valid if backed by text
+  const char *mapped;
+  size_t mapped_length;
+  struct timespec mtime; // modification time at the last mapping
+  struct timespec last_access; // monotonic time the text was last used (if backed by text)
+  uint64_t mapped_hash; // hash of the mapping, taken when mapped (kept on eviction)
+  int mapped_hash_valid;
+
+  file_journal_t journal;
 
   struct file_s *next, *prev;
-  struct file_s *hash_next, *hash_prev;
+  struct file_s *lru_next, *lru_prev; // mapped server-held files, most recently used first
+  struct file_s *idle_next, *idle_prev; // text not compressed, most recently used first
 } file_t;
 
-#define FILE_HASH_SIZE 256
+// open addressing with Robin Hood probing, keyed by path hash
+typedef struct file_slot_s {
+  uint64_t hash;
+  file_t  *file; // NULL if empty
+} file_slot_t;
+
+#define FILE_TABLE_MIN_CAPACITY 64
+// how many entries of the old table each insertion or removal moves to the new one
+#define FILE_TABLE_MIGRATE 16
+
+typedef struct file_table_s {
+  file_slot_t *slots;
+  size_t capacity; // a power of two (or zero)
+  size_t count;
+
+  // after growing, the old table is drained into the new one a few entries
+  // at a time, so no single insertion pays for rehashing everything
+  file_slot_t *old_slots;
+  size_t old_capacity;
+  size_t old_count;
+  size_t old_index; // where to continue draining
+} file_table_t;
+
+#define FILE_COLD_AFTER 300 // seconds
+
+// clients send the same URI strings over and over: remember which file each one named,
+// so repeated lookups do not parse and decode it again
+typedef struct file_uri_cache_entry_s {
+  uint64_t hash;
+  size_t   length;
+  char    *uri; // a copy of the raw URI
+  size_t   capacity; // of [uri]
+  file_t  *file; // NULL if unused
+} file_uri_cache_entry_t;
+
+#define FILE_URI_CACHE_SIZE 64 // direct-mapped by the hash of the URI
+
+// server-held files are mapped on demand; once their mappings add up to more
+// than the budget, or there are more of them than allowed, the least recently
+// used ones are dropped (and mapped again when needed). client-opened files are
+// never evicted
+#define FILE_MEMORY_BUDGET ((size_t)256 << 20) // bytes
+// well below the mappings a process may have (vm.max_map_count, 65530 by
+// default), which malloc and thread stacks need too
+#define FILE_MAPPINGS_MAX 16384
+
+typedef struct file_metrics_s {
+  size_t evictions;
+  size_t evicted_bytes;
+  size_t reloads; // evicted files mapped again
+} file_metrics_t;
 
 typedef struct file_system_s {
-  file_t *files;
-  file_t *files_hash_table[FILE_HASH_SIZE];  
+  file_t *files; // for iteration
+  path_table_t paths;
+  file_table_t table; // for lookup
+  file_uri_cache_entry_t uri_cache[FILE_URI_CACHE_SIZE];
+  time_t cold_after; // seconds of idleness before the text of a file is compressed (0: never)
+  file_t *lru_head, *lru_tail;
+  file_t *idle_head, *idle_tail; // files backed by text that may go cold, by [last_access]
+  size_t held_memory; // bytes mapped for server-held files
+  size_t memory_budget; // for [held_memory] (0: unlimited)
+  size_t held_mappings; // mappings of server-held files (empty files have none)
+  size_t max_mappings; // for [held_mappings] (0: unlimited)
+  file_metrics_t metrics;
 } file_system_t;
 
 // edit kinds:
@@ -60,8 +173,81 @@ void file_system_init(file_system_t *fs);
 void file_system_free(file_system_t *fs);
 
 file_t *file_system_lookup(file_system_t *fs, const char *uri);
+// several clients may have the same file open: the last one to open or
+// change it has its text kept, and only the last close lets go of it
 void file_system_open(file_system_t *fs, const char *uri, int version, const char *contents, size_t len);
 int file_system_change(file_system_t *fs, const char *uri, int version, const file_edit_t *edits, size_t num_edits);
 void file_system_close(file_system_t *fs, const char *uri);
+void file_system_close_file(file_system_t *fs, file_t *file);
+
+// make a server-held file for the given absolute path, backed by
+// the file on disk; returns NULL if it can not be read
+file_t *file_system_load(file_system_t *fs, const char *path);
+// what was found reading a file elsewhere (e.g. on a worker thread)
+typedef struct file_digest_s {
+  size_t          length;
+  struct timespec mtime;
+  uint64_t        hash; // same as the fingerprint of the mapping
+} file_digest_t;
+
+// same as above, but the fingerprint is taken from [digest] (instead of hashing
+// the file again) if the file did not change since it was read. then, it is not
+// mapped yet either: it is known as evicted, and mapped once read
+file_t *file_system_load_known(file_system_t *fs, const char *path, const file_digest_t *digest);
+// map the file from disk again (only if it is server-held and not opened by the client);
+// returns non-zero if succeeded
+int file_system_refresh(file_system_t *fs, file_t *file);
+
+// the file gone from disk: drop it, unless the client has it open (then it is
+// dropped once closed); returns non-zero if dropped
+int file_system_unload(file_system_t *fs, file_t *file);
+// NULL if no file is known by that absolute path
+file_t *file_system_find_path(file_system_t *fs, const char *path);
+// same as above, by interned path (PATH_ID_NONE for none)
+file_t *file_system_find(file_system_t *fs, path_id_t id);
+
+// write out the path of the file (NUL-terminated); returns its length, or zero if it does not fit
+size_t file_path(file_system_t *fs, const file_t *file, char *buffer, size_t size);
+
+// sequential reading of the text, whatever holds it (evicted files are mapped again, frozen
+// ones thawed); returns zero if it could not be read (gone from disk, or out of memory)
+int file_read(file_system_t *fs, file_t *file, text_buffer_read_t read, void *state);
+
+// fingerprint of the text: if it did not change, neither did the text.
+// it survives eviction, so it can be checked without touching the disk.
+// NOTE: only comparable between fingerprints taken with the same backing
+uint64_t file_fingerprint(file_t *file);
+
+// compress the text of all files not used for [fs->cold_after] seconds;
+// they are decompressed as soon as they are used again. returns how many were compressed
+size_t file_system_compress_idle(file_system_t *fs);
+// milliseconds until the next file goes cold (for file_system_compress_idle); -1 if none will
+int file_system_idle_timeout(file_system_t *fs);
+
+// return 0 to stop the search
+typedef
+int (*file_search_t)(file_t *file, const text_match_t *matches, size_t count, void *state);
+
+#define FILE_SEARCH_THREADS_MAX 16
+
+// search all files opened by the client, several at a time on separate threads.
+// calls to [found] are serialized, and come in order for each file, but files are
+// interleaved in no particular order. returns how many matches were passed to [found]
+size_t file_system_search(file_system_t *fs, const char *pattern, size_t length, file_search_t found, void *state);
+
+// return 0 to stop iteration
+typedef
+int (*file_change_visit_t)(const file_change_t *change, void *state);
+
+// visit, oldest first, all changes made after [version];
+// returns zero if the journal no longer reaches back that far
+// (then the consumer has to start from scratch)
+int file_journal_changes(file_t *file, int version, file_change_visit_t visit, void *state);
+// map a position computed against [version] to the current version;
+// positions inside a replaced range move to its start.
+// returns zero if the journal no longer reaches back that far
+int file_journal_map_position(file_t *file, int version, text_position_t *pos);
+// same as above, but for byte offsets
+int file_journal_map_offset(file_t *file, int version, size_t *offset);
 
 #endif /* !__FILE_SYSTEM_H__ */
@@ -0,0 +1,350 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "file_watcher.h"
+#include "file_system.h"
+#include "xxhash64.h"
+
+#define FILE_WATCHER_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+static long file_watcher_elapsed_ms(const struct timespec *since, const struct timespec *now) {
+  return (now->tv_sec - since->tv_sec) * 1000 + (now->tv_nsec - since->tv_nsec) / 1000000;
+}
+
+int file_watcher_init(file_watcher_t *watcher) {
+  assert(watcher != NULL);
+
+  memset(watcher, 0, sizeof(*watcher));
+  watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watcher->fd < 0) {
+    fprintf(stderr, "file_watcher_init: inotify not available: %s\n", strerror(errno));
+    return 0;
+  }
+  return 1;
+}
+
+void file_watcher_free(file_watcher_t *watcher) {
+  assert(watcher != NULL);
+
+  if (watcher->fd >= 0) {
+    close(watcher->fd);
+  }
+  for (size_t i = 0; i < watcher->dirs_capacity; i++) {
+    free(watcher->dirs[i]);
+  }
+  free(watcher->dirs);
+  for (size_t i = 0; i < watcher->num_pending; i++) {
+    free(watcher->pending[i]);
+  }
+  free(watcher->pending);
+  free(watcher->index);
+  memset(watcher, 0, sizeof(*watcher));
+  watcher->fd = -1;
+}
+
+int file_watcher_fd(file_watcher_t *watcher) {
+  assert(watcher != NULL);
+  return watcher->fd;
+}
+
+static void file_watcher_unwatch(file_watcher_t *watcher, int wd) {
+  inotify_rm_watch(watcher->fd, wd);
+  if ((size_t)wd < watcher->dirs_capacity) {
+    free(watcher->dirs[wd]);
+    watcher->dirs[wd] = NULL;
+  }
+}
+
+// the directory named [dir] itself, or one below it
+static int file_watcher_below(const char *path, const char *dir, size_t dir_length) {
+  return !strncmp(path, dir, dir_length) && (path[dir_length] == '\0' || path[dir_length] == '/');
+}
+
+// the directories below [from] (moved to [to]) go by their new names; those that can
+// not be renamed (out of memory) are not watched anymore
+static void file_watcher_rename(file_watcher_t *watcher, const char *from, const char *to) {
+  size_t from_length = strlen(from);
+  size_t to_length = strlen(to);
+  for (size_t i = 0; i < watcher->dirs_capacity; i++) {
+    char *path = watcher->dirs[i];
+    if (path == NULL || path == from || !file_watcher_below(path, from, from_length) || path[from_length] == '\0') {
+      continue;
+    }
+    size_t rest = strlen(path + from_length);
+    char *renamed = malloc(to_length + rest + 1);
+    if (renamed == NULL) {
+      fprintf(stderr, "file_watcher_rename: out of memory\n");
+      file_watcher_unwatch(watcher, (int)i);
+      continue;
+    }
+    memcpy(renamed, to, to_length);
+    memcpy(renamed + to_length, path + from_length, rest + 1);
+    free(path);
+    watcher->dirs[i] = renamed;
+  }
+}
+
+int file_watcher_watch(file_watcher_t *watcher, const char *dir) {
+  assert(watcher != NULL);
+  assert(dir != NULL);
+
+  if (watcher->fd < 0) {
+    return 0;
+  }
+  int wd = inotify_add_watch(watcher->fd, dir, FILE_WATCHER_MASK);
+  if (wd < 0) {
+    fprintf(stderr, "file_watcher_watch(%s): %s\n", dir, strerror(errno));
+    return 0;
+  }
+
+  if ((size_t)wd >= watcher->dirs_capacity) {
+    size_t capacity = watcher->dirs_capacity > 0 ? watcher->dirs_capacity : FILE_WATCHER_MIN_CAPACITY;
+    while (capacity <= (size_t)wd) {
+      capacity *= 2;
+    }
+    char **dirs = realloc(watcher->dirs, capacity * sizeof(char *));
+    if (dirs == NULL) {
+      fprintf(stderr, "file_watcher_watch: out of memory\n");
+      inotify_rm_watch(watcher->fd, wd);
+      return 0;
+    }
+    memset(dirs + watcher->dirs_capacity, 0, (capacity - watcher->dirs_capacity) * sizeof(char *));
+    watcher->dirs = dirs;
+    watcher->dirs_capacity = capacity;
+  }
+  if (watcher->dirs[wd] != NULL && !strcmp(watcher->dirs[wd], dir)) {
+    return 1; // already watched
+  }
+  // new, or moved: inotify watches the directory itself, whatever its name
+  char *name = strdup(dir);
+  if (name == NULL) {
+    fprintf(stderr, "file_watcher_watch: out of memory\n");
+    file_watcher_unwatch(watcher, wd);
+    return 0;
+  }
+  if (watcher->dirs[wd] != NULL) {
+    file_watcher_rename(watcher, watcher->dirs[wd], dir);
+    free(watcher->dirs[wd]);
+  }
+  watcher->dirs[wd] = name;
+  return 1;
+}
+
+/* ****** ****** */
+
+static int file_watcher_index_grow(file_watcher_t *watcher) {
+  size_t capacity = watcher->index_capacity > 0 ? watcher->index_capacity * 2 : FILE_WATCHER_MIN_CAPACITY;
+  uint32_t *index = calloc(capacity, sizeof(uint32_t));
+  if (index == NULL) {
+    return 0;
+  }
+  for (size_t i = 0; i < watcher->num_pending; i++) {
+    size_t slot = xxh64(watcher->pending[i], strlen(watcher->pending[i]), 0) & (capacity - 1);
+    while (index[slot] != 0) {
+      slot = (slot + 1) & (capacity - 1);
+    }
+    index[slot] = (uint32_t)(i + 1);
+  }
+  free(watcher->index);
+  watcher->index = index;
+  watcher->index_capacity = capacity;
+  return 1;
+}
+
+void file_watcher_push(file_watcher_t *watcher, const char *path, size_t length) {
+  assert(watcher != NULL);
+  assert(path != NULL);
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (watcher->num_pending == 0 && !watcher->overflowed) {
+    watcher->first_change = now;
+  }
+  watcher->last_change = now;
+  watcher->changes++;
+
+  // at most half full
+  if (2 * (watcher->num_pending + 1) > watcher->index_capacity && !file_watcher_index_grow(watcher)) {
+    fprintf(stderr, "file_watcher_push: out of memory\n");
+    watcher->overflowed = 1;
+    return;
+  }
+  size_t mask = watcher->index_capacity - 1;
+  size_t slot = xxh64(path, length, 0) & mask;
+  while (watcher->index[slot] != 0) {
+    const char *other = watcher->pending[watcher->index[slot] - 1];
+    if (!strncmp(other, path, length) && other[length] == '\0') {
+      watcher->coalesced++;
+      return;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  if (watcher->num_pending == watcher->pending_capacity) {
+    size_t capacity = watcher->pending_capacity > 0 ? watcher->pending_capacity * 2 : FILE_WATCHER_MIN_CAPACITY;
+    char **pending = realloc(watcher->pending, capacity * sizeof(char *));
+    if (pending == NULL) {
+      fprintf(stderr, "file_watcher_push: out of memory\n");
+      watcher->overflowed = 1;
+      return;
+    }
+    watcher->pending = pending;
+    watcher->pending_capacity = capacity;
+  }
+  char *copy = malloc(length + 1);
+  if (copy == NULL) {
+    fprintf(stderr, "file_watcher_push: out of memory\n");
+    watcher->overflowed = 1;
+    return;
+  }
+  memcpy(copy, path, length);
+  copy[length] = '\0';
+  watcher->pending[watcher->num_pending++] = copy;
+  watcher->index[slot] = (uint32_t)watcher->num_pending;
+}
+
+// a directory showed up: watch it, and queue whatever is in it already
+// (it may have been filled before the watch was in place)
+static void file_watcher_scan(file_watcher_t *watcher, const char *dir) {
+  if (!file_watcher_watch(watcher, dir)) {
+    return;
+  }
+  DIR *d = opendir(dir);
+  if (d == NULL) {
+    return;
+  }
+  char path[FILE_URI_MAX];
+  size_t dir_length = strlen(dir);
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    size_t name_length = strlen(entry->d_name);
+    if (dir_length + 1 + name_length + 1 > sizeof(path)) {
+      continue;
+    }
+    memcpy(path, dir, dir_length);
+    path[dir_length] = '/';
+    memcpy(path + dir_length + 1, entry->d_name, name_length + 1);
+
+    unsigned char type = entry->d_type;
+    if (type == DT_UNKNOWN) {
+      struct stat st;
+      if (lstat(path, &st) != 0) {
+        continue;
+      }
+      type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+    }
+    if (type == DT_DIR) {
+      file_watcher_scan(watcher, path);
+    } else if (type == DT_REG) {
+      file_watcher_push(watcher, path, dir_length + 1 + name_length);
+    }
+  }
+  closedir(d);
+}
+
+void file_watcher_read(file_watcher_t *watcher) {
+  assert(watcher != NULL);
+
+  if (watcher->fd < 0) {
+    return;
+  }
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  char path[FILE_URI_MAX];
+
+  while (1) {
+    ssize_t length = read(watcher->fd, buffer, sizeof(buffer));
+    if (length <= 0) {
+      if (length < 0 && errno != EAGAIN && errno != EINTR) {
+        fprintf(stderr, "file_watcher_read: %s\n", strerror(errno));
+      }
+      break;
+    }
+
+    for (char *p = buffer; p < buffer + length; ) {
+      const struct inotify_event *event = (const struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        if (watcher->num_pending == 0 && !watcher->overflowed) {
+          clock_gettime(CLOCK_MONOTONIC, &watcher->first_change);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &watcher->last_change);
+        watcher->overflowed = 1;
+        continue;
+      }
+      if (event->wd < 0 || (size_t)event->wd >= watcher->dirs_capacity || watcher->dirs[event->wd] == NULL) {
+        continue;
+      }
+      if (event->mask & IN_IGNORED) {
+        // the directory is gone
+        free(watcher->dirs[event->wd]);
+        watcher->dirs[event->wd] = NULL;
+        continue;
+      }
+      if (event->len == 0 || event->name[0] == '.') {
+        continue;
+      }
+
+      int used = snprintf(path, sizeof(path), "%s/%s", watcher->dirs[event->wd], event->name);
+      if (used < 0 || (size_t)used >= sizeof(path)) {
+        continue;
+      }
+      if (!(event->mask & IN_ISDIR)) {
+        file_watcher_push(watcher, path, used);
+      } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        file_watcher_scan(watcher, path);
+      } else if (event->mask & IN_MOVED_FROM) {
+        // whatever was below is gone (no events come for it): the directory itself is
+        // queued for it. it is watched again if it shows up in a watched directory
+        for (size_t i = 0; i < watcher->dirs_capacity; i++) {
+          if (watcher->dirs[i] != NULL && file_watcher_below(watcher->dirs[i], path, used)) {
+            file_watcher_unwatch(watcher, (int)i);
+          }
+        }
+        file_watcher_push(watcher, path, used);
+      }
+    }
+  }
+}
+
+int file_watcher_timeout(file_watcher_t *watcher) {
+  assert(watcher != NULL);
+
+  if (watcher->num_pending == 0 && !watcher->overflowed) {
+    return -1;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  long settle = FILE_WATCHER_SETTLE_MS - file_watcher_elapsed_ms(&watcher->last_change, &now);
+  long delay = FILE_WATCHER_MAX_DELAY_MS - file_watcher_elapsed_ms(&watcher->first_change, &now);
+  long timeout = settle < delay ? settle : delay;
+  return timeout > 0 ? (int)timeout : 0;
+}
+
+size_t file_watcher_drain(file_watcher_t *watcher, int force, file_watcher_visit_t visit, void *state) {
+  assert(watcher != NULL);
+  assert(visit != NULL);
+
+  if (watcher->num_pending == 0 || (!force && file_watcher_timeout(watcher) != 0)) {
+    return 0;
+  }
+  size_t count = watcher->num_pending;
+  for (size_t i = 0; i < count; i++) {
+    visit(watcher->pending[i], state);
+    free(watcher->pending[i]);
+  }
+  watcher->num_pending = 0;
+  memset(watcher->index, 0, watcher->index_capacity * sizeof(uint32_t));
+  return count;
+}
@@ -0,0 +1,65 @@
+#ifndef __FILE_WATCHER_H__
+#define __FILE_WATCHER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// collects the paths of files changed on disk (created, written, moved or deleted),
+// as reported by inotify for the watched directories, or as pushed by hand (e.g. from
+// workspace/didChangeWatchedFiles). every path is queued once however many times it
+// changes, and the queue is only handed over once changes settle down, so a burst
+// (a checkout touching thousands of files) is dealt with in one go.
+// - directories created in a watched directory are watched (and scanned) as well, and
+//   so are those moved into one
+// - a directory moved out of a watched directory is queued (its own path): whatever
+//   was below it is gone from there
+// - hidden entries are ignored
+
+#define FILE_WATCHER_SETTLE_MS 50 // quiet time before the changes are handed over
+#define FILE_WATCHER_MAX_DELAY_MS 1000 // ... but no change waits longer than this
+#define FILE_WATCHER_MIN_CAPACITY 64
+
+typedef struct file_watcher_s {
+  int fd; // inotify descriptor; -1 if not available
+  char **dirs; // watched directories, by watch descriptor
+  size_t dirs_capacity;
+
+  // changed paths, each once, in the order they first changed
+  char **pending;
+  size_t num_pending;
+  size_t pending_capacity;
+  uint32_t *index; // set of pending paths: open addressing, (position in [pending]) + 1, or 0
+  size_t index_capacity; // a power of two
+  struct timespec first_change; // of the pending ones (monotonic)
+  struct timespec last_change;
+
+  size_t changes; // reported so far
+  size_t coalesced; // ... of which were already pending
+  int overflowed; // some changes were lost: everything has to be checked
+} file_watcher_t;
+
+// returns zero if inotify is not available: then changes can only be pushed
+int file_watcher_init(file_watcher_t *watcher);
+void file_watcher_free(file_watcher_t *watcher);
+
+// the descriptor to poll for reading (-1 if none)
+int file_watcher_fd(file_watcher_t *watcher);
+// watch the entries of the directory (not those of its subdirectories); returns zero on failure
+int file_watcher_watch(file_watcher_t *watcher, const char *dir);
+
+// queue a changed path
+void file_watcher_push(file_watcher_t *watcher, const char *path, size_t length);
+// queue the changes inotify reported (without blocking)
+void file_watcher_read(file_watcher_t *watcher);
+
+// milliseconds until the pending changes are handed over; -1 if there are none
+int file_watcher_timeout(file_watcher_t *watcher);
+
+typedef
+void (*file_watcher_visit_t)(const char *path, void *state);
+
+// hand over the pending changes, if they settled down (or [force]); returns how many
+size_t file_watcher_drain(file_watcher_t *watcher, int force, file_watcher_visit_t visit, void *state);
+
+#endif /* !__FILE_WATCHER_H__ */
@@ -54,6 +54,111 @@ static void json_rpc_write_response(FILE *fout, struct json_value_s *value) {
   }
 }
 
+// where the replies written on this thread are kept instead (NULL: written out)
+static _Thread_local json_rpc_reply_t *json_rpc_capture = NULL;
+
+json_rpc_reply_t *json_rpc_capture_replies(json_rpc_reply_t *reply) {
+  json_rpc_reply_t *previous = json_rpc_capture;
+  json_rpc_capture = reply;
+  return previous;
+}
+
+void json_rpc_reply_free(json_rpc_reply_t *reply) {
+  assert(reply != NULL);
+
+  free(reply->json);
+  reply->json = NULL;
+  reply->length = 0;
+}
+
+// an answer to a request (to be sent in a batch, if it was part of one)
+static void json_rpc_write_reply(FILE *fout, struct json_value_s *value) {
+  json_rpc_reply_t *reply = json_rpc_capture;
+  if (reply == NULL) {
+    json_rpc_write_response(fout, value);
+    return;
+  }
+  size_t size = 0;
+  char *string = json_write_minified(value, &size);
+  assert(string != NULL);
+
+  // one request has one answer: the last one counts
+  free(reply->json);
+  reply->json = string;
+  reply->length = strlen(string);
+}
+
+void json_rpc_reply_write(FILE *fout, const json_rpc_reply_t *reply) {
+  assert(fout != NULL);
+  assert(reply != NULL);
+
+  if (reply->json == NULL) {
+    return;
+  }
+  // (framed as by json_rpc_write_response)
+  fprintf(fout, "Content-Length: %ld\r\n\r\n%s\r\n", reply->length + 1, reply->json);
+  fflush(fout);
+}
+
+void json_rpc_write_batch(FILE *fout, const json_rpc_reply_t *replies, size_t count) {
+  assert(fout != NULL);
+  assert(replies != NULL || count == 0);
+
+  size_t length = 1; // [
+  size_t num_replies = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (replies[i].json != NULL) {
+      length += replies[i].length + 1; // , or ]
+      num_replies++;
+    }
+  }
+  if (num_replies == 0) {
+    return; // only notifications: nothing to answer
+  }
+
+  // framed like any other message, then written out in one go
+  char header[64];
+  int header_length = snprintf(header, sizeof(header), "Content-Length: %ld\r\n\r\n", length + 1);
+  assert(header_length > 0 && (size_t)header_length < sizeof(header));
+  size_t total = header_length + length + 2;
+  char *buffer = malloc(total);
+  if (buffer == NULL) {
+    // TODO: handle failure
+    fprintf(stderr, "json_rpc_write_batch: out of memory\n");
+    return;
+  }
+  char *p = buffer;
+  memcpy(p, header, header_length);
+  p += header_length;
+  *p++ = '[';
+  for (size_t i = 0; i < count; i++) {
+    if (replies[i].json != NULL) {
+      memcpy(p, replies[i].json, replies[i].length);
+      p += replies[i].length;
+      *p++ = --num_replies > 0 ? ',' : ']';
+    }
+  }
+  *p++ = '\r';
+  *p++ = '\n';
+  assert(p == buffer + total);
+
+  fflush(fout);
+  int fd = fileno(fout);
+  size_t written = 0;
+  while (written < total) {
+    ssize_t ret = write(fd, buffer + written, total - written);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      fprintf(stderr, "json_rpc_write_batch: %s\n", strerror(errno));
+      break;
+    }
+    written += ret;
+  }
+  free(buffer);
+}
+
 static void json_rpc_error(FILE *fout, const struct json_value_s *id, const char *code, const char *message, const struct json_value_s *data) {
   JSON_PROP_NUMBER(error_code, "code", code);
   JSON_PROP_STRING(error_message, "message", message);
@@ -71,12 +176,12 @@ static void json_rpc_error(FILE *fout, const struct json_value_s *id, const char
     json_object_extend(&response_obj, &id_prop, &error, &jsonrpc, NULL);
 
     struct json_value_s response = json_value_object(&response_obj);
-    json_rpc_write_response(fout, &response);
+    json_rpc_write_reply(fout, &response);
   } else {
     json_object_extend(&response_obj, &error, &jsonrpc, NULL);
 
     struct json_value_s response = json_value_object(&response_obj);
-    json_rpc_write_response(fout, &response);
+    json_rpc_write_reply(fout, &response);
   }
 }
 
@@ -184,6 +289,12 @@ void json_rpc_internal_error(FILE *fout, json_rpc_request_notification_t *reques
   }
 }
 
+void json_rpc_request_cancelled_error(FILE *fout, json_rpc_request_notification_t *request) {
+  assert(request != NULL);
+
+  json_rpc_error(fout, request->id, "-32800", "Request cancelled", NULL);
+}
+
 void json_rpc_custom_error(FILE *fout, json_rpc_request_notification_t *request, int error_code, const char *message) {
   assert(request != NULL);
 
@@ -244,15 +355,93 @@ void json_rpc_success(FILE *fout, json_rpc_request_notification_t *request, cons
     json_object_extend(&response_obj, &id_prop, &result_prop, &jsonrpc, NULL);
 
     struct json_value_s response = json_value_object(&response_obj);
-    json_rpc_write_response(fout, &response);
+    json_rpc_write_reply(fout, &response);
   } else {
     json_object_extend(&response_obj, &result_prop, &jsonrpc, NULL);
 
     struct json_value_s response = json_value_object(&response_obj);
-    json_rpc_write_response(fout, &response);
+    json_rpc_write_reply(fout, &response);
   }
 }
 
+static void json_rpc_write_message(FILE *fout, const struct json_value_s *id, const char *method, const struct json_value_s *params) {
+  assert(method != NULL);
+
+  struct json_object_s message_obj = json_object_empty();
+  JSON_PROP_STRING(jsonrpc, "jsonrpc", "2.0");
+  JSON_PROP_STRING(method_prop, "method", method);
+  // (only written out: the casts are safe)
+  JSON_PROP_VALUE(params_prop, "params", (struct json_value_s *)params);
+  JSON_PROP_VALUE(id_prop, "id", (struct json_value_s *)id);
+  json_object_extend(&message_obj, &id_prop, &params_prop, &method_prop, &jsonrpc, NULL);
+
+  struct json_value_s message = json_value_object(&message_obj);
+  json_rpc_write_response(fout, &message);
+}
+
+// NULL if [json] is malformed
+static struct json_value_s *json_rpc_parse_custom(const char *json) {
+  struct json_parse_result_s parse_result;
+  struct json_value_s *json_value = json_parse_ex(json, strlen(json), json_parse_flags_default, NULL, NULL, &parse_result);
+
+  if (parse_result.error != json_parse_error_none) {
+    char data_buf[1024];
+    json_parse_error_reason(data_buf, sizeof(data_buf), &parse_result);
+    fprintf(stderr, "json_rpc_parse_custom: %s\n", data_buf);
+    if (json_value != json_null) {
+      free(json_value);
+    }
+    return NULL;
+  }
+  return json_value;
+}
+
+void json_rpc_notification(FILE *fout, const char *method, const struct json_value_s *params) {
+  json_rpc_write_message(fout, NULL, method, params);
+}
+
+void json_rpc_custom_notification(FILE *fout, const char *method, const char *json) {
+  assert(json != NULL);
+
+  struct json_value_s *params = json_rpc_parse_custom(json);
+  if (params != NULL) {
+    json_rpc_notification(fout, method, params);
+    free(params);
+  }
+}
+
+void json_rpc_request(FILE *fout, int id, const char *method, const struct json_value_s *params) {
+  char id_buf[16];
+  snprintf(id_buf, sizeof(id_buf), "%d", id);
+
+  struct json_number_s id_number = json_make_number(id_buf);
+  struct json_value_s id_value = json_value_number(&id_number);
+  json_rpc_write_message(fout, &id_value, method, params);
+}
+
+void json_rpc_custom_request(FILE *fout, int id, const char *method, const char *json) {
+  assert(json != NULL);
+
+  struct json_value_s *params = json_rpc_parse_custom(json);
+  if (params != NULL) {
+    json_rpc_request(fout, id, method, params);
+    free(params);
+  }
+}
+
+/* ****** ****** */
+
+struct json_value_s *json_object_property(struct json_object_s *object, const char *name) {
+  struct json_object_element_s* property = object != NULL ? object->start : NULL;
+  while (property != NULL) {
+    if (!strcmp(property->name->string, name)) {
+      return property->value;
+    }
+    property = property->next;
+  }
+  return NULL;
+}
+
 int json_rpc_parse_request_notification(struct json_value_s *root, json_rpc_request_notification_t *res) {
   struct json_object_s* object = json_value_as_object(root);
   
@@ -296,6 +485,30 @@ int json_rpc_parse_request_notification(struct json_value_s *root, json_rpc_requ
   return valid;
 }
 
+int json_rpc_is_response(struct json_value_s *root) {
+  struct json_object_s* object = json_value_as_object(root);
+  if (object == NULL) {
+    return 0;
+  }
+
+  int has_id = 0;
+  int has_outcome = 0;
+  struct json_object_element_s* property = object->start;
+  while (property != NULL) {
+    const char *property_name = property->name->string;
+
+    if (!strcmp(property_name, "method")) {
+      return 0;
+    } else if (!strcmp(property_name, "id")) {
+      has_id = 1;
+    } else if (!strcmp(property_name, "result") || !strcmp(property_name, "error")) {
+      has_outcome = 1;
+    }
+    property = property->next;
+  }
+  return has_id && has_outcome;
+}
+
 int json_rpc_request_is_notification(json_rpc_request_notification_t *request) {
   assert(request != NULL);
   return (request->id == NULL);
@@ -363,39 +576,139 @@ char *parse_request(FILE *fd, size_t *content_length) {
   return content_buf;
 }
 
-int json_rpc_server_step(FILE *fd, FILE *fout, json_rpc_evaluate_t evaluate, void *state) {
+json_rpc_message_t *json_rpc_read_message(FILE *fd) {
+  assert(fd != NULL);
+
   size_t content_length;
   char *content = parse_request(fd, &content_length);
-    
   if (content == NULL) {
-    fprintf(stderr, "json_rpc_server_step: failed to parse anything\n");
-    return 0;
+    return NULL;
   }
-  // printf("RAW content: %s with length %d\n", content, content_length);
-  
-  int cont;
-  struct json_parse_result_s parse_result;
-  struct json_value_s *json_value = json_parse_ex(content, content_length, json_parse_flags_default, NULL, NULL, &parse_result);
+  json_rpc_message_t *message = malloc(sizeof(json_rpc_message_t));
+  if (message == NULL) {
+    fprintf(stderr, "json_rpc_read_message: out of memory\n");
+    free(content);
+    return NULL;
+  }
+  memset(message, 0, sizeof(*message));
+  message->content = content;
+  message->content_length = content_length;
+  message->root = json_parse_ex(content, content_length, json_parse_flags_default, NULL, NULL, &message->parse_result);
+  if (message->parse_result.error != json_parse_error_none || message->root == json_null) {
+    message->root = NULL;
+  }
+  return message;
+}
 
-  if (parse_result.error != json_parse_error_none || json_value == json_null) {
-   json_rpc_parse_error(fout, NULL, &parse_result);
-   cont = 1;
-  } else {
-    json_rpc_request_notification_t request;
+void json_rpc_message_free(json_rpc_message_t *message) {
+  if (message == NULL) {
+    return;
+  }
+  free(message->root);
+  free(message->content);
+  free(message);
+}
 
-    memset(&request, 0, sizeof(request));
-    if (!json_rpc_parse_request_notification(json_value, &request)) {
+int json_rpc_message_is_batch(json_rpc_message_t *message) {
+  assert(message != NULL);
+  return message->root != NULL && json_value_as_array(message->root) != NULL;
+}
+
+int json_rpc_batch_element(struct json_value_s *element, json_rpc_request_notification_t *request) {
+  assert(element != NULL);
+  assert(request != NULL);
+
+  memset(request, 0, sizeof(*request));
+  if (json_rpc_is_response(element)) {
+    return -1;
+  }
+  return json_rpc_parse_request_notification(element, request);
+}
+
+// one after another, answered at once
+static int json_rpc_batch_dispatch(FILE *fout, struct json_array_s *batch, json_rpc_evaluate_t evaluate, void *state) {
+  json_rpc_reply_t *replies = calloc(batch->length, sizeof(json_rpc_reply_t));
+  if (replies == NULL) {
+    // TODO: handle failure
+    fprintf(stderr, "json_rpc_batch_dispatch: out of memory\n");
+    return 1;
+  }
+  int cont = 1;
+  size_t i = 0;
+  for (struct json_array_element_s *element = batch->start; element != NULL && cont; element = element->next, i++) {
+    json_rpc_request_notification_t request;
+    json_rpc_capture_replies(&replies[i]);
+    int valid = json_rpc_batch_element(element->value, &request);
+    if (valid == 0) {
       json_rpc_invalid_request_error(fout, &request);
-      cont = 1;
-    } else {
+    } else if (valid > 0) {
       cont = evaluate(fout, &request, state);
     }
+    json_rpc_capture_replies(NULL);
   }
+  json_rpc_write_batch(fout, replies, batch->length);
+  for (i = 0; i < batch->length; i++) {
+    json_rpc_reply_free(&replies[i]);
+  }
+  free(replies);
+  return cont;
+}
 
-  if (json_value != json_null) {
-    free(json_value);
+int json_rpc_message_reject(FILE *fout, json_rpc_message_t *message) {
+  assert(message != NULL);
+
+  if (message->root == NULL) {
+    json_rpc_parse_error(fout, NULL, &message->parse_result);
+    return 1;
+  }
+  struct json_array_s *batch = json_value_as_array(message->root);
+  if (batch != NULL) {
+    if (batch->length == 0) {
+      json_rpc_request_notification_t request;
+      memset(&request, 0, sizeof(request));
+      json_rpc_invalid_request_error(fout, &request);
+      return 1;
+    }
+    return 0;
+  }
+  if (json_rpc_is_response(message->root)) {
+    // nothing the server asked for needs the answer (yet)
+    return 1;
+  }
+  json_rpc_request_notification_t request;
+  memset(&request, 0, sizeof(request));
+  if (!json_rpc_parse_request_notification(message->root, &request)) {
+    json_rpc_invalid_request_error(fout, &request);
+    return 1;
+  }
+  return 0;
+}
+
+int json_rpc_message_dispatch(FILE *fout, json_rpc_message_t *message, json_rpc_evaluate_t evaluate, void *state) {
+  assert(message != NULL);
+  assert(evaluate != NULL);
+
+  if (json_rpc_message_reject(fout, message)) {
+    return 1;
+  }
+  if (json_rpc_message_is_batch(message)) {
+    return json_rpc_batch_dispatch(fout, json_value_as_array(message->root), evaluate, state);
+  }
+  json_rpc_request_notification_t request;
+  memset(&request, 0, sizeof(request));
+  json_rpc_parse_request_notification(message->root, &request);
+  return evaluate(fout, &request, state);
+}
+
+int json_rpc_server_step(FILE *fd, FILE *fout, json_rpc_evaluate_t evaluate, void *state) {
+  json_rpc_message_t *message = json_rpc_read_message(fd);
+  if (message == NULL) {
+    fprintf(stderr, "json_rpc_server_step: failed to parse anything\n");
+    return 0;
   }
-  free(content);
+  // printf("RAW content: %s with length %d\n", message->content, message->content_length);
 
+  int cont = json_rpc_message_dispatch(fout, message, evaluate, state);
+  json_rpc_message_free(message);
   return cont;
 }
@@ -90,17 +90,72 @@ void json_rpc_method_not_found_error(FILE *fout, json_rpc_request_notification_t
 void json_rpc_invalid_params_error(FILE *fout, json_rpc_request_notification_t *request, const char *reason);
 void json_rpc_internal_error(FILE *fout, json_rpc_request_notification_t *request, const char *reason);
 void json_rpc_custom_error(FILE *fout, json_rpc_request_notification_t *request, int error_code, const char *message);
+// the request was cancelled by the client (LSP)
+void json_rpc_request_cancelled_error(FILE *fout, json_rpc_request_notification_t *request);
 
 void json_rpc_custom_success(FILE *fout, json_rpc_request_notification_t *request, const char *json);
 void json_rpc_success(FILE *fout, json_rpc_request_notification_t *request, const struct json_value_s *json);
 
+// messages the server sends on its own ([params] may be NULL)
+void json_rpc_notification(FILE *fout, const char *method, const struct json_value_s *params);
+void json_rpc_custom_notification(FILE *fout, const char *method, const char *json);
+void json_rpc_request(FILE *fout, int id, const char *method, const struct json_value_s *params);
+void json_rpc_custom_request(FILE *fout, int id, const char *method, const char *json);
+
+// NULL if [object] (which may be NULL) has no such property
+struct json_value_s *json_object_property(struct json_object_s *object, const char *name);
+
 int json_rpc_parse_request_notification(struct json_value_s *root, json_rpc_request_notification_t *res);
 
+// the client answering a request sent by the server (these are not evaluated)
+int json_rpc_is_response(struct json_value_s *root);
+
 int json_rpc_request_is_notification(json_rpc_request_notification_t *request);
 
 typedef
 int (*json_rpc_evaluate_t)(FILE *fout, json_rpc_request_notification_t *request, void *state);
 
+// a message as read off the input, framed and parsed, but not evaluated yet
+typedef struct json_rpc_message_s {
+  char *content; // NUL-terminated
+  size_t content_length;
+  struct json_value_s *root; // NULL if not valid JSON
+  struct json_parse_result_s parse_result;
+  struct json_rpc_message_s *next; // for whoever holds it
+} json_rpc_message_t;
+
+// an answer kept back (instead of written out), to be sent in a batch with others
+typedef struct json_rpc_reply_s {
+  char *json; // NULL if none
+  size_t length;
+} json_rpc_reply_t;
+
+// from now on (until called with NULL), answers to requests written on this thread
+// (successes and errors) are kept in [reply]. messages of the server are written out.
+// returns where answers were kept before (NULL if written out)
+json_rpc_reply_t *json_rpc_capture_replies(json_rpc_reply_t *reply);
+void json_rpc_reply_free(json_rpc_reply_t *reply);
+// write out an answer kept back (nothing if none)
+void json_rpc_reply_write(FILE *fout, const json_rpc_reply_t *reply);
+// write out the answers to a batch as one array (in order, leaving out those missing),
+// with a single write; nothing if all are missing
+void json_rpc_write_batch(FILE *fout, const json_rpc_reply_t *replies, size_t count);
+
+// read the next message (blocking); NULL at the end of the input, or on a framing error
+json_rpc_message_t *json_rpc_read_message(FILE *fd);
+void json_rpc_message_free(json_rpc_message_t *message);
+// a JSON-RPC batch: an array of requests and notifications
+int json_rpc_message_is_batch(json_rpc_message_t *message);
+// parse an element of a batch; returns zero if it is not valid, negative if it is a response
+// (to be ignored)
+int json_rpc_batch_element(struct json_value_s *element, json_rpc_request_notification_t *request);
+// answer a message that is not a well-formed request or notification, or batch of them (a
+// response of the client is ignored); returns zero if [message] is one, for [evaluate]
+int json_rpc_message_reject(FILE *fout, json_rpc_message_t *message);
+// evaluate (or reject) the message; returns what [evaluate] returned (non-zero if rejected).
+// the elements of a batch are evaluated in order, and answered at once
+int json_rpc_message_dispatch(FILE *fout, json_rpc_message_t *message, json_rpc_evaluate_t evaluate, void *state);
+
 // NOTE: this is more of a function template than a function
 int json_rpc_server_step(FILE *fd, FILE *fout, json_rpc_evaluate_t evaluate, void *state);
 
@@ -0,0 +1,141 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "json_rpc_reader.h"
+
+// how long the reader waits for room in a full queue before trying again
+#define JSON_RPC_READER_BACKOFF_NS 1000000
+
+static void json_rpc_reader_wake(json_rpc_reader_t *reader) {
+  char c = 0;
+  // if the pipe is full, there is a wakeup pending anyway
+  ssize_t ret = write(reader->wake[1], &c, 1);
+  (void)ret;
+}
+
+static void *json_rpc_reader_run(void *arg) {
+  json_rpc_reader_t *reader = (json_rpc_reader_t *)arg;
+  struct timespec backoff = {0, JSON_RPC_READER_BACKOFF_NS};
+
+  while (1) {
+    // the thread is only ever cancelled while waiting for input (a message
+    // read and not pushed yet would be lost)
+    json_rpc_message_t *message = json_rpc_read_message(reader->fin);
+    int state;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    if (message == NULL) {
+      break;
+    }
+    while (!spsc_queue_push(&reader->queue, message)) {
+      if (atomic_load(&reader->stop)) {
+        json_rpc_message_free(message);
+        message = NULL;
+        break;
+      }
+      // the owner is behind: make sure it knows, and give it time to catch up
+      json_rpc_reader_wake(reader);
+      nanosleep(&backoff, NULL);
+    }
+    if (message == NULL) {
+      break;
+    }
+    json_rpc_reader_wake(reader);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &state);
+  }
+  atomic_store(&reader->done, 1);
+  json_rpc_reader_wake(reader);
+  return NULL;
+}
+
+/* ****** ****** */
+
+int json_rpc_reader_start(json_rpc_reader_t *reader, FILE *fin) {
+  assert(reader != NULL);
+  assert(fin != NULL);
+
+  memset(reader, 0, sizeof(*reader));
+  reader->fin = fin;
+  spsc_queue_init(&reader->queue);
+  atomic_init(&reader->done, 0);
+  atomic_init(&reader->stop, 0);
+  if (pipe(reader->wake) != 0) {
+    fprintf(stderr, "json_rpc_reader_start: unable to make a pipe: %s\n", strerror(errno));
+    reader->wake[0] = reader->wake[1] = -1;
+    return 0;
+  }
+  for (int i = 0; i < 2; i++) {
+    fcntl(reader->wake[i], F_SETFL, O_NONBLOCK);
+    fcntl(reader->wake[i], F_SETFD, FD_CLOEXEC);
+  }
+  if (pthread_create(&reader->thread, NULL, json_rpc_reader_run, reader) != 0) {
+    fprintf(stderr, "json_rpc_reader_start: unable to start a thread\n");
+    close(reader->wake[0]);
+    close(reader->wake[1]);
+    reader->wake[0] = reader->wake[1] = -1;
+    return 0;
+  }
+  reader->running = 1;
+  return 1;
+}
+
+void json_rpc_reader_free(json_rpc_reader_t *reader) {
+  assert(reader != NULL);
+
+  if (!reader->running) {
+    return; // never started
+  }
+  atomic_store(&reader->stop, 1);
+  if (!atomic_load(&reader->done)) {
+    // most likely waiting for input that is not coming
+    pthread_cancel(reader->thread);
+  }
+  pthread_join(reader->thread, NULL);
+
+  void *item;
+  while (spsc_queue_pop(&reader->queue, &item)) {
+    json_rpc_message_free((json_rpc_message_t *)item);
+  }
+  close(reader->wake[0]);
+  close(reader->wake[1]);
+  memset(reader, 0, sizeof(*reader));
+  reader->wake[0] = reader->wake[1] = -1;
+}
+
+int json_rpc_reader_fd(json_rpc_reader_t *reader) {
+  assert(reader != NULL);
+  return reader->wake[0];
+}
+
+json_rpc_message_t *json_rpc_reader_pop(json_rpc_reader_t *reader) {
+  assert(reader != NULL);
+
+  void *item;
+  if (spsc_queue_pop(&reader->queue, &item)) {
+    return (json_rpc_message_t *)item;
+  }
+  char buffer[64];
+  while (read(reader->wake[0], buffer, sizeof(buffer)) > 0) {
+    // consume all wakeups, then look again: a push may have come in between
+  }
+  if (spsc_queue_pop(&reader->queue, &item)) {
+    return (json_rpc_message_t *)item;
+  }
+  return NULL;
+}
+
+int json_rpc_reader_done(json_rpc_reader_t *reader) {
+  assert(reader != NULL);
+
+  if (!atomic_load(&reader->done)) {
+    return 0;
+  }
+  // nothing is pushed after [done] is set
+  return atomic_load_explicit(&reader->queue.head, memory_order_acquire)
+    == atomic_load_explicit(&reader->queue.tail, memory_order_acquire);
+}
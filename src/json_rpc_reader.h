@@ -0,0 +1,42 @@
+#ifndef __JSON_RPC_READER_H__
+#define __JSON_RPC_READER_H__
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "json_rpc.h"
+#include "spsc_queue.h"
+
+// reads messages off the input on a thread of its own: the headers are taken apart
+// and the content parsed into JSON there, while the owner evaluates the messages
+// before. parsed messages are handed over through a lock-free queue; the owner
+// polls a pipe to learn there are some (as for the crawler), and pops them on its
+// own thread. when the queue is full, the reader waits for room: the input is not
+// read any further meanwhile, so a client far ahead is held back by the pipe.
+
+typedef struct json_rpc_reader_s {
+  FILE *fin;
+  pthread_t thread;
+  int running; // the thread was started (and not joined yet)
+  spsc_queue_t queue; // of json_rpc_message_t
+  atomic_int done; // the input is over: nothing is pushed anymore
+  atomic_int stop; // the owner is going away: do not wait for room
+  int wake[2]; // pipe: readable when there is something to pop, or the input is over
+} json_rpc_reader_t;
+
+// start reading [fin]; returns zero on failure
+int json_rpc_reader_start(json_rpc_reader_t *reader, FILE *fin);
+// stop reading (if not at the end of the input yet), and drop all messages not popped
+void json_rpc_reader_free(json_rpc_reader_t *reader);
+
+// the descriptor to poll for reading
+int json_rpc_reader_fd(json_rpc_reader_t *reader);
+
+// the next message read (to be freed with json_rpc_message_free), or NULL if there is none yet.
+// once it returns NULL, the pipe is readable again as soon as there is another one
+json_rpc_message_t *json_rpc_reader_pop(json_rpc_reader_t *reader);
+// the input is over, and all messages were popped
+int json_rpc_reader_done(json_rpc_reader_t *reader);
+
+#endif /* !__JSON_RPC_READER_H__ */
@@ -4,6 +4,10 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
 // for "kill"
 #include <sys/types.h>
@@ -13,6 +17,7 @@
 #include "json.h"
 #include "json_rpc.h"
 #include "language_server.h"
+#include "transport.h"
 
 /* ****** ****** */
 
@@ -103,6 +108,8 @@ int server_parse_initialize_request(FILE *fout, json_rpc_request_notification_t
   params->parent_process_id = -1;
   params->root_uri = NULL;
   params->trace = LT_OFF;
+  params->work_done_progress = 0;
+  params->watched_files_registration = 0;
 
   if (!validate_json_value_type(fout, request, "/params", request->params, 0, json_type_object, "InitializeParams")) {
     return 0;
@@ -152,6 +159,16 @@ int server_parse_initialize_request(FILE *fout, json_rpc_request_notification_t
         json_rpc_invalid_params_error(fout, request, "trace should be one of \"off\", \"messages\", \"verbose\"");
         return 0;
       }
+    } else if (!strcmp(property_name, "capabilities")) {
+      // all capabilities are optional: anything unexpected counts as unsupported
+      struct json_value_s *window = json_object_property(json_value_as_object(property_value), "window");
+      struct json_value_s *progress = json_object_property(json_value_as_object(window), "workDoneProgress");
+      params->work_done_progress = json_value_is_true(progress);
+
+      struct json_value_s *workspace = json_object_property(json_value_as_object(property_value), "workspace");
+      struct json_value_s *watched = json_object_property(json_value_as_object(workspace), "didChangeWatchedFiles");
+      struct json_value_s *dynamic = json_object_property(json_value_as_object(watched), "dynamicRegistration");
+      params->watched_files_registration = json_value_is_true(dynamic);
     }
 
     property = property->next;
@@ -656,10 +673,77 @@ int parse_textDocument_didClose(json_rpc_request_notification_t *request, char *
 }
 
 
+/* ****** ****** */
+
+// (see server_analysis_submit)
+static void server_document_quiesce(language_server_t *server, path_id_t id);
+static void server_quiesce(language_server_t *server);
+
+// the client whose message an analysis task evaluates on this worker, and that message
+// (see server_analysis_run)
+static _Thread_local language_client_t *server_worker_client = NULL;
+static _Thread_local queued_message_t *server_worker_queued = NULL;
+
+// the client whose message is being evaluated (on this thread): for handlers that may
+// run on the workers (see server_method_read_only)
+static language_client_t *server_client(language_server_t *server) {
+  return server_worker_client != NULL ? server_worker_client : server->client;
+}
+
+// where [id] is in the documents opened by the client (negative if not there)
+static ssize_t server_client_document(language_client_t *client, path_id_t id) {
+  for (size_t i = 0; i < client->num_documents; i++) {
+    if (client->documents[i] == id) {
+      return (ssize_t)i;
+    }
+  }
+  return -1;
+}
+
+static void server_client_document_add(language_client_t *client, path_id_t id) {
+  if (client->num_documents == client->documents_capacity) {
+    size_t capacity = client->documents_capacity > 0 ? 2 * client->documents_capacity : 16;
+    path_id_t *documents = realloc(client->documents, capacity * sizeof(path_id_t));
+    if (documents == NULL) {
+      // TODO: handle failure
+      fprintf(stderr, "server_client_document_add: out of memory\n");
+      return;
+    }
+    client->documents = documents;
+    client->documents_capacity = capacity;
+  }
+  client->documents[client->num_documents++] = id;
+}
+
+// the client let go of the document: back to the text on disk, or gone, if no other
+// client has it open
+static void server_document_close(language_server_t *server, path_id_t id) {
+  file_t *file = file_system_find(&server->fs, id);
+  if (file == NULL || file->open_count == 0) {
+    return;
+  }
+  file_system_close_file(&server->fs, file);
+
+  file = file_system_find(&server->fs, id);
+  if (file != NULL) {
+    dep_graph_update(&server->deps, file);
+  } else {
+    dep_graph_remove(&server->deps, id);
+  }
+}
+
+// close all documents the client left open (e.g. on disconnecting)
+static void server_client_close_documents(language_server_t *server, language_client_t *client) {
+  for (size_t i = 0; i < client->num_documents; i++) {
+    server_document_close(server, client->documents[i]);
+  }
+  client->num_documents = 0;
+}
+
 /* ****** ****** */
 
 void server_textDocument_didOpen(language_server_t *server, json_rpc_request_notification_t *request) {
-  if (!server->initialized) {
+  if (!server->client->initialized) {
     fprintf(stderr, "server not initialized yet!\n");
     return;
   }
@@ -674,34 +758,164 @@ void server_textDocument_didOpen(language_server_t *server, json_rpc_request_not
     return;
   }
 
+  file_t *file = file_system_lookup(&server->fs, uri);
+  if (file != NULL && server_client_document(server->client, file->path_id) >= 0) {
+    fprintf(stderr, "textDocument/didOpen: %s is open already!\n", uri);
+    return;
+  }
+  // another client has it open: the text is of that client (the edits of both, made to
+  // texts of their own, can not be applied to one), so this one is refused
+  if (file != NULL && file->open_count > 0) {
+    fprintf(stderr, "textDocument/didOpen: %s is open in another client!\n", uri);
+    json_rpc_custom_notification(server->client->fout, "window/showMessage", "{\"type\": 1, \"message\": \
+\"This document is open in another editor: xatsls does not see the changes made to it here.\"}");
+    return;
+  }
   file_system_open(&server->fs, uri, version, contents->string, contents->string_size);
+  file = file_system_lookup(&server->fs, uri);
+  if (file != NULL) {
+    server_client_document_add(server->client, file->path_id);
+    dep_graph_update(&server->deps, file);
+    if (!file->on_disk) {
+      dep_graph_retry_unresolved(&server->deps); // (it need not be saved to be staloaded)
+    }
+  }
 }
 
-void server_textDocument_didChange(language_server_t *server, json_rpc_request_notification_t *request) {
-  if (!server->initialized) {
+// apply [edits] to the document at [uri] (if any), as of [version]; takes over [edits]
+static void server_document_change(language_server_t *server, char *uri, int version, file_edit_t *edits, size_t length) {
+  if (uri == NULL) {
+    free(edits);
+    return;
+  }
+  file_t *file = file_system_lookup(&server->fs, uri);
+  if (file == NULL || server_client_document(server->client, file->path_id) < 0) {
+    fprintf(stderr, "textDocument/didChange: %s is not open!\n", uri);
+    free(edits);
+    return;
+  }
+
+  // only the document changes (unless its directives do): tasks of the others go on
+  server_document_quiesce(server, file->path_id);
+  if (!file_system_change(&server->fs, uri, version, edits, length)) {
+    fprintf(stderr, "textDocument/didChange: error while applying changes!\n");
+  } else {
+    // (replays the journal: edits away from the directives do not scan the text again)
+    if (!dep_graph_settled(&server->deps, file)) {
+      server_quiesce(server);
+    }
+    dep_graph_update(&server->deps, file);
+  }
+
+  free(edits);
+}
+
+// apply the changes of [count] didChange notifications at once (the edits of each
+// after those before, as one batch of the last version). one that can not be joined to
+// the others ends the batch: those before it are applied first, with their own version
+static void server_textDocument_didChange_batch(language_server_t *server, json_rpc_request_notification_t **requests, size_t count) {
+  if (!server->client->initialized) {
     fprintf(stderr, "server not initialized yet!\n");
     return;
   }
 
   char *uri = NULL;
   int version = 0;
-  file_edit_t *file_edits = NULL;
-  size_t file_edits_length = 0;
-
-  if (!parse_textDocument_didChange(request, &uri, &version, &file_edits, &file_edits_length)) {
-    if (file_edits != NULL) {
-      free(file_edits);
+  file_edit_t *all_edits = NULL;
+  size_t all_edits_length = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    char *request_uri = NULL;
+    int request_version = 0;
+    file_edit_t *file_edits = NULL;
+    size_t file_edits_length = 0;
+
+    if (!parse_textDocument_didChange(requests[i], &request_uri, &request_version, &file_edits, &file_edits_length)) {
+      if (file_edits != NULL) {
+        free(file_edits);
+      }
+      fprintf(stderr, "textDocument/didChange: unable to parse parameters!\n");
+      server_document_change(server, uri, version, all_edits, all_edits_length);
+      uri = NULL;
+      all_edits = NULL;
+      all_edits_length = 0;
+      continue;
     }
-    fprintf(stderr, "textDocument/didChange: unable to parse parameters!\n");
-    return;
+    if (uri != NULL && strcmp(uri, request_uri)) {
+      server_document_change(server, uri, version, all_edits, all_edits_length);
+      all_edits = NULL;
+      all_edits_length = 0;
+    }
+    if (all_edits != NULL) {
+      file_edit_t *edits = realloc(all_edits, (all_edits_length + file_edits_length) * sizeof(file_edit_t));
+      if (edits == NULL) {
+        fprintf(stderr, "textDocument/didChange: out of memory, applying changes apart\n");
+        server_document_change(server, uri, version, all_edits, all_edits_length);
+        all_edits = NULL;
+        all_edits_length = 0;
+      } else {
+        all_edits = edits;
+        memcpy(all_edits + all_edits_length, file_edits, file_edits_length * sizeof(file_edit_t));
+        free(file_edits);
+        file_edits = NULL;
+      }
+    }
+    if (all_edits == NULL) {
+      all_edits = file_edits;
+    }
+    all_edits_length += file_edits_length;
+    uri = request_uri;
+    version = request_version;
   }
+  server_document_change(server, uri, version, all_edits, all_edits_length);
+}
 
-  if (!file_system_change(&server->fs, uri, version, file_edits, file_edits_length)) {
-    fprintf(stderr, "textDocument/didChange: error while applying changes!\n");
+void server_textDocument_didChange(language_server_t *server, json_rpc_request_notification_t *request) {
+  server_textDocument_didChange_batch(server, &request, 1);
+}
+
+// the document a didChange notification is about (NULL if not one)
+static const char *server_change_uri(queued_message_t *queued) {
+  if (!queued->valid || !json_rpc_request_is_notification(&queued->request)
+      || strcmp(queued->request.method->string, "textDocument/didChange")) {
+    return NULL;
   }
+  struct json_value_s *text_document = json_object_property(json_value_as_object(queued->request.params), "textDocument");
+  struct json_string_s *uri = json_value_as_string(json_object_property(json_value_as_object(text_document), "uri"));
+  return uri != NULL ? uri->string : NULL;
+}
+
+// a didChange notification is next: the ones for the same document queued right behind it
+// are applied along with it (nothing in between could read the document meanwhile), so the
+// document is looked up, edited and analysed once for all of them
+static void server_textDocument_didChange_queued(language_server_t *server, queued_message_t *first) {
+  const char *uri = server_change_uri(first);
+  assert(uri != NULL);
 
-  if (file_edits != NULL) {
-    free(file_edits);
+  json_rpc_request_notification_t *requests[LANGUAGE_SERVER_MAX_COALESCED];
+  queued_message_t *batch = NULL, **last = &batch;
+  size_t count = 0;
+  requests[count++] = &first->request;
+
+  queued_message_t *next;
+  while (count < LANGUAGE_SERVER_MAX_COALESCED && (next = request_queue_peek(&server->client->requests)) != NULL) {
+    const char *next_uri = server_change_uri(next);
+    if (next_uri == NULL || strcmp(next_uri, uri)) {
+      break;
+    }
+    *last = request_queue_take(&server->client->requests);
+    last = &next->next;
+    requests[count++] = &next->request;
+  }
+  if (count > 1) {
+    fprintf(stderr, "coalesced %zu changes\n", count);
+  }
+  server_textDocument_didChange_batch(server, requests, count);
+
+  while (batch != NULL) {
+    next = batch->next;
+    queued_message_free(batch);
+    batch = next;
   }
 }
 
@@ -721,7 +935,7 @@ void textbuf_fprint(text_buffer_t *tb, FILE *fp) {
 }
 
 void server_textDocument_didSave(language_server_t *server, json_rpc_request_notification_t *request) {
-  if (!server->initialized) {
+  if (!server->client->initialized) {
     fprintf(stderr, "server not initialized yet!\n");
     return;
   }
@@ -749,7 +963,7 @@ void server_textDocument_didSave(language_server_t *server, json_rpc_request_not
 }
 
 void server_textDocument_didClose(language_server_t *server, json_rpc_request_notification_t *request) {
-  if (!server->initialized) {
+  if (!server->client->initialized) {
     fprintf(stderr, "server not initialized yet!\n");
     return;
   }
@@ -760,59 +974,577 @@ void server_textDocument_didClose(language_server_t *server, json_rpc_request_no
     return;
   }
 
-  file_system_close(&server->fs, uri);
+  file_t *file = file_system_lookup(&server->fs, uri);
+  ssize_t index = file != NULL ? server_client_document(server->client, file->path_id) : -1;
+  if (index < 0) {
+    fprintf(stderr, "textDocument/didClose: %s is not open!\n", uri);
+    return;
+  }
+  language_client_t *client = server->client;
+  client->documents[index] = client->documents[--client->num_documents];
+  server_document_close(server, file->path_id);
+}
+
+/* ****** ****** */
+
+// what became ready, in the event loop (along with the id of the client, if any)
+typedef enum {
+  SERVER_EVENT_LISTEN,
+  SERVER_EVENT_CLIENT, // a message was read
+  SERVER_EVENT_PARENT, // the editor is gone
+  SERVER_EVENT_CRAWLER,
+  SERVER_EVENT_WATCHER,
+  SERVER_EVENT_COMPLETION // analysis tasks are done
+} server_event_t;
+
+static void server_poll_add(language_server_t *server, int fd, server_event_t event, int client_id) {
+  if (server->epoll_fd < 0 || fd < 0) {
+    return; // (not polling: see language_server_loop)
+  }
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = ((uint64_t)client_id << 8) | event;
+  if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    fprintf(stderr, "server_poll_add: %s\n", strerror(errno));
+  }
+}
+
+static void server_poll_remove(language_server_t *server, int fd) {
+  if (server->epoll_fd >= 0 && fd >= 0) {
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+  }
+}
+
+static language_client_t *server_client_find(language_server_t *server, int id) {
+  for (language_client_t *client = server->clients; client != NULL; client = client->next) {
+    if (client->id == id) {
+      return client;
+    }
+  }
+  return NULL;
 }
 
 /* ****** ****** */
 
+#define SERVER_CRAWL_TOKEN "xatsls/crawl"
+
+// start reading all sources in the workspace, in the background
+static void server_crawl_start(language_server_t *server, const char *root_uri) {
+  char *root = server->root;
+
+  if (file_uri_parse(root_uri, root) == 0) {
+    fprintf(stderr, "server_crawl_start: unable to crawl %s\n", root_uri);
+    root[0] = '\0';
+    return;
+  }
+  // files unchanged since the last run are not read again
+  if (!workspace_index_location(root, server->index_path, sizeof(server->index_path))) {
+    server->index_path[0] = '\0';
+  } else if (workspace_index_open(&server->index, server->index_path, root)) {
+    fprintf(stderr, "workspace index: %lu files\n", server->index.num_files);
+  }
+  if (!crawler_start(&server->crawler, root, server->num_threads, &server->index)) {
+    workspace_index_close(&server->index);
+    return;
+  }
+  server->crawling = 1;
+  server->crawl_percentage = 0;
+  if (server->watching) {
+    // every directory crawled is watched
+    server->resolver.watched_root = path_table_intern(&server->fs.paths, root, strlen(root));
+  }
+
+  server_poll_add(server, crawler_fd(&server->crawler), SERVER_EVENT_CRAWLER, 0);
+
+  // progress goes to the client the crawl was started for (as long as it is there)
+  language_client_t *client = server->client;
+  server->crawl_client = client->work_done_progress ? client->id : 0;
+  if (client->work_done_progress) {
+    json_rpc_custom_request(client->fout, client->next_request_id++, "window/workDoneProgress/create",
+                            "{\"token\": \"" SERVER_CRAWL_TOKEN "\"}");
+    json_rpc_custom_notification(client->fout, "$/progress",
+                                 "{\"token\": \"" SERVER_CRAWL_TOKEN "\", \"value\": {\"kind\": \"begin\", \
+\"title\": \"Indexing workspace\", \"cancellable\": false, \"percentage\": 0}}");
+  }
+}
+
+static void server_crawl_load(const char *path, const file_digest_t *digest, const dep_directives_t *directives, void *state) {
+  language_server_t *server = (language_server_t *)state;
+
+  if (digest == NULL) {
+    // a directory of the workspace
+    file_watcher_watch(&server->watcher, path);
+    return;
+  }
+  file_t *file = file_system_load_known(&server->fs, path, digest);
+  if (file == NULL) {
+    fprintf(stderr, "server_crawl_load: unable to load %s\n", path);
+    return;
+  }
+  // the directives were found by the crawler: the text is only scanned here if it is not
+  // the one they were found in (opened by a client, or changed since)
+  if (directives != NULL && file->backing != FILE_BACKING_TEXT && file_fingerprint(file) == digest->hash) {
+    dep_graph_load(&server->deps, file, digest->hash, directives);
+  } else {
+    dep_graph_update(&server->deps, file);
+  }
+}
+
+// some client has interactive requests queued
+static int server_interactive_queued(language_server_t *server) {
+  for (language_client_t *client = server->clients; client != NULL; client = client->next) {
+    if (request_queue_depth(&client->requests, REQUEST_CLASS_INTERACTIVE) > 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// take over some of what the crawler found so far, and report progress. indexing is
+// background work: it is taken in slices, and put off (for a while) as long as
+// interactive requests are waiting
+static void server_crawl_step(language_server_t *server) {
+  if (!server->crawling) {
+    return;
+  }
+  if (server_interactive_queued(server) && server->crawl_deferred < LANGUAGE_SERVER_MAX_CRAWL_DEFERRED) {
+    server->crawl_deferred++;
+    return;
+  }
+  server->crawl_deferred = 0;
+  // the workers are only waited for when there is something to load (or to finish)
+  if (!crawler_has_results(&server->crawler) && !crawler_done(&server->crawler)) {
+    return;
+  }
+  server_quiesce(server);
+  crawler_drain(&server->crawler, LANGUAGE_SERVER_CRAWL_SLICE, server_crawl_load, server);
+
+  size_t num_read = 0;
+  size_t found = 0;
+  crawler_progress(&server->crawler, &num_read, &found);
+
+  char json[256];
+  language_client_t *client = server_client_find(server, server->crawl_client);
+  if (crawler_done(&server->crawler)) {
+    fprintf(stderr, "workspace crawled: %lu sources (%lu unchanged, %lu scanned)\n", num_read, server->crawler.reused,
+            server->crawler.scanned);
+    server_poll_remove(server, crawler_fd(&server->crawler));
+    crawler_free(&server->crawler);
+    server->crawling = 0;
+    workspace_index_close(&server->index);
+    if (server->index_path[0] != '\0') {
+      workspace_index_write(server->index_path, server->root, &server->fs, &server->deps);
+    }
+
+    if (client != NULL) {
+      snprintf(json, sizeof(json), "{\"token\": \"" SERVER_CRAWL_TOKEN "\", \"value\": {\"kind\": \"end\", \
+\"message\": \"%lu files\"}}", num_read);
+      json_rpc_custom_notification(client->fout, "$/progress", json);
+    }
+    server->crawl_client = 0;
+    return;
+  }
+
+  // more sources are found as the crawl goes on, but the percentage must not go down
+  int percentage = found > 0 ? (int)(num_read * 100 / found) : 0;
+  if (client != NULL && percentage > server->crawl_percentage) {
+    server->crawl_percentage = percentage;
+    snprintf(json, sizeof(json), "{\"token\": \"" SERVER_CRAWL_TOKEN "\", \"value\": {\"kind\": \"report\", \
+\"message\": \"%lu/%lu files\", \"percentage\": %d}}", num_read, found, percentage);
+    json_rpc_custom_notification(client->fout, "$/progress", json);
+  }
+}
+
+// map the server-held file again, or drop it if gone
+static void server_file_refresh(language_server_t *server, file_t *file) {
+  if (file_system_refresh(&server->fs, file)) {
+    dep_graph_update(&server->deps, file);
+    return;
+  }
+  path_id_t id = file->path_id;
+  if (file_system_unload(&server->fs, file)) {
+    dep_graph_remove(&server->deps, id);
+  }
+}
+
+static int server_path_is_file(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// bring the server-held files below the directory up to date
+static void server_dir_changed(language_server_t *server, path_id_t dir) {
+  path_table_t *paths = &server->fs.paths;
+  path_resolver_invalidate_all(&server->resolver);
+  file_t *file = server->fs.files;
+  while (file != NULL) {
+    file_t *next = file->next;
+    path_id_t id = file->path_id;
+    while (id != PATH_ID_NONE && id != dir) {
+      id = path_table_parent(paths, id);
+    }
+    if (id == dir && file->open_count == 0 && file->on_disk) {
+      server_file_refresh(server, file);
+    }
+    file = next;
+  }
+}
+
+// a path changed on disk: bring the file (if any) up to date
+static void server_file_changed(const char *path, void *state) {
+  language_server_t *server = (language_server_t *)state;
+  file_system_t *fs = &server->fs;
+
+  path_resolver_invalidate(&server->resolver, path, strlen(path));
+  file_t *file = file_system_find_path(fs, path);
+  path_id_t id = file == NULL ? path_table_find(&fs->paths, path, strlen(path)) : PATH_ID_NONE;
+  if (id != PATH_ID_NONE && !server_path_is_file(path)) {
+    // a directory moved away: the files below it are gone from there
+    server_dir_changed(server, id);
+    return;
+  }
+  if (file == NULL) {
+    // a new source
+    const char *name = strrchr(path, '/');
+    if (name != NULL && crawler_is_source(name + 1, strlen(name + 1)) && access(path, R_OK) == 0) {
+      file = file_system_load(fs, path);
+    }
+    if (file != NULL) {
+      dep_graph_update(&server->deps, file);
+      server->deps_retry = 1;
+    }
+    return;
+  }
+  if (file->open_count > 0 || !file->on_disk) {
+    return; // the client's text is authoritative
+  }
+  server_file_refresh(server, file);
+}
+
+// hand the changes on disk over, once they settle down
+static void server_watch_step(language_server_t *server) {
+  if (file_watcher_timeout(&server->watcher) != 0) {
+    return;
+  }
+  server_quiesce(server);
+  size_t count = file_watcher_drain(&server->watcher, 1, server_file_changed, server);
+  if (count > 0) {
+    fprintf(stderr, "files changed on disk: %lu\n", count);
+  }
+  if (server->deps_retry) {
+    server->deps_retry = 0;
+    dep_graph_retry_unresolved(&server->deps);
+  }
+
+  if (server->watcher.overflowed) {
+    // changes were lost: check all files from disk
+    fprintf(stderr, "file watcher overflowed, refreshing all files\n");
+    server->watcher.overflowed = 0;
+    path_resolver_invalidate_all(&server->resolver);
+    file_t *file = server->fs.files;
+    while (file != NULL) {
+      file_t *next = file->next;
+      if (file->open_count == 0 && file->on_disk) {
+        server_file_refresh(server, file);
+      }
+      file = next;
+    }
+  }
+}
+
+/* ****** ****** */
+
+// the client is done with the server: it is dropped (and with it, the server, unless
+// it serves others) once its message is evaluated
 void server_exit(language_server_t *server) {
-  int retcode = server->shutdown_requested? 0 : 1;
-  exit(retcode);  
+  server->client->exited = 1;
+}
+
+// the editor process goes away without telling (e.g. killed): it is watched for
+// by its pidfd, if there is one; returns 0 if it is gone already
+static int server_watch_parent(language_server_t *server, language_client_t *client, int pid) {
+#ifdef SYS_pidfd_open
+  int fd = (int)syscall(SYS_pidfd_open, (pid_t)pid, 0);
+  if (fd >= 0) {
+    // (pidfds are close-on-exec)
+    client->parent_pidfd = fd;
+    server_poll_add(server, fd, SERVER_EVENT_PARENT, client->id);
+    return 1;
+  }
+  if (errno == ESRCH) {
+    return 0;
+  }
+  // no pidfds (before Linux 5.3): it is only checked once
+#endif
+  return is_process_running(pid);
 }
 
 void server_initialize(language_server_t *server, json_rpc_request_notification_t *request) {
-  if (server->initialized) {
-    json_rpc_invalid_params_error(server->fout, request, "Server already initialized");
+  language_client_t *client = server->client;
+  if (client->initialized) {
+    json_rpc_invalid_params_error(client->fout, request, "Server already initialized");
     return;
   }
 
   lsp_initialize_request_params_t params;
   memset(&params, 0, sizeof(params));
 
-  if (!server_parse_initialize_request(server->fout, request, &params)) {
+  if (!server_parse_initialize_request(client->fout, request, &params)) {
     return;
   }
 
-  if (params.parent_process_id > 0) {
-    int parent_running = is_process_running(params.parent_process_id);
-    if (!parent_running) {
+  if (params.parent_process_id > 0 && client->parent_pidfd < 0) {
+    if (!server_watch_parent(server, client, params.parent_process_id)) {
       server_exit(server);
+      return;
     }
   }
-  server->initialized = 1;
+  client->initialized = 1;
 
   fprintf(stderr, "initialized, sending response\n");
 
   // NOTE about "textDocumentSync" capabilities:
   // - "openClose": true means that both document open and document sent notifications are sent by the client
   // - "change": 2 means that docs are synced by sending the full content on open; after that only incremental updates are sent by the client
-  json_rpc_custom_success(server->fout, request, "{\"capabilities\": {\"textDocumentSync\": {\"openClose\": true, \"change\": 2, \"save\": {\"includeText\": false}}}, \
+  json_rpc_custom_success(client->fout, request, "{\"capabilities\": {\"textDocumentSync\": {\"openClose\": true, \"change\": 2, \"save\": {\"includeText\": false}}}, \
 \"serverInfo\": {\"name\": \"xatsls\", \"version\": \"0.1.5\"}}");
+
+  // the crawl goes on while requests are served
+  client->work_done_progress = params.work_done_progress;
+  client->watched_files_registration = params.watched_files_registration;
+  char root[FILE_URI_MAX];
+  if (server->root[0] == '\0') {
+    server_crawl_start(server, params.root_uri);
+  } else if (params.root_uri != NULL && (file_uri_parse(params.root_uri, root) == 0 || strcmp(root, server->root))) {
+    // (one workspace per server: that of the first client)
+    fprintf(stderr, "client %d: serving %s already, not %s\n", client->id, server->root, params.root_uri);
+  }
+}
+
+void server_initialized(language_server_t *server, json_rpc_request_notification_t *request) {
+  language_client_t *client = server->client;
+  if (server->watching || !client->watched_files_registration) {
+    return;
+  }
+  // no inotify: let the client tell about changes
+  json_rpc_custom_request(client->fout, client->next_request_id++, "client/registerCapability",
+                          "{\"registrations\": [{\"id\": \"xatsls/watch\", \"method\": \"workspace/didChangeWatchedFiles\", \
+\"registerOptions\": {\"watchers\": [{\"globPattern\": \"**/*.{dats,sats,hats,cats}\"}]}}]}");
+}
+
+void server_workspace_didChangeWatchedFiles(language_server_t *server, json_rpc_request_notification_t *request) {
+  struct json_value_s *changes = json_object_property(json_value_as_object(request->params), "changes");
+  struct json_array_s *array = json_value_as_array(changes);
+  if (array == NULL) {
+    fprintf(stderr, "workspace/didChangeWatchedFiles: unable to parse parameters!\n");
+    return;
+  }
+
+  char path[FILE_URI_MAX];
+  for (struct json_array_element_s *element = array->start; element != NULL; element = element->next) {
+    struct json_value_s *uri = json_object_property(json_value_as_object(element->value), "uri");
+    struct json_string_s *uri_string = json_value_as_string(uri);
+    if (uri_string != NULL && file_uri_parse(uri_string->string, path) != 0) {
+      file_watcher_push(&server->watcher, path, strlen(path));
+    }
+  }
+}
+
+// write out the URIs of the files as a JSON array
+static void server_write_uris(language_server_t *server, FILE *fp, const path_id_t *ids, size_t count) {
+  char path[FILE_URI_MAX];
+  char uri[3 * FILE_URI_MAX];
+  int first = 1;
+
+  fputc('[', fp);
+  for (size_t i = 0; i < count; i++) {
+    if (path_table_get(&server->fs.paths, ids[i], path, sizeof(path)) == 0
+        || file_uri_make(path, uri, sizeof(uri)) == 0) {
+      continue;
+    }
+    // (nothing to escape in a URI)
+    fprintf(fp, first ? "\"%s\"" : ",\"%s\"", uri);
+    first = 0;
+  }
+  fputc(']', fp);
+}
+
+// the files a document staloads or includes, and those that staload or include it.
+// only reads the state of the server (see server_method_read_only)
+void server_xatsls_dependencies(language_server_t *server, json_rpc_request_notification_t *request) {
+  language_client_t *client = server_client(server);
+  if (!client->initialized) {
+    json_rpc_invalid_params_error(client->fout, request, "Server not initialized yet");
+    return;
+  }
+  struct json_value_s *text_document = json_object_property(json_value_as_object(request->params), "textDocument");
+  struct json_string_s *uri = json_value_as_string(json_object_property(json_value_as_object(text_document), "uri"));
+  char path[FILE_URI_MAX];
+  size_t length = uri != NULL ? file_uri_parse(uri->string, path) : 0;
+  if (length == 0) {
+    json_rpc_invalid_params_error(client->fout, request, "textDocument/uri is missing or not a file URI");
+    return;
+  }
+
+  // (a document never seen has no edges)
+  path_id_t id = path_table_find(&server->fs.paths, path, length);
+  const path_id_t *deps = NULL, *dependents = NULL;
+  size_t num_deps = 0, num_dependents = 0;
+  if (id != PATH_ID_NONE) {
+    num_deps = dep_graph_dependencies(&server->deps, id, &deps);
+    num_dependents = dep_graph_dependents(&server->deps, id, &dependents);
+  }
+
+  char *json = NULL;
+  size_t json_size = 0;
+  FILE *fp = open_memstream(&json, &json_size);
+  if (fp == NULL) {
+    json_rpc_internal_error(client->fout, request, "out of memory");
+    return;
+  }
+  fputs("{\"dependencies\":", fp);
+  server_write_uris(server, fp, deps, num_deps);
+  fputs(",\"dependents\":", fp);
+  server_write_uris(server, fp, dependents, num_dependents);
+  fputc('}', fp);
+  fclose(fp);
+
+  json_rpc_custom_success(client->fout, request, json);
+  free(json);
+}
+
+static void server_write_class_stats(FILE *fp, const char *name, const request_class_stats_t *stats) {
+  fprintf(fp, "\"%s\":{\"queued\":%lu,\"maxQueued\":%lu,\"evaluated\":%lu,\"meanWaitUs\":%llu,\"maxWaitUs\":%llu}",
+          name, stats->depth, stats->max_depth, stats->evaluated,
+          (unsigned long long)(stats->evaluated > 0 ? stats->wait_ns / stats->evaluated / 1000 : 0),
+          (unsigned long long)(stats->max_wait_ns / 1000));
+}
+
+// queue depths, and time spent in the queues, of each scheduling class (of all clients,
+// past and present)
+void server_xatsls_metrics(language_server_t *server, json_rpc_request_notification_t *request) {
+  language_client_t *client = server->client;
+  if (!client->initialized) {
+    json_rpc_invalid_params_error(client->fout, request, "Server not initialized yet");
+    return;
+  }
+  static const char *names[REQUEST_NUM_CLASSES] = {"interactive", "foreground", "background"};
+  request_class_stats_t stats[REQUEST_NUM_CLASSES];
+  memcpy(stats, server->retired_stats, sizeof(stats));
+  for (language_client_t *other = server->clients; other != NULL; other = other->next) {
+    for (int i = 0; i < REQUEST_NUM_CLASSES; i++) {
+      request_class_stats_add(&stats[i], &other->requests.stats[i]);
+    }
+  }
+
+  char *json = NULL;
+  size_t json_size = 0;
+  FILE *fp = open_memstream(&json, &json_size);
+  if (fp == NULL) {
+    json_rpc_internal_error(client->fout, request, "out of memory");
+    return;
+  }
+  fputc('{', fp);
+  for (int i = 0; i < REQUEST_NUM_CLASSES; i++) {
+    if (i > 0) {
+      fputc(',', fp);
+    }
+    server_write_class_stats(fp, names[i], &stats[i]);
+  }
+  fprintf(fp, ",\"indexing\":%s}", server->crawling ? "true" : "false");
+  fclose(fp);
+
+  json_rpc_custom_success(client->fout, request, json);
+  free(json);
 }
 
 void server_shutdown(language_server_t *server, json_rpc_request_notification_t *request) {
-  if (!server->initialized) {
-    json_rpc_invalid_params_error(server->fout, request, "Server already uninitialized");
+  language_client_t *client = server->client;
+  if (!client->initialized) {
+    json_rpc_invalid_params_error(client->fout, request, "Server already uninitialized");
+  }
+  server_client_close_documents(server, client);
+  if (server->daemon) {
+    // others are (or will be) served: only this client is done
+    if (!server->crawling && server->index_path[0] != '\0') {
+      workspace_index_write(server->index_path, server->root, &server->fs, &server->deps);
+    }
+    client->shutdown_requested = 1;
+    json_rpc_success(client->fout, request, json_null);
+    return;
   }
   // TODO: free everything, etc.
+  if (server->crawling) {
+    server_poll_remove(server, crawler_fd(&server->crawler));
+    crawler_free(&server->crawler);
+    server->crawling = 0;
+    workspace_index_close(&server->index);
+  } else if (server->index_path[0] != '\0') {
+    // (an interrupted crawl would leave out files: better keep the last index)
+    workspace_index_write(server->index_path, server->root, &server->fs, &server->deps);
+  }
+  dep_graph_free(&server->deps);
+  path_resolver_free(&server->resolver);
   file_system_free(&server->fs);
-  server->shutdown_requested = 1;
+  client->shutdown_requested = 1;
 
-  json_rpc_success(server->fout, request, json_null);
+  json_rpc_success(client->fout, request, json_null);
 }
 
 /* ****** ****** */
 
+// a message that could not be queued: its requests are answered with an error
+static void server_drop_message(language_client_t *client, json_rpc_message_t *message) {
+  json_rpc_request_notification_t request;
+  if (message->root != NULL && json_rpc_message_is_batch(message)) {
+    struct json_array_s *batch = json_value_as_array(message->root);
+    for (struct json_array_element_s *element = batch->start; element != NULL; element = element->next) {
+      if (json_rpc_batch_element(element->value, &request) > 0 && !json_rpc_request_is_notification(&request)) {
+        json_rpc_internal_error(client->fout, &request, "out of memory");
+      }
+    }
+  } else if (message->root != NULL && !json_rpc_is_response(message->root)
+             && json_rpc_parse_request_notification(message->root, &request)
+             && !json_rpc_request_is_notification(&request)) {
+    json_rpc_internal_error(client->fout, &request, "out of memory");
+  }
+  json_rpc_message_free(message);
+}
+
+// take over the messages read so far; cancellations of requests still queued are answered here
+static void server_take_input(language_client_t *client) {
+  // (answered right away, even while evaluating a batch)
+  json_rpc_reply_t *capture = json_rpc_capture_replies(NULL);
+  json_rpc_message_t *message;
+  while ((message = json_rpc_reader_pop(&client->reader)) != NULL) {
+    queued_message_t *cancelled;
+    int pushed = request_queue_push(&client->requests, message, &cancelled);
+    if (pushed < 0) {
+      server_drop_message(client, message);
+    } else if (!pushed && cancelled != NULL) {
+      fprintf(stderr, "cancelled request: %s\n", cancelled->request.method->string);
+      json_rpc_request_cancelled_error(client->fout, &cancelled->request);
+      queued_message_free(cancelled);
+    }
+  }
+  json_rpc_capture_replies(capture);
+}
+
+int server_request_cancelled(language_server_t *server) {
+  assert(server != NULL);
+
+  // on a worker, only the flag (set by the main thread, which reads the input)
+  if (server_worker_queued != NULL) {
+    return atomic_load(&server_worker_queued->cancelled);
+  }
+  assert(server->client != NULL);
+  if (server->client->reading) {
+    server_take_input(server->client);
+  }
+  return request_queue_cancelled(&server->client->requests);
+}
+
 void language_server_evaluate(language_server_t *server, json_rpc_request_notification_t *request) {
   assert(request != NULL);
   assert(server != NULL);
@@ -832,6 +1564,12 @@ void language_server_evaluate(language_server_t *server, json_rpc_request_notifi
       server_textDocument_didClose(server, request);
     } else if (!strcmp(method, "textDocument/didSave")) {
       server_textDocument_didSave(server, request);
+    } else if (!strcmp(method, "initialized")) {
+      server_initialized(server, request);
+    } else if (!strcmp(method, "workspace/didChangeWatchedFiles")) {
+      server_workspace_didChangeWatchedFiles(server, request);
+    } else if (!strcmp(method, "$/cancelRequest")) {
+      // (taken care of when queued) the request was answered already
     } else {
       fprintf(stderr, "skipping notification: %s\n", method);
     }
@@ -843,8 +1581,12 @@ void language_server_evaluate(language_server_t *server, json_rpc_request_notifi
     } else if (!strcmp(method, "shutdown")) {
       fprintf(stderr, "shutdown request\n");
       server_shutdown(server, request);
+    } else if (!strcmp(method, "xatsls/dependencies")) {
+      server_xatsls_dependencies(server, request);
+    } else if (!strcmp(method, "xatsls/metrics")) {
+      server_xatsls_metrics(server, request);
     } else {
-      json_rpc_method_not_found_error(server->fout, request);
+      json_rpc_method_not_found_error(server->client->fout, request);
     }
   }
 }
@@ -857,21 +1599,556 @@ int language_server_json_rpc_evaluate(FILE *fout, json_rpc_request_notification_
   return 1;
 }
 
-void language_server_loop() {
-  FILE *fd = stdin;
-  FILE *fout = stdout;
-  language_server_t server = {
-    .fin = fd,
-    .fout = fout,
-    .initialized = 0,
-    .shutdown_requested = 0
-  };
+/* ****** ****** */
+
+// requests that only read the state of the server: they are evaluated on the workers, at
+// the same time as others (their handlers may not write anything but their answer, and
+// get their client with server_client)
+static int server_method_read_only(const char *method) {
+  return !strcmp(method, "xatsls/dependencies");
+}
+
+// the scheduling class of a request (see request_queue.h): what is asked for while typing
+// goes ahead of the rest, and workspace-wide requests go last
+static request_class_t server_method_class(const char *method) {
+  if (!strcmp(method, "textDocument/completion") || !strcmp(method, "completionItem/resolve")
+      || !strcmp(method, "textDocument/hover") || !strcmp(method, "textDocument/signatureHelp")) {
+    return REQUEST_CLASS_INTERACTIVE;
+  }
+  if (!strcmp(method, "workspace/diagnostic")) {
+    return REQUEST_CLASS_BACKGROUND;
+  }
+  return REQUEST_CLASS_FOREGROUND; // definition, references, dependencies, metrics, ...
+}
+
+/* ****** ****** */
+
+// read-only requests are analysis tasks: they run on the workers while the main thread
+// goes on reading and dispatching messages, and their answers come back through the
+// completion queue. anything changing the state of the server (edits, the crawl, changes
+// on disk) waits for the tasks in flight first (see server_quiesce), so they see it as
+// it was when they were submitted, without locks
+typedef struct server_analysis_s {
+  completion_t completion;
+  language_server_t *server;
+  language_client_t *client; // (not dropped before the task is taken back)
+  queued_message_t *queued;
+  json_rpc_reply_t reply;
+} server_analysis_t;
+
+static void server_analysis_run(void *arg) {
+  server_analysis_t *analysis = (server_analysis_t *)arg;
+
+  server_worker_client = analysis->client;
+  server_worker_queued = analysis->queued;
+  json_rpc_capture_replies(&analysis->reply);
+  language_server_evaluate(analysis->server, &analysis->queued->request);
+  json_rpc_capture_replies(NULL);
+  server_worker_queued = NULL;
+  server_worker_client = NULL;
+  completion_queue_push(&analysis->server->completions, &analysis->completion);
+}
+
+// the mailbox of the document (NULL if there is none yet, and not [create]).
+// mailboxes are only made on the main thread, and stay until the end
+static mailbox_t *server_mailbox(language_server_t *server, path_id_t id, int create) {
+  if (id == PATH_ID_NONE || (id >= server->mailboxes_capacity && !create)) {
+    return NULL;
+  }
+  if (id >= server->mailboxes_capacity) {
+    size_t capacity = server->mailboxes_capacity > 0 ? server->mailboxes_capacity : 64;
+    while (capacity <= id) {
+      capacity *= 2;
+    }
+    mailbox_t **mailboxes = realloc(server->mailboxes, capacity * sizeof(mailbox_t *));
+    if (mailboxes == NULL) {
+      // TODO: handle failure
+      return NULL;
+    }
+    memset(mailboxes + server->mailboxes_capacity, 0, (capacity - server->mailboxes_capacity) * sizeof(mailbox_t *));
+    server->mailboxes = mailboxes;
+    server->mailboxes_capacity = capacity;
+  }
+  if (server->mailboxes[id] == NULL && create) {
+    mailbox_t *mailbox = malloc(sizeof(mailbox_t));
+    if (mailbox == NULL) {
+      // TODO: handle failure
+      return NULL;
+    }
+    mailbox_init(mailbox, &server->pool);
+    server->mailboxes[id] = mailbox;
+  }
+  return server->mailboxes[id];
+}
+
+// the document a request is about (PATH_ID_NONE if none, or never seen)
+static path_id_t server_request_document(language_server_t *server, json_rpc_request_notification_t *request) {
+  struct json_value_s *text_document = json_object_property(json_value_as_object(request->params), "textDocument");
+  struct json_string_s *uri = json_value_as_string(json_object_property(json_value_as_object(text_document), "uri"));
+  char path[FILE_URI_MAX];
+  size_t length = uri != NULL ? file_uri_parse(uri->string, path) : 0;
+  return length > 0 ? path_table_find(&server->fs.paths, path, length) : PATH_ID_NONE;
+}
+
+// returns zero if it was not submitted (to be evaluated right away, then). tasks about a
+// document go through its mailbox: they run one at a time, in order, while those of
+// other documents run at the same time
+static int server_analysis_submit(language_server_t *server, language_client_t *client, queued_message_t *queued) {
+  if (!server->pooled) {
+    return 0;
+  }
+  server_analysis_t *analysis = calloc(1, sizeof(server_analysis_t));
+  if (analysis == NULL) {
+    return 0;
+  }
+  analysis->server = server;
+  analysis->client = client;
+  analysis->queued = queued;
+  mailbox_t *mailbox = server_mailbox(server, server_request_document(server, &queued->request), 1);
+  if (mailbox != NULL ? !mailbox_post(mailbox, server_analysis_run, analysis)
+      : !thread_pool_submit(&server->pool, server_analysis_run, analysis)) {
+    free(analysis);
+    return 0;
+  }
+  server->in_flight++;
+  return 1;
+}
+
+// write out the answers of the analysis tasks done (in the order they were done)
+static void server_analysis_drain(language_server_t *server) {
+  completion_t *completion = completion_queue_take(&server->completions);
+  while (completion != NULL) {
+    server_analysis_t *analysis = (server_analysis_t *)completion;
+    completion = completion->next;
+
+    json_rpc_reply_write(analysis->client->fout, &analysis->reply);
+    json_rpc_reply_free(&analysis->reply);
+    request_queue_finish_detached(&analysis->client->requests, analysis->queued);
+    queued_message_free(analysis->queued);
+    free(analysis);
+    server->in_flight--;
+  }
+}
+
+// wait for the analysis tasks of the document, before changing it (but nothing else)
+static void server_document_quiesce(language_server_t *server, path_id_t id) {
+  mailbox_t *mailbox = server_mailbox(server, id, 0);
+  if (mailbox != NULL) {
+    mailbox_wait(mailbox);
+  }
+}
+
+// wait for the analysis tasks in flight, before changing the state of the server
+static void server_quiesce(language_server_t *server) {
+  if (server->in_flight == 0) {
+    return;
+  }
+  thread_pool_wait(&server->pool);
+  server_analysis_drain(server);
+  assert(server->in_flight == 0);
+}
+
+typedef struct server_batch_task_s {
+  language_server_t *server;
+  queued_message_t *queued; // the batch
+  json_rpc_request_notification_t request;
+  json_rpc_reply_t *reply;
+} server_batch_task_t;
+
+// (on a worker, or on the main thread: either way, cancellation is told by the flag of
+// the batch, and the input is left to the main thread's loop)
+static void server_batch_run(void *arg) {
+  server_batch_task_t *task = (server_batch_task_t *)arg;
+
+  queued_message_t *queued = server_worker_queued;
+  server_worker_queued = task->queued;
+  json_rpc_capture_replies(task->reply);
+  language_server_evaluate(task->server, &task->request);
+  json_rpc_capture_replies(NULL);
+  server_worker_queued = queued;
+}
+
+// evaluate read-only requests of a batch, at the same time if more than one
+static void server_batch_flush(language_server_t *server, server_batch_task_t *tasks, size_t count) {
+  if (count <= 1 || !server->pooled) {
+    for (size_t i = 0; i < count; i++) {
+      server_batch_run(&tasks[i]);
+    }
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (!thread_pool_submit(&server->pool, server_batch_run, &tasks[i])) {
+      server_batch_run(&tasks[i]);
+    }
+  }
+  // nothing changes meanwhile: the main thread waits
+  thread_pool_wait(&server->pool);
+}
+
+// evaluate the elements of a batch, and answer them all at once. runs of read-only requests
+// are evaluated at the same time; anything else is evaluated on its own, in order
+static int server_evaluate_batch(language_server_t *server, queued_message_t *queued) {
+  struct json_array_s *batch = json_value_as_array(queued->message->root);
+  assert(batch != NULL);
+
+  json_rpc_reply_t *replies = calloc(batch->length, sizeof(json_rpc_reply_t));
+  server_batch_task_t *tasks = calloc(batch->length, sizeof(server_batch_task_t));
+  if (replies == NULL || tasks == NULL) {
+    // TODO: handle failure
+    free(replies);
+    free(tasks);
+    return json_rpc_message_dispatch(server->client->fout, queued->message, &language_server_json_rpc_evaluate, server);
+  }
+
+  int cont = 1;
+  size_t run_start = 0, i = 0;
+  for (struct json_array_element_s *element = batch->start; element != NULL && cont; element = element->next, i++) {
+    server_batch_task_t *task = &tasks[i];
+    task->server = server;
+    task->queued = queued;
+    task->reply = &replies[i];
+    int valid = json_rpc_batch_element(element->value, &task->request);
+    if (valid > 0 && !json_rpc_request_is_notification(&task->request)
+        && server_method_read_only(task->request.method->string)) {
+      continue; // joins the run
+    }
+    server_batch_flush(server, tasks + run_start, i - run_start);
+    run_start = i + 1;
+
+    json_rpc_capture_replies(task->reply);
+    if (valid == 0) {
+      json_rpc_invalid_request_error(server->client->fout, &task->request);
+    } else if (valid > 0) {
+      cont = language_server_json_rpc_evaluate(server->client->fout, &task->request, server);
+    }
+    json_rpc_capture_replies(NULL);
+  }
+  server_batch_flush(server, tasks + run_start, i - run_start);
+
+  json_rpc_write_batch(server->client->fout, replies, batch->length);
+  for (i = 0; i < batch->length; i++) {
+    json_rpc_reply_free(&replies[i]);
+  }
+  free(replies);
+  free(tasks);
+  return cont;
+}
+
+/* ****** ****** */
+
+// take on a connection: messages are read off [fin] on a thread of the client's own
+// (for the standard input, [fd] is negative, and if no thread can be started, the
+// messages are read one at a time: see language_server_loop)
+static language_client_t *server_client_add(language_server_t *server, int fd, FILE *fin, FILE *fout) {
+  language_client_t *client = calloc(1, sizeof(language_client_t));
+  if (client == NULL) {
+    // TODO: handle failure
+    fprintf(stderr, "server_client_add: out of memory\n");
+    return NULL;
+  }
+  client->id = ++server->next_client_id;
+  client->fd = fd;
+  client->fin = fin;
+  client->fout = fout;
+  client->next_request_id = 1;
+  client->parent_pidfd = -1;
+  request_queue_init(&client->requests, server_method_class);
+  client->reading = json_rpc_reader_start(&client->reader, fin);
+  if (!client->reading && fd >= 0) {
+    request_queue_free(&client->requests);
+    free(client);
+    return NULL;
+  }
+  if (client->reading) {
+    server_poll_add(server, json_rpc_reader_fd(&client->reader), SERVER_EVENT_CLIENT, client->id);
+  }
+
+  // (served in the order they came)
+  language_client_t **last = &server->clients;
+  while (*last != NULL) {
+    last = &(*last)->next;
+  }
+  *last = client;
+  fprintf(stderr, "client %d connected\n", client->id);
+  return client;
+}
+
+// the client is gone: whatever it left open goes back to what is on disk
+static void server_client_remove(language_server_t *server, language_client_t *client) {
+  server_quiesce(server); // (its answers still go out)
+  fprintf(stderr, "client %d disconnected\n", client->id);
+  if (client->shutdown_requested && !server->daemon) {
+    client->num_documents = 0; // (all freed already)
+  }
+  server_client_close_documents(server, client);
+  if (client->parent_pidfd >= 0) {
+    server_poll_remove(server, client->parent_pidfd);
+    close(client->parent_pidfd);
+  }
+  if (client->reading) {
+    server_poll_remove(server, json_rpc_reader_fd(&client->reader));
+    if (client->fd >= 0) {
+      shutdown(client->fd, SHUT_RDWR); // (the reader sees the end of the input)
+    }
+    json_rpc_reader_free(&client->reader);
+  }
+  for (int i = 0; i < REQUEST_NUM_CLASSES; i++) {
+    client->requests.stats[i].depth = 0; // (dropped)
+    request_class_stats_add(&server->retired_stats[i], &client->requests.stats[i]);
+  }
+  request_queue_free(&client->requests);
+  if (client->fd >= 0) {
+    fclose(client->fin);
+    fclose(client->fout);
+  }
+  if (server->crawl_client == client->id) {
+    server->crawl_client = 0;
+  }
+
+  language_client_t **link = &server->clients;
+  while (*link != client) {
+    link = &(*link)->next;
+  }
+  *link = client->next;
+  free(client->documents);
+  free(client);
+}
+
+static void server_accept(language_server_t *server) {
+  int fd;
+  while ((fd = transport_accept(server->listen_fd)) >= 0) {
+    FILE *fin, *fout;
+    if (!transport_open(fd, &fin, &fout)) {
+      continue;
+    }
+    if (server_client_add(server, fd, fin, fout) == NULL) {
+      fclose(fin);
+      fclose(fout);
+    }
+  }
+}
+
+// evaluate the next message of the client, if there is one; returns non-zero if so
+static int server_client_step(language_server_t *server, language_client_t *client) {
+  queued_message_t *queued = request_queue_pop(&client->requests);
+  if (queued == NULL) {
+    return 0;
+  }
+  if (queued->valid && client->initialized && !json_rpc_request_is_notification(&queued->request)
+      && server_method_read_only(queued->request.method->string)
+      && server_analysis_submit(server, client, queued)) {
+    // (the task has it now; a cancellation flags it until its answer is written)
+    request_queue_detach(&client->requests);
+    return 1;
+  }
+  if (server_change_uri(queued) == NULL) {
+    server_quiesce(server); // (edits only wait for the tasks of their document)
+  }
+
+  int cont = 1;
+  server->client = client;
+  if (server_change_uri(queued) != NULL) {
+    fprintf(stderr, "got method: %s\n", queued->request.method->string);
+    server_textDocument_didChange_queued(server, queued);
+  } else if (queued->valid) {
+    cont = language_server_json_rpc_evaluate(client->fout, &queued->request, server);
+  } else if (!json_rpc_message_reject(client->fout, queued->message)) {
+    cont = server_evaluate_batch(server, queued);
+  }
+  server->client = NULL;
+  if (!cont) {
+    client->exited = 1;
+  }
+  request_queue_finish(&client->requests);
+  queued_message_free(queued);
+  server_crawl_step(server);
+  server_watch_step(server);
+  return 1;
+}
+
+// a client goes away once it said so, or once its input is over and all its
+// messages are evaluated
+static int server_client_done(language_client_t *client) {
+  return client->exited
+    || (json_rpc_reader_done(&client->reader) && request_queue_peek(&client->requests) == NULL);
+}
+
+#define SERVER_MAX_EVENTS 16
+
+// the sooner of two timeouts (in milliseconds; -1 for none)
+static int server_timeout_min(int a, int b) {
+  if (a < 0) {
+    return b;
+  }
+  return b < 0 || a < b ? a : b;
+}
+
+int language_server_loop(const language_server_options_t *options) {
+  assert(options != NULL);
+
+  language_server_t server;
+  memset(&server, 0, sizeof(server));
+  server.epoll_fd = -1;
+  server.listen_fd = -1;
+  server.daemon = options->transport == LS_TRANSPORT_LISTEN;
+  // a client gone while being written to is noticed by its reader
+  signal(SIGPIPE, SIG_IGN);
+
   file_system_init(&server.fs);
+  if (options->cold_after >= 0) {
+    server.fs.cold_after = options->cold_after;
+  }
+  if (options->memory_budget > 0) {
+    server.fs.memory_budget = options->memory_budget;
+  }
+  if (options->max_mappings > 0) {
+    server.fs.max_mappings = options->max_mappings;
+  }
+  server.watching = file_watcher_init(&server.watcher);
+  path_resolver_init(&server.resolver, &server.fs);
+  dep_graph_init(&server.deps, &server.fs, &server.resolver);
+
+  server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (server.epoll_fd < 0) {
+    fprintf(stderr, "language_server_loop: unable to make an epoll instance: %s\n", strerror(errno));
+    return 1;
+  }
+  server_poll_add(&server, file_watcher_fd(&server.watcher), SERVER_EVENT_WATCHER, 0);
+
+  server.num_threads = options->num_threads;
+  if (completion_queue_init(&server.completions)) {
+    server.pooled = thread_pool_init(&server.pool, server.num_threads);
+    server_poll_add(&server, completion_queue_fd(&server.completions), SERVER_EVENT_COMPLETION, 0);
+  }
 
+  int fd = -1;
+  FILE *fin = stdin, *fout = stdout;
+  switch (options->transport) {
+  case LS_TRANSPORT_LISTEN:
+    server.listen_fd = transport_listen(options->socket_path);
+    if (server.listen_fd < 0) {
+      return 1;
+    }
+    server_poll_add(&server, server.listen_fd, SERVER_EVENT_LISTEN, 0);
+    fprintf(stderr, "listening on %s\n", options->socket_path);
+    break;
+  case LS_TRANSPORT_PIPE:
+    fd = transport_connect(options->socket_path);
+    if (fd < 0 || !transport_open(fd, &fin, &fout)) {
+      return 1;
+    }
+    // fall through
+  case LS_TRANSPORT_STDIO:
+    if (server_client_add(&server, fd, fin, fout) == NULL) {
+      return 1;
+    }
+    break;
+  }
+  if (options->parent_process_id > 0 && server.clients != NULL
+      && !server_watch_parent(&server, server.clients, options->parent_process_id)) {
+    fprintf(stderr, "language_server_loop: process %d is gone\n", options->parent_process_id);
+    return 1;
+  }
+
+  language_client_t *client = server.clients;
+  if (client != NULL && !client->reading) {
+    // read and evaluate in turn, then
+    server.client = client;
+    while (!client->exited && json_rpc_server_step(client->fin, client->fout, &language_server_json_rpc_evaluate, &server)) {
+      server_crawl_step(&server);
+      server_watch_step(&server);
+      file_system_compress_idle(&server.fs);
+    }
+    return client->shutdown_requested ? 0 : 1;
+  }
+
+  int retcode = 0;
   while (1) {
-    int cont = json_rpc_server_step(fd, fout, &language_server_json_rpc_evaluate, &server);
-    if (!cont) {
+    // a message of each client in turn: none is held up by another sending many
+    int progress = 0;
+    client = server.clients;
+    while (client != NULL) {
+      language_client_t *next = client->next;
+      // the reader parses the next messages while these are evaluated
+      server_take_input(client);
+      if (!client->exited) {
+        progress |= server_client_step(&server, client);
+      }
+      if (server_client_done(client)) {
+        retcode = client->shutdown_requested ? 0 : 1;
+        server_client_remove(&server, client);
+      }
+      client = next;
+    }
+    if (!server.daemon && server.clients == NULL) {
+      break;
+    }
+
+    // wait for the next message, taking over crawl results and changes on disk meanwhile
+    // (and waking up when documents are due to be compressed, unless tasks are in flight:
+    // those wake the loop as they are done)
+    int timeout = file_watcher_timeout(&server.watcher);
+    if (server.in_flight == 0) {
+      timeout = server_timeout_min(timeout, file_system_idle_timeout(&server.fs));
+    }
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    int ret = epoll_wait(server.epoll_fd, events, SERVER_MAX_EVENTS, progress ? 0 : timeout);
+    if (ret < 0 && errno != EINTR) {
+      fprintf(stderr, "language_server_loop: epoll_wait failed: %s\n", strerror(errno));
+      retcode = 1;
       break;
     }
+    for (int i = 0; i < ret; i++) {
+      int client_id = (int)(events[i].data.u64 >> 8);
+      switch ((server_event_t)(events[i].data.u64 & 0xff)) {
+      case SERVER_EVENT_LISTEN:
+        server_accept(&server);
+        break;
+      case SERVER_EVENT_CLIENT:
+        break; // (taken over above)
+      case SERVER_EVENT_PARENT:
+        client = server_client_find(&server, client_id);
+        if (client != NULL) {
+          fprintf(stderr, "client %d: the editor is gone\n", client->id);
+          client->exited = 1;
+        }
+        break;
+      case SERVER_EVENT_CRAWLER:
+        server_crawl_step(&server);
+        break;
+      case SERVER_EVENT_WATCHER:
+        file_watcher_read(&server.watcher);
+        break;
+      case SERVER_EVENT_COMPLETION:
+        server_analysis_drain(&server);
+        break;
+      }
+    }
+    server_watch_step(&server);
+    // idle documents are compressed between messages (and tasks), so no locking is needed
+    if (server.in_flight == 0) {
+      file_system_compress_idle(&server.fs);
+    }
+  }
+
+  while (server.clients != NULL) {
+    server_client_remove(&server, server.clients);
+  }
+  if (server.listen_fd >= 0) {
+    close(server.listen_fd);
+    unlink(options->socket_path);
+  }
+  close(server.epoll_fd);
+  if (server.pooled) {
+    thread_pool_free(&server.pool);
+  }
+  for (size_t i = 0; i < server.mailboxes_capacity; i++) {
+    if (server.mailboxes[i] != NULL) {
+      mailbox_free(server.mailboxes[i]);
+      free(server.mailboxes[i]);
+    }
   }
+  free(server.mailboxes);
+  completion_queue_free(&server.completions);
+  return retcode;
 }
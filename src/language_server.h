@@ -4,13 +4,21 @@
 #include <stdio.h>
 #include "json_rpc.h"
 #include "file_system.h"
+#include "crawler.h"
+#include "file_watcher.h"
+#include "path_resolver.h"
+#include "dep_graph.h"
+#include "json_rpc_reader.h"
+#include "request_queue.h"
+#include "completion_queue.h"
+#include "mailbox.h"
 
 /*
 set of "source files"
 - each source file has
   - version:int
   - document URI (uniquely identifies a file)
-  - open count (should be at most 1: how many times we get 'didOpen'/'didClose' notifications)
+  - open count (how many clients have it open: one per didOpen, until its didClose)
   - text (aka content)
 
 what to do with this set?
@@ -23,12 +31,80 @@ do we also need a mapping from document URIs to file names and back?
 - 
  */
 
-typedef struct language_server_s {
+// consecutive didChange notifications for a document applied at once, at most
+#define LANGUAGE_SERVER_MAX_COALESCED 64
+// crawl results taken over in one step, at most (the rest waits for the next round)
+#define LANGUAGE_SERVER_CRAWL_SLICE 256
+// crawl steps put off in a row while interactive requests are queued, at most
+#define LANGUAGE_SERVER_MAX_CRAWL_DEFERRED 16
+
+// what tells the messages of one connection apart from those of another (the workspace,
+// and the text of the documents, are shared by all)
+typedef struct language_client_s {
+  int   id; // for the log
+  int   fd; // of the connection (negative for the standard input and output)
   FILE *fin;
   FILE *fout;
+  json_rpc_reader_t reader;
+  int   reading; // messages come from [reader] (else, they are read one at a time)
+  request_queue_t requests; // read, not evaluated yet
   int   initialized;
   int   shutdown_requested;
+  int   exited; // (or gone): to be dropped
+  int   next_request_id; // of requests sent to the client
+  int   work_done_progress; // the client takes progress reports started by the server
+  int   watched_files_registration; // the client takes a registration for workspace/didChangeWatchedFiles
+  int   parent_pidfd; // readable once the process of the editor is gone (negative if not watched)
+  path_id_t *documents; // opened by this client
+  size_t num_documents, documents_capacity;
+  struct language_client_s *next;
+} language_client_t;
+
+typedef enum {
+  LS_TRANSPORT_STDIO,
+  LS_TRANSPORT_PIPE, // connect to a socket of the editor
+  LS_TRANSPORT_LISTEN // serve any number of editors on a socket (until killed)
+} language_server_transport_t;
+
+typedef struct language_server_options_s {
+  language_server_transport_t transport;
+  const char *socket_path; // of the pipe, or to listen on
+  int parent_process_id; // to watch from the start (non-positive if none)
+  size_t num_threads; // of the worker pool (zero: one per core)
+  long cold_after; // seconds before the text of an idle document is compressed (0: never; negative: FILE_COLD_AFTER)
+  size_t memory_budget; // bytes of files on disk kept mapped (zero: FILE_MEMORY_BUDGET)
+  size_t max_mappings; // files on disk kept mapped (zero: FILE_MAPPINGS_MAX)
+} language_server_options_t;
+
+typedef struct language_server_s {
+  language_client_t *clients;
+  language_client_t *client; // whose message is being evaluated
+  int   next_client_id;
+  int   daemon; // clients come and go (else, the server is done once its client is)
+  int   epoll_fd;
+  int   listen_fd; // negative if not listening
   file_system_t fs;
+  int   crawling; // the workspace is being crawled
+  int   crawl_percentage; // last reported
+  int   crawl_client; // id of the client the progress is reported to (0 if none)
+  crawler_t crawler;
+  char  root[FILE_URI_MAX]; // of the workspace (empty if none)
+  char  index_path[FILE_URI_MAX]; // where the workspace index is kept (empty if nowhere)
+  workspace_index_t index; // of the last run, while crawling
+  file_watcher_t watcher;
+  path_resolver_t resolver;
+  dep_graph_t deps;
+  int deps_retry; // a file showed up: directives naming nothing may name it now
+  int   watching; // changes on disk are reported by inotify
+  size_t num_threads; // of the worker pools (zero: one per core)
+  thread_pool_t pool; // runs analysis tasks (and read-only requests of batches)
+  int   pooled; // (else, all is evaluated on the main thread)
+  completion_queue_t completions; // analysis tasks done
+  size_t in_flight; // analysis tasks submitted and not taken back yet
+  mailbox_t **mailboxes; // analysis tasks of each document, in order (by path id; made on first use)
+  size_t mailboxes_capacity;
+  int   crawl_deferred; // crawl steps put off in a row, for interactive requests
+  request_class_stats_t retired_stats[REQUEST_NUM_CLASSES]; // of the requests of clients gone
 } language_server_t;
 
 typedef enum {
@@ -41,6 +117,8 @@ typedef struct lsp_initialize_request_params_s {
   int parent_process_id; // negative if unset
   char *root_uri;
   lsp_trace_t trace;
+  int work_done_progress; // from the window capabilities of the client
+  int watched_files_registration; // from the workspace capabilities of the client
 } lsp_initialize_request_params_t;
 
 typedef struct lsp_position_s {
@@ -88,8 +166,12 @@ typedef struct lsp_text_document_change_s {
 } lsp_text_document_change_t;
 
 void server_exit(language_server_t *server);
+// the request being evaluated was cancelled by the client: for handlers that take long
+// to poll now and then (if so, they answer with json_rpc_request_cancelled_error)
+int server_request_cancelled(language_server_t *server);
 
 void language_server_evaluate(language_server_t *ls, json_rpc_request_notification_t *request);
-void language_server_loop();
+// returns the exit code
+int language_server_loop(const language_server_options_t *options);
 
 #endif /* !__LANGUAGE_SERVER_H__ */
@@ -0,0 +1,164 @@
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_HASH_BITS 12
+
+size_t lz_compress_bound(size_t length) {
+  return length + length / 255 + 16;
+}
+
+static unsigned char *lz_put_length(unsigned char *op, size_t length) {
+  while (length >= 255) {
+    *op++ = 255;
+    length -= 255;
+  }
+  *op++ = (unsigned char)length;
+  return op;
+}
+
+static unsigned char *lz_put_sequence(unsigned char *op, const unsigned char *literals, size_t num_literals, size_t offset, size_t match) {
+  size_t lit_nibble = num_literals < 15 ? num_literals : 15;
+  size_t match_nibble = 0;
+
+  if (match > 0) {
+    assert(match >= LZ_MIN_MATCH && offset > 0 && offset <= LZ_MAX_OFFSET);
+    match_nibble = match - LZ_MIN_MATCH < 15 ? match - LZ_MIN_MATCH : 15;
+  }
+  *op++ = (unsigned char)(lit_nibble << 4 | match_nibble);
+  if (lit_nibble == 15) {
+    op = lz_put_length(op, num_literals - 15);
+  }
+  memcpy(op, literals, num_literals);
+  op += num_literals;
+
+  if (match > 0) {
+    *op++ = (unsigned char)(offset & 0xFF);
+    *op++ = (unsigned char)(offset >> 8);
+    if (match_nibble == 15) {
+      op = lz_put_length(op, match - LZ_MIN_MATCH - 15);
+    }
+  }
+  return op;
+}
+
+size_t lz_compress(const char *src, size_t length, char *dst, size_t capacity) {
+  assert(src != NULL || length == 0);
+  assert(dst != NULL);
+
+  if (capacity < lz_compress_bound(length)) {
+    return 0;
+  }
+
+  // positions of the last occurrences of 4-byte sequences (by their hash)
+  size_t table[1 << LZ_HASH_BITS];
+  memset(table, 0, sizeof(table));
+
+  const unsigned char *base = (const unsigned char *)src;
+  const unsigned char *ip = base, *anchor = base, *end = base + length;
+  unsigned char *op = (unsigned char *)dst;
+
+  while (end - ip >= LZ_MIN_MATCH) {
+    uint32_t seq;
+    memcpy(&seq, ip, sizeof(seq));
+    uint32_t hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+
+    const unsigned char *ref = base + table[hash];
+    table[hash] = ip - base;
+
+    if (ref < ip && ip - ref <= LZ_MAX_OFFSET && memcmp(ref, ip, LZ_MIN_MATCH) == 0) {
+      size_t match = LZ_MIN_MATCH;
+      while (ip + match < end && ref[match] == ip[match]) {
+        match++;
+      }
+      op = lz_put_sequence(op, anchor, ip - anchor, ip - ref, match);
+      ip += match;
+      anchor = ip;
+    } else {
+      ip++;
+    }
+  }
+  op = lz_put_sequence(op, anchor, end - anchor, 0, 0);
+
+  return op - (unsigned char *)dst;
+}
+
+static int lz_get_length(const unsigned char **ip, const unsigned char *end, size_t *length) {
+  unsigned char byte;
+
+  do {
+    if (*ip >= end) {
+      return 0;
+    }
+    byte = *(*ip)++;
+    *length += byte;
+  } while (byte == 255);
+  return 1;
+}
+
+int lz_decompress(const char *src, size_t size, char *dst, size_t capacity, size_t *length) {
+  assert(src != NULL);
+  assert(dst != NULL || capacity == 0);
+  assert(length != NULL);
+
+  const unsigned char *ip = (const unsigned char *)src, *end = ip + size;
+  unsigned char *base = (unsigned char *)dst, *op = base, *limit = base + capacity;
+
+  if (size == 0) {
+    return 0; // there is always at least one token
+  }
+  while (1) {
+    if (ip >= end) {
+      return 0;
+    }
+    unsigned token = *ip++;
+
+    size_t num_literals = token >> 4;
+    if (num_literals == 15 && !lz_get_length(&ip, end, &num_literals)) {
+      return 0;
+    }
+    if (num_literals > (size_t)(end - ip) || num_literals > (size_t)(limit - op)) {
+      return 0;
+    }
+    memcpy(op, ip, num_literals);
+    op += num_literals;
+    ip += num_literals;
+
+    if (ip == end) {
+      break; // the last sequence
+    }
+
+    if (end - ip < 2) {
+      return 0;
+    }
+    size_t offset = ip[0] | (size_t)ip[1] << 8;
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - base)) {
+      return 0;
+    }
+    size_t match = token & 15;
+    if (match == 15 && !lz_get_length(&ip, end, &match)) {
+      return 0;
+    }
+    match += LZ_MIN_MATCH;
+    if (match > (size_t)(limit - op)) {
+      return 0;
+    }
+
+    const unsigned char *ref = op - offset;
+    if (offset >= match) {
+      memcpy(op, ref, match);
+      op += match;
+    } else {
+      // overlapping: repeats the last [offset] bytes
+      while (match-- > 0) {
+        *op++ = *ref++;
+      }
+    }
+  }
+
+  *length = op - base;
+  return 1;
+}
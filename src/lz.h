@@ -0,0 +1,29 @@
+#ifndef __LZ_H__
+#define __LZ_H__
+
+#include <stddef.h>
+
+// a small LZ77 codec in the spirit of LZ4: fast rather than tight.
+//
+// the compressed block is a sequence of
+//   token: literal count (high nibble), match length - 4 (low nibble)
+//   [255...] extension of the literal count, if its nibble is 15
+//   literals
+//   offset of the match: two bytes, little-endian (absent in the last sequence)
+//   [255...] extension of the match length, if its nibble is 15
+// the last sequence has only literals, and ends the block.
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+// how much room compressing [length] bytes may take at most
+size_t lz_compress_bound(size_t length);
+
+// returns the size of the compressed block, or 0 if [capacity] is below lz_compress_bound
+size_t lz_compress(const char *src, size_t length, char *dst, size_t capacity);
+
+// returns non-zero if the block is well-formed and its text fits into [capacity];
+// [length] receives the size of the text
+int lz_decompress(const char *src, size_t size, char *dst, size_t capacity, size_t *length);
+
+#endif /* !__LZ_H__ */
@@ -0,0 +1,111 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mailbox.h"
+
+void mailbox_init(mailbox_t *mailbox, thread_pool_t *pool) {
+  assert(mailbox != NULL);
+  assert(pool != NULL);
+
+  memset(mailbox, 0, sizeof(*mailbox));
+  mailbox->pool = pool;
+  pthread_mutex_init(&mailbox->lock, NULL);
+  pthread_cond_init(&mailbox->idle, NULL);
+}
+
+void mailbox_free(mailbox_t *mailbox) {
+  assert(mailbox != NULL);
+
+  mailbox_wait(mailbox);
+  assert(mailbox->head == NULL && !mailbox->scheduled);
+  pthread_cond_destroy(&mailbox->idle);
+  pthread_mutex_destroy(&mailbox->lock);
+}
+
+static void mailbox_run(void *arg) {
+  mailbox_t *mailbox = (mailbox_t *)arg;
+
+  pthread_mutex_lock(&mailbox->lock);
+  for (int i = 0; i < MAILBOX_MAX_BATCH && mailbox->head != NULL; i++) {
+    mailbox_job_t *job = mailbox->head;
+    mailbox->head = job->next;
+    if (mailbox->head == NULL) {
+      mailbox->tail = NULL;
+    }
+    pthread_mutex_unlock(&mailbox->lock);
+
+    job->task(job->arg);
+    free(job);
+
+    pthread_mutex_lock(&mailbox->lock);
+    mailbox->pending--;
+  }
+
+  // more to do: make way for the others first (if the runner can not be submitted
+  // again, it goes on here)
+  if (mailbox->head != NULL) {
+    pthread_mutex_unlock(&mailbox->lock);
+    if (!thread_pool_submit(mailbox->pool, mailbox_run, mailbox)) {
+      mailbox_run(mailbox);
+    }
+    return; // (still scheduled)
+  }
+  mailbox->scheduled = 0;
+  if (mailbox->pending == 0) {
+    pthread_cond_broadcast(&mailbox->idle);
+  }
+  // (nothing touches the mailbox after this: it may be freed right away)
+  pthread_mutex_unlock(&mailbox->lock);
+}
+
+int mailbox_post(mailbox_t *mailbox, thread_pool_task_t task, void *arg) {
+  assert(mailbox != NULL);
+  assert(task != NULL);
+
+  mailbox_job_t *job = malloc(sizeof(mailbox_job_t));
+  if (job == NULL) {
+    fprintf(stderr, "mailbox_post: out of memory\n");
+    return 0;
+  }
+  job->task = task;
+  job->arg = arg;
+  job->next = NULL;
+
+  pthread_mutex_lock(&mailbox->lock);
+  if (mailbox->tail != NULL) {
+    mailbox->tail->next = job;
+  } else {
+    mailbox->head = job;
+  }
+  mailbox->tail = job;
+  mailbox->pending++;
+  int schedule = !mailbox->scheduled;
+  mailbox->scheduled = 1;
+  pthread_mutex_unlock(&mailbox->lock);
+
+  if (schedule && !thread_pool_submit(mailbox->pool, mailbox_run, mailbox)) {
+    mailbox_run(mailbox); // no room on the pool: run here, then
+  }
+  return 1;
+}
+
+void mailbox_wait(mailbox_t *mailbox) {
+  assert(mailbox != NULL);
+
+  pthread_mutex_lock(&mailbox->lock);
+  while (mailbox->pending > 0) {
+    pthread_cond_wait(&mailbox->idle, &mailbox->lock);
+  }
+  pthread_mutex_unlock(&mailbox->lock);
+}
+
+size_t mailbox_pending(mailbox_t *mailbox) {
+  assert(mailbox != NULL);
+
+  pthread_mutex_lock(&mailbox->lock);
+  size_t pending = mailbox->pending;
+  pthread_mutex_unlock(&mailbox->lock);
+  return pending;
+}
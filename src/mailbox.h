@@ -0,0 +1,42 @@
+#ifndef __MAILBOX_H__
+#define __MAILBOX_H__
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "thread_pool.h"
+
+// a serial executor on top of a thread pool: the jobs posted to one mailbox run one
+// at a time, in the order posted, while those of other mailboxes run at the same time.
+// a mailbox with jobs has a single runner on the pool; it runs a few jobs, and goes
+// back to the pool (behind the others) if there are more.
+
+typedef struct mailbox_job_s {
+  thread_pool_task_t task;
+  void *arg;
+  struct mailbox_job_s *next;
+} mailbox_job_t;
+
+// jobs run before the runner makes way for others
+#define MAILBOX_MAX_BATCH 8
+
+typedef struct mailbox_s {
+  thread_pool_t *pool;
+  pthread_mutex_t lock;
+  pthread_cond_t idle; // signalled when the last job is done
+  mailbox_job_t *head, *tail;
+  size_t pending; // jobs posted and not done
+  int scheduled; // the runner is on the pool
+} mailbox_t;
+
+void mailbox_init(mailbox_t *mailbox, thread_pool_t *pool);
+// waits for the jobs posted
+void mailbox_free(mailbox_t *mailbox);
+
+// returns zero if out of memory
+int mailbox_post(mailbox_t *mailbox, thread_pool_task_t task, void *arg);
+// block until no job is queued or running
+void mailbox_wait(mailbox_t *mailbox);
+size_t mailbox_pending(mailbox_t *mailbox);
+
+#endif /* !__MAILBOX_H__ */
@@ -0,0 +1,280 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "path_resolver.h"
+#include "xxhash64.h"
+
+static const char *path_resolver_home_names[PATH_RESOLVER_NUM_HOMES] = {"PATSHOME", "XATSHOME"};
+
+static long path_resolver_elapsed_ms(const struct timespec *since, const struct timespec *now) {
+  return (now->tv_sec - since->tv_sec) * 1000 + (now->tv_nsec - since->tv_nsec) / 1000000;
+}
+
+void path_resolver_init(path_resolver_t *resolver, file_system_t *fs) {
+  assert(resolver != NULL);
+  assert(fs != NULL);
+
+  memset(resolver, 0, sizeof(*resolver));
+  resolver->fs = fs;
+  resolver->watched_root = PATH_ID_NONE;
+
+  char home[FILE_URI_MAX];
+  for (int i = 0; i < PATH_RESOLVER_NUM_HOMES; i++) {
+    const char *value = getenv(path_resolver_home_names[i]);
+    if (value == NULL) {
+      continue;
+    }
+    size_t length = path_canonicalize(value, strlen(value), home, sizeof(home));
+    if (length == 0) {
+      fprintf(stderr, "path_resolver_init: $%s is not an absolute path, ignored\n", path_resolver_home_names[i]);
+      continue;
+    }
+    resolver->homes[i] = strdup(home); // TODO: handle failure
+  }
+}
+
+void path_resolver_free(path_resolver_t *resolver) {
+  assert(resolver != NULL);
+
+  free(resolver->stats);
+  for (int i = 0; i < PATH_RESOLVER_NUM_HOMES; i++) {
+    free(resolver->homes[i]);
+  }
+  memset(resolver, 0, sizeof(*resolver));
+  resolver->watched_root = PATH_ID_NONE;
+}
+
+/* ****** ****** */
+
+static path_stat_t *path_resolver_entry(path_resolver_t *resolver, path_id_t id) {
+  if (id >= resolver->stats_capacity) {
+    size_t capacity = resolver->stats_capacity > 0 ? resolver->stats_capacity : PATH_RESOLVER_MIN_CAPACITY;
+    while (capacity <= id) {
+      capacity *= 2;
+    }
+    path_stat_t *stats = realloc(resolver->stats, capacity * sizeof(path_stat_t));
+    if (stats == NULL) {
+      fprintf(stderr, "path_resolver_stat: out of memory\n");
+      return NULL;
+    }
+    memset(stats + resolver->stats_capacity, 0, (capacity - resolver->stats_capacity) * sizeof(path_stat_t));
+    resolver->stats = stats;
+    resolver->stats_capacity = capacity;
+  }
+  return &resolver->stats[id];
+}
+
+static int path_resolver_watched(path_resolver_t *resolver, path_id_t id) {
+  if (resolver->watched_root == PATH_ID_NONE) {
+    return 0;
+  }
+  for (; id != PATH_ID_NONE; id = path_table_parent(&resolver->fs->paths, id)) {
+    if (id == resolver->watched_root) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// same as above, for a path that is not interned
+static int path_resolver_watched_path(path_resolver_t *resolver, const char *path, size_t length) {
+  char root[FILE_URI_MAX];
+  size_t root_length = resolver->watched_root != PATH_ID_NONE
+    ? path_table_get(&resolver->fs->paths, resolver->watched_root, root, sizeof(root)) : 0;
+  return root_length > 0 && root_length < length && !memcmp(path, root, root_length)
+    && (path[root_length] == '/' || root[root_length - 1] == '/');
+}
+
+const path_stat_t *path_resolver_stat(path_resolver_t *resolver, path_id_t id) {
+  assert(resolver != NULL);
+  assert(id != PATH_ID_NONE);
+
+  path_stat_t *entry = path_resolver_entry(resolver, id);
+  if (entry == NULL) {
+    return NULL;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (entry->known && (path_resolver_elapsed_ms(&entry->checked, &now) < PATH_RESOLVER_TTL_MS
+                       || path_resolver_watched(resolver, id))) {
+    resolver->hits++;
+    return entry;
+  }
+
+  char path[FILE_URI_MAX];
+  struct stat st;
+  resolver->stat_calls++;
+  entry->known = 1;
+  entry->checked = now;
+  if (path_table_get(&resolver->fs->paths, id, path, sizeof(path)) > 0
+      && stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+    entry->exists = 1;
+    entry->length = st.st_size;
+    entry->mtime = st.st_mtim;
+  } else {
+    entry->exists = 0;
+    entry->length = 0;
+    memset(&entry->mtime, 0, sizeof(entry->mtime));
+  }
+  return entry;
+}
+
+// (never zero: that marks an unused entry)
+static uint64_t path_resolver_hash(const char *path, size_t length) {
+  uint64_t hash = xxh64(path, length, 0);
+  return hash != 0 ? hash : 1;
+}
+
+// the entry of the path in its set, or else the one to take for it (unused, or the oldest)
+static path_miss_t *path_resolver_miss(path_resolver_t *resolver, uint64_t hash) {
+  path_miss_t *set = &resolver->misses[(hash & (PATH_RESOLVER_MISSES / PATH_RESOLVER_MISS_WAYS - 1)) * PATH_RESOLVER_MISS_WAYS];
+  path_miss_t *oldest = &set[0];
+  for (int i = 0; i < PATH_RESOLVER_MISS_WAYS; i++) {
+    if (set[i].hash == hash) {
+      return &set[i];
+    }
+    if (oldest->hash != 0 && (set[i].hash == 0 || path_resolver_elapsed_ms(&set[i].checked, &oldest->checked) > 0)) {
+      oldest = &set[i];
+    }
+  }
+  return oldest;
+}
+
+void path_resolver_invalidate(path_resolver_t *resolver, const char *path, size_t length) {
+  assert(resolver != NULL);
+  assert(path != NULL);
+
+  // never interned: stat'ed as a miss, if at all
+  path_id_t id = path_table_find(&resolver->fs->paths, path, length);
+  if (id != PATH_ID_NONE && id < resolver->stats_capacity) {
+    resolver->stats[id].known = 0;
+  }
+  uint64_t hash = path_resolver_hash(path, length);
+  path_miss_t *miss = path_resolver_miss(resolver, hash);
+  if (miss->hash == hash) {
+    miss->hash = 0;
+  }
+}
+
+void path_resolver_invalidate_all(path_resolver_t *resolver) {
+  assert(resolver != NULL);
+
+  for (size_t i = 0; i < resolver->stats_capacity; i++) {
+    resolver->stats[i].known = 0;
+  }
+  memset(resolver->misses, 0, sizeof(resolver->misses));
+}
+
+/* ****** ****** */
+
+// [name] (relative) in [dir], if there is such a file
+static path_id_t path_resolver_try(path_resolver_t *resolver, const char *dir, size_t dir_length, const char *name, size_t length) {
+  char joined[FILE_URI_MAX];
+  char canonical[FILE_URI_MAX];
+
+  if (dir_length + 1 + length + 1 > sizeof(joined)) {
+    return PATH_ID_NONE;
+  }
+  memcpy(joined, dir, dir_length);
+  joined[dir_length] = '/';
+  memcpy(joined + dir_length + 1, name, length);
+  size_t canonical_length = path_canonicalize(joined, dir_length + 1 + length, canonical, sizeof(canonical));
+  if (canonical_length == 0) {
+    return PATH_ID_NONE;
+  }
+
+  path_id_t id = path_table_find(&resolver->fs->paths, canonical, canonical_length);
+  if (id != PATH_ID_NONE) {
+    // the client may have it open without it being on disk (yet)
+    file_t *file = file_system_find(resolver->fs, id);
+    if (file != NULL && file->open_count > 0) {
+      return id;
+    }
+    const path_stat_t *st = path_resolver_stat(resolver, id);
+    return st != NULL && st->exists ? id : PATH_ID_NONE;
+  }
+
+  // never seen: interned only if it is a file
+  uint64_t hash = path_resolver_hash(canonical, canonical_length);
+  path_miss_t *miss = path_resolver_miss(resolver, hash);
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (miss->hash == hash && (path_resolver_elapsed_ms(&miss->checked, &now) < PATH_RESOLVER_TTL_MS
+                             || path_resolver_watched_path(resolver, canonical, canonical_length))) {
+    resolver->hits++;
+    return PATH_ID_NONE;
+  }
+  struct stat st;
+  resolver->stat_calls++;
+  if (stat(canonical, &st) != 0 || !S_ISREG(st.st_mode)) {
+    miss->hash = hash;
+    miss->checked = now;
+    return PATH_ID_NONE;
+  }
+  if (miss->hash == hash) {
+    miss->hash = 0;
+  }
+  id = path_table_intern(&resolver->fs->paths, canonical, canonical_length);
+  path_stat_t *entry = id != PATH_ID_NONE ? path_resolver_entry(resolver, id) : NULL;
+  if (entry == NULL) {
+    return PATH_ID_NONE;
+  }
+  entry->known = 1;
+  entry->checked = now;
+  entry->exists = 1;
+  entry->length = st.st_size;
+  entry->mtime = st.st_mtim;
+  return id;
+}
+
+static path_id_t path_resolver_try_home(path_resolver_t *resolver, int home, const char *name, size_t length) {
+  const char *dir = resolver->homes[home];
+  if (dir == NULL) {
+    return PATH_ID_NONE;
+  }
+  return path_resolver_try(resolver, dir, strlen(dir), name, length);
+}
+
+path_id_t path_resolve(path_resolver_t *resolver, path_id_t from, const char *spec, size_t length) {
+  assert(resolver != NULL);
+  assert(spec != NULL);
+
+  if (length == 0) {
+    return PATH_ID_NONE;
+  }
+  if (spec[0] == '/') {
+    return path_resolver_try(resolver, "", 0, spec, length);
+  }
+  if (spec[0] == '$') {
+    for (int i = 0; i < PATH_RESOLVER_NUM_HOMES; i++) {
+      size_t name_length = strlen(path_resolver_home_names[i]);
+      if (length > 1 + name_length && !memcmp(spec + 1, path_resolver_home_names[i], name_length) && spec[1 + name_length] == '/') {
+        return path_resolver_try_home(resolver, i, spec + 1 + name_length, length - 1 - name_length);
+      }
+    }
+    return PATH_ID_NONE; // some other variable
+  }
+
+  path_id_t id = PATH_ID_NONE;
+  path_id_t parent = from != PATH_ID_NONE ? path_table_parent(&resolver->fs->paths, from) : PATH_ID_NONE;
+  if (parent != PATH_ID_NONE) {
+    char dir[FILE_URI_MAX];
+    size_t dir_length = path_table_get(&resolver->fs->paths, parent, dir, sizeof(dir));
+    if (dir_length > 0) {
+      id = path_resolver_try(resolver, dir, dir_length, spec, length);
+    }
+  }
+  for (int i = 0; i < PATH_RESOLVER_NUM_HOMES && id == PATH_ID_NONE; i++) {
+    id = path_resolver_try_home(resolver, i, spec, length);
+  }
+  return id;
+}
+
+file_t *path_resolve_file(path_resolver_t *resolver, path_id_t from, const char *spec, size_t length) {
+  assert(resolver != NULL);
+
+  return file_system_find(resolver->fs, path_resolve(resolver, from, spec, length));
+}
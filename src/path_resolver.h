@@ -0,0 +1,73 @@
+#ifndef __PATH_RESOLVER_H__
+#define __PATH_RESOLVER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "file_system.h"
+
+// finds the files named by #staload, #include and #dynload directives:
+// - "/abs/name.sats" is taken as is
+// - "$PATSHOME/name.sats" and "$XATSHOME/name.sats" are relative to those homes
+// - anything else is relative to the directory of the file naming it, and failing
+//   that, to $PATSHOME, then $XATSHOME
+// candidates are canonicalized (lexically, see path_canonicalize). only those that
+// exist are interned in the path table of the file system (which never shrinks): what
+// stat said about each is cached by path id. those that do not (misses in the homes,
+// half-typed names) are remembered in a small table by the hash of their path. either
+// is trusted:
+// - below [watched_root], until the file watcher reports a change to that path
+// - elsewhere for PATH_RESOLVER_TTL_MS, then it is checked again
+
+#define PATH_RESOLVER_TTL_MS 2000
+#define PATH_RESOLVER_MIN_CAPACITY 64
+#define PATH_RESOLVER_NUM_HOMES 2
+#define PATH_RESOLVER_MISSES 256 // in sets by hash
+#define PATH_RESOLVER_MISS_WAYS 4 // (more than the candidates of a name: they never take each other's entry)
+
+typedef struct path_stat_s {
+  int             known; // stat'ed (and not invalidated since)
+  int             exists; // as a regular file
+  size_t          length;
+  struct timespec mtime;
+  struct timespec checked; // monotonic time of the stat
+} path_stat_t;
+
+// a path found not to be a file, without interning it
+typedef struct path_miss_s {
+  uint64_t        hash; // of the path (0 if unused)
+  struct timespec checked; // monotonic time of the stat
+} path_miss_t;
+
+typedef struct path_resolver_s {
+  file_system_t *fs;
+  path_stat_t *stats; // by path id
+  size_t stats_capacity;
+  char *homes[PATH_RESOLVER_NUM_HOMES]; // $PATSHOME, $XATSHOME, canonicalized (NULL if unset)
+  path_id_t watched_root; // changes on disk below are reported (PATH_ID_NONE: nowhere)
+  path_miss_t misses[PATH_RESOLVER_MISSES];
+
+  size_t stat_calls;
+  size_t hits; // stat results taken from the cache
+} path_resolver_t;
+
+// the homes are read from the environment once, here
+void path_resolver_init(path_resolver_t *resolver, file_system_t *fs);
+void path_resolver_free(path_resolver_t *resolver);
+
+// what is known of the path (from the cache if still valid); NULL if out of memory
+const path_stat_t *path_resolver_stat(path_resolver_t *resolver, path_id_t id);
+// the path changed on disk (created, written, moved or deleted)
+void path_resolver_invalidate(path_resolver_t *resolver, const char *path, size_t length);
+// changes were lost: nothing cached can be trusted
+void path_resolver_invalidate_all(path_resolver_t *resolver);
+
+// the path named by [spec] (not NUL-terminated) in the file at [from] (PATH_ID_NONE if
+// none, e.g. a buffer of the client): a file on disk, or one the client has open.
+// returns PATH_ID_NONE if there is no such file
+path_id_t path_resolve(path_resolver_t *resolver, path_id_t from, const char *spec, size_t length);
+// same as above, but the file must be known to the file system already
+file_t *path_resolve_file(path_resolver_t *resolver, path_id_t from, const char *spec, size_t length);
+
+#endif /* !__PATH_RESOLVER_H__ */
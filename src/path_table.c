@@ -0,0 +1,278 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "path_table.h"
+#include "xxhash64.h"
+
+#define PATH_TABLE_MIN_CAPACITY 64
+
+static int is_path_id(path_table_t *pt, path_id_t id) {
+  return id < pt->num_nodes;
+}
+
+static uint64_t path_child_hash(path_table_t *pt, path_id_t parent, const char *name, size_t length) {
+  return xxh64(name, length, pt->nodes[parent].path_hash);
+}
+
+int path_table_init(path_table_t *pt) {
+  assert(pt != NULL);
+
+  memset(pt, 0, sizeof(*pt));
+  pt->nodes = malloc(PATH_TABLE_MIN_CAPACITY * sizeof(path_node_t));
+  pt->children = malloc(PATH_TABLE_MIN_CAPACITY * sizeof(path_id_t));
+  if (pt->nodes == NULL || pt->children == NULL) {
+    fprintf(stderr, "path_table_init: out of memory\n");
+    free(pt->nodes);
+    free(pt->children);
+    memset(pt, 0, sizeof(*pt));
+    return 0;
+  }
+  pt->nodes_capacity = PATH_TABLE_MIN_CAPACITY;
+  pt->children_capacity = PATH_TABLE_MIN_CAPACITY;
+  memset(pt->children, 0xFF, PATH_TABLE_MIN_CAPACITY * sizeof(path_id_t));
+
+  // the root
+  path_node_t *root = &pt->nodes[PATH_ID_ROOT];
+  root->parent = PATH_ID_NONE;
+  root->name_offset = 0;
+  root->name_length = 0;
+  root->path_length = 1;
+  root->path_hash = xxh64("/", 1, 0);
+  pt->num_nodes = 1;
+
+  return 1;
+}
+
+void path_table_free(path_table_t *pt) {
+  assert(pt != NULL);
+
+  free(pt->nodes);
+  free(pt->names);
+  free(pt->children);
+  memset(pt, 0, sizeof(*pt));
+}
+
+// the slot of the child (or the empty slot where it would go)
+static path_id_t *path_table_child_slot(path_table_t *pt, path_id_t parent, const char *name, size_t length, uint64_t hash) {
+  size_t mask = pt->children_capacity - 1;
+  size_t index = hash & mask;
+
+  while (1) {
+    path_id_t *slot = &pt->children[index];
+    if (*slot == PATH_ID_NONE) {
+      return slot;
+    }
+    path_node_t *node = &pt->nodes[*slot];
+    if (node->path_hash == hash && node->parent == parent && node->name_length == length
+        && !memcmp(pt->names + node->name_offset, name, length)) {
+      return slot;
+    }
+    index = (index + 1) & mask;
+  }
+}
+
+static int path_table_grow_children(path_table_t *pt) {
+  size_t capacity = pt->children_capacity * 2;
+  path_id_t *children = malloc(capacity * sizeof(path_id_t));
+  if (children == NULL) {
+    return 0;
+  }
+  memset(children, 0xFF, capacity * sizeof(path_id_t));
+
+  // every node but the root is somebody's child
+  for (path_id_t id = 1; id < pt->num_nodes; id++) {
+    size_t index = pt->nodes[id].path_hash & (capacity - 1);
+    while (children[index] != PATH_ID_NONE) {
+      index = (index + 1) & (capacity - 1);
+    }
+    children[index] = id;
+  }
+  free(pt->children);
+  pt->children = children;
+  pt->children_capacity = capacity;
+  return 1;
+}
+
+static path_id_t path_table_add_child(path_table_t *pt, path_id_t parent, const char *name, size_t length, uint64_t hash) {
+  // keep the children map at most half full
+  if ((pt->num_nodes + 1) * 2 > pt->children_capacity && !path_table_grow_children(pt)) {
+    return PATH_ID_NONE;
+  }
+  if (pt->num_nodes == pt->nodes_capacity) {
+    path_node_t *nodes = realloc(pt->nodes, pt->nodes_capacity * 2 * sizeof(path_node_t));
+    if (nodes == NULL) {
+      return PATH_ID_NONE;
+    }
+    pt->nodes = nodes;
+    pt->nodes_capacity *= 2;
+  }
+  if (pt->names_length + length > pt->names_capacity) {
+    size_t capacity = pt->names_capacity > 0 ? pt->names_capacity : 1024;
+    while (pt->names_length + length > capacity) {
+      capacity *= 2;
+    }
+    char *names = realloc(pt->names, capacity);
+    if (names == NULL) {
+      return PATH_ID_NONE;
+    }
+    pt->names = names;
+    pt->names_capacity = capacity;
+  }
+
+  path_id_t id = pt->num_nodes++;
+  path_node_t *node = &pt->nodes[id];
+  node->parent = parent;
+  node->name_offset = pt->names_length;
+  node->name_length = length;
+  // "/" + "name", or "/dir" + "/" + "name"
+  node->path_length = (parent == PATH_ID_ROOT ? 0 : pt->nodes[parent].path_length) + 1 + length;
+  node->path_hash = hash;
+  memcpy(pt->names + pt->names_length, name, length);
+  pt->names_length += length;
+
+  *path_table_child_slot(pt, parent, name, length, hash) = id;
+  return id;
+}
+
+static path_id_t path_table_walk(path_table_t *pt, const char *path, size_t length, int intern) {
+  assert(pt != NULL);
+  assert(path != NULL);
+
+  if (length == 0 || path[0] != '/') {
+    return PATH_ID_NONE;
+  }
+
+  path_id_t id = PATH_ID_ROOT;
+  const char *end = path + length;
+  const char *name = path;
+
+  while (name < end) {
+    // the next component
+    while (name < end && *name == '/') {
+      name++;
+    }
+    const char *name_end = name;
+    while (name_end < end && *name_end != '/') {
+      name_end++;
+    }
+    if (name == name_end) {
+      break;
+    }
+
+    size_t name_length = name_end - name;
+    uint64_t hash = path_child_hash(pt, id, name, name_length);
+    path_id_t child = *path_table_child_slot(pt, id, name, name_length, hash);
+    if (child == PATH_ID_NONE) {
+      if (!intern) {
+        return PATH_ID_NONE;
+      }
+      child = path_table_add_child(pt, id, name, name_length, hash);
+      if (child == PATH_ID_NONE) {
+        fprintf(stderr, "path_table_intern: out of memory\n");
+        return PATH_ID_NONE;
+      }
+    }
+    id = child;
+    name = name_end;
+  }
+  return id;
+}
+
+path_id_t path_table_intern(path_table_t *pt, const char *path, size_t length) {
+  return path_table_walk(pt, path, length, 1);
+}
+
+path_id_t path_table_find(path_table_t *pt, const char *path, size_t length) {
+  return path_table_walk(pt, path, length, 0);
+}
+
+path_id_t path_table_parent(path_table_t *pt, path_id_t id) {
+  assert(is_path_id(pt, id));
+  return pt->nodes[id].parent;
+}
+
+size_t path_table_length(path_table_t *pt, path_id_t id) {
+  assert(is_path_id(pt, id));
+  return pt->nodes[id].path_length;
+}
+
+uint64_t path_table_hash(path_table_t *pt, path_id_t id) {
+  assert(is_path_id(pt, id));
+  return pt->nodes[id].path_hash;
+}
+
+size_t path_table_get(path_table_t *pt, path_id_t id, char *buffer, size_t size) {
+  assert(is_path_id(pt, id));
+  assert(buffer != NULL);
+
+  size_t length = pt->nodes[id].path_length;
+  if (length + 1 > size) {
+    return 0;
+  }
+
+  // fill in from the back
+  buffer[length] = '\0';
+  if (id == PATH_ID_ROOT) {
+    buffer[0] = '/';
+    return length;
+  }
+  char *p = buffer + length;
+  while (id != PATH_ID_ROOT) {
+    path_node_t *node = &pt->nodes[id];
+    p -= node->name_length;
+    memcpy(p, pt->names + node->name_offset, node->name_length);
+    *--p = '/';
+    id = node->parent;
+  }
+  assert(p == buffer);
+  return length;
+}
+
+/* ****** ****** */
+
+size_t path_canonicalize(const char *path, size_t length, char *buffer, size_t size) {
+  assert(path != NULL);
+  assert(buffer != NULL);
+
+  if (length == 0 || path[0] != '/' || size < 2) {
+    return 0;
+  }
+  size_t used = 0; // without the trailing slash
+  const char *end = path + length;
+  const char *p = path;
+  while (p < end) {
+    while (p < end && *p == '/') {
+      p++;
+    }
+    const char *name = p;
+    while (p < end && *p != '/') {
+      p++;
+    }
+    size_t name_length = p - name;
+    if (name_length == 0 || (name_length == 1 && name[0] == '.')) {
+      continue;
+    }
+    if (name_length == 2 && name[0] == '.' && name[1] == '.') {
+      if (used == 0) {
+        return 0; // above the root
+      }
+      while (buffer[--used] != '/') {
+        // back to the slash before the last component
+      }
+      continue;
+    }
+    if (used + 1 + name_length + 1 > size) {
+      return 0;
+    }
+    buffer[used++] = '/';
+    memcpy(buffer + used, name, name_length);
+    used += name_length;
+  }
+  if (used == 0) {
+    buffer[used++] = '/';
+  }
+  buffer[used] = '\0';
+  return used;
+}
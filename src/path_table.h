@@ -0,0 +1,61 @@
+#ifndef __PATH_TABLE_H__
+#define __PATH_TABLE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// an interner for absolute paths: every path is stored once, as a node pointing to its
+// parent directory plus its last component, so directories are shared by all paths below
+// them. paths are identified by small integer handles, so two interned paths are equal
+// iff their handles are. nothing is ever removed.
+
+typedef uint32_t path_id_t;
+
+#define PATH_ID_ROOT 0          // "/"
+#define PATH_ID_NONE UINT32_MAX // no such path
+
+typedef struct path_node_s {
+  path_id_t parent;
+  uint32_t  name_offset; // of the last component, in the string table
+  uint32_t  name_length;
+  uint32_t  path_length; // of the whole path
+  uint64_t  path_hash;   // of the whole path, chained over the components
+} path_node_t;
+
+typedef struct path_table_s {
+  path_node_t *nodes;
+  size_t num_nodes;
+  size_t nodes_capacity;
+
+  char *names; // string table of components (not NUL-terminated)
+  size_t names_length;
+  size_t names_capacity;
+
+  // (parent, component) -> child, open addressing with linear probing
+  path_id_t *children;
+  size_t children_capacity; // a power of two
+} path_table_t;
+
+int path_table_init(path_table_t *pt);
+void path_table_free(path_table_t *pt);
+
+// the path must be absolute; empty components are ignored (so "/a//b/" is "/a/b").
+// returns PATH_ID_NONE if it is not absolute (or if out of memory)
+path_id_t path_table_intern(path_table_t *pt, const char *path, size_t length);
+// same as above, but never adds anything: PATH_ID_NONE if not interned yet
+path_id_t path_table_find(path_table_t *pt, const char *path, size_t length);
+
+path_id_t path_table_parent(path_table_t *pt, path_id_t id);
+size_t path_table_length(path_table_t *pt, path_id_t id);
+uint64_t path_table_hash(path_table_t *pt, path_id_t id);
+
+// write out the path, NUL-terminated; returns its length, or zero if it does not fit
+size_t path_table_get(path_table_t *pt, path_id_t id, char *buffer, size_t size);
+
+// write out [path] with empty and "." components dropped, and each ".." component
+// dropping the one before it. this is lexical only: symbolic links are not followed,
+// so "a/link/.." is taken to be "a" (whatever the link points to). returns the length,
+// or zero if the path is not absolute, goes above the root, or does not fit
+size_t path_canonicalize(const char *path, size_t length, char *buffer, size_t size);
+
+#endif /* !__PATH_TABLE_H__ */
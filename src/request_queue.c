@@ -0,0 +1,322 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "request_queue.h"
+#include "xxhash64.h"
+
+#define REQUEST_QUEUE_MIN_BUCKETS 16
+
+void request_queue_init(request_queue_t *queue, request_queue_classify_t classify) {
+  assert(queue != NULL);
+  memset(queue, 0, sizeof(*queue));
+  queue->classify = classify;
+}
+
+void queued_message_free(queued_message_t *queued) {
+  if (queued == NULL) {
+    return;
+  }
+  json_rpc_message_free(queued->message);
+  free(queued);
+}
+
+void request_queue_free(request_queue_t *queue) {
+  assert(queue != NULL);
+
+  queued_message_t *queued = queue->head;
+  while (queued != NULL) {
+    queued_message_t *next = queued->next;
+    queued_message_free(queued);
+    queued = next;
+  }
+  // the current one belongs to whoever is evaluating it
+  free(queue->buckets);
+  request_queue_classify_t classify = queue->classify;
+  memset(queue, 0, sizeof(*queue));
+  queue->classify = classify;
+}
+
+size_t request_queue_id_key(struct json_value_s *id, char *buffer, size_t size) {
+  assert(buffer != NULL);
+
+  struct json_number_s *number = json_value_as_number(id);
+  struct json_string_s *string = json_value_as_string(id);
+  // numbers and strings are told apart by the quote
+  if (number != NULL && number->number_size > 0 && number->number_size < size) {
+    memcpy(buffer, number->number, number->number_size);
+    return number->number_size;
+  } else if (string != NULL && string->string_size + 1 < size) {
+    buffer[0] = '"';
+    memcpy(buffer + 1, string->string, string->string_size);
+    return string->string_size + 1;
+  }
+  return 0;
+}
+
+static uint64_t request_queue_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* ****** ****** */
+
+static queued_message_t **request_queue_bucket(request_queue_t *queue, const char *id, size_t length) {
+  return &queue->buckets[xxh64(id, length, 0) & (queue->num_buckets - 1)];
+}
+
+static int request_queue_grow(request_queue_t *queue) {
+  size_t num_buckets = queue->num_buckets == 0 ? REQUEST_QUEUE_MIN_BUCKETS : 2 * queue->num_buckets;
+  queued_message_t **buckets = calloc(num_buckets, sizeof(queued_message_t *));
+  if (buckets == NULL) {
+    return 0;
+  }
+  queued_message_t **old = queue->buckets;
+  size_t old_size = queue->num_buckets;
+  queue->buckets = buckets;
+  queue->num_buckets = num_buckets;
+  for (size_t i = 0; i < old_size; i++) {
+    queued_message_t *queued = old[i];
+    while (queued != NULL) {
+      queued_message_t *chain = queued->chain;
+      queued_message_t **bucket = request_queue_bucket(queue, queued->id, queued->id_length);
+      queued->chain = *bucket;
+      *bucket = queued;
+      queued = chain;
+    }
+  }
+  free(old);
+  return 1;
+}
+
+static queued_message_t *request_queue_find(request_queue_t *queue, const char *id, size_t length) {
+  if (queue->num_buckets == 0) {
+    return NULL;
+  }
+  queued_message_t *queued = *request_queue_bucket(queue, id, length);
+  while (queued != NULL && (queued->id_length != length || memcmp(queued->id, id, length))) {
+    queued = queued->chain;
+  }
+  return queued;
+}
+
+static void request_queue_forget(request_queue_t *queue, queued_message_t *queued) {
+  if (queued->id_length == 0) {
+    return;
+  }
+  queued_message_t **link = request_queue_bucket(queue, queued->id, queued->id_length);
+  while (*link != NULL && *link != queued) {
+    link = &(*link)->chain;
+  }
+  if (*link == queued) {
+    *link = queued->chain;
+    queue->num_pending--;
+  }
+  queued->chain = NULL;
+}
+
+static void request_queue_unlink(request_queue_t *queue, queued_message_t *queued) {
+  if (queued->prev != NULL) {
+    queued->prev->next = queued->next;
+  } else {
+    queue->head = queued->next;
+  }
+  if (queued->next != NULL) {
+    queued->next->prev = queued->prev;
+  } else {
+    queue->tail = queued->prev;
+  }
+  queued->prev = queued->next = NULL;
+  queue->length--;
+  if (queued->request_class != REQUEST_NUM_CLASSES) {
+    queue->stats[queued->request_class].depth--;
+  }
+}
+
+// a $/cancelRequest: returns the request taken out of the queue, if any
+static queued_message_t *request_queue_cancel(request_queue_t *queue, json_rpc_request_notification_t *request) {
+  struct json_value_s *id = json_object_property(json_value_as_object(request->params), "id");
+  char key[REQUEST_QUEUE_ID_MAX];
+  size_t length = request_queue_id_key(id, key, sizeof(key));
+  queued_message_t *queued = length == 0 ? NULL : request_queue_find(queue, key, length);
+  if (queued == NULL) {
+    return NULL; // answered already (or never asked)
+  }
+  if (queued == queue->current || queued->detached) {
+    atomic_store(&queued->cancelled, 1);
+    queue->cancelled_running++;
+    return NULL;
+  }
+  request_queue_forget(queue, queued);
+  request_queue_unlink(queue, queued);
+  atomic_store(&queued->cancelled, 1);
+  queue->cancelled_queued++;
+  return queued;
+}
+
+int request_queue_push(request_queue_t *queue, json_rpc_message_t *message, queued_message_t **cancelled) {
+  assert(queue != NULL);
+  assert(message != NULL);
+  assert(cancelled != NULL);
+
+  *cancelled = NULL;
+  queued_message_t *queued = malloc(sizeof(queued_message_t));
+  if (queued == NULL) {
+    fprintf(stderr, "request_queue_push: out of memory\n");
+    return -1;
+  }
+  memset(queued, 0, sizeof(*queued));
+  queued->message = message;
+  atomic_init(&queued->cancelled, 0);
+  queued->valid = message->root != NULL && !json_rpc_is_response(message->root)
+    && json_rpc_parse_request_notification(message->root, &queued->request);
+  queued->batch = !queued->valid && json_rpc_message_is_batch(message);
+  queued->request_class = REQUEST_NUM_CLASSES;
+
+  if (queued->valid && json_rpc_request_is_notification(&queued->request)
+      && !strcmp(queued->request.method->string, "$/cancelRequest")) {
+    *cancelled = request_queue_cancel(queue, &queued->request);
+    queued_message_free(queued);
+    return 0;
+  }
+
+  if (queued->valid && !json_rpc_request_is_notification(&queued->request)) {
+    queued->id_length = request_queue_id_key(queued->request.id, queued->id, sizeof(queued->id));
+  }
+  // an id in use already is the client's mistake: the later request can not be cancelled
+  if (queued->id_length > 0 && request_queue_find(queue, queued->id, queued->id_length) != NULL) {
+    queued->id_length = 0;
+  }
+  if (queued->id_length > 0 && (queue->num_pending + 1 > 2 * queue->num_buckets) && !request_queue_grow(queue)) {
+    queued->id_length = 0;
+  }
+  if (queued->id_length > 0) {
+    queued_message_t **bucket = request_queue_bucket(queue, queued->id, queued->id_length);
+    queued->chain = *bucket;
+    *bucket = queued;
+    queue->num_pending++;
+  }
+  if (queued->valid && !json_rpc_request_is_notification(&queued->request)) {
+    queued->request_class = queue->classify != NULL ? queue->classify(queued->request.method->string) : REQUEST_CLASS_FOREGROUND;
+    assert(queued->request_class < REQUEST_NUM_CLASSES);
+    request_class_stats_t *stats = &queue->stats[queued->request_class];
+    if (++stats->depth > stats->max_depth) {
+      stats->max_depth = stats->depth;
+    }
+    queued->queued_at = request_queue_now();
+  }
+
+  queued->prev = queue->tail;
+  if (queue->tail != NULL) {
+    queue->tail->next = queued;
+  } else {
+    queue->head = queued;
+  }
+  queue->tail = queued;
+  queue->length++;
+  return 1;
+}
+
+queued_message_t *request_queue_pop(request_queue_t *queue) {
+  assert(queue != NULL);
+  assert(queue->current == NULL);
+
+  queued_message_t *queued = queue->head;
+  if (queued == NULL) {
+    return NULL;
+  }
+  if (queued->request_class != REQUEST_NUM_CLASSES) {
+    // the earliest of the most urgent class, up to the next notification (looked for
+    // only if there is a more urgent request queued at all)
+    int urgent = 0;
+    for (int i = 0; i < (int)queued->request_class; i++) {
+      urgent |= queue->stats[i].depth > 0;
+    }
+    queued_message_t *other = urgent ? queued->next : NULL;
+    for (size_t scanned = 1; other != NULL && other->request_class != REQUEST_NUM_CLASSES
+           && queued->request_class != REQUEST_CLASS_INTERACTIVE && scanned < REQUEST_QUEUE_SCAN_MAX; scanned++) {
+      if (other->request_class < queued->request_class) {
+        queued = other;
+      }
+      other = other->next;
+    }
+
+    request_class_stats_t *stats = &queue->stats[queued->request_class];
+    uint64_t wait = request_queue_now() - queued->queued_at;
+    stats->evaluated++;
+    stats->wait_ns += wait;
+    if (wait > stats->max_wait_ns) {
+      stats->max_wait_ns = wait;
+    }
+  }
+  request_queue_unlink(queue, queued);
+  queue->current = queued;
+  return queued;
+}
+
+queued_message_t *request_queue_peek(request_queue_t *queue) {
+  assert(queue != NULL);
+  return queue->head;
+}
+
+queued_message_t *request_queue_take(request_queue_t *queue) {
+  assert(queue != NULL);
+
+  queued_message_t *queued = queue->head;
+  if (queued == NULL) {
+    return NULL;
+  }
+  request_queue_forget(queue, queued);
+  request_queue_unlink(queue, queued);
+  return queued;
+}
+
+void request_queue_finish(request_queue_t *queue) {
+  assert(queue != NULL);
+
+  if (queue->current != NULL) {
+    request_queue_forget(queue, queue->current);
+    queue->current = NULL;
+  }
+}
+
+void request_queue_detach(request_queue_t *queue) {
+  assert(queue != NULL);
+  assert(queue->current != NULL);
+
+  queue->current->detached = 1;
+  queue->current = NULL;
+}
+
+void request_queue_finish_detached(request_queue_t *queue, queued_message_t *queued) {
+  assert(queue != NULL);
+  assert(queued != NULL && queued->detached);
+
+  request_queue_forget(queue, queued);
+  queued->detached = 0;
+}
+
+size_t request_queue_depth(request_queue_t *queue, request_class_t request_class) {
+  assert(queue != NULL);
+  assert(request_class < REQUEST_NUM_CLASSES);
+  return queue->stats[request_class].depth;
+}
+
+void request_class_stats_add(request_class_stats_t *into, const request_class_stats_t *from) {
+  assert(into != NULL);
+  assert(from != NULL);
+
+  into->depth += from->depth;
+  into->max_depth = from->max_depth > into->max_depth ? from->max_depth : into->max_depth;
+  into->evaluated += from->evaluated;
+  into->wait_ns += from->wait_ns;
+  into->max_wait_ns = from->max_wait_ns > into->max_wait_ns ? from->max_wait_ns : into->max_wait_ns;
+}
+
+int request_queue_cancelled(request_queue_t *queue) {
+  assert(queue != NULL);
+  return queue->current != NULL && atomic_load(&queue->current->cancelled);
+}
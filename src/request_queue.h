@@ -0,0 +1,117 @@
+#ifndef __REQUEST_QUEUE_H__
+#define __REQUEST_QUEUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "json.h"
+#include "json_rpc.h"
+
+// messages read but not evaluated yet, in order, and all requests not answered
+// yet, by id: those still queued, the one being evaluated, and those detached (being
+// evaluated elsewhere). a cancellation ($/cancelRequest) takes a request that is still
+// queued out of the queue (it is answered right away), and flags one being evaluated
+// (its handler may poll for it, and give up early).
+//
+// requests have a scheduling class: a request is evaluated ahead of less urgent ones
+// queued before it (and answered out of order, then), but never ahead of a notification
+// or a batch, so it still sees every change sent before it.
+
+#define REQUEST_QUEUE_ID_MAX 64 // longer ids are fine, but their requests can not be cancelled
+// how far down the queue a more urgent request is looked for
+#define REQUEST_QUEUE_SCAN_MAX 256
+
+// most urgent first
+typedef enum {
+  REQUEST_CLASS_INTERACTIVE, // on the keystroke path (completion, hover, ...)
+  REQUEST_CLASS_FOREGROUND, // asked for by the user, but not while typing
+  REQUEST_CLASS_BACKGROUND, // about the whole workspace
+  REQUEST_NUM_CLASSES // (also: not a request)
+} request_class_t;
+
+// the class of a request, by its method
+typedef
+request_class_t (*request_queue_classify_t)(const char *method);
+
+typedef struct request_class_stats_s {
+  size_t depth; // queued now
+  size_t max_depth;
+  size_t evaluated; // taken out of the queue to be evaluated
+  uint64_t wait_ns; // in the queue, of all those evaluated
+  uint64_t max_wait_ns;
+} request_class_stats_t;
+
+typedef struct queued_message_s {
+  json_rpc_message_t *message;
+  json_rpc_request_notification_t request; // if valid (else, [message] is rejected on evaluation)
+  int valid;
+  int batch; // (else) a batch of requests and notifications: these can not be cancelled
+  char id[REQUEST_QUEUE_ID_MAX]; // of a request, as a key (empty if none)
+  size_t id_length;
+  request_class_t request_class; // REQUEST_NUM_CLASSES for notifications and batches
+  uint64_t queued_at; // (monotonic, in nanoseconds)
+  atomic_int cancelled; // (read by whoever evaluates it, on any thread)
+  int detached; // being evaluated elsewhere (see request_queue_detach)
+
+  struct queued_message_s *prev, *next; // in the queue
+  struct queued_message_s *chain; // in the bucket of its id
+} queued_message_t;
+
+typedef struct request_queue_s {
+  queued_message_t *head, *tail;
+  size_t length;
+  queued_message_t **buckets; // pending requests by id
+  size_t num_buckets; // a power of two (or zero)
+  size_t num_pending;
+  queued_message_t *current; // being evaluated (taken out of the queue, but still pending)
+
+  size_t cancelled_queued; // requests cancelled before their evaluation
+  size_t cancelled_running; // ... during it
+
+  request_queue_classify_t classify; // (NULL: all requests are foreground, in order)
+  request_class_stats_t stats[REQUEST_NUM_CLASSES];
+} request_queue_t;
+
+void request_queue_init(request_queue_t *queue, request_queue_classify_t classify);
+// drops all messages not evaluated
+void request_queue_free(request_queue_t *queue);
+
+// the key of a request id (a number or a string), written to [buffer];
+// returns its length, or zero if not an id (or too long)
+size_t request_queue_id_key(struct json_value_s *id, char *buffer, size_t size);
+
+// queue [message] (taking it over); returns zero if it was a cancellation instead
+// (freed already). if that names a request still queued, the request is taken out of
+// the queue, and handed back in [*cancelled] (to be answered and freed by the caller);
+// if it names the current one, that is flagged. returns -1 if out of memory: [message]
+// is left to the caller then (a request in it still to be answered)
+int request_queue_push(request_queue_t *queue, json_rpc_message_t *message, queued_message_t **cancelled);
+
+// the next message to evaluate (it becomes the current one), or NULL if none: the most
+// urgent request before the first notification, or else the first message
+queued_message_t *request_queue_pop(request_queue_t *queue);
+// the next message to evaluate, left in the queue (NULL if none)
+queued_message_t *request_queue_peek(request_queue_t *queue);
+// take the next message out of the queue along with the current one (e.g. to evaluate
+// both at once); it is not pending anymore
+queued_message_t *request_queue_take(request_queue_t *queue);
+// the current message was evaluated: forget it
+void request_queue_finish(request_queue_t *queue);
+// the current message is evaluated elsewhere (e.g. on a worker): it is not the current
+// one anymore, but still pending (a cancellation flags it) until it is finished
+void request_queue_detach(request_queue_t *queue);
+// the detached message was evaluated: forget it (before freeing it)
+void request_queue_finish_detached(request_queue_t *queue, queued_message_t *queued);
+// free a message taken out of the queue
+void queued_message_free(queued_message_t *queued);
+
+// requests of the class queued now, anywhere in the queue
+size_t request_queue_depth(request_queue_t *queue, request_class_t request_class);
+// add up the statistics of [from] into [into] (as if of one queue)
+void request_class_stats_add(request_class_stats_t *into, const request_class_stats_t *from);
+
+// the current request was cancelled (its handler may stop, and answer with RequestCancelled)
+int request_queue_cancelled(request_queue_t *queue);
+
+#endif /* !__REQUEST_QUEUE_H__ */
@@ -0,0 +1,37 @@
+#include <assert.h>
+
+#include "spsc_queue.h"
+
+void spsc_queue_init(spsc_queue_t *queue) {
+  assert(queue != NULL);
+
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+}
+
+int spsc_queue_push(spsc_queue_t *queue, void *item) {
+  assert(queue != NULL);
+
+  size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  if (tail - head == SPSC_QUEUE_CAPACITY) {
+    return 0;
+  }
+  queue->items[tail & (SPSC_QUEUE_CAPACITY - 1)] = item;
+  atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+int spsc_queue_pop(spsc_queue_t *queue, void **item) {
+  assert(queue != NULL);
+  assert(item != NULL);
+
+  size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  if (head == tail) {
+    return 0;
+  }
+  *item = queue->items[head & (SPSC_QUEUE_CAPACITY - 1)];
+  atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+  return 1;
+}
@@ -0,0 +1,29 @@
+#ifndef __SPSC_QUEUE_H__
+#define __SPSC_QUEUE_H__
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+// a bounded queue between exactly one producer thread and one consumer thread,
+// without locks: each side only ever writes its own index, and publishes it with
+// release ordering (so the items before it are visible to the other side).
+// neither side blocks: the producer is told the queue is full, the consumer
+// that it is empty; waiting (and waking up) is up to them.
+
+#define SPSC_QUEUE_CAPACITY 256 // a power of two
+
+typedef struct spsc_queue_s {
+  void *items[SPSC_QUEUE_CAPACITY];
+  // both only ever grow (wrapping around); kept on separate cache lines
+  _Alignas(64) atomic_size_t head; // next to pop (written by the consumer)
+  _Alignas(64) atomic_size_t tail; // next to push (written by the producer)
+} spsc_queue_t;
+
+void spsc_queue_init(spsc_queue_t *queue);
+
+// producer side: returns zero if full
+int spsc_queue_push(spsc_queue_t *queue, void *item);
+// consumer side: returns zero if empty
+int spsc_queue_pop(spsc_queue_t *queue, void **item);
+
+#endif /* !__SPSC_QUEUE_H__ */
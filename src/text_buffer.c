@@ -4,6 +4,8 @@
 #include <stdlib.h>
 
 #include "text_buffer.h"
+#include "xxhash64.h"
+#include "lz.h"
 
 int is_gapbuf(gapbuf_t *tb) {
   return tb != NULL
@@ -34,6 +36,7 @@ int gapbuf_init(size_t limit, gapbuf_t *gb) {
   gb->limit = limit;
   gb->gap_start = 0;
   gb->gap_end = limit;
+  gb->hash_valid = 0;
   gb->next = gb->prev = NULL;
   
   assert(is_gapbuf(gb));
@@ -54,6 +57,7 @@ void gapbuf_clear(gapbuf_t *gb) {
 
   gb->gap_start = 0;
   gb->gap_end = gb->limit;
+  gb->hash_valid = 0;
   
   assert(is_gapbuf(gb));
 }
@@ -99,6 +103,7 @@ int gapbuf_insert(gapbuf_t *gb, const char *str, size_t length) {
   }
   memcpy(gb->buffer + gb->gap_start, str, length);
   gb->gap_start += length;
+  gb->hash_valid = 0;
   
   assert(is_gapbuf(gb));
   return 1;
@@ -111,6 +116,7 @@ int gapbuf_delete(gapbuf_t *gb, size_t length) {
     return 0;
   }
   gb->gap_end += length;
+  gb->hash_valid = 0;
   
   assert(is_gapbuf(gb));
 
@@ -152,6 +158,20 @@ int gapbuf_strncmp(gapbuf_t *gb, const char *str, size_t length) {
     return memcmp(buffer, str, length);
   }
 }
+uint64_t gapbuf_hash(gapbuf_t *gb) {
+  assert(is_gapbuf(gb));
+
+  if (!gb->hash_valid) {
+    xxh64_state_t state;
+
+    xxh64_init(&state, 0);
+    xxh64_update(&state, gb->buffer, gb->gap_start);
+    xxh64_update(&state, gb->buffer + gb->gap_end, gb->limit - gb->gap_end);
+    gb->hash = xxh64_digest(&state);
+    gb->hash_valid = 1;
+  }
+  return gb->hash;
+}
 
 /* ****** ****** */
 
@@ -255,6 +275,9 @@ int is_tbuf_on_codepoint(text_buffer_t *tb) {
 int is_tbuf(text_buffer_t *tb) {
   assert(tb != NULL);
 
+  if (tb->is_cold) {
+    return tb->point == NULL && tb->cold.data != NULL;
+  }
   if (!is_linked(tb)) {
     return 0;
   }
@@ -291,29 +314,30 @@ void text_buffer_init(text_buffer_t *tb, size_t chunk_size) {
   tb->end.next = NULL;
 
   tb->point = point;
+  tb->is_cold = 0;
+  memset(&tb->cold, 0, sizeof(tb->cold));
 
   tb->point_position.line_num = 0;
   tb->point_position.char_num = 0;
+  tb->point_position_valid = 1;
+  tb->point_offset = 0;
 
   assert(is_tbuf(tb));
 }
 
+static void text_cold_free(text_cold_t *cold);
+static void text_buffer_drop_chunks(text_buffer_t *tb);
+
 void text_buffer_free(text_buffer_t *tb) {
   assert(is_tbuf(tb));
 
-  // go over the list and dealloc all nodes
-  tb->point = NULL;
-  gapbuf_t *rover = tb->start.next;
-  while (rover != &tb->end) {
-    gapbuf_t *next = rover->next;
-
-    gapbuf_free(rover);
-    free(rover);
-    
-    rover = next;
+  if (tb->is_cold) {
+    text_cold_free(&tb->cold);
+    tb->is_cold = 0;
   }
-  tb->start.next = &tb->end;
-  tb->end.prev = &tb->start;
+
+  // go over the list and dealloc all nodes
+  text_buffer_drop_chunks(tb);
 }
 
 // returns true iff the text buffer is empty
@@ -349,6 +373,7 @@ int split_point(text_buffer_t *tb) {
 
     memcpy(point->buffer + half + point_start, point->buffer + point_start, half - point_start);
     point->gap_end += half;
+    point->hash_valid = 0;
 
     assert(is_gapbuf(point));
     
@@ -367,6 +392,7 @@ int split_point(text_buffer_t *tb) {
 
     memcpy(buffer, buffer+half, point_start - half);
     point->gap_start -= half;
+    point->hash_valid = 0;
     assert(is_gapbuf(point));
 
     // gb is before point
@@ -385,6 +411,8 @@ static void textbuf_rewind(text_buffer_t *tb) {
 
   tb->point_position.line_num = 0;
   tb->point_position.char_num = 0;
+  tb->point_position_valid = 1;
+  tb->point_offset = 0;
 
   gapbuf_t *rover = tb->point;
   while (rover != &tb->start) {
@@ -399,8 +427,23 @@ static void textbuf_rewind(text_buffer_t *tb) {
   assert(is_tbuf(tb));
 }
 
-static
-int text_position_cmp(text_position_t *a, text_position_t *b) {
+void text_position_advance(text_position_t *pos, const char *text, size_t length) {
+  assert(pos != NULL);
+
+  for (size_t i = 0; i < length; i++) {
+    unsigned char ch = text[i];
+
+    if (ch == '\n') {
+      pos->line_num++;
+      pos->char_num = 0;
+    } else if ((ch & 0xC0) != 0x80) {
+      // count leading bytes only: one per codepoint
+      pos->char_num++;
+    }
+  }
+}
+
+int text_position_cmp(const text_position_t *a, const text_position_t *b) {
   if (a->line_num < b->line_num) {
     return -1;
   }
@@ -436,6 +479,9 @@ static inline size_t codepoint_size(int byte) {
 }
 
 int forward_char(text_buffer_t *tb) {
+  if (!text_buffer_thaw(tb)) {
+    return 0;
+  }
   gapbuf_t *point = tb->point;
 
   // how many to skip?
@@ -460,6 +506,7 @@ int forward_char(text_buffer_t *tb) {
       ret = gapbuf_forward(point, 1);
       assert(ret);
       tb->point = point;
+      tb->point_offset++;
       if (ch == '\n') {
         tb->point_position.line_num++;
         tb->point_position.char_num = 0;
@@ -472,6 +519,7 @@ int forward_char(text_buffer_t *tb) {
 
       size_t len = codepoint_size(ch);
 
+      tb->point_offset += len;
       if (point->gap_end+len > point->limit) {
         size_t have = point->limit - point->gap_end;
         ret = gapbuf_forward(point, have);
@@ -496,6 +544,9 @@ int forward_char(text_buffer_t *tb) {
   }
 }
 int backward_char(text_buffer_t *tb) {
+  if (!text_buffer_thaw(tb)) {
+    return 0;
+  }
   gapbuf_t *point = tb->point;
 
   while (1) {
@@ -511,6 +562,7 @@ int backward_char(text_buffer_t *tb) {
       }
     } else {
       gapbuf_backward(point, 1);
+      tb->point_offset--;
     }
 
     int ret = gapbuf_getc(point, &ch);
@@ -523,6 +575,7 @@ int backward_char(text_buffer_t *tb) {
         num = num > 0 ? num - 1 : 0;
         tb->point_position.line_num = num;
         tb->point_position.char_num = 0; // FIXME: we can't really determine this! unless we go further and then get back.
+        tb->point_position_valid = 0;
       } else {
         size_t num = tb->point_position.char_num;
         num = num > 0 ? num - 1 : 0;
@@ -543,6 +596,9 @@ int backward_char(text_buffer_t *tb) {
 
 // move the cursor forward, to the right
 int forward_chars(text_buffer_t *tb, size_t length) {
+  if (!text_buffer_thaw(tb)) {
+    return 0;
+  }
   assert(is_tbuf(tb));
   int ret;
   int steps = 0;
@@ -561,6 +617,9 @@ int forward_chars(text_buffer_t *tb, size_t length) {
 }
 // move the cursor backward, to the left
 int backward_chars(text_buffer_t *tb, size_t length) {
+  if (!text_buffer_thaw(tb)) {
+    return 0;
+  }
   assert(is_tbuf(tb));
   int ret;
   int steps = 0;
@@ -581,8 +640,15 @@ int backward_chars(text_buffer_t *tb, size_t length) {
 
 // insert the string before the cursor
 void insert_string(text_buffer_t *tb, const char *str, size_t length) {
+  if (!text_buffer_thaw(tb)) {
+    return;
+  }
   assert(is_tbuf(tb));
 
+  // the point ends up after the inserted text
+  text_position_advance(&tb->point_position, str, length);
+  tb->point_offset += length;
+
   while (length > 0) {
     if (gapbuf_full(tb->point)) {
       split_point(tb);
@@ -605,11 +671,23 @@ void insert_string(text_buffer_t *tb, const char *str, size_t length) {
 
 // delete the string after the cursor
 void delete_string(text_buffer_t *tb, size_t length) {
+  if (!text_buffer_thaw(tb)) {
+    return;
+  }
   assert(is_tbuf(tb));
 
   while (length > 0) {
     gapbuf_t *point = tb->point;
 
+    if (gapbuf_at_right(point)) {
+      // the rest is in the following gapbuffer (a codepoint may straddle the boundary)
+      if (point->next == &tb->end) {
+        break;
+      }
+      point = point->next;
+      tb->point = point;
+    }
+
     size_t have = point->limit - point->gap_end;
     have = length < have ? length : have;
     
@@ -619,15 +697,17 @@ void delete_string(text_buffer_t *tb, size_t length) {
 
     // delete the point if it becomes empty, unless it's the only gapbuffer we have
     if (gapbuf_empty(point) && !(point->prev == &tb->start && point->next == &tb->end)) {
-      gapbuf_t *gb = point->next;
+      // the point moves to the neighbour: either way, it stays at the same place in the text
+      gapbuf_t *gb = point->next != &tb->end ? point->next : point->prev;
 
-      gb->prev = point->prev;
-      point->prev->next = gb;
+      point->next->prev = point->prev;
+      point->prev->next = point->next;
       tb->point = gb;
 
       point->prev = NULL;
       point->next = NULL;
       gapbuf_free(point);
+      free(point);
     }
   }
 
@@ -635,10 +715,17 @@ void delete_string(text_buffer_t *tb, size_t length) {
 }
 
 int text_buffer_set_point(text_buffer_t *tb, text_position_t *pos) {
+  if (!text_buffer_thaw(tb)) {
+    return 0;
+  }
   assert(is_tbuf(tb));
   assert(pos != NULL);
 
-  textbuf_rewind(tb);
+  // only rewind if we have to: a forward seek can start from the point,
+  // so a series of increasing positions costs a single pass over the text
+  if (!tb->point_position_valid || text_position_cmp(&tb->point_position, pos) > 0) {
+    textbuf_rewind(tb);
+  }
 
   while (text_position_cmp(&tb->point_position, pos) < 0) {
     if (!forward_char(tb)) {
@@ -660,7 +747,16 @@ void text_buffer_get_point(text_buffer_t *tb, text_position_t *pos) {
   *pos = tb->point_position;
 }
 
+size_t text_buffer_get_offset(text_buffer_t *tb) {
+  assert(is_tbuf(tb));
+
+  return tb->point_offset;
+}
+
 void text_buffer_clear(text_buffer_t *tb) {
+  if (!text_buffer_thaw(tb)) {
+    return;
+  }
   gapbuf_t *point = tb->point;
   gapbuf_t *rover = tb->start.next;
 
@@ -686,6 +782,10 @@ void text_buffer_clear(text_buffer_t *tb) {
   tb->end.next = NULL;
 
   tb->point = point;
+  tb->point_position.line_num = 0;
+  tb->point_position.char_num = 0;
+  tb->point_position_valid = 1;
+  tb->point_offset = 0;
 
   assert(is_tbuf(tb));
 }
@@ -694,11 +794,15 @@ void text_buffer_insert(text_buffer_t *tb, const char *text, size_t length) {
   insert_string(tb, text, length);
 }
 
-void text_buffer_delete(text_buffer_t *tb, text_position_t *pos) {
+size_t text_buffer_delete(text_buffer_t *tb, text_position_t *pos) {
+  if (!text_buffer_thaw(tb)) {
+    return 0;
+  }
   assert(pos != NULL);
   assert(text_position_cmp(&tb->point_position, pos) < 0); // this should be a range!
 
   text_position_t current_pos = tb->point_position;
+  size_t deleted = 0;
 
   // NOTE: range is exclusive
   while (text_position_cmp(&current_pos, pos) < 0) {
@@ -717,6 +821,7 @@ void text_buffer_delete(text_buffer_t *tb, text_position_t *pos) {
 
       if (ch <= 0x7F) { // plain ASCII
         delete_string(tb, 1);
+        deleted++;
         if (ch == '\n') {
           current_pos.line_num++;
           current_pos.char_num = 0;
@@ -730,12 +835,19 @@ void text_buffer_delete(text_buffer_t *tb, text_position_t *pos) {
         size_t size = codepoint_size(ch);
 
         delete_string(tb, size);
+        deleted += size;
       }
     }
   }
+
+  *pos = current_pos;
+  return deleted;
 }
 
 void text_buffer_read(text_buffer_t *tb, text_buffer_read_t read, void *state) {
+  if (!text_buffer_thaw(tb)) {
+    return;
+  }
   assert(is_tbuf(tb));
 
   // here we should go over all gapbuffers and expose all of their readable data to the [read] function
@@ -759,3 +871,697 @@ void text_buffer_read(text_buffer_t *tb, text_buffer_read_t read, void *state) {
     rover = next;
   }
 }
+
+size_t text_buffer_length(text_buffer_t *tb) {
+  assert(is_tbuf(tb));
+
+  if (tb->is_cold) {
+    return tb->cold.length;
+  }
+
+  size_t length = 0;
+  gapbuf_t *rover = tb->start.next;
+  while (rover != &tb->end) {
+    length += gapbuf_length(rover);
+    rover = rover->next;
+  }
+  return length;
+}
+
+int text_buffer_set_offset(text_buffer_t *tb, size_t offset) {
+  if (!text_buffer_thaw(tb)) {
+    return 0;
+  }
+  assert(is_tbuf(tb));
+
+  if (!tb->point_position_valid || offset < tb->point_offset) {
+    textbuf_rewind(tb);
+  }
+
+  // skip whole runs of bytes after the gap, chunk by chunk
+  gapbuf_t *point = tb->point;
+  while (tb->point_offset < offset) {
+    size_t have = point->limit - point->gap_end;
+    size_t want = offset - tb->point_offset;
+    size_t len = want < have ? want : have;
+
+    text_position_advance(&tb->point_position, point->buffer + point->gap_end, len);
+    gapbuf_forward(point, len);
+    tb->point_offset += len;
+
+    if (gapbuf_at_right(point) && tb->point_offset < offset) {
+      if (point->next == &tb->end) {
+        break;
+      }
+      point = point->next;
+    }
+  }
+  tb->point = point;
+
+  assert(is_tbuf(tb));
+  return tb->point_offset == offset;
+}
+
+size_t text_buffer_delete_bytes(text_buffer_t *tb, size_t length, text_position_t *end) {
+  if (!text_buffer_thaw(tb)) {
+    return 0;
+  }
+  assert(is_tbuf(tb));
+
+  text_position_t pos = tb->point_position;
+  size_t deleted = 0;
+
+  while (deleted < length) {
+    if (gapbuf_at_right(tb->point)) {
+      if (tb->point->next == &tb->end) {
+        break; // no more text to delete
+      }
+      tb->point = tb->point->next;
+    }
+
+    gapbuf_t *point = tb->point;
+    size_t have = point->limit - point->gap_end;
+    size_t len = length - deleted < have ? length - deleted : have;
+
+    text_position_advance(&pos, point->buffer + point->gap_end, len);
+    delete_string(tb, len);
+    deleted += len;
+  }
+
+  if (end != NULL) {
+    *end = pos;
+  }
+  return deleted;
+}
+
+typedef struct text_buffer_affix_s {
+  const char *text;
+  size_t      length;
+  size_t      common;
+  int         done;
+} text_buffer_affix_t;
+
+static size_t common_prefix_length(const char *a, const char *b, size_t length) {
+  if (!memcmp(a, b, length)) {
+    return length;
+  }
+  size_t i = 0;
+  while (i < length && a[i] == b[i]) {
+    i++;
+  }
+  return i;
+}
+
+static size_t common_suffix_length(const char *a_end, const char *b_end, size_t length) {
+  if (!memcmp(a_end - length, b_end - length, length)) {
+    return length;
+  }
+  size_t i = 0;
+  while (i < length && a_end[-1 - (long)i] == b_end[-1 - (long)i]) {
+    i++;
+  }
+  return i;
+}
+
+// compare the fragment against the text following the common prefix found so far
+static void text_buffer_affix_forward(text_buffer_affix_t *affix, const char *fragment, size_t length) {
+  if (affix->done || length == 0) {
+    return;
+  }
+  size_t left = affix->length - affix->common;
+  size_t n = length < left ? length : left;
+  size_t same = common_prefix_length(fragment, affix->text + affix->common, n);
+
+  affix->common += same;
+  affix->done = same < length;
+}
+
+// compare the fragment against the text preceding the common suffix found so far
+static void text_buffer_affix_backward(text_buffer_affix_t *affix, const char *fragment, size_t length) {
+  if (affix->done || length == 0) {
+    return;
+  }
+  size_t left = affix->length - affix->common;
+  size_t n = length < left ? length : left;
+  size_t same = common_suffix_length(fragment + length, affix->text + left, n);
+
+  affix->common += same;
+  affix->done = same < length;
+}
+
+void text_buffer_common_affixes(text_buffer_t *tb, const char *text, size_t length, size_t *prefix, size_t *suffix) {
+  if (!text_buffer_thaw(tb)) {
+    *prefix = *suffix = 0; // (nothing in common: all of it is replaced)
+    return;
+  }
+  assert(is_tbuf(tb));
+  assert(text != NULL || length == 0);
+  assert(prefix != NULL && suffix != NULL);
+
+  size_t old_length = text_buffer_length(tb);
+  size_t limit = old_length < length ? old_length : length;
+  gapbuf_t *rover;
+
+  text_buffer_affix_t head = {text, limit, 0, 0};
+  rover = tb->start.next;
+  while (rover != &tb->end && !head.done) {
+    text_buffer_affix_forward(&head, rover->buffer, rover->gap_start);
+    text_buffer_affix_forward(&head, rover->buffer + rover->gap_end, rover->limit - rover->gap_end);
+    rover = rover->next;
+  }
+  // do not split a codepoint
+  while (head.common > 0 && head.common < length && (text[head.common] & 0xC0) == 0x80) {
+    head.common--;
+  }
+
+  // the suffix is searched for in what remains after the prefix
+  text_buffer_affix_t tail = {text + head.common, limit - head.common, 0, 0};
+  tail.length = length - head.common;
+  rover = tb->end.prev;
+  while (rover != &tb->start && !tail.done) {
+    text_buffer_affix_backward(&tail, rover->buffer + rover->gap_end, rover->limit - rover->gap_end);
+    text_buffer_affix_backward(&tail, rover->buffer, rover->gap_start);
+    rover = rover->prev;
+  }
+  if (tail.common > limit - head.common) {
+    tail.common = limit - head.common;
+  }
+  while (tail.common > 0 && (text[length - tail.common] & 0xC0) == 0x80) {
+    tail.common--;
+  }
+
+  *prefix = head.common;
+  *suffix = tail.common;
+}
+
+uint64_t text_buffer_fingerprint(text_buffer_t *tb) {
+  assert(is_tbuf(tb));
+
+  // Merkle-style: hash the sequence of chunk hashes
+  xxh64_state_t state;
+  xxh64_init(&state, 0);
+
+  if (tb->is_cold) {
+    for (size_t i = 0; i < tb->cold.num_chunks; i++) {
+      xxh64_update(&state, &tb->cold.chunks[i].hash, sizeof(uint64_t));
+    }
+    return xxh64_digest(&state);
+  }
+
+  gapbuf_t *rover = tb->start.next;
+  while (rover != &tb->end) {
+    uint64_t hash = gapbuf_hash(rover);
+    xxh64_update(&state, &hash, sizeof(hash));
+    rover = rover->next;
+  }
+  return xxh64_digest(&state);
+}
+
+/* ****** ****** */
+
+// the text as a sequence of fragments: the bytes before, and then after, the gap of each chunk
+typedef struct text_fragment_s {
+  gapbuf_t *chunk;
+  int after_gap;
+  const char *data;
+  size_t length;
+} text_fragment_t;
+
+static void text_fragment_load(text_fragment_t *frag) {
+  gapbuf_t *gb = frag->chunk;
+
+  if (frag->after_gap) {
+    frag->data = gb->buffer + gb->gap_end;
+    frag->length = gb->limit - gb->gap_end;
+  } else {
+    frag->data = gb->buffer;
+    frag->length = gb->gap_start;
+  }
+}
+static void text_fragment_first(text_buffer_t *tb, text_fragment_t *frag) {
+  frag->chunk = tb->start.next;
+  frag->after_gap = 0;
+  text_fragment_load(frag);
+}
+// returns 0 at the end of the text
+static int text_fragment_next(text_buffer_t *tb, text_fragment_t *frag) {
+  if (!frag->after_gap) {
+    frag->after_gap = 1;
+  } else {
+    if (frag->chunk->next == &tb->end) {
+      return 0;
+    }
+    frag->chunk = frag->chunk->next;
+    frag->after_gap = 0;
+  }
+  text_fragment_load(frag);
+  return 1;
+}
+// does the text at [index] of the fragment start with the pattern?
+static int text_fragment_match(text_buffer_t *tb, const text_fragment_t *at, size_t index, const char *pattern, size_t length) {
+  text_fragment_t frag = *at;
+
+  while (1) {
+    size_t have = frag.length - index;
+
+    if (have >= length) {
+      return memcmp(frag.data + index, pattern, length) == 0;
+    }
+    if (memcmp(frag.data + index, pattern, have) != 0) {
+      return 0;
+    }
+    pattern += have;
+    length -= have;
+    index = 0;
+    if (!text_fragment_next(tb, &frag)) {
+      return 0;
+    }
+  }
+}
+
+size_t text_buffer_copy(text_buffer_t *tb, size_t offset, char *buffer, size_t length) {
+  if (!text_buffer_thaw(tb)) {
+    return 0;
+  }
+  assert(is_tbuf(tb));
+  assert(buffer != NULL || length == 0);
+
+  text_fragment_t frag;
+  text_fragment_first(tb, &frag);
+  // skip whole fragments
+  while (offset >= frag.length) {
+    offset -= frag.length;
+    if (!text_fragment_next(tb, &frag)) {
+      return 0;
+    }
+  }
+  size_t copied = 0;
+  while (copied < length) {
+    size_t have = frag.length - offset;
+    if (have > length - copied) {
+      have = length - copied;
+    }
+    memcpy(buffer + copied, frag.data + offset, have);
+    copied += have;
+    offset = 0;
+    if (!text_fragment_next(tb, &frag)) {
+      break;
+    }
+  }
+  return copied;
+}
+
+// position & offset of a place in the text, only moved forward when needed
+typedef struct text_cursor_s {
+  text_fragment_t frag;
+  size_t index;
+  text_position_t position;
+  size_t offset;
+} text_cursor_t;
+
+static void text_cursor_init(text_buffer_t *tb, text_cursor_t *cursor) {
+  text_fragment_first(tb, &cursor->frag);
+  cursor->index = 0;
+  cursor->position.line_num = 0;
+  cursor->position.char_num = 0;
+  cursor->offset = 0;
+}
+
+// move on to the next fragment with bytes left; returns 0 at the end of the text
+static int text_cursor_settle(text_buffer_t *tb, text_cursor_t *cursor) {
+  while (cursor->index >= cursor->frag.length) {
+    if (!text_fragment_next(tb, &cursor->frag)) {
+      return 0;
+    }
+    cursor->index = 0;
+  }
+  return 1;
+}
+
+// move forward to the given offset, or to the end of the text
+static void text_cursor_to_offset(text_buffer_t *tb, text_cursor_t *cursor, size_t offset) {
+  while (cursor->offset < offset && text_cursor_settle(tb, cursor)) {
+    size_t length = cursor->frag.length - cursor->index;
+    if (length > offset - cursor->offset) {
+      length = offset - cursor->offset;
+    }
+    text_position_advance(&cursor->position, cursor->frag.data + cursor->index, length);
+    cursor->index += length;
+    cursor->offset += length;
+  }
+}
+
+// move forward to the given position, or to the end of its line, or to the end of the text
+static void text_cursor_to_position(text_buffer_t *tb, text_cursor_t *cursor, const text_position_t *pos) {
+  // skip whole lines
+  while (cursor->position.line_num < pos->line_num && text_cursor_settle(tb, cursor)) {
+    const char *data = cursor->frag.data + cursor->index;
+    size_t length = cursor->frag.length - cursor->index;
+    const char *newline = memchr(data, '\n', length);
+
+    if (newline != NULL) {
+      length = newline - data + 1;
+      cursor->position.line_num++;
+      cursor->position.char_num = 0;
+    } else {
+      text_position_advance(&cursor->position, data, length);
+    }
+    cursor->index += length;
+    cursor->offset += length;
+  }
+  if (cursor->position.line_num < pos->line_num) {
+    return;
+  }
+  // then codepoints, up to the end of the line
+  while (text_cursor_settle(tb, cursor)) {
+    unsigned char ch = cursor->frag.data[cursor->index];
+
+    if (ch == '\n') {
+      break;
+    }
+    if ((ch & 0xC0) != 0x80) {
+      if (cursor->position.char_num >= pos->char_num) {
+        break;
+      }
+      cursor->position.char_num++;
+    }
+    cursor->index++;
+    cursor->offset++;
+  }
+}
+
+static void text_cursor_advance(text_buffer_t *tb, text_cursor_t *cursor, const text_fragment_t *frag, size_t index) {
+  while (cursor->frag.chunk != frag->chunk || cursor->frag.after_gap != frag->after_gap) {
+    size_t rest = cursor->frag.length - cursor->index;
+
+    text_position_advance(&cursor->position, cursor->frag.data + cursor->index, rest);
+    cursor->offset += rest;
+    cursor->index = 0;
+    int ret = text_fragment_next(tb, &cursor->frag);
+    assert(ret);
+  }
+  assert(cursor->index <= index);
+  text_position_advance(&cursor->position, cursor->frag.data + cursor->index, index - cursor->index);
+  cursor->offset += index - cursor->index;
+  cursor->index = index;
+}
+
+size_t text_buffer_search(text_buffer_t *tb, const char *pattern, size_t length, text_buffer_search_t found, void *state) {
+  if (!text_buffer_thaw(tb)) {
+    return 0;
+  }
+  assert(is_tbuf(tb));
+  assert(pattern != NULL);
+  assert(found != NULL);
+
+  if (length == 0) {
+    return 0;
+  }
+
+  text_match_t batch[TEXT_SEARCH_BATCH];
+  size_t batched = 0, total = 0;
+  int more = 1;
+
+  text_fragment_t frag;
+  text_fragment_first(tb, &frag);
+  size_t index = 0;
+
+  // positions are only computed for the matches: the text in between is skipped
+  // by memchr (vectorized in any decent libc), looking for the first byte
+  text_cursor_t cursor;
+  text_cursor_init(tb, &cursor);
+
+  while (more) {
+    const char *hit = NULL;
+    if (index < frag.length) {
+      hit = memchr(frag.data + index, pattern[0], frag.length - index);
+    }
+    if (hit == NULL) {
+      more = text_fragment_next(tb, &frag);
+      index = 0;
+      continue;
+    }
+    index = hit - frag.data;
+    if (!text_fragment_match(tb, &frag, index, pattern, length)) {
+      index++;
+      continue;
+    }
+
+    text_cursor_advance(tb, &cursor, &frag, index);
+    batch[batched].position = cursor.position;
+    batch[batched].offset = cursor.offset;
+    batched++;
+    if (batched == TEXT_SEARCH_BATCH) {
+      total += batched;
+      more = found(batch, batched, state);
+      batched = 0;
+    }
+
+    // continue after the match, which may end in a later fragment
+    index += length;
+    while (more && index >= frag.length) {
+      index -= frag.length;
+      more = text_fragment_next(tb, &frag);
+    }
+  }
+  if (batched > 0) {
+    total += batched;
+    found(batch, batched, state);
+  }
+  return total;
+}
+
+static int text_location_offset_cmp(const void *a, const void *b) {
+  const text_location_t *x = *(const text_location_t * const *)a;
+  const text_location_t *y = *(const text_location_t * const *)b;
+
+  return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+static int text_location_position_cmp(const void *a, const void *b) {
+  const text_location_t *x = *(const text_location_t * const *)a;
+  const text_location_t *y = *(const text_location_t * const *)b;
+
+  return text_position_cmp(&x->position, &y->position);
+}
+
+// visit the locations in sorted order, without moving them: usually they come sorted already,
+// otherwise they are sorted through an array of pointers
+static int text_buffer_convert(text_buffer_t *tb, text_location_t *locs, size_t count, int by_offset) {
+  if (!text_buffer_thaw(tb)) {
+    return 0;
+  }
+  assert(is_tbuf(tb));
+  assert(locs != NULL || count == 0);
+
+  int (*cmp)(const void *, const void *) = by_offset ? text_location_offset_cmp : text_location_position_cmp;
+  text_location_t **order = NULL;
+
+  for (size_t i = 1; i < count; i++) {
+    const text_location_t *prev = &locs[i-1], *next = &locs[i];
+    if (cmp(&prev, &next) > 0) {
+      order = malloc(count * sizeof(text_location_t *));
+      if (order == NULL) {
+        fprintf(stderr, "text_buffer_convert: out of memory\n");
+        return 0;
+      }
+      for (size_t j = 0; j < count; j++) {
+        order[j] = &locs[j];
+      }
+      qsort(order, count, sizeof(text_location_t *), cmp);
+      break;
+    }
+  }
+
+  text_cursor_t cursor;
+  text_cursor_init(tb, &cursor);
+
+  for (size_t i = 0; i < count; i++) {
+    text_location_t *loc = order != NULL ? order[i] : &locs[i];
+
+    if (by_offset) {
+      text_cursor_to_offset(tb, &cursor, loc->offset);
+    } else {
+      text_cursor_to_position(tb, &cursor, &loc->position);
+    }
+    loc->position = cursor.position;
+    loc->offset = cursor.offset;
+  }
+
+  free(order);
+  return 1;
+}
+
+int text_buffer_offsets_to_positions(text_buffer_t *tb, text_location_t *locs, size_t count) {
+  return text_buffer_convert(tb, locs, count, 1);
+}
+
+int text_buffer_positions_to_offsets(text_buffer_t *tb, text_location_t *locs, size_t count) {
+  return text_buffer_convert(tb, locs, count, 0);
+}
+
+/* ****** ****** */
+
+static void text_cold_free(text_cold_t *cold) {
+  free(cold->data);
+  free(cold->chunks);
+  memset(cold, 0, sizeof(*cold));
+}
+
+// drop all chunks, leaving just the sentinels
+static void text_buffer_drop_chunks(text_buffer_t *tb) {
+  gapbuf_t *rover = tb->start.next;
+  while (rover != &tb->end) {
+    gapbuf_t *next = rover->next;
+
+    gapbuf_free(rover);
+    free(rover);
+    rover = next;
+  }
+  tb->point = NULL;
+  tb->start.next = &tb->end;
+  tb->end.prev = &tb->start;
+}
+
+int text_buffer_freeze(text_buffer_t *tb) {
+  assert(is_tbuf(tb));
+
+  if (tb->is_cold) {
+    return 1;
+  }
+
+  size_t length = text_buffer_length(tb), num_chunks = 0;
+  for (gapbuf_t *rover = tb->start.next; rover != &tb->end; rover = rover->next) {
+    num_chunks++;
+  }
+
+  text_cold_t cold;
+  size_t bound = lz_compress_bound(length);
+  char *text = malloc(length > 0 ? length : 1);
+  cold.data = malloc(bound);
+  cold.chunks = malloc(num_chunks * sizeof(text_chunk_info_t));
+  if (text == NULL || cold.data == NULL || cold.chunks == NULL) {
+    fprintf(stderr, "text_buffer_freeze: out of memory\n");
+    free(text);
+    free(cold.data);
+    free(cold.chunks);
+    return 0;
+  }
+
+  // flatten, remembering the chunks (their hashes make up the fingerprint)
+  size_t at = 0, i = 0;
+  for (gapbuf_t *rover = tb->start.next; rover != &tb->end; rover = rover->next, i++) {
+    memcpy(text + at, rover->buffer, rover->gap_start);
+    at += rover->gap_start;
+    memcpy(text + at, rover->buffer + rover->gap_end, rover->limit - rover->gap_end);
+    at += rover->limit - rover->gap_end;
+
+    cold.chunks[i].length = gapbuf_length(rover);
+    cold.chunks[i].hash = gapbuf_hash(rover);
+  }
+  assert(at == length);
+
+  cold.size = lz_compress(text, length, cold.data, bound);
+  assert(cold.size > 0);
+  free(text);
+  char *data = realloc(cold.data, cold.size);
+  if (data != NULL) {
+    cold.data = data;
+  }
+  cold.length = length;
+  cold.num_chunks = num_chunks;
+
+  text_buffer_drop_chunks(tb);
+  tb->cold = cold;
+  tb->is_cold = 1;
+
+  assert(is_tbuf(tb));
+  return 1;
+}
+
+// restore the chunks as they were, with the point where it was
+static int text_buffer_thaw_chunks(text_buffer_t *tb) {
+  assert(tb->is_cold);
+
+  text_cold_t *cold = &tb->cold;
+  size_t length = 0;
+  char *text = malloc(cold->length > 0 ? cold->length : 1);
+  if (text == NULL) {
+    fprintf(stderr, "text_buffer_thaw: out of memory\n");
+    return 0;
+  }
+  if (!lz_decompress(cold->data, cold->size, text, cold->length, &length) || length != cold->length) {
+    fprintf(stderr, "text_buffer_thaw: corrupt block\n");
+    free(text);
+    return 0;
+  }
+
+  gapbuf_t *prev = &tb->start, *point = NULL;
+  size_t at = 0;
+  for (size_t i = 0; i < cold->num_chunks; i++) {
+    gapbuf_t *gb = malloc(sizeof(gapbuf_t));
+    if (gb == NULL || !gapbuf_init(tb->chunk_size, gb)) {
+      fprintf(stderr, "text_buffer_thaw: out of memory\n");
+      free(gb);
+      prev->next = &tb->end;
+      tb->end.prev = prev;
+      text_buffer_drop_chunks(tb);
+      free(text);
+      return 0;
+    }
+
+    // the gap is to the right before the point, and to the left after it
+    size_t len = cold->chunks[i].length, before = 0;
+    if (point == NULL && tb->point_offset <= at + len) {
+      before = tb->point_offset - at;
+      point = gb;
+    } else if (point == NULL) {
+      before = len;
+    }
+    memcpy(gb->buffer, text + at, before);
+    memcpy(gb->buffer + gb->limit - (len - before), text + at + before, len - before);
+    gb->gap_start = before;
+    gb->gap_end = gb->limit - (len - before);
+    gb->hash = cold->chunks[i].hash;
+    gb->hash_valid = 1;
+    at += len;
+
+    gb->prev = prev;
+    prev->next = gb;
+    prev = gb;
+  }
+  prev->next = &tb->end;
+  tb->end.prev = prev;
+  free(text);
+
+  assert(point != NULL);
+  tb->point = point;
+  text_cold_free(cold);
+  tb->is_cold = 0;
+
+  assert(is_tbuf(tb));
+  return 1;
+}
+
+int text_buffer_thaw(text_buffer_t *tb) {
+  assert(tb != NULL);
+
+  if (tb->is_cold && !text_buffer_thaw_chunks(tb)) {
+    // the text is still there, frozen: it can be thawed once there is memory again
+    fprintf(stderr, "text_buffer_thaw: unable to thaw the text\n");
+    return 0;
+  }
+  return 1;
+}
+
+size_t text_buffer_memory(text_buffer_t *tb) {
+  assert(is_tbuf(tb));
+
+  if (tb->is_cold) {
+    return tb->cold.size + tb->cold.num_chunks * sizeof(text_chunk_info_t);
+  }
+  size_t memory = 0;
+  for (gapbuf_t *rover = tb->start.next; rover != &tb->end; rover = rover->next) {
+    memory += sizeof(gapbuf_t) + rover->limit;
+  }
+  return memory;
+}
@@ -1,6 +1,9 @@
 #ifndef __TEXT_BUFFER_H__
 #define __TEXT_BUFFER_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
 // NOTE: based on https://www.cs.cmu.edu/~fp/courses/15122-f12/assignments/15-122-prog4-2.pdf
 
 /* ****** ****** */
@@ -11,6 +14,11 @@ typedef struct gapbuf_s {
   size_t gap_start;
   size_t gap_end;
 
+  // hash of the content (not including the gap), recomputed lazily:
+  // edits clear [hash_valid], moving the gap does not
+  uint64_t hash;
+  int hash_valid;
+
   struct gapbuf_s *next, *prev;
 } gapbuf_t;
 
@@ -32,6 +40,7 @@ int gapbuf_insert(gapbuf_t *gb, const char *str, size_t length);
 int gapbuf_delete(gapbuf_t *gb, size_t length);
 int gapbuf_getc(gapbuf_t *gb, unsigned char *res);
 int gapbuf_strncmp(gapbuf_t *gb, const char *str, size_t length);
+uint64_t gapbuf_hash(gapbuf_t *gb);
 
 /* ****** ****** */
 
@@ -40,14 +49,39 @@ typedef struct text_position_s {
   size_t char_num;
 } text_position_t;
 
+// returns negative, zero or positive if [a] is before, at, or after [b]
+int text_position_cmp(const text_position_t *a, const text_position_t *b);
+// advance the position over the given UTF-8 text (length is bytes!)
+void text_position_advance(text_position_t *pos, const char *text, size_t length);
+
 #define TEXT_BUFFER_CHUNK_SIZE 16384
 
+typedef struct text_chunk_info_s {
+  size_t length;
+  uint64_t hash;
+} text_chunk_info_t;
+
+// the text of a cold buffer: no chunks, just one compressed block
+typedef struct text_cold_s {
+  char *data;
+  size_t size;   // of the compressed block
+  size_t length; // of the text
+  text_chunk_info_t *chunks; // to restore the same chunks
+  size_t num_chunks;
+} text_cold_t;
+
 typedef struct text_buffer_s {
   gapbuf_t start, *point, end;
   size_t chunk_size;
 
+  int is_cold; // if so, there are no chunks (and no point) until thawed
+  text_cold_t cold;
+
   // derived & stored info: line/char number of the point (only valid if moving forward!)
   text_position_t point_position;
+  int point_position_valid; // zero after moving backward over a newline
+  // byte offset of the point from the start of the text
+  size_t point_offset;
 } text_buffer_t;
 
 int is_tbuf(text_buffer_t *tb);
@@ -71,18 +105,22 @@ void insert_string(text_buffer_t *tb, const char *str, size_t length);
 // delete the string after the cursor (length is bytes!)
 void delete_string(text_buffer_t *tb, size_t length);
 
-// set the point to the specified location (returns non-zero if succeeded)
+// set the point to the specified location (returns non-zero if succeeded);
+// seeking forward from the point does not rescan the text before it
 int text_buffer_set_point(text_buffer_t *tb, text_position_t *pos);
 // get the location of the point
 void text_buffer_get_point(text_buffer_t *tb, text_position_t *pos);
+// get the byte offset of the point
+size_t text_buffer_get_offset(text_buffer_t *tb);
 
 // clear all text in the buffer
 void text_buffer_clear(text_buffer_t *tb);
 
-// insert text at point (length is bytes!)
+// insert text at point (length is bytes!); the point ends up after the text
 void text_buffer_insert(text_buffer_t *tb, const char *text, size_t length);
-// delete from point until the given position
-void text_buffer_delete(text_buffer_t *tb, text_position_t *pos);
+// delete from point until the given position; returns how many bytes were deleted
+// and updates [pos] to the position actually reached (the text may end before it)
+size_t text_buffer_delete(text_buffer_t *tb, text_position_t *pos);
 
 // return 0 to stop iteration
 typedef
@@ -91,4 +129,68 @@ int (*text_buffer_read_t)(char *buffer, size_t length, void *state);
 // sequential reading from the buffer
 void text_buffer_read(text_buffer_t *tb, text_buffer_read_t read, void *state);
 
+// total length of the text (in bytes)
+size_t text_buffer_length(text_buffer_t *tb);
+
+// copy out up to [length] bytes of the text, starting at the byte [offset], without
+// moving the point; returns how many were copied (less at the end of the text)
+size_t text_buffer_copy(text_buffer_t *tb, size_t offset, char *buffer, size_t length);
+
+// set the point to the given byte offset (returns non-zero if succeeded);
+// the offset must be on a codepoint boundary
+int text_buffer_set_offset(text_buffer_t *tb, size_t offset);
+// delete the given number of bytes after the point; returns how many bytes were deleted.
+// if [end] is non-NULL, it receives the position where the deleted text ended
+size_t text_buffer_delete_bytes(text_buffer_t *tb, size_t length, text_position_t *end);
+
+// find the longest common prefix and suffix (in bytes) of the text in the buffer and
+// the given text; they do not overlap and both end on codepoint boundaries, so replacing
+// everything in between turns the buffer into the given text
+void text_buffer_common_affixes(text_buffer_t *tb, const char *text, size_t length, size_t *prefix, size_t *suffix);
+
+// fingerprint of the whole text: a hash over the hashes of the chunks, so only the
+// chunks edited since the last call are rehashed. NOTE: equal texts split into chunks
+// differently get different fingerprints; a changed fingerprint means "maybe changed"
+uint64_t text_buffer_fingerprint(text_buffer_t *tb);
+
+typedef struct text_match_s {
+  text_position_t position; // where the match starts
+  size_t offset;            // byte offset of the start
+} text_match_t;
+
+#define TEXT_SEARCH_BATCH 64
+
+// receives up to TEXT_SEARCH_BATCH matches at a time; return 0 to stop searching
+typedef
+int (*text_buffer_search_t)(const text_match_t *matches, size_t count, void *state);
+
+// find all non-overlapping occurrences of the pattern (length is bytes!), in order;
+// matches may straddle chunks. does not move the point or otherwise modify the buffer.
+// returns how many matches were passed to [found]
+size_t text_buffer_search(text_buffer_t *tb, const char *pattern, size_t length, text_buffer_search_t found, void *state);
+
+typedef struct text_location_s {
+  text_position_t position;
+  size_t offset; // in bytes
+} text_location_t;
+
+// batch conversions in a single forward sweep over the text (the locations need not be sorted,
+// and are not reordered); both fields of each location are filled in.
+// offsets past the end of the text, and positions past the end of their line or of the text,
+// are moved back to the end. returns 0 if out of memory
+int text_buffer_offsets_to_positions(text_buffer_t *tb, text_location_t *locs, size_t count);
+int text_buffer_positions_to_offsets(text_buffer_t *tb, text_location_t *locs, size_t count);
+
+// compress the text into cold storage, dropping all chunks (returns non-zero if succeeded).
+// the point and the fingerprint are kept; any other operation on the buffer
+// (except for getting the point, length and fingerprint) thaws it first, transparently.
+// if that fails (out of memory), the operation does nothing, and returns zero if it
+// returns anything: callers that must tell thaw first
+int text_buffer_freeze(text_buffer_t *tb);
+// decompress the text of a frozen buffer (if it is); returns zero if out of memory,
+// and then the buffer stays frozen, as it was
+int text_buffer_thaw(text_buffer_t *tb);
+// how many bytes the buffer holds on the heap, chunks or compressed
+size_t text_buffer_memory(text_buffer_t *tb);
+
 #endif /* !__TEXT_BUFFER_H__ */
@@ -0,0 +1,259 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+// the pool (and deque) of the worker running on this thread, if any
+static _Thread_local thread_pool_t *thread_pool_current = NULL;
+static _Thread_local size_t thread_pool_index = 0;
+
+size_t thread_pool_default_threads(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1) {
+    return 1;
+  }
+  return n > THREAD_POOL_MAX_THREADS ? THREAD_POOL_MAX_THREADS : (size_t)n;
+}
+
+/* ****** ****** */
+
+static int thread_pool_deque_init(thread_pool_deque_t *deque) {
+  memset(deque, 0, sizeof(*deque));
+  deque->jobs = malloc(THREAD_POOL_MIN_DEQUE * sizeof(thread_pool_job_t));
+  if (deque->jobs == NULL) {
+    return 0;
+  }
+  deque->capacity = THREAD_POOL_MIN_DEQUE;
+  pthread_mutex_init(&deque->lock, NULL);
+  return 1;
+}
+
+static void thread_pool_deque_free(thread_pool_deque_t *deque) {
+  assert(deque->count == 0);
+  pthread_mutex_destroy(&deque->lock);
+  free(deque->jobs);
+}
+
+// push onto the owner's end; returns zero if out of memory
+static int thread_pool_deque_push(thread_pool_deque_t *deque, const thread_pool_job_t *job) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count == deque->capacity) {
+    thread_pool_job_t *jobs = malloc(2 * deque->capacity * sizeof(thread_pool_job_t));
+    if (jobs == NULL) {
+      pthread_mutex_unlock(&deque->lock);
+      return 0;
+    }
+    for (size_t i = 0; i < deque->count; i++) {
+      jobs[i] = deque->jobs[(deque->top + i) & (deque->capacity - 1)];
+    }
+    free(deque->jobs);
+    deque->jobs = jobs;
+    deque->capacity *= 2;
+    deque->top = 0;
+  }
+  deque->jobs[(deque->top + deque->count) & (deque->capacity - 1)] = *job;
+  deque->count++;
+  pthread_mutex_unlock(&deque->lock);
+  return 1;
+}
+
+// take the newest job (if [newest]), or the oldest one; returns zero if empty
+static int thread_pool_deque_take(thread_pool_deque_t *deque, int newest, thread_pool_job_t *job) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count == 0) {
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+  }
+  if (newest) {
+    *job = deque->jobs[(deque->top + deque->count - 1) & (deque->capacity - 1)];
+  } else {
+    *job = deque->jobs[deque->top];
+    deque->top = (deque->top + 1) & (deque->capacity - 1);
+  }
+  deque->count--;
+  pthread_mutex_unlock(&deque->lock);
+  return 1;
+}
+
+/* ****** ****** */
+
+// a job from the worker's own deque, else one stolen from the others (in turn,
+// starting next to it, so that thieves spread out); returns zero if none
+static int thread_pool_find(thread_pool_t *pool, size_t index, thread_pool_job_t *job) {
+  if (atomic_load(&pool->queued) == 0) {
+    return 0;
+  }
+  if (thread_pool_deque_take(&pool->deques[index], 1, job)) {
+    atomic_fetch_sub(&pool->queued, 1);
+    return 1;
+  }
+  for (size_t i = 1; i < pool->num_threads; i++) {
+    if (thread_pool_deque_take(&pool->deques[(index + i) % pool->num_threads], 0, job)) {
+      atomic_fetch_sub(&pool->queued, 1);
+      atomic_fetch_add(&pool->steals, 1);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+typedef struct thread_pool_worker_s {
+  thread_pool_t *pool;
+  size_t index;
+} thread_pool_worker_t;
+
+static void *thread_pool_worker(void *arg) {
+  thread_pool_worker_t *worker = (thread_pool_worker_t *)arg;
+  thread_pool_t *pool = worker->pool;
+  size_t index = worker->index;
+  free(worker);
+  thread_pool_current = pool;
+  thread_pool_index = index;
+
+  thread_pool_job_t job;
+  while (1) {
+    if (thread_pool_find(pool, index, &job)) {
+      job.task(job.arg);
+      if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->idle);
+        pthread_mutex_unlock(&pool->lock);
+      }
+      continue;
+    }
+
+    // nothing anywhere: sleep until a job is queued. [sleeping] is raised before
+    // [queued] is checked, and submitters raise [queued] before checking [sleeping],
+    // so either this worker sees the job, or the submitter sees it sleeping
+    pthread_mutex_lock(&pool->lock);
+    atomic_fetch_add(&pool->sleeping, 1);
+    while (atomic_load(&pool->queued) == 0 && !pool->stopping) {
+      pthread_cond_wait(&pool->work, &pool->lock);
+    }
+    atomic_fetch_sub(&pool->sleeping, 1);
+    int stop = pool->stopping && atomic_load(&pool->queued) == 0;
+    pthread_mutex_unlock(&pool->lock);
+    if (stop) {
+      break; // stopping, and nothing left to do
+    }
+  }
+  thread_pool_current = NULL;
+  return NULL;
+}
+
+int thread_pool_init(thread_pool_t *pool, size_t num_threads) {
+  assert(pool != NULL);
+
+  memset(pool, 0, sizeof(*pool));
+  if (num_threads == 0) {
+    num_threads = thread_pool_default_threads();
+  }
+  if (num_threads > THREAD_POOL_MAX_THREADS) {
+    num_threads = THREAD_POOL_MAX_THREADS;
+  }
+
+  pool->threads = malloc(num_threads * sizeof(pthread_t));
+  pool->deques = aligned_alloc(_Alignof(thread_pool_deque_t), num_threads * sizeof(thread_pool_deque_t));
+  if (pool->threads == NULL || pool->deques == NULL) {
+    fprintf(stderr, "thread_pool_init: out of memory\n");
+    free(pool->threads);
+    free(pool->deques);
+    return 0;
+  }
+  size_t num_deques = 0;
+  while (num_deques < num_threads && thread_pool_deque_init(&pool->deques[num_deques])) {
+    num_deques++;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+
+  // (all deques are there before any worker looks for a job)
+  for (size_t i = 0; i < num_deques; i++) {
+    thread_pool_worker_t *worker = malloc(sizeof(thread_pool_worker_t));
+    if (worker == NULL) {
+      break;
+    }
+    worker->pool = pool;
+    worker->index = i;
+    if (pthread_create(&pool->threads[i], NULL, thread_pool_worker, worker) != 0) {
+      fprintf(stderr, "thread_pool_init: unable to start a worker\n");
+      free(worker);
+      break;
+    }
+    pool->num_threads++;
+  }
+  // (deques without a worker were never used)
+  for (size_t i = pool->num_threads; i < num_deques; i++) {
+    thread_pool_deque_free(&pool->deques[i]);
+  }
+  if (pool->num_threads == 0) {
+    thread_pool_free(pool);
+    return 0;
+  }
+  return 1;
+}
+
+void thread_pool_free(thread_pool_t *pool) {
+  assert(pool != NULL);
+
+  if (pool->threads == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (size_t i = 0; i < pool->num_threads; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  assert(atomic_load(&pool->queued) == 0);
+
+  for (size_t i = 0; i < pool->num_threads; i++) {
+    thread_pool_deque_free(&pool->deques[i]);
+  }
+  pthread_cond_destroy(&pool->idle);
+  pthread_cond_destroy(&pool->work);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->threads);
+  free(pool->deques);
+  memset(pool, 0, sizeof(*pool));
+}
+
+int thread_pool_submit(thread_pool_t *pool, thread_pool_task_t task, void *arg) {
+  assert(pool != NULL);
+  assert(task != NULL);
+
+  thread_pool_job_t job = {task, arg};
+  size_t index = thread_pool_current == pool
+    ? thread_pool_index
+    : atomic_fetch_add(&pool->next_deque, 1) % pool->num_threads;
+
+  atomic_fetch_add(&pool->pending, 1);
+  if (!thread_pool_deque_push(&pool->deques[index], &job)) {
+    atomic_fetch_sub(&pool->pending, 1);
+    fprintf(stderr, "thread_pool_submit: out of memory\n");
+    return 0;
+  }
+  atomic_fetch_add(&pool->queued, 1);
+  if (atomic_load(&pool->sleeping) > 0) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return 1;
+}
+
+void thread_pool_wait(thread_pool_t *pool) {
+  assert(pool != NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  while (atomic_load(&pool->pending) > 0) {
+    pthread_cond_wait(&pool->idle, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,64 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// a fixed set of worker threads, each with a deque of its own: a worker takes the
+// newest job of its own deque (the one it just submitted, with the data it needs
+// still in its caches), and once out of them, steals the oldest job of another's.
+// tasks may submit further tasks (onto the deque of their worker); jobs submitted
+// from other threads are spread over the deques in turn. the pool knows nothing
+// about what the tasks compute: results are handed back by the tasks themselves
+// (e.g. through a completion queue).
+
+typedef void (*thread_pool_task_t)(void *arg);
+
+typedef struct thread_pool_job_s {
+  thread_pool_task_t task;
+  void *arg;
+} thread_pool_job_t;
+
+#define THREAD_POOL_MAX_THREADS 64
+#define THREAD_POOL_MIN_DEQUE 64 // a power of two
+
+typedef struct thread_pool_deque_s {
+  _Alignas(64) pthread_mutex_t lock; // (only contended by thieves; each deque on cache lines of its own)
+  thread_pool_job_t *jobs; // ring buffer
+  size_t capacity; // a power of two
+  size_t top; // oldest job (stolen from here)
+  size_t count; // the newest is at top + count - 1 (the owner takes it from there)
+} thread_pool_deque_t;
+
+typedef struct thread_pool_s {
+  pthread_t *threads;
+  size_t num_threads;
+  thread_pool_deque_t *deques; // one per worker
+
+  atomic_size_t queued; // jobs in the deques
+  atomic_size_t pending; // jobs queued or running
+  atomic_size_t sleeping; // workers waiting for a job
+  atomic_size_t next_deque; // for jobs submitted from outside
+  atomic_size_t steals; // jobs run by another worker than the one they were queued for
+
+  pthread_mutex_t lock;
+  pthread_cond_t work; // signalled when a job is queued while workers sleep, or on stopping
+  pthread_cond_t idle; // signalled when the last job finishes
+  int stopping;
+} thread_pool_t;
+
+// the number of online cores (at least one)
+size_t thread_pool_default_threads(void);
+
+// [num_threads] of zero means one per core; returns zero on failure
+int thread_pool_init(thread_pool_t *pool, size_t num_threads);
+// all queued jobs are still run before the workers are joined
+void thread_pool_free(thread_pool_t *pool);
+
+// returns zero if out of memory
+int thread_pool_submit(thread_pool_t *pool, thread_pool_task_t task, void *arg);
+// block until no job is queued or running
+void thread_pool_wait(thread_pool_t *pool);
+
+#endif /* !__THREAD_POOL_H__ */
@@ -0,0 +1,119 @@
+// for accept4
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "transport.h"
+
+#define TRANSPORT_BACKLOG 16
+
+static int transport_address(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  size_t length = strlen(path);
+  if (length == 0 || length >= sizeof(addr->sun_path)) {
+    fprintf(stderr, "transport: socket path empty or too long: %s\n", path);
+    return 0;
+  }
+  memcpy(addr->sun_path, path, length + 1);
+  return 1;
+}
+
+// whether the socket at [addr] is refusing connections (no server behind it)
+static int transport_stale(const struct sockaddr_un *addr) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return 0;
+  }
+  int stale = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) != 0 && errno == ECONNREFUSED;
+  close(fd);
+  return stale;
+}
+
+int transport_listen(const char *path) {
+  assert(path != NULL);
+
+  struct sockaddr_un addr;
+  if (!transport_address(path, &addr)) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fprintf(stderr, "transport_listen: unable to make a socket: %s\n", strerror(errno));
+    return -1;
+  }
+  // left over by a server killed before (but only replace a socket nobody listens on)
+  struct stat st;
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode) && transport_stale(&addr)) {
+    unlink(path);
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, TRANSPORT_BACKLOG) != 0) {
+    fprintf(stderr, "transport_listen(%s): %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int transport_accept(int listen_fd) {
+  while (1) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd >= 0 || errno != EINTR) {
+      if (fd < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        fprintf(stderr, "transport_accept: %s\n", strerror(errno));
+      }
+      return fd;
+    }
+  }
+}
+
+int transport_connect(const char *path) {
+  assert(path != NULL);
+
+  struct sockaddr_un addr;
+  if (!transport_address(path, &addr)) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fprintf(stderr, "transport_connect: unable to make a socket: %s\n", strerror(errno));
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "transport_connect(%s): %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int transport_open(int fd, FILE **fin, FILE **fout) {
+  assert(fin != NULL);
+  assert(fout != NULL);
+
+  int out_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  *fin = out_fd >= 0 ? fdopen(fd, "rb") : NULL;
+  *fout = *fin != NULL ? fdopen(out_fd, "wb") : NULL;
+  if (*fout == NULL) {
+    fprintf(stderr, "transport_open: %s\n", strerror(errno));
+    if (*fin != NULL) {
+      fclose(*fin); // (closes fd)
+    } else {
+      close(fd);
+    }
+    if (out_fd >= 0) {
+      close(out_fd);
+    }
+    *fin = NULL;
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,22 @@
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+#include <stdio.h>
+
+// connections to editors other than through the standard input and output: unix
+// domain sockets, either made by the editor (the server connects), or by the server
+// (editors connect, any number of them)
+
+// a listening socket at [path] (a stale one left there is replaced, not one another
+// server listens on), not blocking on accept; returns a negative number on failure
+int transport_listen(const char *path);
+// the next connection pending (blocking on reads), or a negative number if none
+int transport_accept(int listen_fd);
+// connect to the socket at [path]; returns a negative number on failure
+int transport_connect(const char *path);
+
+// streams for reading and for writing the connection (each closes a descriptor of its
+// own); returns zero on failure, having closed [fd]
+int transport_open(int fd, FILE **fin, FILE **fout);
+
+#endif /* !__TRANSPORT_H__ */
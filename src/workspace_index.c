@@ -0,0 +1,371 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "workspace_index.h"
+#include "xxhash64.h"
+
+#define WORKSPACE_INDEX_NUM_SECTIONS 4
+#define WORKSPACE_INDEX_MIN_LOOKUP 16
+
+static size_t workspace_index_align(size_t n) {
+  return (n + 7) & ~(size_t)7;
+}
+
+int workspace_index_location(const char *root, char *buffer, size_t size) {
+  assert(root != NULL);
+  assert(buffer != NULL);
+
+  char base[FILE_URI_MAX];
+  const char *cache = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  int used;
+  if (cache != NULL && cache[0] == '/') {
+    used = snprintf(base, sizeof(base), "%s", cache);
+  } else if (home != NULL && home[0] == '/') {
+    used = snprintf(base, sizeof(base), "%s/.cache", home);
+  } else {
+    return 0;
+  }
+  if (used < 0 || (size_t)used >= sizeof(base)) {
+    return 0;
+  }
+  // either may be there already
+  mkdir(base, 0700);
+  used = snprintf(buffer, size, "%s/xatsls", base);
+  if (used < 0 || (size_t)used >= size) {
+    return 0;
+  }
+  mkdir(buffer, 0700);
+
+  used = snprintf(buffer, size, "%s/xatsls/%016llx.idx", base, (unsigned long long)xxh64(root, strlen(root), 0));
+  return used >= 0 && (size_t)used < size;
+}
+
+/* ****** ****** */
+
+// the section fits in the file, and is aligned
+static int workspace_index_section_valid(const workspace_index_section_t *section, size_t file_size) {
+  return section->offset % 8 == 0 && section->offset <= file_size && section->size <= file_size - section->offset;
+}
+
+int workspace_index_open(workspace_index_t *index, const char *path, const char *root) {
+  assert(index != NULL);
+  assert(path != NULL);
+  assert(root != NULL);
+
+  memset(index, 0, sizeof(*index));
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return 0; // no index yet
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(workspace_index_header_t)) {
+    close(fd);
+    return 0;
+  }
+  void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    fprintf(stderr, "workspace_index_open(%s): unable to map: %s\n", path, strerror(errno));
+    return 0;
+  }
+  index->data = addr;
+  index->size = st.st_size;
+
+  const workspace_index_header_t *header = (const workspace_index_header_t *)index->data;
+  if (memcmp(header->magic, WORKSPACE_INDEX_MAGIC, sizeof(header->magic))
+      || header->version != WORKSPACE_INDEX_VERSION
+      || header->root_hash != xxh64(root, strlen(root), 0)
+      || header->num_sections > (index->size - sizeof(*header)) / sizeof(workspace_index_section_t)) {
+    workspace_index_close(index);
+    return 0;
+  }
+
+  const workspace_index_section_t *sections = (const workspace_index_section_t *)(header + 1);
+  int seen = 0;
+  size_t directives_count = 0;
+  for (uint32_t i = 0; i < header->num_sections; i++) {
+    const workspace_index_section_t *section = &sections[i];
+    if (!workspace_index_section_valid(section, index->size)) {
+      workspace_index_close(index);
+      return 0;
+    }
+    const char *start = index->data + section->offset;
+    switch (section->kind) {
+    case WORKSPACE_INDEX_FILES:
+      if (section->size != (uint64_t)section->count * sizeof(workspace_index_file_t)) {
+        break;
+      }
+      index->files = (const workspace_index_file_t *)start;
+      index->num_files = section->count;
+      seen |= 1;
+      break;
+    case WORKSPACE_INDEX_LOOKUP:
+      if (section->size != (uint64_t)section->count * sizeof(uint32_t)
+          || section->count == 0 || (section->count & (section->count - 1)) != 0) {
+        break;
+      }
+      index->lookup = (const uint32_t *)start;
+      index->lookup_capacity = section->count;
+      seen |= 2;
+      break;
+    case WORKSPACE_INDEX_PATHS:
+      if (section->size != section->count) {
+        break;
+      }
+      index->paths = start;
+      index->paths_size = section->count;
+      seen |= 4;
+      break;
+    case WORKSPACE_INDEX_DIRECTIVES:
+      if (section->size < (uint64_t)section->count * sizeof(workspace_index_directives_t)) {
+        break;
+      }
+      index->directives = (const workspace_index_directives_t *)start;
+      index->directives_data = start + (size_t)section->count * sizeof(workspace_index_directives_t);
+      index->directives_size = section->size - (size_t)section->count * sizeof(workspace_index_directives_t);
+      seen |= 8;
+      directives_count = section->count;
+      break;
+    default:
+      break; // from a later version: not needed
+    }
+  }
+  if ((seen & 7) != 7 || index->lookup_capacity <= index->num_files) {
+    workspace_index_close(index);
+    return 0;
+  }
+
+  // no record may point outside of the file
+  for (size_t i = 0; i < index->num_files; i++) {
+    const workspace_index_file_t *file = &index->files[i];
+    if (file->path_offset > index->paths_size || file->path_length > index->paths_size - file->path_offset) {
+      workspace_index_close(index);
+      return 0;
+    }
+  }
+  for (size_t i = 0; i < index->lookup_capacity; i++) {
+    if (index->lookup[i] > index->num_files) {
+      workspace_index_close(index);
+      return 0;
+    }
+  }
+  // (without the directives, the files are scanned again)
+  for (size_t i = 0; index->directives != NULL && i < directives_count; i++) {
+    const workspace_index_directives_t *directives = &index->directives[i];
+    if (directives_count != index->num_files || directives->offset > index->directives_size
+        || directives->size > index->directives_size - directives->offset) {
+      index->directives = NULL;
+    }
+  }
+  return 1;
+}
+
+void workspace_index_close(workspace_index_t *index) {
+  assert(index != NULL);
+
+  if (index->data != NULL) {
+    munmap((void *)index->data, index->size);
+  }
+  memset(index, 0, sizeof(*index));
+}
+
+// the record of [path] (its index), or -1 if none
+static ssize_t workspace_index_lookup(const workspace_index_t *index, const char *path, size_t length) {
+  if (index->lookup_capacity == 0) {
+    return -1;
+  }
+  size_t mask = index->lookup_capacity - 1;
+  size_t slot = xxh64(path, length, 0) & mask;
+  // there is always an empty slot, but the file may have been tampered with
+  for (size_t probes = 0; probes < index->lookup_capacity && index->lookup[slot] != 0; probes++) {
+    const workspace_index_file_t *file = &index->files[index->lookup[slot] - 1];
+    if (file->path_length == length && !memcmp(index->paths + file->path_offset, path, length)) {
+      return index->lookup[slot] - 1;
+    }
+    slot = (slot + 1) & mask;
+  }
+  return -1;
+}
+
+int workspace_index_find(const workspace_index_t *index, const char *path, size_t length, file_digest_t *digest) {
+  assert(index != NULL);
+  assert(path != NULL);
+  assert(digest != NULL);
+
+  ssize_t i = workspace_index_lookup(index, path, length);
+  if (i < 0) {
+    return 0;
+  }
+  const workspace_index_file_t *file = &index->files[i];
+  digest->length = file->length;
+  digest->mtime.tv_sec = file->mtime_sec;
+  digest->mtime.tv_nsec = file->mtime_nsec;
+  digest->hash = file->hash;
+  return 1;
+}
+
+int workspace_index_directives(const workspace_index_t *index, const char *path, size_t length, uint64_t hash, dep_directives_t *directives) {
+  assert(index != NULL);
+  assert(path != NULL);
+  assert(directives != NULL);
+
+  ssize_t i = index->directives != NULL ? workspace_index_lookup(index, path, length) : -1;
+  if (i < 0 || !(index->directives[i].flags & WORKSPACE_INDEX_SCANNED) || index->directives[i].hash != hash) {
+    return 0;
+  }
+  directives->data = index->directives_data + index->directives[i].offset;
+  directives->size = index->directives[i].size;
+  return 1;
+}
+
+/* ****** ****** */
+
+// only server-held files are as they are on disk
+static int workspace_index_includes(const file_t *file) {
+  return file->on_disk && file->open_count == 0
+    && (file->backing == FILE_BACKING_MAPPED || file->backing == FILE_BACKING_EVICTED);
+}
+
+// the directives of [file] known to [deps] (if any); returns zero if not known
+static int workspace_index_file_directives(dep_graph_t *deps, file_t *file, dep_directives_t *directives) {
+  return deps != NULL && dep_graph_directives(deps, file->path_id, file_fingerprint(file), directives)
+    && directives->size <= UINT32_MAX;
+}
+
+int workspace_index_write(const char *path, const char *root, file_system_t *fs, dep_graph_t *deps) {
+  assert(path != NULL);
+  assert(root != NULL);
+  assert(fs != NULL);
+
+  char file_path_buf[FILE_URI_MAX];
+  dep_directives_t directives;
+
+  size_t num_files = 0;
+  size_t paths_size = 0;
+  size_t directives_size = 0;
+  for (file_t *file = fs->files; file != NULL; file = file->next) {
+    if (workspace_index_includes(file)) {
+      size_t length = file_path(fs, file, file_path_buf, sizeof(file_path_buf));
+      num_files += length > 0;
+      paths_size += length;
+      if (length > 0 && workspace_index_file_directives(deps, file, &directives)) {
+        directives_size += directives.size;
+      }
+    }
+  }
+  size_t lookup_capacity = WORKSPACE_INDEX_MIN_LOOKUP;
+  while (lookup_capacity < 2 * num_files) {
+    lookup_capacity *= 2;
+  }
+
+  // lay out the sections
+  size_t sections_offset = sizeof(workspace_index_header_t);
+  size_t files_offset = workspace_index_align(sections_offset + WORKSPACE_INDEX_NUM_SECTIONS * sizeof(workspace_index_section_t));
+  size_t lookup_offset = workspace_index_align(files_offset + num_files * sizeof(workspace_index_file_t));
+  size_t paths_offset = workspace_index_align(lookup_offset + lookup_capacity * sizeof(uint32_t));
+  size_t directives_offset = workspace_index_align(paths_offset + paths_size);
+  size_t directives_table = num_files * sizeof(workspace_index_directives_t);
+  size_t total = directives_offset + directives_table + directives_size;
+
+  char *data = calloc(1, total);
+  if (data == NULL) {
+    fprintf(stderr, "workspace_index_write: out of memory\n");
+    return 0;
+  }
+
+  workspace_index_header_t *header = (workspace_index_header_t *)data;
+  memcpy(header->magic, WORKSPACE_INDEX_MAGIC, sizeof(header->magic));
+  header->version = WORKSPACE_INDEX_VERSION;
+  header->num_sections = WORKSPACE_INDEX_NUM_SECTIONS;
+  header->root_hash = xxh64(root, strlen(root), 0);
+
+  workspace_index_section_t *sections = (workspace_index_section_t *)(data + sections_offset);
+  sections[0].kind = WORKSPACE_INDEX_FILES;
+  sections[0].count = num_files;
+  sections[0].offset = files_offset;
+  sections[0].size = num_files * sizeof(workspace_index_file_t);
+  sections[1].kind = WORKSPACE_INDEX_LOOKUP;
+  sections[1].count = lookup_capacity;
+  sections[1].offset = lookup_offset;
+  sections[1].size = lookup_capacity * sizeof(uint32_t);
+  sections[2].kind = WORKSPACE_INDEX_PATHS;
+  sections[2].count = paths_size;
+  sections[2].offset = paths_offset;
+  sections[2].size = paths_size;
+  sections[3].kind = WORKSPACE_INDEX_DIRECTIVES;
+  sections[3].count = num_files;
+  sections[3].offset = directives_offset;
+  sections[3].size = directives_table + directives_size;
+
+  workspace_index_file_t *records = (workspace_index_file_t *)(data + files_offset);
+  uint32_t *lookup = (uint32_t *)(data + lookup_offset);
+  char *paths = data + paths_offset;
+  workspace_index_directives_t *found = (workspace_index_directives_t *)(data + directives_offset);
+  char *directives_data = data + directives_offset + directives_table;
+  size_t i = 0;
+  size_t paths_used = 0;
+  size_t directives_used = 0;
+  for (file_t *file = fs->files; file != NULL && i < num_files; file = file->next) {
+    if (!workspace_index_includes(file)) {
+      continue;
+    }
+    size_t length = file_path(fs, file, file_path_buf, sizeof(file_path_buf));
+    if (length == 0) {
+      continue;
+    }
+    workspace_index_file_t *record = &records[i];
+    record->path_offset = paths_used;
+    record->path_length = length;
+    record->length = file->mapped_length;
+    record->mtime_sec = file->mtime.tv_sec;
+    record->mtime_nsec = file->mtime.tv_nsec;
+    record->hash = file_fingerprint(file);
+    memcpy(paths + paths_used, file_path_buf, length);
+    paths_used += length;
+    if (workspace_index_file_directives(deps, file, &directives) && directives.size <= directives_size - directives_used) {
+      workspace_index_directives_t *known = &found[i];
+      known->hash = record->hash;
+      known->offset = directives_used;
+      known->size = (uint32_t)directives.size;
+      known->flags = WORKSPACE_INDEX_SCANNED;
+      if (directives.size > 0) {
+        memcpy(directives_data + directives_used, directives.data, directives.size);
+      }
+      directives_used += directives.size;
+    }
+
+    size_t slot = xxh64(file_path_buf, length, 0) & (lookup_capacity - 1);
+    while (lookup[slot] != 0) {
+      slot = (slot + 1) & (lookup_capacity - 1);
+    }
+    lookup[slot] = (uint32_t)(++i);
+  }
+
+  // write it out next to the old one, then take its place
+  char tmp[FILE_URI_MAX + 32];
+  snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+  FILE *fp = fopen(tmp, "wb");
+  if (fp == NULL) {
+    fprintf(stderr, "workspace_index_write(%s): %s\n", tmp, strerror(errno));
+    free(data);
+    return 0;
+  }
+  int ok = fwrite(data, 1, total, fp) == total;
+  ok = (fclose(fp) == 0) && ok;
+  free(data);
+  if (!ok || rename(tmp, path) != 0) {
+    fprintf(stderr, "workspace_index_write(%s): unable to write\n", path);
+    unlink(tmp);
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,103 @@
+#ifndef __WORKSPACE_INDEX_H__
+#define __WORKSPACE_INDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "file_system.h"
+#include "dep_graph.h"
+
+/*
+ * what is known about the files of a workspace, kept on disk between runs,
+ * so that on startup only files that changed since have to be read again.
+ *
+ * the file is meant to be mapped and used as is: a header, a table of sections,
+ * then the sections, each aligned to 8 bytes (all integers are in host order):
+ * - FILES: fixed-size records, one per file
+ * - LOOKUP: open addressing table over the records, keyed by the hash of the path
+ * - PATHS: the paths of the records, back to back
+ * - DIRECTIVES: a record for each file (in the same order), of the directives found
+ *   in it (packed, see dep_directives_t) and the fingerprint of the text they were
+ *   found in, then the directives of all, back to back
+ * readers skip sections they do not know; a change in the layout of a known
+ * section bumps the version, and older files are ignored (and rewritten).
+ */
+
+#define WORKSPACE_INDEX_MAGIC "XATSIDX" // 8 bytes with the NUL
+#define WORKSPACE_INDEX_VERSION 1
+
+typedef struct workspace_index_header_s {
+  char     magic[8];
+  uint32_t version;
+  uint32_t num_sections;
+  uint64_t root_hash; // of the root path of the workspace
+} workspace_index_header_t;
+
+typedef enum {
+  WORKSPACE_INDEX_FILES = 1,
+  WORKSPACE_INDEX_LOOKUP = 2,
+  WORKSPACE_INDEX_PATHS = 3,
+  WORKSPACE_INDEX_DIRECTIVES = 4
+} workspace_index_section_kind_t;
+
+typedef struct workspace_index_section_s {
+  uint32_t kind;
+  uint32_t count; // of records, slots or bytes
+  uint64_t offset; // from the start of the file
+  uint64_t size; // in bytes
+} workspace_index_section_t;
+
+typedef struct workspace_index_file_s {
+  uint64_t path_offset; // in PATHS
+  uint32_t path_length;
+  uint32_t flags; // none yet
+  uint64_t length;
+  int64_t  mtime_sec;
+  int64_t  mtime_nsec;
+  uint64_t hash; // fingerprint of the contents
+} workspace_index_file_t;
+
+typedef struct workspace_index_directives_s {
+  uint64_t hash; // fingerprint of the text they were found in
+  uint64_t offset; // after the records
+  uint32_t size;
+  uint32_t flags; // WORKSPACE_INDEX_SCANNED, if known
+} workspace_index_directives_t;
+
+#define WORKSPACE_INDEX_SCANNED 1
+
+typedef struct workspace_index_s {
+  const char *data; // the mapping
+  size_t size;
+
+  const workspace_index_file_t *files;
+  size_t num_files;
+  const uint32_t *lookup; // (record index) + 1, or 0 if empty
+  size_t lookup_capacity; // a power of two
+  const char *paths;
+  size_t paths_size;
+  const workspace_index_directives_t *directives; // NULL if not there (of an older run)
+  const char *directives_data;
+  size_t directives_size;
+} workspace_index_t;
+
+// write out where the index of the workspace at [root] is kept: $XDG_CACHE_HOME/xatsls,
+// or ~/.cache/xatsls (made if missing); returns zero if there is no such place
+int workspace_index_location(const char *root, char *buffer, size_t size);
+
+// map the index at [path]; returns zero if it is missing, malformed,
+// of another version or of another workspace (then [index] is empty)
+int workspace_index_open(workspace_index_t *index, const char *path, const char *root);
+void workspace_index_close(workspace_index_t *index);
+
+// returns zero if the path is not in the index
+int workspace_index_find(const workspace_index_t *index, const char *path, size_t length, file_digest_t *digest);
+// the directives found in the file at [path], if its text had the fingerprint [hash]
+// (they point into the index); returns zero if not known
+int workspace_index_directives(const workspace_index_t *index, const char *path, size_t length, uint64_t hash, dep_directives_t *directives);
+
+// save all server-held files, along with the directives [deps] found in them (replacing
+// the previous index, if any); returns zero on failure
+int workspace_index_write(const char *path, const char *root, file_system_t *fs, dep_graph_t *deps);
+
+#endif /* !__WORKSPACE_INDEX_H__ */
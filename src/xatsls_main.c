@@ -1,6 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "language_server.h"
 
+static void usage(const char *program) {
+  fprintf(stderr, "usage: %s [--stdio | --pipe=PATH | --listen=unix:PATH] [--clientProcessId=PID] [--threads=N]\n\
+  [--coldAfter=SECONDS] [--memoryBudget=MB] [--maxMappings=N]\n", program);
+}
+
 int main(int argc, char **argv) {
-  language_server_loop();
-  return 0;
+  language_server_options_t options = {
+    .transport = LS_TRANSPORT_STDIO,
+    .socket_path = NULL,
+    .parent_process_id = -1,
+    .num_threads = 0,
+    .cold_after = -1,
+    .memory_budget = 0,
+    .max_mappings = 0
+  };
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (!strcmp(arg, "--stdio")) {
+      options.transport = LS_TRANSPORT_STDIO;
+    } else if (!strncmp(arg, "--pipe=", 7) && arg[7] != '\0') {
+      options.transport = LS_TRANSPORT_PIPE;
+      options.socket_path = arg + 7;
+    } else if (!strncmp(arg, "--listen=unix:", 14) && arg[14] != '\0') {
+      options.transport = LS_TRANSPORT_LISTEN;
+      options.socket_path = arg + 14;
+    } else if (!strncmp(arg, "--clientProcessId=", 18)) {
+      options.parent_process_id = atoi(arg + 18);
+    } else if (!strncmp(arg, "--threads=", 10) && atoi(arg + 10) >= 0) {
+      options.num_threads = (size_t)atoi(arg + 10);
+    } else if (!strncmp(arg, "--coldAfter=", 12) && arg[12] >= '0' && arg[12] <= '9') {
+      options.cold_after = atol(arg + 12);
+    } else if (!strncmp(arg, "--memoryBudget=", 15) && atol(arg + 15) > 0) {
+      options.memory_budget = (size_t)atol(arg + 15) << 20;
+    } else if (!strncmp(arg, "--maxMappings=", 14) && atol(arg + 14) > 0) {
+      options.max_mappings = (size_t)atol(arg + 14);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  return language_server_loop(&options);
 }
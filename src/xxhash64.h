@@ -0,0 +1,164 @@
+#ifndef __XXHASH64_H__
+#define __XXHASH64_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// the XXH64 hash function by Yann Collet (https://github.com/Cyan4973/xxHash),
+// in streaming form, so that text split over several fragments
+// (e.g. both sides of a gap) hashes the same as the contiguous text
+
+typedef struct xxh64_state_s {
+  uint64_t total_length;
+  uint64_t v[4];
+  unsigned char mem[32];
+  size_t mem_size;
+  uint64_t seed;
+} xxh64_state_t;
+
+#define XXH64_PRIME1 0x9E3779B185EBCA87ULL
+#define XXH64_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define XXH64_PRIME3 0x165667B19E3779F9ULL
+#define XXH64_PRIME4 0x85EBCA77C2B2AE63ULL
+#define XXH64_PRIME5 0x27D4EB2F165667C5ULL
+
+static inline
+uint64_t xxh64_rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline
+uint64_t xxh64_read64(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v)); // NOTE: assumes a little-endian host
+  return v;
+}
+
+static inline
+uint32_t xxh64_read32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline
+uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+  acc += input * XXH64_PRIME2;
+  acc = xxh64_rotl(acc, 31);
+  return acc * XXH64_PRIME1;
+}
+
+static inline
+uint64_t xxh64_merge_round(uint64_t acc, uint64_t val) {
+  acc ^= xxh64_round(0, val);
+  return acc * XXH64_PRIME1 + XXH64_PRIME4;
+}
+
+static inline
+void xxh64_init(xxh64_state_t *st, uint64_t seed) {
+  memset(st, 0, sizeof(*st));
+  st->seed = seed;
+  st->v[0] = seed + XXH64_PRIME1 + XXH64_PRIME2;
+  st->v[1] = seed + XXH64_PRIME2;
+  st->v[2] = seed;
+  st->v[3] = seed - XXH64_PRIME1;
+}
+
+static inline
+void xxh64_stripe(xxh64_state_t *st, const unsigned char *p) {
+  st->v[0] = xxh64_round(st->v[0], xxh64_read64(p));
+  st->v[1] = xxh64_round(st->v[1], xxh64_read64(p + 8));
+  st->v[2] = xxh64_round(st->v[2], xxh64_read64(p + 16));
+  st->v[3] = xxh64_round(st->v[3], xxh64_read64(p + 24));
+}
+
+static inline
+void xxh64_update(xxh64_state_t *st, const void *data, size_t length) {
+  const unsigned char *p = (const unsigned char *)data;
+  const unsigned char *end = p + length;
+
+  st->total_length += length;
+
+  // not enough for a stripe yet
+  if (st->mem_size + length < 32) {
+    if (length > 0) {
+      memcpy(st->mem + st->mem_size, p, length);
+    }
+    st->mem_size += length;
+    return;
+  }
+
+  // complete the buffered stripe
+  if (st->mem_size > 0) {
+    size_t fill = 32 - st->mem_size;
+    memcpy(st->mem + st->mem_size, p, fill);
+    xxh64_stripe(st, st->mem);
+    p += fill;
+    st->mem_size = 0;
+  }
+
+  while (p + 32 <= end) {
+    xxh64_stripe(st, p);
+    p += 32;
+  }
+
+  if (p < end) {
+    memcpy(st->mem, p, end - p);
+    st->mem_size = end - p;
+  }
+}
+
+static inline
+uint64_t xxh64_digest(const xxh64_state_t *st) {
+  uint64_t h;
+
+  if (st->total_length >= 32) {
+    h = xxh64_rotl(st->v[0], 1) + xxh64_rotl(st->v[1], 7) + xxh64_rotl(st->v[2], 12) + xxh64_rotl(st->v[3], 18);
+    h = xxh64_merge_round(h, st->v[0]);
+    h = xxh64_merge_round(h, st->v[1]);
+    h = xxh64_merge_round(h, st->v[2]);
+    h = xxh64_merge_round(h, st->v[3]);
+  } else {
+    h = st->seed + XXH64_PRIME5;
+  }
+  h += st->total_length;
+
+  const unsigned char *p = st->mem;
+  const unsigned char *end = p + st->mem_size;
+
+  while (p + 8 <= end) {
+    h ^= xxh64_round(0, xxh64_read64(p));
+    h = xxh64_rotl(h, 27) * XXH64_PRIME1 + XXH64_PRIME4;
+    p += 8;
+  }
+  if (p + 4 <= end) {
+    h ^= (uint64_t)xxh64_read32(p) * XXH64_PRIME1;
+    h = xxh64_rotl(h, 23) * XXH64_PRIME2 + XXH64_PRIME3;
+    p += 4;
+  }
+  while (p < end) {
+    h ^= (*p) * XXH64_PRIME5;
+    h = xxh64_rotl(h, 11) * XXH64_PRIME1;
+    p++;
+  }
+
+  // avalanche
+  h ^= h >> 33;
+  h *= XXH64_PRIME2;
+  h ^= h >> 29;
+  h *= XXH64_PRIME3;
+  h ^= h >> 32;
+  return h;
+}
+
+static inline
+uint64_t xxh64(const void *data, size_t length, uint64_t seed) {
+  xxh64_state_t st;
+
+  xxh64_init(&st, seed);
+  xxh64_update(&st, data, length);
+  return xxh64_digest(&st);
+}
+
+#endif /* !__XXHASH64_H__ */
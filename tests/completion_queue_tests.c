@@ -0,0 +1,95 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "completion_queue.h"
+
+#define NUM_PRODUCERS 4
+#define NUM_RESULTS 1000 // per producer
+
+typedef struct result_s {
+  completion_t completion;
+  int producer;
+  int value;
+} result_t;
+
+typedef struct producer_s {
+  completion_queue_t *queue;
+  int index;
+} producer_t;
+
+void *produce(void *arg) {
+  producer_t *producer = (producer_t *)arg;
+
+  for (int i = 0; i < NUM_RESULTS; i++) {
+    result_t *result = malloc(sizeof(result_t));
+    assert(result != NULL);
+    result->producer = producer->index;
+    result->value = i;
+    completion_queue_push(producer->queue, &result->completion);
+  }
+  return NULL;
+}
+
+int readable(completion_queue_t *queue, int timeout) {
+  struct pollfd fds = {completion_queue_fd(queue), POLLIN, 0};
+  return poll(&fds, 1, timeout) == 1;
+}
+
+int main(int argc, char **argv) {
+  completion_queue_t queue;
+  assert(completion_queue_init(&queue));
+
+  // nothing yet
+  assert(!readable(&queue, 0));
+  assert(completion_queue_take(&queue) == NULL);
+
+  // in the order pushed
+  result_t results[3];
+  for (int i = 0; i < 3; i++) {
+    results[i].value = i;
+    completion_queue_push(&queue, &results[i].completion);
+  }
+  assert(readable(&queue, 0));
+  completion_t *completion = completion_queue_take(&queue);
+  for (int i = 0; i < 3; i++) {
+    assert(completion == &results[i].completion);
+    completion = completion->next;
+  }
+  assert(completion == NULL);
+  assert(!readable(&queue, 0));
+
+  // from several threads: each one's results keep their order
+  pthread_t threads[NUM_PRODUCERS];
+  producer_t producers[NUM_PRODUCERS];
+  for (int i = 0; i < NUM_PRODUCERS; i++) {
+    producers[i].queue = &queue;
+    producers[i].index = i;
+    assert(pthread_create(&threads[i], NULL, produce, &producers[i]) == 0);
+  }
+  int next[NUM_PRODUCERS];
+  memset(next, 0, sizeof(next));
+  int taken = 0;
+  while (taken < NUM_PRODUCERS * NUM_RESULTS) {
+    assert(readable(&queue, 5000));
+    completion = completion_queue_take(&queue);
+    while (completion != NULL) {
+      result_t *result = (result_t *)completion;
+      completion = completion->next;
+      assert(result->value == next[result->producer]);
+      next[result->producer]++;
+      taken++;
+      free(result);
+    }
+  }
+  for (int i = 0; i < NUM_PRODUCERS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  assert(completion_queue_take(&queue) == NULL);
+
+  completion_queue_free(&queue);
+  return 0;
+}
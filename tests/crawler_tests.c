@@ -0,0 +1,187 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "crawler.h"
+#include "test_files.h"
+#include "xxhash64.h"
+
+typedef struct crawl_state_s {
+  const char *root;
+  int seen[4];
+  int directories;
+} crawl_state_t;
+
+void crawl_visit(const char *path, const file_digest_t *digest, const dep_directives_t *directives, void *state) {
+  crawl_state_t *cs = (crawl_state_t *)state;
+  static const char *names[] = {"a.dats", "b.sats", "sub/c.hats", "sub/deeper/d.cats"};
+  static const char *contents[] = {"staload \"b.sats\"\nimplement main0 () = ()\n", "fun f (): int\n", "", "int d;\n"};
+
+  size_t root_length = strlen(cs->root);
+  assert(!strncmp(path, cs->root, root_length));
+  if (digest == NULL) {
+    assert(!strcmp(path + root_length, "") || !strcmp(path + root_length, "/sub") || !strcmp(path + root_length, "/sub/deeper"));
+    assert(directives == NULL);
+    cs->directories++;
+    return;
+  }
+  assert(path[root_length] == '/');
+  for (int i = 0; i < 4; i++) {
+    if (!strcmp(path + root_length + 1, names[i])) {
+      cs->seen[i]++;
+      assert(digest->length == strlen(contents[i]));
+      assert(digest->hash == xxh64(contents[i], strlen(contents[i]), 0));
+      // the directives are found as well
+      assert(directives != NULL);
+      if (i == 0) {
+        assert(directives->size == 5 + 6 && !memcmp(directives->data + 5, "b.sats", 6));
+      } else {
+        assert(directives->size == 0);
+      }
+      return;
+    }
+  }
+  fprintf(stderr, "unexpected: %s\n", path);
+  assert(0);
+}
+
+// [max] results at a time (zero: all there are)
+void crawl_all(crawler_t *crawler, size_t max, crawl_state_t *cs) {
+  while (!crawler_done(crawler)) {
+    struct pollfd fds = {crawler_fd(crawler), POLLIN, 0};
+    assert(poll(&fds, 1, 10000) == 1);
+    if (!crawler_has_results(crawler)) {
+      continue; // (woken for results drained already)
+    }
+    size_t count = crawler_drain(crawler, max, crawl_visit, cs);
+    assert(max == 0 || count <= max);
+  }
+}
+
+int main(int argc, char **argv) {
+  assert(crawler_is_source("a.dats", 6) && crawler_is_source("a.cats", 6));
+  assert(!crawler_is_source(".dats", 5) && !crawler_is_source("a.dat", 5) && !crawler_is_source("a.dats~", 7));
+
+  char root[] = "/tmp/crawler_tests_XXXXXX";
+  assert(mkdtemp(root) != NULL);
+
+  write_file(root, "a.dats", "staload \"b.sats\"\nimplement main0 () = ()\n");
+  write_file(root, "b.sats", "fun f (): int\n");
+  write_file(root, "notes.txt", "not a source\n");
+  make_dir(root, "sub");
+  write_file(root, "sub/c.hats", "");
+  make_dir(root, "sub/deeper");
+  write_file(root, "sub/deeper/d.cats", "int d;\n");
+  make_dir(root, ".git");
+  write_file(root, ".git/e.dats", "hidden\n");
+  char target[FILE_URI_MAX];
+  char link[FILE_URI_MAX];
+  snprintf(target, sizeof(target), "%s/sub", root);
+  snprintf(link, sizeof(link), "%s/sub/loop", root);
+  assert(symlink(target, link) == 0);
+
+  crawler_t crawler;
+  crawl_state_t cs;
+  memset(&cs, 0, sizeof(cs));
+  cs.root = root;
+
+  assert(crawler_start(&crawler, root, 3, NULL));
+  crawl_all(&crawler, 0, &cs);
+  for (int i = 0; i < 4; i++) {
+    assert(cs.seen[i] == 1);
+  }
+  assert(cs.directories == 3);
+  size_t num_read = 0;
+  size_t found = 0;
+  crawler_progress(&crawler, &num_read, &found);
+  assert(num_read == 4 && found == 4 && crawler.scanned == 4);
+  assert(!crawler_has_results(&crawler));
+  struct pollfd fds = {crawler_fd(&crawler), POLLIN, 0};
+  assert(poll(&fds, 1, 0) == 0); // no wakeups left
+  assert(crawler_drain(&crawler, 0, crawl_visit, &cs) == 0);
+  crawler_free(&crawler);
+
+  // loaded into a file system, the fingerprints are taken over
+  char path[FILE_URI_MAX];
+  snprintf(path, sizeof(path), "%s/a.dats", root);
+  struct stat st;
+  assert(stat(path, &st) == 0);
+  file_digest_t digest;
+  digest.length = st.st_size;
+  digest.mtime = st.st_mtim;
+  digest.hash = 42; // not what it really is: it can only come from the digest
+
+  file_system_t fs;
+  file_system_init(&fs);
+  file_t *file = file_system_load_known(&fs, path, &digest);
+  assert(file != NULL && file_fingerprint(file) == 42);
+  // (not mapped until read)
+  assert(file->backing == FILE_BACKING_EVICTED && fs.held_mappings == 0);
+  int version = file->version;
+  assert(file_system_load_known(&fs, path, &digest) == file);
+  assert(file->version == version && file_fingerprint(file) == 42);
+  digest.length++; // changed since
+  snprintf(path, sizeof(path), "%s/b.sats", root);
+  file = file_system_load_known(&fs, path, &digest);
+  assert(file != NULL && file_fingerprint(file) == xxh64("fun f (): int\n", 14, 0));
+  assert(file->backing == FILE_BACKING_MAPPED);
+  file_system_free(&fs);
+
+  // with the index of a previous run, unchanged files are not read again (but for their
+  // directives, if it has none)
+  file_system_init(&fs);
+  path_resolver_t resolver;
+  path_resolver_init(&resolver, &fs);
+  dep_graph_t graph;
+  dep_graph_init(&graph, &fs, &resolver);
+  for (int i = 0; i < 4; i++) {
+    static const char *names[] = {"a.dats", "b.sats", "sub/c.hats", "sub/deeper/d.cats"};
+    snprintf(path, sizeof(path), "%s/%s", root, names[i]);
+    file = file_system_load(&fs, path);
+    assert(file != NULL);
+    dep_graph_update(&graph, file);
+  }
+  char index_path[FILE_URI_MAX];
+  snprintf(index_path, sizeof(index_path), "%s/.index", root);
+  for (int with_directives = 0; with_directives < 2; with_directives++) {
+    assert(workspace_index_write(index_path, root, &fs, with_directives ? &graph : NULL));
+
+    workspace_index_t index;
+    assert(workspace_index_open(&index, index_path, root));
+    memset(&cs, 0, sizeof(cs));
+    cs.root = root;
+    // (one at a time: those left keep the descriptor readable)
+    assert(crawler_start(&crawler, root, 2, &index));
+    crawl_all(&crawler, 1, &cs);
+    for (int i = 0; i < 4; i++) {
+      assert(cs.seen[i] == 1);
+    }
+    assert(cs.directories == 3);
+    assert(crawler.reused == 4 && crawler.scanned == (with_directives ? 0 : 4));
+    crawler_free(&crawler);
+    workspace_index_close(&index);
+  }
+  dep_graph_free(&graph);
+  path_resolver_free(&resolver);
+  file_system_free(&fs);
+
+  // nothing there
+  memset(&cs, 0, sizeof(cs));
+  cs.root = "/nonexistent";
+  assert(crawler_start(&crawler, "/nonexistent", 1, NULL));
+  crawl_all(&crawler, 0, &cs);
+  crawler_free(&crawler);
+  assert(!crawler_start(&crawler, "relative", 1, NULL));
+
+  // stopped half-way
+  cs.root = root;
+  assert(crawler_start(&crawler, root, 2, NULL));
+  crawler_free(&crawler);
+
+  remove_tree(root);
+  return 0;
+}
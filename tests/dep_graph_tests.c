@@ -0,0 +1,267 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "dep_graph.h"
+#include "test_files.h"
+
+typedef struct scanned_s {
+  dep_directive_t directives[32];
+  int count;
+} scanned_t;
+
+void collect(const dep_directive_t *directive, void *state) {
+  scanned_t *scanned = (scanned_t *)state;
+  assert(scanned->count < 32);
+  scanned->directives[scanned->count++] = *directive;
+}
+
+// the [n]th directive (not counting other regions) is of [kind], naming [spec]
+int directive_is(const char *text, scanned_t *scanned, int n, dep_kind_t kind, const char *spec) {
+  for (int i = 0; i < scanned->count; i++) {
+    const dep_directive_t *d = &scanned->directives[i];
+    if (d->kind == DEP_OTHER) {
+      continue;
+    }
+    if (n-- == 0) {
+      return d->kind == kind && d->spec_length == strlen(spec) && !memcmp(text + d->spec_offset, spec, d->spec_length);
+    }
+  }
+  return 0;
+}
+
+int count_directives(scanned_t *scanned) {
+  int count = 0;
+  for (int i = 0; i < scanned->count; i++) {
+    count += scanned->directives[i].kind != DEP_OTHER;
+  }
+  return count;
+}
+
+void dep_scan_tests() {
+  scanned_t scanned;
+
+  const char *text =
+    "#staload \"a.sats\"\n"
+    "staload M = \"b.sats\"\n"
+    "staload _ = \"c.dats\"\n"
+    "#include \"d.hats\"\n"
+    "dynload \"e.dats\"\n"
+    "#dynload \"f.dats\"\n"
+    "val x = 'a' and y = '\\n' and z = '\"'\n" // not a string
+    "(* staload \"no.sats\" (* nested *) staload \"no.sats\" *)\n"
+    "/* staload \"no.sats\" */\n"
+    "// staload \"no.sats\"\n"
+    "val s = \"staload \\\"no.sats\\\"\"\n"
+    "%{ staload \"no.sats\" %}\n"
+    "val mystaload = 1 and staloadx = \"no.sats\"\n"
+    "staload\n  N\n  =\n  \"g.sats\"\n"
+    "////\n"
+    "staload \"no.sats\"\n";
+  memset(&scanned, 0, sizeof(scanned));
+  dep_scan(text, strlen(text), collect, &scanned);
+  assert(count_directives(&scanned) == 7);
+  assert(directive_is(text, &scanned, 0, DEP_STALOAD, "a.sats"));
+  assert(directive_is(text, &scanned, 1, DEP_STALOAD, "b.sats"));
+  assert(directive_is(text, &scanned, 2, DEP_STALOAD, "c.dats"));
+  assert(directive_is(text, &scanned, 3, DEP_INCLUDE, "d.hats"));
+  assert(directive_is(text, &scanned, 4, DEP_DYNLOAD, "e.dats"));
+  assert(directive_is(text, &scanned, 5, DEP_DYNLOAD, "f.dats"));
+  assert(directive_is(text, &scanned, 6, DEP_STALOAD, "g.sats"));
+
+  // in order, not overlapping, the whole directive
+  for (int i = 1; i < scanned.count; i++) {
+    assert(scanned.directives[i - 1].end <= scanned.directives[i].start);
+  }
+  assert(scanned.directives[0].start == 0 && scanned.directives[0].end == strlen("#staload \"a.sats\""));
+  // the rest of the file, commented out
+  assert(scanned.directives[scanned.count - 1].end == strlen(text));
+
+  // cut short
+  const char *unclosed[] = {"staload \"a.sats", "staload M =", "(* staload \"a.sats\"", "staload", "\"", "'"};
+  for (size_t i = 0; i < sizeof(unclosed) / sizeof(unclosed[0]); i++) {
+    memset(&scanned, 0, sizeof(scanned));
+    dep_scan(unclosed[i], strlen(unclosed[i]), collect, &scanned);
+    assert(count_directives(&scanned) == 0);
+  }
+  memset(&scanned, 0, sizeof(scanned));
+  dep_scan(NULL, 0, collect, &scanned);
+  assert(scanned.count == 0);
+}
+
+/* ****** ****** */
+
+char root[] = "/tmp/dep_graph_tests_XXXXXX";
+
+file_t *load(file_system_t *fs, const char *name) {
+  char path[FILE_URI_MAX];
+  snprintf(path, sizeof(path), "%s/%s", root, name);
+  file_t *file = file_system_load(fs, path);
+  assert(file != NULL);
+  return file;
+}
+
+path_id_t id_of(file_system_t *fs, const char *name) {
+  char path[FILE_URI_MAX];
+  snprintf(path, sizeof(path), "%s/%s", root, name);
+  return path_table_find(&fs->paths, path, strlen(path));
+}
+
+typedef struct affected_s {
+  path_id_t ids[16];
+  int count;
+  int stop_after;
+} affected_t;
+
+int collect_affected(path_id_t id, void *state) {
+  affected_t *affected = (affected_t *)state;
+  assert(affected->count < 16);
+  affected->ids[affected->count++] = id;
+  return affected->stop_after == 0 || affected->count < affected->stop_after;
+}
+
+// the files affected by a change to [name]
+affected_t *affected_by(dep_graph_t *graph, const char *name) {
+  static affected_t affected;
+  memset(&affected, 0, sizeof(affected));
+  path_id_t id = id_of(graph->fs, name);
+  assert(dep_graph_affected(graph, &id, 1, collect_affected, &affected) == (size_t)affected.count);
+  return &affected;
+}
+
+int has(affected_t *affected, file_system_t *fs, const char *name) {
+  path_id_t id = id_of(fs, name);
+  for (int i = 0; i < affected->count; i++) {
+    if (affected->ids[i] == id) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+file_edit_t file_edit_make(int start_line, int start_char, int end_line, int end_char, const char *text) {
+  file_edit_t edit = {start_line, start_char, end_line, end_char, text, strlen(text)};
+  return edit;
+}
+
+void dep_graph_tests() {
+  assert(mkdtemp(root) != NULL);
+  write_file(root, "a.sats", "fun a (): int\n");
+  write_file(root, "b.sats", "staload \"./a.sats\"\nfun b (): int\n");
+  write_file(root, "c.dats", "#staload \"b.sats\"\n#include \"d.hats\"\nstaload \"missing.sats\"\nimplement main0 () = ()\n");
+  write_file(root, "d.hats", "(* staload \"a.sats\" *)\n");
+  write_file(root, "e.dats", "staload \"c.dats\"\nstaload \"e.dats\"\n"); // and itself
+
+  file_system_t fs;
+  file_system_init(&fs);
+  path_resolver_t resolver;
+  path_resolver_init(&resolver, &fs);
+  dep_graph_t graph;
+  dep_graph_init(&graph, &fs, &resolver);
+
+  const char *names[] = {"a.sats", "b.sats", "c.dats", "d.hats", "e.dats"};
+  for (int i = 0; i < 5; i++) {
+    file_t *file = load(&fs, names[i]);
+    assert(dep_graph_update(&graph, file) == (i != 0 && i != 3));
+  }
+  assert(graph.scans == 5);
+
+  const path_id_t *deps;
+  assert(dep_graph_dependencies(&graph, id_of(&fs, "a.sats"), &deps) == 0);
+  assert(dep_graph_dependencies(&graph, id_of(&fs, "b.sats"), &deps) == 1 && deps[0] == id_of(&fs, "a.sats"));
+  assert(dep_graph_dependencies(&graph, id_of(&fs, "c.dats"), &deps) == 2);
+  assert(dep_graph_dependencies(&graph, id_of(&fs, "e.dats"), &deps) == 1 && deps[0] == id_of(&fs, "c.dats"));
+  assert(dep_graph_dependents(&graph, id_of(&fs, "d.hats"), &deps) == 1 && deps[0] == id_of(&fs, "c.dats"));
+  assert(graph.nodes[id_of(&fs, "c.dats")].unresolved == 1);
+
+  // transitively, nearest first
+  affected_t *affected = affected_by(&graph, "a.sats");
+  assert(affected->count == 3);
+  assert(affected->ids[0] == id_of(&fs, "b.sats") && affected->ids[1] == id_of(&fs, "c.dats") && affected->ids[2] == id_of(&fs, "e.dats"));
+  affected = affected_by(&graph, "d.hats");
+  assert(affected->count == 2 && has(affected, &fs, "c.dats") && has(affected, &fs, "e.dats"));
+  assert(affected_by(&graph, "e.dats")->count == 0);
+  // several at once, each once
+  path_id_t ids[] = {id_of(&fs, "a.sats"), id_of(&fs, "d.hats"), id_of(&fs, "b.sats")};
+  affected_t many = {{0}, 0, 0};
+  assert(dep_graph_affected(&graph, ids, 3, collect_affected, &many) == 2);
+  assert(has(&many, &fs, "c.dats") && has(&many, &fs, "e.dats"));
+  // stopped early
+  many.count = 0;
+  many.stop_after = 1;
+  assert(dep_graph_affected(&graph, ids, 1, collect_affected, &many) == 1);
+
+  // unchanged on disk: not scanned again
+  file_t *c = file_system_find(&fs, id_of(&fs, "c.dats"));
+  assert(dep_graph_update(&graph, c) == 0);
+  assert(graph.scans == 5 && graph.skipped == 1);
+
+  // opened by the client: edits away from the directives are replayed
+  char uri[FILE_URI_MAX];
+  snprintf(uri, sizeof(uri), "file://%s/c.dats", root);
+  file_system_open(&fs, uri, 1, "#staload \"b.sats\"\n#include \"d.hats\"\nstaload \"missing.sats\"\nimplement main0 () = ()\n", 83);
+  assert(c == file_system_lookup(&fs, uri));
+  assert(dep_graph_update(&graph, c) == 0);
+  assert(graph.scans == 6);
+  file_edit_t edit = file_edit_make(3, 22, 3, 24, "println! 1");
+  assert(file_system_change(&fs, uri, 2, &edit, 1));
+  edit = file_edit_make(3, 0, 3, 0, "\n\n");
+  assert(file_system_change(&fs, uri, 3, &edit, 1));
+  assert(dep_graph_settled(&graph, c));
+  assert(dep_graph_update(&graph, c) == 0);
+  assert(graph.scans == 6 && graph.skipped == 2);
+  assert(graph.nodes[c->path_id].version == 3);
+
+  // ... but not those that may bring in, or take out, a directive
+  edit = file_edit_make(5, 0, 5, 0, "(* ");
+  assert(file_system_change(&fs, uri, 4, &edit, 1));
+  assert(!dep_graph_settled(&graph, c));
+  assert(!graph.nodes[c->path_id].scanned); // (left to be scanned, not replayed again)
+  assert(dep_graph_update(&graph, c) == 0);
+  assert(graph.scans == 7 && graph.nodes[c->path_id].version == 4);
+  edit = file_edit_make(5, 0, 5, 3, "");
+  assert(file_system_change(&fs, uri, 5, &edit, 1));
+  edit = file_edit_make(0, 0, 1, 0, ""); // drop the #staload
+  assert(file_system_change(&fs, uri, 6, &edit, 1));
+  assert(dep_graph_update(&graph, c) == 1);
+  assert(graph.scans == 8);
+  affected = affected_by(&graph, "a.sats");
+  assert(affected->count == 1 && has(affected, &fs, "b.sats"));
+  edit = file_edit_make(3, 0, 3, 0, "staloa \"b.sats\"\n");
+  assert(file_system_change(&fs, uri, 7, &edit, 1));
+  assert(dep_graph_update(&graph, c) == 0);
+  edit = file_edit_make(3, 6, 3, 6, "d"); // makes a keyword
+  assert(file_system_change(&fs, uri, 8, &edit, 1));
+  assert(dep_graph_update(&graph, c) == 1);
+  assert(affected_by(&graph, "a.sats")->count == 3);
+
+  // a missing file shows up
+  write_file(root, "missing.sats", "");
+  char path[FILE_URI_MAX];
+  snprintf(path, sizeof(path), "%s/missing.sats", root);
+  path_resolver_invalidate(&resolver, path, strlen(path));
+  assert(dep_graph_retry_unresolved(&graph) == 1);
+  assert(dep_graph_dependents(&graph, id_of(&fs, "missing.sats"), &deps) == 1 && deps[0] == c->path_id);
+  assert(dep_graph_retry_unresolved(&graph) == 0);
+
+  // gone
+  dep_graph_remove(&graph, c->path_id);
+  assert(dep_graph_dependencies(&graph, c->path_id, &deps) == 0);
+  assert(dep_graph_dependents(&graph, id_of(&fs, "b.sats"), &deps) == 0);
+  assert(dep_graph_dependents(&graph, c->path_id, &deps) == 1); // e.dats still names it
+  assert(affected_by(&graph, "a.sats")->count == 1);
+
+  dep_graph_free(&graph);
+  path_resolver_free(&resolver);
+  file_system_free(&fs);
+  remove_tree(root);
+}
+
+int main(int argc, char **argv) {
+  dep_scan_tests();
+  dep_graph_tests();
+  return 0;
+}
@@ -1,8 +1,12 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "file_system.h"
+#include "test_files.h"
+#include "xxhash64.h"
 
 /* ****** ****** */
 
@@ -42,9 +46,23 @@ void file_uri_tests() {
   file_uri_parses_nope("file:///file/ with spaces/textfile"); // malformed
   file_uri_parses_nope("file://example.com/something.txt"); // non-local URI: unsupported!
   file_uri_parses_nope("file://example.com/something.txt"); // non-local URI: unsupported!
+  file_uri_parses_okay("file:///some/./dir//file.txt", "/some/dir/file.txt");
+  file_uri_parses_okay("file:///some/dir./.file.txt", "/some/dir./.file.txt");
   file_uri_parses_nope("file://./file.txt"); // relative path
+  file_uri_parses_nope("file:///some/dir/%2E%2E/file.txt"); // relative path
   file_uri_parses_nope("file:///some/dir/../../file.txt"); // relative path
   file_uri_parses_nope("file://file.txt"); // relative path
+
+  // and back
+  char uri[FILE_URI_MAX], path[FILE_URI_MAX];
+  assert(file_uri_make("/home/someone/Projects Something/a_b-c~d.txt", uri, sizeof(uri)) > 0);
+  assert(!strcmp(uri, "file:///home/someone/Projects%20Something/a_b-c~d.txt"));
+  assert(file_uri_parse(uri, path) > 0 && !strcmp(path, "/home/someone/Projects Something/a_b-c~d.txt"));
+  assert(file_uri_make("/50%#?", uri, sizeof(uri)) > 0);
+  assert(!strcmp(uri, "file:///50%25%23%3F"));
+  assert(file_uri_make("relative", uri, sizeof(uri)) == 0);
+  assert(file_uri_make("/abc", uri, 11) == 0);
+  assert(file_uri_make("/abc", uri, 12) == 11);
 }
 
 /* ****** ****** */
@@ -116,10 +134,575 @@ void file_system_multi_lifecycle() {
 
 /* ****** ****** */
 
+typedef struct file_text_s {
+  char   text[65536];
+  size_t length;
+} file_text_t;
+
+int file_text_read(char *buffer, size_t length, void *state) {
+  file_text_t *ft = (file_text_t *)state;
+
+  assert(ft->length + length < sizeof(ft->text));
+  memcpy(ft->text + ft->length, buffer, length);
+  ft->length += length;
+  ft->text[ft->length] = '\0';
+  return 1;
+}
+
+int file_text_is(file_system_t *fs, file_t *file, const char *expected) {
+  file_text_t ft;
+
+  ft.length = 0;
+  ft.text[0] = '\0';
+  file_read(fs, file, file_text_read, &ft);
+  if (strcmp(ft.text, expected)) {
+    fprintf(stderr, "EXPECTED: %s\nACTUAL: %s\n", expected, ft.text);
+    return 0;
+  }
+  return 1;
+}
+
+file_edit_t file_edit_make(int start_line, int start_char, int end_line, int end_char, const char *text) {
+  file_edit_t edit = {start_line, start_char, end_line, end_char, text, text != NULL ? strlen(text) : 0};
+  return edit;
+}
+
+int count_changes(const file_change_t *change, void *state) {
+  (*(int *)state)++;
+  return 1;
+}
+
+void file_system_journal() {
+  const char *uri = "file:///foo/journal.dats";
+  const char *contents = "val x = 1\nval y = 2\n";
+  file_system_t fs;
+
+  file_system_init(&fs);
+  file_system_open(&fs, uri, 1, contents, strlen(contents));
+
+  file_t *file = file_system_lookup(&fs, uri);
+  assert(file != NULL);
+
+  // v2: insert a line before the second one
+  file_edit_t edit2 = file_edit_make(1, 0, 1, 0, "val z = 3\n");
+  assert(file_system_change(&fs, uri, 2, &edit2, 1));
+  assert(file_text_is(&fs, file, "val x = 1\nval z = 3\nval y = 2\n"));
+
+  // v3: replace "1" with "100" on the first line
+  file_edit_t edit3 = file_edit_make(0, 8, 0, 9, "100");
+  assert(file_system_change(&fs, uri, 3, &edit3, 1));
+  assert(file_text_is(&fs, file, "val x = 100\nval z = 3\nval y = 2\n"));
+
+  int num = 0;
+  assert(file_journal_changes(file, 1, count_changes, &num) && num == 2);
+  num = 0;
+  assert(file_journal_changes(file, 2, count_changes, &num) && num == 1);
+  num = 0;
+  assert(file_journal_changes(file, 3, count_changes, &num) && num == 0);
+
+  // "y" as computed against v1 is now on the third line
+  text_position_t pos = {1, 4};
+  assert(file_journal_map_position(file, 1, &pos));
+  assert(pos.line_num == 2 && pos.char_num == 4);
+
+  // "1" as computed against v2 was replaced: moves to the start of the range
+  pos.line_num = 0;
+  pos.char_num = 8;
+  assert(file_journal_map_position(file, 2, &pos));
+  assert(pos.line_num == 0 && pos.char_num == 8);
+
+  // end of the first line, as computed against v1
+  pos.line_num = 0;
+  pos.char_num = 9;
+  assert(file_journal_map_position(file, 1, &pos));
+  assert(pos.line_num == 0 && pos.char_num == 11);
+
+  // byte offset of "y" in v1 is 14; the text before it grew by 12 bytes
+  size_t offset = 14;
+  assert(file_journal_map_offset(file, 1, &offset));
+  assert(offset == 26);
+
+  // replacing the whole text only records what actually changed
+  file_edit_t edit4 = file_edit_make(-1, -1, -1, -1, "val w = 4\n");
+  assert(file_system_change(&fs, uri, 4, &edit4, 1));
+  assert(file_text_is(&fs, file, "val w = 4\n"));
+  num = 0;
+  assert(file_journal_changes(file, 3, count_changes, &num) && num == 1);
+  pos.line_num = 2;
+  pos.char_num = 4;
+  assert(file_journal_map_position(file, 3, &pos));
+  assert(pos.line_num == 0 && pos.char_num == 4);
+  pos.line_num = 2;
+  pos.char_num = 9;
+  assert(file_journal_map_position(file, 3, &pos));
+  assert(pos.line_num == 0 && pos.char_num == 9);
+
+  file_system_free(&fs);
+}
+
+void file_system_batch_check(const char *contents, file_edit_t *edits, size_t num_edits, const char *expected) {
+  const char *uri = "file:///foo/batch.dats";
+  file_system_t fs;
+
+  file_system_init(&fs);
+  file_system_open(&fs, uri, 1, contents, strlen(contents));
+
+  file_t *file = file_system_lookup(&fs, uri);
+  assert(file != NULL);
+  assert(file_system_change(&fs, uri, 2, edits, num_edits));
+  assert(file_text_is(&fs, file, expected));
+  assert(file->version == 2);
+
+  file_system_close(&fs, uri);
+  file_system_free(&fs);
+}
+
+void file_system_batches() {
+  // in reverse document order
+  {
+    file_edit_t edits[] = {
+      file_edit_make(2, 0, 2, 3, "C3"),
+      file_edit_make(1, 1, 1, 2, "XY\nZ"),
+      file_edit_make(0, 0, 0, 0, "pre ")
+    };
+    file_system_batch_check("aaa\nbbb\nccc\n", edits, 3, "pre aaa\nbXY\nZb\nC3\n");
+  }
+  // in reverse document order, on the same line
+  {
+    file_edit_t edits[] = {
+      file_edit_make(1, 2, 1, 3, "!"),
+      file_edit_make(1, 0, 1, 1, "x\ny"),
+      file_edit_make(0, 3, 1, 0, NULL)
+    };
+    file_system_batch_check("aaa\nbbb\n", edits, 3, "aaax\nyb!\n");
+  }
+  // in reverse document order, touching each other
+  {
+    file_edit_t edits[] = {
+      file_edit_make(0, 2, 0, 2, "2"),
+      file_edit_make(0, 2, 0, 2, "1"),
+      file_edit_make(0, 0, 0, 2, "")
+    };
+    file_system_batch_check("abc", edits, 3, "12c");
+  }
+  // in document order, each in terms of the text after the previous one
+  {
+    file_edit_t edits[] = {
+      file_edit_make(0, 0, 0, 1, "A"),
+      file_edit_make(1, 0, 1, 0, "B\n"),
+      file_edit_make(2, 3, 2, 3, "!")
+    };
+    file_system_batch_check("aaa\nbbb\n", edits, 3, "Aaa\nB\nbbb!\n");
+  }
+  // out of order
+  {
+    file_edit_t edits[] = {
+      file_edit_make(1, 0, 1, 1, "B"),
+      file_edit_make(0, 0, 0, 1, "A"),
+      file_edit_make(1, 2, 1, 3, "C")
+    };
+    file_system_batch_check("aaa\nbbb\n", edits, 3, "Aaa\nBbC\n");
+  }
+}
+
+int last_change(const file_change_t *change, void *state) {
+  *(file_change_t *)state = *change;
+  return 1;
+}
+
+void file_system_full_sync() {
+  const char *uri = "file:///foo/full.dats";
+  static char contents[30001];
+  file_system_t fs;
+
+  for (int i = 0; i < 3000; i++) {
+    snprintf(contents + i * 10, 11, "line %04d\n", i);
+  }
+  file_system_init(&fs);
+  file_system_open(&fs, uri, 1, contents, strlen(contents));
+
+  file_t *file = file_system_lookup(&fs, uri);
+  assert(file != NULL);
+
+  gapbuf_t *first = file->text.start.next;
+  gapbuf_t *last = file->text.end.prev;
+  assert(first != last);
+
+  // change a single character in the middle
+  contents[1500 * 10 + 7] = 'X';
+  file_edit_t edit = file_edit_make(-1, -1, -1, -1, contents);
+  assert(file_system_change(&fs, uri, 2, &edit, 1));
+  assert(file_text_is(&fs, file, contents));
+
+  // the gapbuffers at both ends were not touched
+  assert(file->text.start.next == first && file->text.end.prev == last);
+
+  file_change_t change;
+  int num = 0;
+  assert(file_journal_changes(file, 1, count_changes, &num) && num == 1);
+  assert(file_journal_changes(file, 1, last_change, &change));
+  assert(change.start_offset == 15007 && change.old_length == 1 && change.new_length == 1);
+  assert(change.start.line_num == 1500 && change.start.char_num == 7);
+  assert(change.old_end.line_num == 1500 && change.old_end.char_num == 8);
+  assert(change.new_end.line_num == 1500 && change.new_end.char_num == 8);
+
+  // the same text again: nothing to do
+  assert(file_system_change(&fs, uri, 3, &edit, 1));
+  num = 0;
+  assert(file_journal_changes(file, 2, count_changes, &num) && num == 0);
+
+  // shrink to a prefix, then grow back
+  file_edit_t shrink = file_edit_make(-1, -1, -1, -1, "line 0000\n");
+  assert(file_system_change(&fs, uri, 4, &shrink, 1));
+  assert(file_text_is(&fs, file, "line 0000\n"));
+  assert(file_system_change(&fs, uri, 5, &edit, 1));
+  assert(file_text_is(&fs, file, contents));
+
+  // multibyte characters: the common prefix must not split a codepoint
+  file_edit_t utf8_1 = file_edit_make(-1, -1, -1, -1, "x\320\277y");
+  file_edit_t utf8_2 = file_edit_make(-1, -1, -1, -1, "x\320\260y");
+  assert(file_system_change(&fs, uri, 6, &utf8_1, 1));
+  assert(file_system_change(&fs, uri, 7, &utf8_2, 1));
+  assert(file_text_is(&fs, file, "x\320\260y"));
+  assert(file_journal_changes(file, 6, last_change, &change));
+  assert(change.start_offset == 1 && change.old_length == 2 && change.new_length == 2);
+  assert(change.start.char_num == 1 && change.old_end.char_num == 2);
+
+  file_system_free(&fs);
+}
+
+void file_system_server_held() {
+  char path[] = "/tmp/file_system_tests_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  write_bytes(path, "on disk\n", strlen("on disk\n"));
+
+  char uri[FILE_URI_MAX];
+  snprintf(uri, sizeof(uri), "file://%s", path);
+
+  file_system_t fs;
+  file_system_init(&fs);
+
+  file_t *file = file_system_load(&fs, path);
+  assert(file != NULL && file->open_count == 0 && file->backing == FILE_BACKING_MAPPED);
+  assert(file_text_is(&fs, file, "on disk\n"));
+  uint64_t fingerprint = file_fingerprint(file);
+  assert(file_system_lookup(&fs, uri) == file);
+
+  // server-held files can not be edited
+  file_edit_t edit = file_edit_make(0, 0, 0, 0, "edited ");
+  assert(!file_system_change(&fs, uri, 2, &edit, 1));
+
+  // once opened, the client's text is what counts
+  file_system_open(&fs, uri, 1, "in editor\n", strlen("in editor\n"));
+  assert(file_system_lookup(&fs, uri) == file);
+  assert(file->open_count == 1 && file->backing == FILE_BACKING_TEXT);
+  assert(file_system_change(&fs, uri, 2, &edit, 1));
+  assert(file_text_is(&fs, file, "edited in editor\n"));
+
+  // another client opens it too: its text is kept, and one close is not enough
+  file_system_open(&fs, uri, 1, "other editor\n", strlen("other editor\n"));
+  assert(file->open_count == 2 && file_text_is(&fs, file, "other editor\n"));
+  file_system_close(&fs, uri);
+  assert(file->open_count == 1 && file->backing == FILE_BACKING_TEXT);
+  assert(file_text_is(&fs, file, "other editor\n"));
+
+  // ... until it is closed
+  file_system_close(&fs, uri);
+  assert(file_system_lookup(&fs, uri) == file);
+  assert(file->open_count == 0 && file->backing == FILE_BACKING_MAPPED);
+  assert(file_text_is(&fs, file, "on disk\n"));
+  assert(file_fingerprint(file) == fingerprint);
+
+  // changed on disk
+  write_bytes(path, "", 0);
+  assert(file_system_refresh(&fs, file));
+  assert(file_text_is(&fs, file, ""));
+  write_bytes(path, "changed on disk\n", strlen("changed on disk\n"));
+  assert(file_system_refresh(&fs, file));
+  assert(file_text_is(&fs, file, "changed on disk\n"));
+  assert(file_fingerprint(file) != fingerprint);
+
+  // truncated in place, and read before it is refreshed: mapped again (reading the old
+  // mapping would fault)
+  int version = file->version;
+  write_bytes(path, "", 0);
+  assert(file_text_is(&fs, file, ""));
+  assert(file->version == version + 1 && file_fingerprint(file) == xxh64(NULL, 0, 0));
+  write_bytes(path, "changed on disk\n", strlen("changed on disk\n"));
+  assert(file_system_refresh(&fs, file));
+
+  // gone from disk
+  assert(file_system_find_path(&fs, path) == file);
+  unlink(path);
+  assert(!file_system_refresh(&fs, file));
+  assert(file_system_unload(&fs, file));
+  assert(file_system_find_path(&fs, path) == NULL && file_system_lookup(&fs, uri) == NULL);
+  assert(file_system_load(&fs, "/nonexistent/file.dats") == NULL);
+
+  file_system_free(&fs);
+}
+
+void file_system_budget() {
+  char paths[3][32];
+  for (int i = 0; i < 3; i++) {
+    strcpy(paths[i], "/tmp/file_system_tests_XXXXXX");
+    int fd = mkstemp(paths[i]);
+    assert(fd >= 0);
+    close(fd);
+    write_bytes(paths[i], "0123456789\n", strlen("0123456789\n"));
+  }
+
+  file_system_t fs;
+  file_system_init(&fs);
+  fs.memory_budget = 25; // two files fit
+
+  file_t *files[3];
+  for (int i = 0; i < 3; i++) {
+    files[i] = file_system_load(&fs, paths[i]);
+    assert(files[i] != NULL);
+  }
+  // the least recently used went first
+  assert(files[0]->backing == FILE_BACKING_EVICTED);
+  assert(files[1]->backing == FILE_BACKING_MAPPED && files[2]->backing == FILE_BACKING_MAPPED);
+  assert(fs.held_memory == 22 && fs.metrics.evictions == 1 && fs.metrics.evicted_bytes == 11);
+  uint64_t fingerprint = file_fingerprint(files[0]);
+  assert(fingerprint == file_fingerprint(files[1]));
+
+  // reading it maps it again (evicting the next in line), nothing else changes
+  int version = files[0]->version;
+  assert(file_text_is(&fs, files[0], "0123456789\n"));
+  assert(files[0]->backing == FILE_BACKING_MAPPED && files[0]->version == version);
+  assert(file_fingerprint(files[0]) == fingerprint);
+  assert(files[1]->backing == FILE_BACKING_EVICTED && fs.metrics.reloads == 1);
+
+  // using a file keeps it around
+  assert(file_system_load(&fs, paths[2]) == files[2]);
+  assert(file_text_is(&fs, files[1], "0123456789\n"));
+  assert(files[0]->backing == FILE_BACKING_EVICTED && files[2]->backing == FILE_BACKING_MAPPED);
+
+  // client-opened files do not count, and are never evicted
+  char uri[FILE_URI_MAX];
+  snprintf(uri, sizeof(uri), "file://%s", paths[1]);
+  file_system_open(&fs, uri, 1, "in editor\n", strlen("in editor\n"));
+  assert(fs.held_memory == 11);
+  assert(file_text_is(&fs, files[0], "0123456789\n"));
+  assert(files[1]->backing == FILE_BACKING_TEXT && fs.held_memory == 22);
+
+  // changed on disk while evicted
+  fs.memory_budget = 1;
+  assert(file_system_refresh(&fs, files[2]));
+  assert(files[0]->backing == FILE_BACKING_EVICTED);
+  write_bytes(paths[0], "changed\n", strlen("changed\n"));
+  version = files[0]->version;
+  assert(file_text_is(&fs, files[0], "changed\n"));
+  assert(files[0]->version == version + 1 && file_fingerprint(files[0]) != fingerprint);
+
+  // gone from disk while evicted
+  assert(files[2]->backing == FILE_BACKING_EVICTED);
+  unlink(paths[2]);
+  assert(file_text_is(&fs, files[2], ""));
+
+  // as many mappings as allowed, whatever their size
+  unlink(paths[1]);
+  write_bytes(paths[2], "0123456789\n", strlen("0123456789\n"));
+  file_system_free(&fs);
+  file_system_init(&fs);
+  fs.memory_budget = 0;
+  fs.max_mappings = 2;
+  for (int i = 0; i < 3; i++) {
+    files[i] = file_system_load(&fs, paths[i == 1 ? 2 : i]);
+    assert(files[i] != NULL && fs.held_mappings <= 2);
+  }
+  assert(fs.metrics.evictions == 0 && files[1] == files[2]);
+  write_bytes(paths[1], "", 0);
+  files[1] = file_system_load(&fs, paths[1]); // (empty: no mapping)
+  assert(files[1] != NULL && fs.held_mappings == 2 && fs.metrics.evictions == 0);
+  fs.max_mappings = 1;
+  assert(file_system_refresh(&fs, files[0]));
+  assert(fs.held_mappings == 1 && files[2]->backing == FILE_BACKING_EVICTED);
+  assert(file_text_is(&fs, files[2], "0123456789\n"));
+  assert(fs.held_mappings == 1 && files[0]->backing == FILE_BACKING_EVICTED);
+
+  unlink(paths[0]);
+  unlink(paths[1]);
+  unlink(paths[2]);
+  file_system_free(&fs);
+}
+
+typedef struct file_search_state_s {
+  file_t *files[2];
+  size_t counts[2];
+  size_t last_offset[2];
+} file_search_state_t;
+
+int file_search_collect(file_t *file, const text_match_t *matches, size_t count, void *state) {
+  file_search_state_t *st = (file_search_state_t *)state;
+  int i = file == st->files[0] ? 0 : 1;
+
+  assert(file == st->files[i]);
+  for (size_t j = 0; j < count; j++) {
+    // in order, per file
+    assert(st->counts[i] == 0 || matches[j].offset > st->last_offset[i]);
+    st->last_offset[i] = matches[j].offset;
+    st->counts[i]++;
+  }
+  return 1;
+}
+
+void file_system_search_all() {
+  file_system_t fs;
+  file_system_init(&fs);
+
+  char text[4096];
+  for (size_t i = 0; i < sizeof(text); i++) {
+    text[i] = i % 64 == 63 ? '\n' : 'a' + i % 7;
+  }
+  file_system_open(&fs, "file:///a.dats", 1, text, sizeof(text));
+  file_system_open(&fs, "file:///b.dats", 1, "abcdefg", 7);
+
+  file_search_state_t st = {{file_system_lookup(&fs, "file:///a.dats"), file_system_lookup(&fs, "file:///b.dats")}, {0, 0}};
+  size_t expected = 0;
+  for (size_t i = 0; i + 3 <= sizeof(text); i++) {
+    expected += !memcmp(text + i, "cde", 3);
+  }
+  assert(file_system_search(&fs, "cde", 3, file_search_collect, &st) == expected + 1);
+  assert(st.counts[0] == expected && st.counts[1] == 1);
+  assert(file_system_search(&fs, "x", 1, file_search_collect, &st) == 0);
+
+  file_system_free(&fs);
+}
+
+void file_system_cold() {
+  file_system_t fs;
+  file_system_init(&fs);
+  assert(fs.cold_after == FILE_COLD_AFTER);
+  assert(file_system_idle_timeout(&fs) == -1);
+
+  file_system_open(&fs, "file:///a.dats", 1, "idle\n", 5);
+  file_system_open(&fs, "file:///b.dats", 1, "busy\n", 5);
+  file_t *a = file_system_lookup(&fs, "file:///a.dats");
+  file_t *b = file_system_lookup(&fs, "file:///b.dats");
+  uint64_t fingerprint = file_fingerprint(a);
+
+  assert(file_system_compress_idle(&fs) == 0);
+  int timeout = file_system_idle_timeout(&fs);
+  assert(timeout > (FILE_COLD_AFTER - 1) * 1000 && timeout <= FILE_COLD_AFTER * 1000);
+  a->last_access.tv_sec -= FILE_COLD_AFTER;
+  assert(file_system_idle_timeout(&fs) == 0);
+  assert(file_system_compress_idle(&fs) == 1);
+  assert(a->text.is_cold && !b->text.is_cold);
+  assert(file_fingerprint(a) == fingerprint);
+  // (only [b] is left to go cold)
+  assert(fs.idle_head == b && fs.idle_tail == b);
+  assert(file_system_idle_timeout(&fs) > 0);
+
+  // used again
+  file_edit_t edit = file_edit_make(0, 4, 0, 4, "!");
+  assert(file_system_change(&fs, "file:///a.dats", 2, &edit, 1));
+  assert(!a->text.is_cold);
+  assert(file_text_is(&fs, a, "idle!\n"));
+  assert(file_system_compress_idle(&fs) == 0);
+
+  // closed: nothing left to compress
+  file_system_close(&fs, "file:///b.dats");
+  assert(fs.idle_head == a && fs.idle_tail == a);
+
+  fs.cold_after = 0;
+  a->last_access.tv_sec -= FILE_COLD_AFTER;
+  assert(file_system_compress_idle(&fs) == 0);
+  assert(file_system_idle_timeout(&fs) == -1);
+
+  file_system_free(&fs);
+}
+
+void file_system_many() {
+  file_system_t fs;
+  file_system_init(&fs);
+
+  // enough to grow the table several times (migrating along the way)
+  const int count = 2000;
+  char uri[64];
+  for (int i = 0; i < count; i++) {
+    snprintf(uri, sizeof(uri), "file:///many/%d.dats", i);
+    file_system_open(&fs, uri, i, "", 0);
+    assert(file_system_lookup(&fs, uri) != NULL);
+  }
+  for (int i = 0; i < count; i++) {
+    snprintf(uri, sizeof(uri), "file:///many/%d.dats", i);
+    file_t *file = file_system_lookup(&fs, uri);
+    assert(file != NULL && file->version == i);
+  }
+  assert(fs.table.count + fs.table.old_count == count);
+  assert(fs.table.count * 8 <= fs.table.capacity * 7);
+
+  // removal shifts entries back; all the others must still be found
+  for (int i = 0; i < count; i += 3) {
+    snprintf(uri, sizeof(uri), "file:///many/%d.dats", i);
+    file_system_close(&fs, uri);
+  }
+  for (int i = 0; i < count; i++) {
+    snprintf(uri, sizeof(uri), "file:///many/%d.dats", i);
+    file_t *file = file_system_lookup(&fs, uri);
+    assert(i % 3 == 0 ? file == NULL : file != NULL && file->version == i);
+  }
+  assert(file_system_lookup(&fs, "file:///many/x.dats") == NULL);
+
+  char path[64];
+  file_t *file = file_system_lookup(&fs, "file:///many/1.dats");
+  assert(file_path(&fs, file, path, sizeof(path)) == strlen("/many/1.dats"));
+  assert(!strcmp(path, "/many/1.dats"));
+
+  file_system_free(&fs);
+}
+
+void file_system_uri_cache() {
+  file_system_t fs;
+  file_system_init(&fs);
+
+  const char *uri = "file:///cache/a.dats", *encoded = "file:///cache/%61.dats";
+  file_system_open(&fs, uri, 1, "a", 1);
+  file_t *file = file_system_lookup(&fs, uri);
+  assert(file != NULL);
+
+  size_t cached = 0;
+  for (size_t i = 0; i < FILE_URI_CACHE_SIZE; i++) {
+    cached += fs.uri_cache[i].file == file;
+  }
+  assert(cached == 1);
+
+  // another spelling of the same path gets its own entry
+  assert(file_system_lookup(&fs, encoded) == file);
+  assert(file_system_lookup(&fs, encoded) == file);
+  assert(file_system_lookup(&fs, uri) == file);
+
+  // removing the file forgets all of them
+  file_system_close(&fs, encoded);
+  for (size_t i = 0; i < FILE_URI_CACHE_SIZE; i++) {
+    assert(fs.uri_cache[i].file == NULL);
+  }
+  assert(file_system_lookup(&fs, uri) == NULL);
+  assert(file_system_lookup(&fs, encoded) == NULL);
+
+  file_system_free(&fs);
+}
+
+/* ****** ****** */
+
 int main(int argc, char **argv) {
   file_uri_tests();
   file_system_simple_lifecycle();
   file_system_multi_lifecycle();
+  file_system_journal();
+  file_system_batches();
+  file_system_full_sync();
+  file_system_server_held();
+  file_system_budget();
+  file_system_search_all();
+  file_system_cold();
+  file_system_many();
+  file_system_uri_cache();
 
   return 0;
 }
@@ -0,0 +1,192 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "file_watcher.h"
+#include "file_system.h"
+#include "test_files.h"
+
+typedef struct changes_s {
+  char paths[16][FILE_URI_MAX];
+  int count;
+} changes_t;
+
+void collect(const char *path, void *state) {
+  changes_t *changes = (changes_t *)state;
+  assert(changes->count < 16);
+  strcpy(changes->paths[changes->count++], path);
+}
+
+int changed(changes_t *changes, const char *dir, const char *name) {
+  char path[FILE_URI_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  for (int i = 0; i < changes->count; i++) {
+    if (!strcmp(changes->paths[i], path)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// wait for the changes to settle down, and take them
+void settle(file_watcher_t *watcher, changes_t *changes) {
+  changes->count = 0;
+  while (1) {
+    struct pollfd fds = {file_watcher_fd(watcher), POLLIN, 0};
+    int timeout = file_watcher_timeout(watcher);
+    if (poll(&fds, 1, timeout < 0 ? 1000 : timeout) > 0) {
+      file_watcher_read(watcher);
+    } else if (file_watcher_drain(watcher, 0, collect, changes) > 0 || timeout < 0) {
+      return;
+    }
+  }
+}
+
+void file_watcher_pushed() {
+  file_watcher_t watcher;
+  file_watcher_init(&watcher);
+  changes_t changes = {0};
+
+  assert(file_watcher_timeout(&watcher) == -1);
+  assert(file_watcher_drain(&watcher, 1, collect, &changes) == 0);
+
+  for (int i = 0; i < 1000; i++) {
+    char path[32];
+    snprintf(path, sizeof(path), "/x/%d.dats", i % 10);
+    file_watcher_push(&watcher, path, strlen(path));
+  }
+  assert(watcher.changes == 1000 && watcher.coalesced == 990);
+
+  // not settled down yet
+  int timeout = file_watcher_timeout(&watcher);
+  assert(timeout > 0 && timeout <= FILE_WATCHER_SETTLE_MS);
+  assert(file_watcher_drain(&watcher, 0, collect, &changes) == 0);
+
+  // in the order they first changed
+  assert(file_watcher_drain(&watcher, 1, collect, &changes) == 10);
+  for (int i = 0; i < 10; i++) {
+    char path[32];
+    snprintf(path, sizeof(path), "/x/%d.dats", i);
+    assert(!strcmp(changes.paths[i], path));
+  }
+  assert(file_watcher_timeout(&watcher) == -1);
+
+  // prefixes are different paths
+  changes.count = 0;
+  file_watcher_push(&watcher, "/x/a.dats", 9);
+  file_watcher_push(&watcher, "/x/a.dats", 6);
+  assert(file_watcher_drain(&watcher, 1, collect, &changes) == 2);
+
+  file_watcher_free(&watcher);
+}
+
+void file_watcher_inotify() {
+  char root[] = "/tmp/file_watcher_tests_XXXXXX";
+  assert(mkdtemp(root) != NULL);
+
+  file_watcher_t watcher;
+  if (!file_watcher_init(&watcher)) {
+    fprintf(stderr, "no inotify, skipped\n");
+    rmdir(root);
+    return;
+  }
+  assert(file_watcher_watch(&watcher, root));
+  changes_t changes = {0};
+
+  // a burst: written several times, each reported once
+  for (int i = 0; i < 5; i++) {
+    write_file(root, "a.dats", "val x = 1\n");
+    write_file(root, "b.sats", "fun f (): int\n");
+  }
+  write_file(root, ".hidden", "no\n");
+  settle(&watcher, &changes);
+  assert(changes.count == 2);
+  assert(changed(&changes, root, "a.dats") && changed(&changes, root, "b.sats"));
+  assert(watcher.coalesced > 0);
+
+  // deleted, and renamed
+  char from[FILE_URI_MAX];
+  char to[FILE_URI_MAX];
+  snprintf(from, sizeof(from), "%s/b.sats", root);
+  snprintf(to, sizeof(to), "%s/c.sats", root);
+  assert(rename(from, to) == 0);
+  snprintf(from, sizeof(from), "%s/a.dats", root);
+  assert(unlink(from) == 0);
+  settle(&watcher, &changes);
+  assert(changes.count == 3);
+  assert(changed(&changes, root, "a.dats") && changed(&changes, root, "b.sats") && changed(&changes, root, "c.sats"));
+
+  // a new directory is watched, along with what is in it already
+  char dir[FILE_URI_MAX];
+  snprintf(dir, sizeof(dir), "%s/sub", root);
+  make_dir(root, "sub");
+  write_file(dir, "d.dats", "val d = 4\n");
+  settle(&watcher, &changes);
+  assert(changes.count == 1 && changed(&changes, dir, "d.dats"));
+  write_file(dir, "e.dats", "val e = 5\n");
+  settle(&watcher, &changes);
+  assert(changes.count == 1 && changed(&changes, dir, "e.dats"));
+
+  // renamed: what is in it goes by the new name, and the old one is gone
+  make_dir(dir, "deeper");
+  settle(&watcher, &changes);
+  assert(changes.count == 0);
+  char renamed[FILE_URI_MAX];
+  snprintf(renamed, sizeof(renamed), "%s/sub2", root);
+  assert(rename(dir, renamed) == 0);
+  settle(&watcher, &changes);
+  assert(changes.count == 3 && changed(&changes, root, "sub"));
+  assert(changed(&changes, renamed, "d.dats") && changed(&changes, renamed, "e.dats"));
+  write_file(renamed, "deeper/f.dats", "val f = 6\n");
+  settle(&watcher, &changes);
+  assert(changes.count == 1 && changed(&changes, renamed, "deeper/f.dats"));
+
+  // moved out: gone, and not watched anymore
+  char outside[] = "/tmp/file_watcher_tests_XXXXXX";
+  assert(mkdtemp(outside) != NULL);
+  char moved[FILE_URI_MAX];
+  snprintf(moved, sizeof(moved), "%s/sub2", outside);
+  assert(rename(renamed, moved) == 0);
+  settle(&watcher, &changes);
+  assert(changes.count == 1 && changed(&changes, root, "sub2"));
+  write_file(moved, "deeper/g.dats", "val g = 7\n");
+  write_file(root, "h.dats", "val h = 8\n");
+  settle(&watcher, &changes);
+  assert(changes.count == 1 && changed(&changes, root, "h.dats"));
+  for (size_t i = 0; i < watcher.dirs_capacity; i++) {
+    assert(watcher.dirs[i] == NULL || strncmp(watcher.dirs[i], renamed, strlen(renamed)));
+  }
+  remove_tree(outside);
+
+  // watched again under its new name before the move is read: the same watch, renamed
+  snprintf(dir, sizeof(dir), "%s/x", root);
+  snprintf(renamed, sizeof(renamed), "%s/y", root);
+  make_dir(root, "x");
+  settle(&watcher, &changes);
+  assert(rename(dir, renamed) == 0);
+  assert(file_watcher_watch(&watcher, renamed));
+  int named_x = 0, named_y = 0;
+  for (size_t i = 0; i < watcher.dirs_capacity; i++) {
+    named_x += watcher.dirs[i] != NULL && !strcmp(watcher.dirs[i], dir);
+    named_y += watcher.dirs[i] != NULL && !strcmp(watcher.dirs[i], renamed);
+  }
+  assert(named_x == 0 && named_y == 1);
+  settle(&watcher, &changes);
+  write_file(renamed, "z.dats", "val z = 9\n");
+  settle(&watcher, &changes);
+  assert(changes.count == 1 && changed(&changes, renamed, "z.dats"));
+  assert(!watcher.overflowed);
+
+  file_watcher_free(&watcher);
+  remove_tree(root);
+}
+
+int main(int argc, char **argv) {
+  file_watcher_pushed();
+  file_watcher_inotify();
+  return 0;
+}
@@ -0,0 +1,92 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "json_rpc_reader.h"
+
+static const char *message_content = "{\"jsonrpc\":\"2.0\",\"method\":\"ping\",\"id\":1}";
+
+void write_message(FILE *fp, const char *content) {
+  fprintf(fp, "Content-Length: %d\r\n\r\n%s", (int)strlen(content), content);
+}
+
+// wait for the next message (NULL once the input is over)
+json_rpc_message_t *next_message(json_rpc_reader_t *reader) {
+  while (1) {
+    json_rpc_message_t *message = json_rpc_reader_pop(reader);
+    if (message != NULL || json_rpc_reader_done(reader)) {
+      return message;
+    }
+    struct pollfd fds[1] = {{json_rpc_reader_fd(reader), POLLIN, 0}};
+    assert(poll(fds, 1, 5000) == 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  int fds[2];
+  json_rpc_reader_t reader;
+
+  // more messages than the queue takes: the reader waits for room
+  assert(pipe(fds) == 0);
+  FILE *in = fdopen(fds[0], "rb");
+  FILE *out = fdopen(fds[1], "wb");
+  assert(json_rpc_reader_start(&reader, in));
+  int total = 3 * SPSC_QUEUE_CAPACITY;
+  for (int i = 0; i < total; i++) {
+    write_message(out, i == 1 ? "{\"foo" : message_content);
+  }
+  fclose(out);
+
+  int count = 0;
+  json_rpc_message_t *message;
+  while ((message = next_message(&reader)) != NULL) {
+    if (count == 1) {
+      // not valid JSON: kept for the error reply
+      assert(message->root == NULL);
+      assert(message->parse_result.error != json_parse_error_none);
+    } else {
+      assert(message->root != NULL);
+      assert(message->content_length == strlen(message_content));
+      assert(!strcmp(message->content, message_content));
+    }
+    json_rpc_message_free(message);
+    count++;
+  }
+  assert(count == total);
+  assert(json_rpc_reader_done(&reader));
+  json_rpc_reader_free(&reader);
+  fclose(in);
+
+  // stopped while waiting for input
+  assert(pipe(fds) == 0);
+  in = fdopen(fds[0], "rb");
+  out = fdopen(fds[1], "wb");
+  assert(json_rpc_reader_start(&reader, in));
+  write_message(out, message_content);
+  fflush(out);
+  message = next_message(&reader);
+  assert(message != NULL && message->root != NULL);
+  json_rpc_message_free(message);
+  assert(!json_rpc_reader_done(&reader));
+  json_rpc_reader_free(&reader);
+  fclose(out);
+  fclose(in);
+
+  // stopped with a full queue
+  assert(pipe(fds) == 0);
+  in = fdopen(fds[0], "rb");
+  out = fdopen(fds[1], "wb");
+  assert(json_rpc_reader_start(&reader, in));
+  for (int i = 0; i < 2 * SPSC_QUEUE_CAPACITY; i++) {
+    write_message(out, message_content);
+  }
+  fflush(out);
+  usleep(20000);
+  json_rpc_reader_free(&reader);
+  fclose(out);
+  fclose(in);
+  return 0;
+}
@@ -123,6 +123,46 @@ void check_request(const char *name, const char *request, const char *response)
   fclose(fout);
 }
 
+// the client answering a request of the server: nothing to send back
+void check_response_ignored() {
+  FILE *fin = tmpfile();
+  FILE *fout = tmpfile();
+  const char *response = "Content-Length: 43\r\n\r\n{\"jsonrpc\": \"2.0\", \"id\": 1, \"result\": null}";
+
+  fwrite(response, strlen(response), 1, fin);
+  fseek(fin, 0, SEEK_SET);
+  assert(json_rpc_server_step(fin, fout, test_evaluate, NULL) == 1);
+  assert(read_file(fout, NULL) == 0);
+
+  fclose(fin);
+  fclose(fout);
+}
+
+void check_server_messages() {
+  FILE *fout = tmpfile();
+
+  json_rpc_custom_request(fout, 7, "window/workDoneProgress/create", "{\"token\": \"t\"}");
+  json_rpc_custom_notification(fout, "$/progress", "{\"token\": \"t\", \"value\": {\"kind\": \"end\"}}");
+  json_rpc_notification(fout, "exit", NULL);
+  json_rpc_custom_notification(fout, "broken", "{"); // not sent
+
+  char *buf;
+  fseek(fout, 0, SEEK_SET);
+  read_file(fout, &buf);
+  const char *expected = "Content-Length: 90\r\n\r\n\
+{\"jsonrpc\":\"2.0\",\"method\":\"window/workDoneProgress/create\",\"params\":{\"token\":\"t\"},\"id\":7}\r\n\
+Content-Length: 86\r\n\r\n\
+{\"jsonrpc\":\"2.0\",\"method\":\"$/progress\",\"params\":{\"token\":\"t\",\"value\":{\"kind\":\"end\"}}}\r\n\
+Content-Length: 34\r\n\r\n\
+{\"jsonrpc\":\"2.0\",\"method\":\"exit\"}\r\n";
+  if (strcmp(buf, expected)) {
+    fprintf(stderr, "server messages failed! details:\nEXPECTED: %s\nACTUAL: %s\n", expected, buf);
+    assert(0);
+  }
+  free(buf);
+  fclose(fout);
+}
+
 int main(int argc, char **argv) {
 
   check_request("Empty request",
@@ -173,4 +213,22 @@ int main(int argc, char **argv) {
                 "Content-Length: 45\r\n\r\n\
 {\"jsonrpc\":\"2.0\",\"result\":5.000000,\"id\":\"a\"}\r\n");
 
+  check_request("Batch",
+                "Content-Length: 173\r\n\r\n\
+[{\"jsonrpc\": \"2.0\", \"method\": \"sum1\", \"params\": [1,4], \"id\": 1}, {\"foo\": 1}, \
+{\"jsonrpc\": \"2.0\", \"id\": 9, \"result\": null}, {\"jsonrpc\": \"2.0\", \"method\": \"interror2\", \"id\": 2}]\r\n",
+                "Content-Length: 220\r\n\r\n\
+[{\"jsonrpc\":\"2.0\",\"result\":5.000000,\"id\":1},\
+{\"jsonrpc\":\"2.0\",\"error\":{\"code\":-32600,\"message\":\"Invalid request\"}},\
+{\"jsonrpc\":\"2.0\",\"error\":{\"code\":-32603,\"message\":\"Internal error\",\"data\":\"INTERNAL ERROR! \\\" \"},\"id\":2}]\r\n");
+
+  check_request("Empty batch",
+                "Content-Length: 2\r\n\r\n[]\r\n",
+                "Content-Length: 70\r\n\r\n\
+{\"jsonrpc\":\"2.0\",\"error\":\
+{\"code\":-32600,\"message\":\"Invalid request\"}}\r\n");
+
+  check_response_ignored();
+  check_server_messages();
+
 }
@@ -0,0 +1,74 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lz.h"
+
+// compress, decompress, and compare; returns the compressed size
+size_t roundtrip(const char *text, size_t length) {
+  size_t bound = lz_compress_bound(length);
+  char *block = malloc(bound);
+  char *out = malloc(length + 1);
+
+  size_t size = lz_compress(text, length, block, bound);
+  assert(size > 0 && size <= bound);
+
+  size_t out_length = 0;
+  assert(lz_decompress(block, size, out, length, &out_length));
+  assert(out_length == length);
+  assert(memcmp(out, text, length) == 0);
+
+  // truncated blocks and too little room are caught
+  assert(!lz_decompress(block, size - 1, out, length + 1, &out_length));
+  assert(length == 0 || !lz_decompress(block, size, out, length - 1, &out_length));
+
+  free(block);
+  free(out);
+  return size;
+}
+
+int main(int argc, char **argv) {
+  // trivial
+  assert(roundtrip("", 0) == 1);
+  assert(roundtrip("a", 1) == 2);
+  roundtrip("abcd", 4);
+
+  // long runs (overlapping matches) and long literals (length extensions)
+  {
+    char text[70000];
+    memset(text, 'x', sizeof(text));
+    assert(roundtrip(text, sizeof(text)) < 400);
+
+    srand(42);
+    for (size_t i = 0; i < sizeof(text); i++) {
+      text[i] = rand() & 0xFF;
+    }
+    assert(roundtrip(text, sizeof(text)) <= lz_compress_bound(sizeof(text)));
+  }
+
+  // source-like text compresses well
+  {
+    const char *line = "implement main0() = println!(\"hello, world!\") // a line of code\n";
+    size_t length = 0;
+    char text[65536];
+    while (length + strlen(line) <= sizeof(text)) {
+      memcpy(text + length, line, strlen(line));
+      text[length] = 'a' + length % 26; // some variation
+      length += strlen(line);
+    }
+    assert(roundtrip(text, length) < length / 4);
+  }
+
+  // garbage is rejected
+  {
+    char out[32];
+    size_t out_length;
+    assert(!lz_decompress("\x10", 1, out, sizeof(out), &out_length));          // missing literal
+    assert(!lz_decompress("\x10" "a" "\x05\x00", 4, out, sizeof(out), &out_length)); // offset too far
+    assert(!lz_decompress("\x10" "a" "\x01", 3, out, sizeof(out), &out_length));     // short offset
+    assert(!lz_decompress("\x1F" "a" "\x01\x00" "\x00" "\x00", 6, out, 16, &out_length)); // 20 bytes do not fit
+    assert(lz_decompress("\x1F" "a" "\x01\x00" "\x00" "\x00", 6, out, 20, &out_length) && out_length == 20);
+  }
+
+  return 0;
+}
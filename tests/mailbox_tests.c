@@ -0,0 +1,87 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "mailbox.h"
+
+#define NUM_MAILBOXES 4
+#define NUM_JOBS 500 // per mailbox
+
+typedef struct log_s {
+  int order[NUM_JOBS];
+  int count;
+  atomic_int running; // jobs of this mailbox running now
+  int overlapped; // ever more than one at a time
+} log_t;
+
+typedef struct job_s {
+  log_t *log;
+  int index;
+} job_t;
+
+void log_task(void *arg) {
+  job_t *job = (job_t *)arg;
+  log_t *log = job->log;
+
+  if (atomic_fetch_add(&log->running, 1) != 0) {
+    log->overlapped = 1;
+  }
+  // (no lock: the mailbox runs its jobs one at a time)
+  log->order[log->count++] = job->index;
+  atomic_fetch_sub(&log->running, 1);
+}
+
+// two mailboxes run at the same time: each job waits for the other's
+static atomic_int arrived;
+
+void rendezvous_task(void *arg) {
+  atomic_fetch_add(&arrived, 1);
+  for (int i = 0; i < 5000 && atomic_load(&arrived) < 2; i++) {
+    usleep(1000);
+  }
+}
+
+int main(int argc, char **argv) {
+  thread_pool_t pool;
+  assert(thread_pool_init(&pool, 4));
+
+  mailbox_t mailboxes[NUM_MAILBOXES];
+  static log_t logs[NUM_MAILBOXES];
+  static job_t jobs[NUM_MAILBOXES][NUM_JOBS];
+  for (int m = 0; m < NUM_MAILBOXES; m++) {
+    mailbox_init(&mailboxes[m], &pool);
+    assert(mailbox_pending(&mailboxes[m]) == 0);
+    mailbox_wait(&mailboxes[m]); // nothing to wait for
+  }
+
+  // posted in turn: each mailbox keeps its own order, and never runs two jobs at once
+  for (int i = 0; i < NUM_JOBS; i++) {
+    for (int m = 0; m < NUM_MAILBOXES; m++) {
+      jobs[m][i].log = &logs[m];
+      jobs[m][i].index = i;
+      assert(mailbox_post(&mailboxes[m], log_task, &jobs[m][i]));
+    }
+  }
+  for (int m = 0; m < NUM_MAILBOXES; m++) {
+    mailbox_wait(&mailboxes[m]);
+    assert(mailbox_pending(&mailboxes[m]) == 0);
+    assert(logs[m].count == NUM_JOBS && !logs[m].overlapped);
+    for (int i = 0; i < NUM_JOBS; i++) {
+      assert(logs[m].order[i] == i);
+    }
+  }
+
+  // ... but different mailboxes do
+  assert(mailbox_post(&mailboxes[0], rendezvous_task, NULL));
+  assert(mailbox_post(&mailboxes[1], rendezvous_task, NULL));
+  thread_pool_wait(&pool);
+  assert(atomic_load(&arrived) == 2);
+
+  for (int m = 0; m < NUM_MAILBOXES; m++) {
+    mailbox_free(&mailboxes[m]);
+  }
+  thread_pool_free(&pool);
+  return 0;
+}
@@ -0,0 +1,149 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "path_resolver.h"
+#include "test_files.h"
+#include "xxhash64.h"
+
+path_id_t resolve(path_resolver_t *resolver, path_id_t from, const char *spec) {
+  return path_resolve(resolver, from, spec, strlen(spec));
+}
+
+// the path [id] is [dir]/[name]
+int resolved_to(path_resolver_t *resolver, path_id_t id, const char *dir, const char *name) {
+  char expected[FILE_URI_MAX];
+  char path[FILE_URI_MAX];
+  snprintf(expected, sizeof(expected), "%s/%s", dir, name);
+  return id != PATH_ID_NONE && path_table_get(&resolver->fs->paths, id, path, sizeof(path)) > 0
+    && !strcmp(path, expected);
+}
+
+int main(int argc, char **argv) {
+  char root[] = "/tmp/path_resolver_tests_XXXXXX";
+  assert(mkdtemp(root) != NULL);
+  char home[FILE_URI_MAX];
+  char path[FILE_URI_MAX];
+
+  // a workspace, and a home with a prelude
+  make_dir(root, "src");
+  make_dir(root, "SATS");
+  write_file(root, "src/main.dats", "#staload \"../SATS/lib.sats\"\n");
+  write_file(root, "src/util.hats", "");
+  write_file(root, "SATS/lib.sats", "fun f (): int\n");
+  make_dir(root, "home");
+  make_dir(root, "home/prelude");
+  write_file(root, "home/prelude/basics.sats", "");
+  write_file(root, "home/prelude/local.sats", "");
+  write_file(root, "src/local.sats", ""); // shadows the one in the home
+  snprintf(home, sizeof(home), "%s/./home/", root);
+  setenv("PATSHOME", home, 1);
+  setenv("XATSHOME", "relative", 1);
+  snprintf(home, sizeof(home), "%s/home", root);
+
+  file_system_t fs;
+  file_system_init(&fs);
+  path_resolver_t resolver;
+  path_resolver_init(&resolver, &fs);
+  assert(resolver.homes[0] != NULL && !strcmp(resolver.homes[0], home));
+  assert(resolver.homes[1] == NULL);
+
+  snprintf(path, sizeof(path), "%s/src/main.dats", root);
+  file_t *main_file = file_system_load(&fs, path);
+  assert(main_file != NULL);
+  path_id_t from = main_file->path_id;
+
+  // relative to the file
+  assert(resolved_to(&resolver, resolve(&resolver, from, "util.hats"), root, "src/util.hats"));
+  assert(resolved_to(&resolver, resolve(&resolver, from, "./util.hats"), root, "src/util.hats"));
+  assert(resolved_to(&resolver, resolve(&resolver, from, "../SATS/lib.sats"), root, "SATS/lib.sats"));
+  assert(resolved_to(&resolver, resolve(&resolver, from, "../src/../SATS//lib.sats"), root, "SATS/lib.sats"));
+  assert(resolved_to(&resolver, resolve(&resolver, from, "local.sats"), root, "src/local.sats"));
+  // then to the homes
+  assert(resolved_to(&resolver, resolve(&resolver, from, "prelude/basics.sats"), home, "prelude/basics.sats"));
+  assert(resolved_to(&resolver, resolve(&resolver, PATH_ID_NONE, "prelude/local.sats"), home, "prelude/local.sats"));
+  assert(resolved_to(&resolver, resolve(&resolver, from, "$PATSHOME/prelude/local.sats"), home, "prelude/local.sats"));
+  // absolute
+  snprintf(path, sizeof(path), "%s/SATS/lib.sats", root);
+  assert(resolved_to(&resolver, resolve(&resolver, from, path), root, "SATS/lib.sats"));
+
+  // nothing there
+  assert(resolve(&resolver, from, "missing.sats") == PATH_ID_NONE);
+  assert(resolve(&resolver, from, "") == PATH_ID_NONE);
+  assert(resolve(&resolver, from, "$XATSHOME/prelude/basics.sats") == PATH_ID_NONE);
+  assert(resolve(&resolver, from, "$OTHER/prelude/basics.sats") == PATH_ID_NONE);
+  assert(resolve(&resolver, from, "../../../../../../../../../../../..") == PATH_ID_NONE);
+  assert(resolve(&resolver, from, "../SATS") == PATH_ID_NONE); // a directory
+
+  // misses are not interned (as when the name is being typed)
+  size_t num_nodes = fs.paths.num_nodes;
+  assert(resolve(&resolver, from, "m") == PATH_ID_NONE);
+  assert(resolve(&resolver, from, "mi") == PATH_ID_NONE);
+  assert(resolve(&resolver, from, "mis/sing.sats") == PATH_ID_NONE);
+  assert(fs.paths.num_nodes == num_nodes);
+  // ... but remembered for a while
+  size_t stat_calls = resolver.stat_calls;
+  assert(resolve(&resolver, from, "mi") == PATH_ID_NONE);
+  assert(resolver.stat_calls == stat_calls);
+  snprintf(path, sizeof(path), "%s/src/mi", root);
+  for (size_t i = 0; i < PATH_RESOLVER_MISSES; i++) {
+    if (resolver.misses[i].hash == xxh64(path, strlen(path), 0)) {
+      resolver.misses[i].checked.tv_sec -= PATH_RESOLVER_TTL_MS / 1000 + 1;
+    }
+  }
+  assert(resolve(&resolver, from, "mi") == PATH_ID_NONE);
+  assert(resolver.stat_calls > stat_calls);
+
+  // not NUL-terminated
+  assert(resolved_to(&resolver, path_resolve(&resolver, from, "util.hats\" (* *)", 9), root, "src/util.hats"));
+
+  // the interned file, if any
+  assert(path_resolve_file(&resolver, from, "util.hats", 9) == NULL);
+  snprintf(path, sizeof(path), "%s/src/util.hats", root);
+  file_t *util = file_system_load(&fs, path);
+  assert(util != NULL && path_resolve_file(&resolver, from, "util.hats", 9) == util);
+  assert(path_resolve_file(&resolver, util->path_id, "main.dats", 9) == main_file);
+
+  // stat results are cached
+  assert(resolve(&resolver, from, "missing.sats") == PATH_ID_NONE); // (in case its entry was taken)
+  stat_calls = resolver.stat_calls;
+  assert(resolve(&resolver, from, "missing.sats") == PATH_ID_NONE);
+  assert(resolved_to(&resolver, resolve(&resolver, from, "../SATS/lib.sats"), root, "SATS/lib.sats"));
+  assert(resolver.stat_calls == stat_calls && resolver.hits > 0);
+
+  // ... until invalidated
+  write_file(root, "src/missing.sats", "");
+  snprintf(path, sizeof(path), "%s/src/missing.sats", root);
+  resolver.watched_root = path_table_find(&fs.paths, root, strlen(root));
+  assert(resolve(&resolver, from, "missing.sats") == PATH_ID_NONE); // not told yet
+  path_resolver_invalidate(&resolver, path, strlen(path));
+  assert(resolved_to(&resolver, resolve(&resolver, from, "missing.sats"), root, "src/missing.sats"));
+  assert(resolver.stat_calls == stat_calls + 1);
+  assert(unlink(path) == 0);
+  path_resolver_invalidate_all(&resolver);
+  assert(resolve(&resolver, from, "missing.sats") == PATH_ID_NONE);
+
+  // ... or, unwatched, after a while
+  resolver.watched_root = PATH_ID_NONE;
+  write_file(root, "src/missing.sats", "");
+  path_id_t missing = path_table_find(&fs.paths, path, strlen(path));
+  assert(missing != PATH_ID_NONE && missing < resolver.stats_capacity);
+  resolver.stats[missing].checked.tv_sec -= PATH_RESOLVER_TTL_MS / 1000 + 1;
+  assert(resolved_to(&resolver, resolve(&resolver, from, "missing.sats"), root, "src/missing.sats"));
+  const path_stat_t *st = path_resolver_stat(&resolver, missing);
+  assert(st->exists && st->length == 0);
+
+  // open in the editor but not saved yet
+  snprintf(path, sizeof(path), "file://%s/src/unsaved.sats", root);
+  file_system_open(&fs, path, 1, "", 0);
+  assert(resolved_to(&resolver, resolve(&resolver, from, "unsaved.sats"), root, "src/unsaved.sats"));
+
+  path_resolver_free(&resolver);
+  file_system_free(&fs);
+
+  remove_tree(root);
+  return 0;
+}
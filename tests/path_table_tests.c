@@ -0,0 +1,88 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "path_table.h"
+
+path_id_t intern(path_table_t *pt, const char *path) {
+  return path_table_intern(pt, path, strlen(path));
+}
+
+int path_is(path_table_t *pt, path_id_t id, const char *path) {
+  char buffer[256];
+  size_t length = path_table_get(pt, id, buffer, sizeof(buffer));
+  return length == strlen(path) && !strcmp(buffer, path) && path_table_length(pt, id) == length;
+}
+
+int canonical(const char *path, const char *expected) {
+  char buffer[32];
+  size_t length = path_canonicalize(path, strlen(path), buffer, sizeof(buffer));
+  if (expected == NULL) {
+    return length == 0;
+  }
+  return length == strlen(expected) && !strcmp(buffer, expected);
+}
+
+int main(int argc, char **argv) {
+  path_table_t pt;
+  assert(path_table_init(&pt));
+
+  // the root, and relative paths
+  assert(intern(&pt, "/") == PATH_ID_ROOT);
+  assert(path_is(&pt, PATH_ID_ROOT, "/"));
+  assert(intern(&pt, "") == PATH_ID_NONE);
+  assert(intern(&pt, "a/b") == PATH_ID_NONE);
+
+  // each path once; directories are shared
+  path_id_t a = intern(&pt, "/home/user/a.dats");
+  path_id_t b = intern(&pt, "/home/user/b.dats");
+  path_id_t dir = path_table_find(&pt, "/home/user", strlen("/home/user"));
+  assert(a != PATH_ID_NONE && b != PATH_ID_NONE && a != b);
+  assert(intern(&pt, "/home/user/a.dats") == a);
+  assert(intern(&pt, "//home/user//a.dats/") == a);
+  assert(dir != PATH_ID_NONE && path_table_parent(&pt, a) == dir && path_table_parent(&pt, b) == dir);
+  assert(path_table_parent(&pt, path_table_parent(&pt, dir)) == PATH_ID_ROOT);
+  assert(path_is(&pt, a, "/home/user/a.dats"));
+  assert(path_is(&pt, dir, "/home/user"));
+  assert(path_table_hash(&pt, a) != path_table_hash(&pt, b));
+
+  // finding does not intern
+  assert(path_table_find(&pt, "/home/user/c.dats", strlen("/home/user/c.dats")) == PATH_ID_NONE);
+  assert(path_table_find(&pt, "/home/user/c.dats", strlen("/home/user/c.dats")) == PATH_ID_NONE);
+  assert(path_table_find(&pt, "/home/user/a.dats", strlen("/home/user/a.dats")) == a);
+
+  // too small a buffer
+  char small[8];
+  assert(path_table_get(&pt, a, small, sizeof(small)) == 0);
+
+  // lots of paths (growing everything)
+  char path[64];
+  path_id_t ids[3000];
+  for (int i = 0; i < 3000; i++) {
+    snprintf(path, sizeof(path), "/src/dir%d/file%d.sats", i % 17, i);
+    ids[i] = intern(&pt, path);
+    assert(ids[i] != PATH_ID_NONE);
+  }
+  for (int i = 0; i < 3000; i++) {
+    snprintf(path, sizeof(path), "/src/dir%d/file%d.sats", i % 17, i);
+    assert(path_table_find(&pt, path, strlen(path)) == ids[i]);
+    assert(path_is(&pt, ids[i], path));
+  }
+  assert(path_is(&pt, a, "/home/user/a.dats"));
+
+  path_table_free(&pt);
+
+  assert(canonical("/", "/"));
+  assert(canonical("/a/b", "/a/b"));
+  assert(canonical("//a/./b/", "/a/b"));
+  assert(canonical("/a/b/../c", "/a/c"));
+  assert(canonical("/a/b/../../c/./", "/c"));
+  assert(canonical("/a/..", "/"));
+  assert(canonical("/a/.b/..c/x./", "/a/.b/..c/x."));
+  assert(canonical("/..", NULL));
+  assert(canonical("/a/../..", NULL));
+  assert(canonical("a/b", NULL));
+  assert(canonical("", NULL));
+  assert(canonical("/a/very/long/path/that/does/not/fit", NULL));
+  assert(canonical("/a/very/long/path/../../../x", "/a/x"));
+  return 0;
+}
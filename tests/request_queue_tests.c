@@ -0,0 +1,243 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+#include "request_queue.h"
+
+// frame and parse [content] as if read off the input
+json_rpc_message_t *make_message(const char *content) {
+  char buffer[512];
+  int used = snprintf(buffer, sizeof(buffer), "Content-Length: %d\r\n\r\n%s", (int)strlen(content), content);
+  assert(used > 0 && (size_t)used < sizeof(buffer));
+  FILE *fp = fmemopen(buffer, used, "rb");
+  assert(fp != NULL);
+  json_rpc_message_t *message = json_rpc_read_message(fp);
+  fclose(fp);
+  assert(message != NULL);
+  return message;
+}
+
+void push_request(request_queue_t *queue, const char *id) {
+  char content[256];
+  snprintf(content, sizeof(content), "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/hover\",\"id\":%s}", id);
+  queued_message_t *cancelled;
+  assert(request_queue_push(queue, make_message(content), &cancelled) == 1);
+  assert(cancelled == NULL);
+}
+
+void push_method(request_queue_t *queue, const char *method, const char *id) {
+  char content[256];
+  if (id != NULL) {
+    snprintf(content, sizeof(content), "{\"jsonrpc\":\"2.0\",\"method\":\"%s\",\"id\":%s}", method, id);
+  } else {
+    snprintf(content, sizeof(content), "{\"jsonrpc\":\"2.0\",\"method\":\"%s\"}", method);
+  }
+  queued_message_t *cancelled;
+  assert(request_queue_push(queue, make_message(content), &cancelled) == 1);
+}
+
+request_class_t classify(const char *method) {
+  if (!strcmp(method, "textDocument/hover")) {
+    return REQUEST_CLASS_INTERACTIVE;
+  }
+  return !strcmp(method, "workspace/diagnostic") ? REQUEST_CLASS_BACKGROUND : REQUEST_CLASS_FOREGROUND;
+}
+
+// pop the next message: it is the request of [id] (or a notification if NULL)
+void pop_expect(request_queue_t *queue, const char *id) {
+  queued_message_t *queued = request_queue_pop(queue);
+  assert(queued != NULL);
+  if (id == NULL) {
+    assert(queued->request_class == REQUEST_NUM_CLASSES);
+  } else {
+    assert(queued->id_length == strlen(id) && !memcmp(queued->id, id, queued->id_length));
+  }
+  request_queue_finish(queue);
+  queued_message_free(queued);
+}
+
+// returns the request taken out of the queue (if any)
+queued_message_t *push_cancel(request_queue_t *queue, const char *id) {
+  char content[256];
+  snprintf(content, sizeof(content), "{\"jsonrpc\":\"2.0\",\"method\":\"$/cancelRequest\",\"params\":{\"id\":%s}}", id);
+  queued_message_t *cancelled;
+  assert(!request_queue_push(queue, make_message(content), &cancelled));
+  return cancelled;
+}
+
+int main(int argc, char **argv) {
+  char key[REQUEST_QUEUE_ID_MAX];
+  const char *ids = "[12, \"12\", null]";
+  struct json_value_s *root = json_parse(ids, strlen(ids));
+  struct json_array_element_s *element = json_value_as_array(root)->start;
+  assert(request_queue_id_key(element->value, key, sizeof(key)) == 2 && !memcmp(key, "12", 2));
+  element = element->next;
+  assert(request_queue_id_key(element->value, key, sizeof(key)) == 3 && !memcmp(key, "\"12", 3));
+  element = element->next;
+  assert(request_queue_id_key(element->value, key, sizeof(key)) == 0);
+  free(root);
+
+  request_queue_t queue;
+  request_queue_init(&queue, NULL);
+  assert(request_queue_pop(&queue) == NULL);
+
+  // in order, notifications and invalid messages too
+  push_request(&queue, "1");
+  push_request(&queue, "\"two\"");
+  queued_message_t *cancelled;
+  assert(request_queue_push(&queue, make_message("{\"jsonrpc\":\"2.0\",\"method\":\"initialized\"}"), &cancelled) == 1);
+  assert(request_queue_push(&queue, make_message("{\"foo"), &cancelled) == 1);
+  push_request(&queue, "3");
+  assert(queue.length == 5 && queue.num_pending == 3);
+
+  // a cancellation takes a queued request out
+  cancelled = push_cancel(&queue, "\"two\"");
+  assert(cancelled != NULL);
+  assert(json_value_as_string(cancelled->request.id) != NULL);
+  assert(queue.length == 4 && queue.num_pending == 2 && queue.cancelled_queued == 1);
+  queued_message_free(cancelled);
+  // twice, or of an unknown one: nothing to do
+  assert(push_cancel(&queue, "\"two\"") == NULL);
+  assert(push_cancel(&queue, "42") == NULL);
+  // a number is not the string of it
+  assert(push_cancel(&queue, "\"1\"") == NULL);
+  assert(queue.length == 4 && queue.cancelled_queued == 1);
+
+  queued_message_t *queued = request_queue_pop(&queue);
+  assert(queued != NULL && queued->valid && queued->id_length == 1);
+  assert(!request_queue_cancelled(&queue));
+  // the current one is only flagged
+  assert(push_cancel(&queue, "1") == NULL);
+  assert(request_queue_cancelled(&queue));
+  assert(queue.cancelled_running == 1 && queue.num_pending == 2);
+  request_queue_finish(&queue);
+  queued_message_free(queued);
+  assert(!request_queue_cancelled(&queue) && queue.num_pending == 1);
+
+  queued = request_queue_pop(&queue);
+  assert(queued->valid && json_rpc_request_is_notification(&queued->request));
+  request_queue_finish(&queue);
+  queued_message_free(queued);
+  queued = request_queue_pop(&queue);
+  assert(!queued->valid && queued->message->root == NULL);
+  request_queue_finish(&queue);
+  queued_message_free(queued);
+
+  // taken along with the current one: not pending anymore
+  push_request(&queue, "7");
+  push_request(&queue, "8");
+  queued = request_queue_pop(&queue);
+  assert(queued->id_length == 1 && queued->id[0] == '3');
+  assert(request_queue_peek(&queue)->id[0] == '7');
+  queued_message_t *taken = request_queue_take(&queue);
+  assert(taken != NULL && taken->id[0] == '7');
+  assert(request_queue_peek(&queue)->id[0] == '8');
+  assert(queue.length == 1 && queue.num_pending == 2);
+  assert(push_cancel(&queue, "7") == NULL);
+  queued_message_free(taken);
+  request_queue_finish(&queue);
+  queued_message_free(queued);
+  queued = request_queue_pop(&queue);
+  request_queue_finish(&queue);
+  queued_message_free(queued);
+  assert(request_queue_peek(&queue) == NULL && request_queue_take(&queue) == NULL);
+  assert(queue.num_pending == 0);
+
+  // detached (evaluated elsewhere): still flagged by a cancellation, until finished
+  push_request(&queue, "9");
+  push_request(&queue, "10");
+  queued = request_queue_pop(&queue);
+  request_queue_detach(&queue);
+  assert(queue.current == NULL && queue.num_pending == 2);
+  taken = request_queue_pop(&queue);
+  assert(taken->id_length == 2);
+  request_queue_finish(&queue);
+  size_t cancelled_running = queue.cancelled_running;
+  assert(push_cancel(&queue, "9") == NULL);
+  assert(atomic_load(&queued->cancelled) && queue.cancelled_running == cancelled_running + 1);
+  assert(!request_queue_cancelled(&queue));
+  request_queue_finish_detached(&queue, queued);
+  queued_message_free(queued);
+  queued_message_free(taken);
+  assert(queue.num_pending == 0);
+  assert(push_cancel(&queue, "9") == NULL && queue.cancelled_running == cancelled_running + 1);
+
+  // many pending at once (the table grows)
+  char id[16];
+  for (int i = 100; i < 300; i++) {
+    snprintf(id, sizeof(id), "%d", i);
+    push_request(&queue, id);
+  }
+  assert(queue.num_pending == 200);
+  for (int i = 100; i < 300; i += 2) {
+    snprintf(id, sizeof(id), "%d", i);
+    cancelled = push_cancel(&queue, id);
+    assert(cancelled != NULL);
+    queued_message_free(cancelled);
+  }
+  assert(queue.num_pending == 100 && queue.length == 100);
+  queued = request_queue_pop(&queue);
+  assert(queued->id_length == 3 && !memcmp(queued->id, "101", 3));
+  request_queue_finish(&queue);
+  queued_message_free(queued);
+
+  request_queue_free(&queue);
+
+  // without a classifier, all requests are foreground
+  assert(queue.stats[REQUEST_CLASS_FOREGROUND].depth == 0 && queue.stats[REQUEST_CLASS_INTERACTIVE].evaluated == 0);
+  push_request(&queue, "1");
+  assert(request_queue_depth(&queue, REQUEST_CLASS_FOREGROUND) == 1);
+  pop_expect(&queue, "1");
+  assert(queue.stats[REQUEST_CLASS_FOREGROUND].evaluated == 1);
+  request_queue_free(&queue);
+
+  // more urgent requests go first, but not past a notification
+  request_queue_init(&queue, classify);
+  push_method(&queue, "workspace/diagnostic", "1");
+  push_method(&queue, "textDocument/definition", "2");
+  push_method(&queue, "textDocument/hover", "3");
+  push_method(&queue, "textDocument/hover", "4");
+  push_method(&queue, "textDocument/didChange", NULL);
+  push_method(&queue, "textDocument/hover", "5");
+  assert(request_queue_depth(&queue, REQUEST_CLASS_INTERACTIVE) == 3);
+  assert(request_queue_depth(&queue, REQUEST_CLASS_FOREGROUND) == 1);
+  assert(request_queue_depth(&queue, REQUEST_CLASS_BACKGROUND) == 1);
+  pop_expect(&queue, "3");
+  pop_expect(&queue, "4");
+  pop_expect(&queue, "2");
+  // (the notification holds the later hover back)
+  pop_expect(&queue, "1");
+  pop_expect(&queue, NULL);
+  pop_expect(&queue, "5");
+  assert(request_queue_pop(&queue) == NULL);
+  assert(queue.stats[REQUEST_CLASS_INTERACTIVE].evaluated == 3 && queue.stats[REQUEST_CLASS_INTERACTIVE].max_depth == 3);
+  assert(queue.stats[REQUEST_CLASS_BACKGROUND].evaluated == 1 && queue.stats[REQUEST_CLASS_BACKGROUND].depth == 0);
+  assert(queue.stats[REQUEST_CLASS_BACKGROUND].wait_ns >= queue.stats[REQUEST_CLASS_BACKGROUND].max_wait_ns);
+
+  // cancelled ones are not evaluated, nor queued anymore
+  push_method(&queue, "textDocument/hover", "6");
+  cancelled = push_cancel(&queue, "6");
+  assert(cancelled != NULL);
+  queued_message_free(cancelled);
+  assert(request_queue_depth(&queue, REQUEST_CLASS_INTERACTIVE) == 0);
+  assert(queue.stats[REQUEST_CLASS_INTERACTIVE].evaluated == 3);
+
+  // only so far down the queue
+  for (int i = 0; i < REQUEST_QUEUE_SCAN_MAX; i++) {
+    snprintf(id, sizeof(id), "%d", 100 + i);
+    push_method(&queue, "textDocument/definition", id);
+  }
+  push_method(&queue, "textDocument/hover", "7");
+  pop_expect(&queue, "100");
+  pop_expect(&queue, "7");
+
+  request_class_stats_t total;
+  memset(&total, 0, sizeof(total));
+  request_class_stats_add(&total, &queue.stats[REQUEST_CLASS_INTERACTIVE]);
+  request_class_stats_add(&total, &queue.stats[REQUEST_CLASS_INTERACTIVE]);
+  assert(total.evaluated == 8 && total.max_depth == queue.stats[REQUEST_CLASS_INTERACTIVE].max_depth);
+  request_queue_free(&queue);
+  return 0;
+}
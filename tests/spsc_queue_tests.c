@@ -0,0 +1,54 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "spsc_queue.h"
+
+#define NUM_ITEMS 100000
+
+void *produce(void *arg) {
+  spsc_queue_t *queue = (spsc_queue_t *)arg;
+
+  for (uintptr_t i = 1; i <= NUM_ITEMS; i++) {
+    while (!spsc_queue_push(queue, (void *)i)) {
+      // full: spin
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  spsc_queue_t queue;
+  spsc_queue_init(&queue);
+
+  void *item;
+  assert(!spsc_queue_pop(&queue, &item));
+
+  // up to the capacity, in order, then wrapping around
+  for (int round = 0; round < 3; round++) {
+    for (uintptr_t i = 0; i < SPSC_QUEUE_CAPACITY; i++) {
+      assert(spsc_queue_push(&queue, (void *)(i + 1)));
+    }
+    assert(!spsc_queue_push(&queue, (void *)1));
+    for (uintptr_t i = 0; i < SPSC_QUEUE_CAPACITY; i++) {
+      assert(spsc_queue_pop(&queue, &item));
+      assert((uintptr_t)item == i + 1);
+    }
+    assert(!spsc_queue_pop(&queue, &item));
+  }
+
+  // another thread pushing: nothing lost, nothing out of order
+  pthread_t producer;
+  assert(pthread_create(&producer, NULL, produce, &queue) == 0);
+  uintptr_t expected = 1;
+  while (expected <= NUM_ITEMS) {
+    if (spsc_queue_pop(&queue, &item)) {
+      assert((uintptr_t)item == expected);
+      expected++;
+    }
+  }
+  pthread_join(producer, NULL);
+  assert(!spsc_queue_pop(&queue, &item));
+  return 0;
+}
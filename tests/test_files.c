@@ -0,0 +1,35 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "test_files.h"
+
+void write_file(const char *dir, const char *name, const char *contents) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  write_bytes(path, contents, strlen(contents));
+}
+
+void write_bytes(const char *path, const char *contents, size_t length) {
+  FILE *fp = fopen(path, "wb");
+  assert(fp != NULL);
+  size_t written = fwrite(contents, 1, length, fp);
+  assert(written == length);
+  (void)written;
+  fclose(fp);
+}
+
+void make_dir(const char *dir, const char *name) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  assert(mkdir(path, 0700) == 0);
+}
+
+void remove_tree(const char *dir) {
+  char command[PATH_MAX + 16];
+  snprintf(command, sizeof(command), "rm -rf '%s'", dir);
+  assert(system(command) == 0);
+}
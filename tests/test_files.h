@@ -0,0 +1,17 @@
+#ifndef __TEST_FILES_H__
+#define __TEST_FILES_H__
+
+#include <stddef.h>
+
+// files and directories for the tests (in a directory of their own, made with mkdtemp);
+// all of these assert that they succeeded
+
+// write [contents] (a string) into the file [dir]/[name]
+void write_file(const char *dir, const char *name, const char *contents);
+// write [length] bytes into the file [path]
+void write_bytes(const char *path, const char *contents, size_t length);
+void make_dir(const char *dir, const char *name);
+// remove [dir] and all below it
+void remove_tree(const char *dir);
+
+#endif /* !__TEST_FILES_H__ */
@@ -3,6 +3,7 @@
 #include <string.h>
 
 #include "text_buffer.h"
+#include "xxhash64.h"
 
 typedef struct test_state_s {
   char *string;
@@ -556,6 +557,329 @@ void textbuf_pos_nav_delete_tests() {
   }
 }
 
+void textbuf_affix_tests() {
+  // common prefix/suffix across gapbuffer boundaries
+  fprintf(stderr, "%s:%d\n", __FILE__, __LINE__);
+  {
+    text_buffer_t tb;
+    const char *literal = "0123456789abcdefghijklmnopqrstuvwxyz";
+    size_t prefix = 0, suffix = 0;
+
+    text_buffer_init(&tb, 16);
+    insert_string(&tb, literal, strlen(literal));
+    assert(tb.start.next != tb.end.prev);
+
+    text_buffer_common_affixes(&tb, literal, strlen(literal), &prefix, &suffix);
+    assert(prefix == strlen(literal) && suffix == 0);
+
+    text_buffer_common_affixes(&tb, "0123456789abcdefghij--mnopqrstuvwxyz", strlen(literal), &prefix, &suffix);
+    assert(prefix == 20 && suffix == 14);
+
+    text_buffer_common_affixes(&tb, "0123xyz", 7, &prefix, &suffix);
+    assert(prefix == 4 && suffix == 3);
+
+    // the suffix does not overlap the prefix
+    text_buffer_common_affixes(&tb, "0123456789", 10, &prefix, &suffix);
+    assert(prefix == 10 && suffix == 0);
+
+    // replace the middle, byte-wise
+    assert(text_buffer_set_offset(&tb, 20));
+    text_position_t end;
+    assert(text_buffer_delete_bytes(&tb, 2, &end) == 2);
+    assert(end.line_num == 0 && end.char_num == 22);
+    text_buffer_insert(&tb, "--", 2);
+    assert(textbuf_eq_string(&tb, "0123456789abcdefghij--mnopqrstuvwxyz"));
+    assert(text_buffer_get_offset(&tb) == 22);
+    assert(text_buffer_length(&tb) == strlen(literal));
+
+    text_buffer_free(&tb);
+  }
+}
+
+void textbuf_fingerprint_tests() {
+  // reference values of XXH64 (seed 0)
+  fprintf(stderr, "%s:%d\n", __FILE__, __LINE__);
+  {
+    const char *nobody = "Nobody inspects the spammish repetition";
+
+    assert(xxh64("", 0, 0) == 0xEF46DB3751D8E999ULL);
+    assert(xxh64("a", 1, 0) == 0xD24EC4F1A98C6E5BULL);
+    assert(xxh64("abc", 3, 0) == 0x44BC2CF5AD770999ULL);
+    assert(xxh64(nobody, strlen(nobody), 0) == 0xFBCEA83C8A378BF1ULL);
+
+    // streaming in pieces gives the same hash
+    xxh64_state_t state;
+    xxh64_init(&state, 0);
+    for (size_t i = 0; i < strlen(nobody); i += 5) {
+      size_t len = strlen(nobody) - i < 5 ? strlen(nobody) - i : 5;
+      xxh64_update(&state, nobody + i, len);
+    }
+    assert(xxh64_digest(&state) == 0xFBCEA83C8A378BF1ULL);
+  }
+  // chunk hashes do not depend on the gap; fingerprints follow the edits
+  fprintf(stderr, "%s:%d\n", __FILE__, __LINE__);
+  {
+    text_buffer_t tb;
+    const char *literal = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+    text_buffer_init(&tb, 16);
+    insert_string(&tb, literal, strlen(literal));
+    assert(tb.start.next != tb.end.prev);
+
+    gapbuf_t *first = tb.start.next;
+    uint64_t hash = gapbuf_hash(first);
+    uint64_t fingerprint = text_buffer_fingerprint(&tb);
+    assert(hash == xxh64(literal, gapbuf_length(first), 0));
+
+    // moving around does not change anything
+    text_position_t pos = {0, 3};
+    assert(text_buffer_set_point(&tb, &pos));
+    assert(tb.point == first && !gapbuf_at_right(first));
+    assert(first->hash_valid && gapbuf_hash(first) == hash);
+    assert(text_buffer_fingerprint(&tb) == fingerprint);
+
+    // an edit does, and reverting it restores the fingerprint
+    text_buffer_insert(&tb, "-", 1);
+    assert(!first->hash_valid);
+    assert(text_buffer_fingerprint(&tb) != fingerprint);
+    assert(text_buffer_set_offset(&tb, 3));
+    assert(text_buffer_delete_bytes(&tb, 1, NULL) == 1);
+    assert(textbuf_eq_string(&tb, literal));
+    assert(gapbuf_hash(first) == hash);
+    assert(text_buffer_fingerprint(&tb) == fingerprint);
+
+    text_buffer_free(&tb);
+  }
+}
+
+typedef struct search_state_s {
+  text_match_t matches[256];
+  size_t count;
+  size_t batches;
+  size_t stop_after; // batches
+} search_state_t;
+
+int search_collect(const text_match_t *matches, size_t count, void *state) {
+  search_state_t *st = (search_state_t *)state;
+
+  assert(count > 0 && count <= TEXT_SEARCH_BATCH);
+  for (size_t i = 0; i < count && st->count < 256; i++) {
+    st->matches[st->count++] = matches[i];
+  }
+  st->batches++;
+  return st->stop_after == 0 || st->batches < st->stop_after;
+}
+
+void textbuf_search_tests() {
+  // matches within and across chunks
+  fprintf(stderr, "%s:%d\n", __FILE__, __LINE__);
+  {
+    text_buffer_t tb;
+    const char *literal = "abcdefghijklmn\nopqrstuvwxyzabcdefghijklmnopqrstuvwxyz";
+    search_state_t st = {0};
+
+    text_buffer_init(&tb, 16);
+    insert_string(&tb, literal, strlen(literal));
+    assert(tb.start.next->next != tb.end.prev);
+    text_position_t pos = {1, 5};
+    assert(text_buffer_set_point(&tb, &pos)); // split a chunk by its gap
+
+    assert(text_buffer_search(&tb, "mn", 2, search_collect, &st) == 2);
+    assert(st.batches == 1);
+    assert(st.matches[0].offset == 12 && st.matches[0].position.line_num == 0 && st.matches[0].position.char_num == 12);
+    assert(st.matches[1].offset == 39 && st.matches[1].position.line_num == 1 && st.matches[1].position.char_num == 24);
+    st.count = 0;
+    assert(text_buffer_search(&tb, "lmn\nopq", 7, search_collect, &st) == 1);
+    assert(st.matches[0].offset == 11);
+
+    for (size_t len = 1; len <= strlen(literal); len++) {
+      st.count = 0;
+      // the first line appears twice
+      assert(text_buffer_search(&tb, literal, len, search_collect, &st) == (len <= 14 ? 2 : 1));
+      assert(st.matches[0].offset == 0);
+      assert(len > 14 || st.matches[1].offset == 27);
+    }
+
+    st.count = 0;
+    assert(text_buffer_search(&tb, "zz", 2, search_collect, &st) == 0);
+    assert(text_buffer_search(&tb, "z\n", 2, search_collect, &st) == 0);
+    assert(text_buffer_search(&tb, "xyz", 3, search_collect, &st) == 2);
+    assert(st.matches[1].offset == strlen(literal) - 3);
+
+    // copying out any range, across chunks
+    char copy[64];
+    for (size_t start = 0; start <= strlen(literal); start += 3) {
+      for (size_t len = 0; start + len <= strlen(literal); len += 5) {
+        assert(text_buffer_copy(&tb, start, copy, len) == len);
+        assert(!memcmp(copy, literal + start, len));
+      }
+    }
+    assert(text_buffer_copy(&tb, strlen(literal) - 2, copy, 10) == 2);
+    assert(text_buffer_copy(&tb, strlen(literal) + 1, copy, 10) == 0);
+
+    // the buffer is left alone
+    text_buffer_get_point(&tb, &pos);
+    assert(pos.line_num == 1 && pos.char_num == 5);
+    assert(textbuf_eq_string(&tb, literal));
+
+    text_buffer_free(&tb);
+  }
+  // non-overlapping, in batches, UTF-8 positions; stopping early
+  fprintf(stderr, "%s:%d\n", __FILE__, __LINE__);
+  {
+    text_buffer_t tb;
+    search_state_t st = {0};
+
+    text_buffer_init(&tb, 16);
+    for (int i = 0; i < 100; i++) {
+      insert_string(&tb, "\xce\xbb" "aaa", 5);
+    }
+    assert(text_buffer_search(&tb, "aa", 2, search_collect, &st) == 100);
+    assert(st.batches == 2);
+    assert(st.matches[99].offset == 99 * 5 + 2 && st.matches[99].position.char_num == 99 * 4 + 1);
+
+    st.count = st.batches = 0;
+    st.stop_after = 1;
+    assert(text_buffer_search(&tb, "\xce\xbb", 2, search_collect, &st) == TEXT_SEARCH_BATCH);
+    assert(st.batches == 1 && st.count == TEXT_SEARCH_BATCH);
+
+    text_buffer_free(&tb);
+  }
+}
+
+void textbuf_location_tests() {
+  // batch conversions match one-by-one seeking
+  fprintf(stderr, "%s:%d\n", __FILE__, __LINE__);
+  {
+    text_buffer_t tb;
+    const char *literal = "first line\n\xce\xbb-second\n\nfourth line is longer\nlast";
+
+    text_buffer_init(&tb, 16);
+    insert_string(&tb, literal, strlen(literal));
+
+    // every offset on a codepoint boundary, in reverse (so they have to be sorted)
+    text_location_t locs[64];
+    size_t count = 0;
+    for (size_t i = strlen(literal) + 1; i-- > 0; ) {
+      if ((literal[i] & 0xC0) != 0x80) {
+        locs[count].offset = i;
+        count++;
+      }
+    }
+    assert(text_buffer_offsets_to_positions(&tb, locs, count));
+    for (size_t i = 0; i < count; i++) {
+      text_position_t pos = {0, 0};
+      text_position_advance(&pos, literal, locs[i].offset);
+      assert(text_position_cmp(&pos, &locs[i].position) == 0);
+    }
+    assert(locs[0].offset == strlen(literal) && locs[count-1].offset == 0); // not reordered
+
+    // and back
+    for (size_t i = 0; i < count; i++) {
+      locs[i].offset = 12345;
+    }
+    assert(text_buffer_positions_to_offsets(&tb, locs, count));
+    for (size_t i = 0; i < count; i++) {
+      text_position_t pos = {0, 0};
+      text_position_advance(&pos, literal, locs[i].offset);
+      assert(text_position_cmp(&pos, &locs[i].position) == 0);
+    }
+    assert(locs[0].offset == strlen(literal) && locs[count-1].offset == 0);
+
+    // clamping
+    text_location_t out[4] = {
+      {{0, 100}, 0}, // past the end of the line
+      {{2, 1}, 0},   // empty line
+      {{9, 0}, 0},   // past the end of the text
+      {{0, 0}, 1000} // unused
+    };
+    assert(text_buffer_positions_to_offsets(&tb, out, 3));
+    assert(out[0].offset == 10 && out[0].position.line_num == 0 && out[0].position.char_num == 10);
+    assert(out[1].offset == 21 && out[1].position.line_num == 2 && out[1].position.char_num == 0);
+    assert(out[2].offset == strlen(literal) && out[2].position.line_num == 4 && out[2].position.char_num == 4);
+    assert(text_buffer_offsets_to_positions(&tb, &out[3], 1));
+    assert(out[3].offset == strlen(literal) && out[3].position.line_num == 4);
+
+    text_buffer_free(&tb);
+  }
+}
+
+void textbuf_cold_tests() {
+  // freezing keeps the text, the point and the fingerprint
+  fprintf(stderr, "%s:%d\n", __FILE__, __LINE__);
+  {
+    text_buffer_t tb;
+    char literal[2000];
+    for (size_t i = 0; i < sizeof(literal) - 1; i++) {
+      literal[i] = i % 40 == 39 ? '\n' : 'a' + i % 3;
+    }
+    literal[sizeof(literal) - 1] = 0;
+
+    text_buffer_init(&tb, 256);
+    insert_string(&tb, literal, strlen(literal));
+    text_position_t pos = {20, 7};
+    assert(text_buffer_set_point(&tb, &pos));
+
+    uint64_t fingerprint = text_buffer_fingerprint(&tb);
+    size_t offset = text_buffer_get_offset(&tb);
+    size_t memory = text_buffer_memory(&tb);
+
+    assert(text_buffer_freeze(&tb));
+    assert(tb.is_cold && tb.point == NULL);
+    assert(text_buffer_freeze(&tb)); // already
+    assert(text_buffer_memory(&tb) < memory / 4);
+    assert(text_buffer_fingerprint(&tb) == fingerprint);
+    assert(text_buffer_length(&tb) == strlen(literal));
+    assert(text_buffer_get_offset(&tb) == offset);
+    text_buffer_get_point(&tb, &pos);
+    assert(pos.line_num == 20 && pos.char_num == 7);
+    assert(tb.is_cold);
+
+    // thawed by reading
+    assert(textbuf_eq_string(&tb, literal));
+    assert(!tb.is_cold);
+    assert(text_buffer_memory(&tb) == memory);
+    assert(text_buffer_fingerprint(&tb) == fingerprint);
+    assert(text_buffer_get_offset(&tb) == offset);
+
+    // thawed by editing, at the point
+    assert(text_buffer_freeze(&tb));
+    text_buffer_insert(&tb, "!", 1);
+    assert(!tb.is_cold);
+    assert(text_buffer_get_offset(&tb) == offset + 1);
+    assert(text_buffer_set_offset(&tb, offset));
+    assert(text_buffer_delete_bytes(&tb, 1, NULL) == 1);
+    assert(textbuf_eq_string(&tb, literal));
+
+    // failing to thaw (as if out of memory) does nothing, and leaves it frozen
+    assert(text_buffer_freeze(&tb));
+    tb.cold.length++; // (the block does not decompress to that)
+    assert(!text_buffer_thaw(&tb) && tb.is_cold);
+    text_buffer_insert(&tb, "!", 1);
+    char copied[8];
+    assert(text_buffer_copy(&tb, 0, copied, sizeof(copied)) == 0);
+    assert(!text_buffer_set_offset(&tb, 1) && text_buffer_get_offset(&tb) == offset);
+    tb.cold.length--;
+    assert(text_buffer_thaw(&tb) && !tb.is_cold);
+    assert(textbuf_eq_string(&tb, literal));
+
+    text_buffer_free(&tb);
+  }
+  // empty buffers, and freeing while cold
+  fprintf(stderr, "%s:%d\n", __FILE__, __LINE__);
+  {
+    text_buffer_t tb;
+
+    text_buffer_init(&tb, 16);
+    assert(text_buffer_freeze(&tb));
+    assert(text_buffer_length(&tb) == 0);
+    insert_string(&tb, "x", 1);
+    assert(textbuf_eq_string(&tb, "x"));
+    assert(text_buffer_freeze(&tb));
+    text_buffer_free(&tb);
+  }
+}
+
 int main(int argc, char **argv) {
 
   gapbuf_tests();
@@ -563,6 +887,11 @@ int main(int argc, char **argv) {
   textbuf_clear_tests();
   textbuf_utf8_nav_tests();
   textbuf_pos_nav_delete_tests();
+  textbuf_affix_tests();
+  textbuf_fingerprint_tests();
+  textbuf_search_tests();
+  textbuf_location_tests();
+  textbuf_cold_tests();
 
   // TODO: probably, add a separate "cursor" facility: it's an index into the string
   // - kinda like the frozen iterator that is baked into the text_buffer...
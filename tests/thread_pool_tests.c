@@ -0,0 +1,106 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "thread_pool.h"
+
+typedef struct counter_s {
+  pthread_mutex_t lock;
+  thread_pool_t *pool;
+  int count;
+  int spawn; // jobs left to submit from inside jobs
+} counter_t;
+
+void count_task(void *arg) {
+  counter_t *counter = (counter_t *)arg;
+
+  pthread_mutex_lock(&counter->lock);
+  counter->count++;
+  int spawn = counter->spawn > 0;
+  if (spawn) {
+    counter->spawn--;
+  }
+  pthread_mutex_unlock(&counter->lock);
+
+  if (spawn) {
+    assert(thread_pool_submit(counter->pool, count_task, counter));
+  }
+}
+
+void slow_task(void *arg) {
+  counter_t *counter = (counter_t *)arg;
+
+  usleep(1000);
+  pthread_mutex_lock(&counter->lock);
+  counter->count++;
+  pthread_mutex_unlock(&counter->lock);
+}
+
+// submits its jobs onto its own deque: the other workers have to steal them
+void fan_out_task(void *arg) {
+  counter_t *counter = (counter_t *)arg;
+
+  for (int i = 0; i < 64; i++) {
+    assert(thread_pool_submit(counter->pool, slow_task, counter));
+  }
+}
+
+int main(int argc, char **argv) {
+  assert(thread_pool_default_threads() >= 1);
+
+  thread_pool_t pool;
+  counter_t counter;
+  memset(&counter, 0, sizeof(counter));
+  pthread_mutex_init(&counter.lock, NULL);
+  counter.pool = &pool;
+
+  assert(thread_pool_init(&pool, 4));
+  assert(pool.num_threads == 4);
+
+  // nothing to wait for
+  thread_pool_wait(&pool);
+
+  for (int i = 0; i < 1000; i++) {
+    assert(thread_pool_submit(&pool, count_task, &counter));
+  }
+  thread_pool_wait(&pool);
+  assert(counter.count == 1000);
+
+  // jobs submitting jobs
+  counter.count = 0;
+  counter.spawn = 100;
+  assert(thread_pool_submit(&pool, count_task, &counter));
+  thread_pool_wait(&pool);
+  assert(counter.count == 101 && counter.spawn == 0);
+
+  // idle workers steal
+  counter.count = 0;
+  assert(thread_pool_submit(&pool, fan_out_task, &counter));
+  thread_pool_wait(&pool);
+  assert(counter.count == 64);
+  assert(pool.steals > 0);
+
+  // more jobs than fit in a deque at first
+  counter.count = 0;
+  for (int i = 0; i < 4 * 4 * THREAD_POOL_MIN_DEQUE; i++) {
+    assert(thread_pool_submit(&pool, count_task, &counter));
+  }
+  thread_pool_wait(&pool);
+  assert(counter.count == 4 * 4 * THREAD_POOL_MIN_DEQUE);
+
+  // queued jobs are run before stopping
+  counter.count = 0;
+  for (int i = 0; i < 100; i++) {
+    assert(thread_pool_submit(&pool, count_task, &counter));
+  }
+  thread_pool_free(&pool);
+  assert(counter.count == 100);
+
+  // one per core
+  assert(thread_pool_init(&pool, 0));
+  assert(pool.num_threads == thread_pool_default_threads());
+  thread_pool_free(&pool);
+
+  pthread_mutex_destroy(&counter.lock);
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "transport.h"
+
+// a connection both ways, through a listening socket
+void transport_round_trip(const char *path) {
+  int listen_fd = transport_listen(path);
+  assert(listen_fd >= 0);
+  // nothing pending: does not block
+  assert(transport_accept(listen_fd) < 0);
+
+  int client_fd = transport_connect(path);
+  assert(client_fd >= 0);
+  int server_fd = transport_accept(listen_fd);
+  assert(server_fd >= 0);
+
+  FILE *client_in, *client_out, *server_in, *server_out;
+  assert(transport_open(client_fd, &client_in, &client_out));
+  assert(transport_open(server_fd, &server_in, &server_out));
+
+  char line[64];
+  fputs("hello\n", client_out);
+  fflush(client_out);
+  assert(fgets(line, sizeof(line), server_in) != NULL && !strcmp(line, "hello\n"));
+  fputs("world\n", server_out);
+  fflush(server_out);
+  assert(fgets(line, sizeof(line), client_in) != NULL && !strcmp(line, "world\n"));
+
+  // once both streams are closed, the other end sees the end of the input
+  fclose(server_in);
+  fclose(server_out);
+  assert(fgets(line, sizeof(line), client_in) == NULL);
+  fclose(client_in);
+  fclose(client_out);
+  close(listen_fd);
+}
+
+int main(int argc, char **argv) {
+  char dir[] = "/tmp/transport_tests_XXXXXX";
+  assert(mkdtemp(dir) != NULL);
+  char path[128];
+  snprintf(path, sizeof(path), "%s/xatsls.sock", dir);
+
+  // nobody listening
+  assert(transport_connect(path) < 0);
+
+  // a socket in use is left alone
+  int listen_fd = transport_listen(path);
+  assert(listen_fd >= 0);
+  assert(transport_listen(path) < 0);
+  int client_fd = transport_connect(path);
+  assert(client_fd >= 0);
+  close(client_fd);
+  close(listen_fd);
+
+  // the socket left behind is replaced
+  struct stat st;
+  assert(stat(path, &st) == 0 && S_ISSOCK(st.st_mode));
+  transport_round_trip(path);
+
+  // too long for a socket address
+  char long_path[256];
+  memset(long_path, 'x', sizeof(long_path) - 1);
+  long_path[0] = '/';
+  long_path[sizeof(long_path) - 1] = '\0';
+  assert(transport_listen(long_path) < 0);
+
+  unlink(path);
+  rmdir(dir);
+  return 0;
+}
@@ -0,0 +1,254 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "workspace_index.h"
+#include "test_files.h"
+#include "xxhash64.h"
+
+// the whole file, in a malloc'd buffer
+char *read_file(const char *path, size_t *length) {
+  struct stat st;
+  assert(stat(path, &st) == 0);
+  char *data = malloc(st.st_size);
+  FILE *fp = fopen(path, "rb");
+  assert(fp != NULL && data != NULL);
+  assert(fread(data, 1, st.st_size, fp) == (size_t)st.st_size);
+  fclose(fp);
+  *length = st.st_size;
+  return data;
+}
+
+void workspace_index_roundtrip(const char *root) {
+  char path[FILE_URI_MAX];
+  char index_path[FILE_URI_MAX];
+  workspace_index_t index;
+  file_digest_t digest;
+  file_system_t fs;
+
+  // nothing there yet
+  snprintf(index_path, sizeof(index_path), "%s/index", root);
+  assert(!workspace_index_open(&index, index_path, root));
+  assert(!workspace_index_find(&index, "/x", 2, &digest));
+
+  file_system_init(&fs);
+  for (int i = 0; i < 100; i++) {
+    char contents[32];
+    snprintf(path, sizeof(path), "%s/f%d.dats", root, i);
+    snprintf(contents, sizeof(contents), "val x%d = %d\n", i, i);
+    write_bytes(path, contents, strlen(contents));
+    assert(file_system_load(&fs, path) != NULL);
+  }
+  // open in the editor: not as it is on disk
+  snprintf(path, sizeof(path), "file://%s/f0.dats", root);
+  file_system_open(&fs, path, 1, "edited", 6);
+  assert(workspace_index_write(index_path, root, &fs, NULL));
+
+  assert(workspace_index_open(&index, index_path, root));
+  assert(index.num_files == 99);
+  for (int i = 0; i < 100; i++) {
+    char contents[32];
+    snprintf(path, sizeof(path), "%s/f%d.dats", root, i);
+    snprintf(contents, sizeof(contents), "val x%d = %d\n", i, i);
+    if (i == 0) {
+      assert(!workspace_index_find(&index, path, strlen(path), &digest));
+      continue;
+    }
+    assert(workspace_index_find(&index, path, strlen(path), &digest));
+    struct stat st;
+    assert(stat(path, &st) == 0);
+    assert(digest.length == strlen(contents));
+    assert(digest.mtime.tv_sec == st.st_mtim.tv_sec && digest.mtime.tv_nsec == st.st_mtim.tv_nsec);
+    assert(digest.hash == xxh64(contents, strlen(contents), 0));
+    // a prefix is another path
+    assert(!workspace_index_find(&index, path, strlen(path) - 1, &digest));
+  }
+  workspace_index_close(&index);
+  assert(index.data == NULL && index.num_files == 0);
+
+  // of another workspace
+  assert(!workspace_index_open(&index, index_path, "/elsewhere"));
+
+  // written again over the old one
+  assert(workspace_index_write(index_path, root, &fs, NULL));
+  assert(workspace_index_open(&index, index_path, root));
+  assert(index.num_files == 99);
+  workspace_index_close(&index);
+  file_system_free(&fs);
+
+  // an empty workspace
+  file_system_init(&fs);
+  assert(workspace_index_write(index_path, root, &fs, NULL));
+  assert(workspace_index_open(&index, index_path, root));
+  assert(index.num_files == 0);
+  assert(!workspace_index_find(&index, "/x", 2, &digest));
+  workspace_index_close(&index);
+  file_system_free(&fs);
+}
+
+// the directives found in the files are kept along with them
+void workspace_index_directives_kept(const char *root) {
+  char path[FILE_URI_MAX];
+  char index_path[FILE_URI_MAX];
+  workspace_index_t index;
+  dep_directives_t directives;
+  file_system_t fs;
+  path_resolver_t resolver;
+  dep_graph_t graph;
+
+  file_system_init(&fs);
+  path_resolver_init(&resolver, &fs);
+  dep_graph_init(&graph, &fs, &resolver);
+  write_file(root, "m.sats", "fun m (): int\n");
+  write_file(root, "n.dats", "staload \"m.sats\"\n#include \"gone.hats\"\n");
+  for (int i = 0; i < 2; i++) {
+    snprintf(path, sizeof(path), "%s/%s", root, i == 0 ? "m.sats" : "n.dats");
+    file_t *file = file_system_load(&fs, path);
+    assert(file != NULL);
+    dep_graph_update(&graph, file);
+  }
+  snprintf(index_path, sizeof(index_path), "%s/index", root);
+  assert(workspace_index_write(index_path, root, &fs, &graph));
+
+  assert(workspace_index_open(&index, index_path, root));
+  snprintf(path, sizeof(path), "%s/n.dats", root);
+  uint64_t hash = xxh64("staload \"m.sats\"\n#include \"gone.hats\"\n", 38, 0);
+  assert(workspace_index_directives(&index, path, strlen(path), hash, &directives));
+  assert(directives.size == 5 + 6 + 5 + 9);
+  assert(!memcmp(directives.data + 5, "m.sats", 6) && !memcmp(directives.data + 16, "gone.hats", 9));
+  // of another text
+  assert(!workspace_index_directives(&index, path, strlen(path), hash + 1, &directives));
+  snprintf(path, sizeof(path), "%s/m.sats", root);
+  assert(workspace_index_directives(&index, path, strlen(path), xxh64("fun m (): int\n", 14, 0), &directives));
+  assert(directives.size == 0);
+  workspace_index_close(&index);
+
+  // without them (of an older run): the files are there all the same
+  assert(workspace_index_write(index_path, root, &fs, NULL));
+  assert(workspace_index_open(&index, index_path, root));
+  assert(index.num_files == 2);
+  assert(!workspace_index_directives(&index, path, strlen(path), xxh64("fun m (): int\n", 14, 0), &directives));
+  workspace_index_close(&index);
+
+  dep_graph_free(&graph);
+  path_resolver_free(&resolver);
+  file_system_free(&fs);
+}
+
+void workspace_index_corrupt(const char *root) {
+  char path[FILE_URI_MAX];
+  char index_path[FILE_URI_MAX];
+  char bad_path[FILE_URI_MAX];
+  workspace_index_t index;
+  file_system_t fs;
+
+  file_system_init(&fs);
+  snprintf(path, sizeof(path), "%s/a.dats", root);
+  write_bytes(path, "val a = 1\n", 10);
+  assert(file_system_load(&fs, path) != NULL);
+  snprintf(index_path, sizeof(index_path), "%s/index", root);
+  assert(workspace_index_write(index_path, root, &fs, NULL));
+  file_system_free(&fs);
+
+  size_t length;
+  char *data = read_file(index_path, &length);
+  snprintf(bad_path, sizeof(bad_path), "%s/bad", root);
+
+  // cut short anywhere
+  for (size_t cut = 0; cut < length; cut += 7) {
+    write_bytes(bad_path, data, cut);
+    assert(!workspace_index_open(&index, bad_path, root));
+  }
+
+  // of another version
+  workspace_index_header_t *header = (workspace_index_header_t *)data;
+  header->version++;
+  write_bytes(bad_path, data, length);
+  assert(!workspace_index_open(&index, bad_path, root));
+  header->version--;
+
+  // a record pointing outside of the paths
+  workspace_index_section_t *sections = (workspace_index_section_t *)(header + 1);
+  for (uint32_t i = 0; i < header->num_sections; i++) {
+    if (sections[i].kind == WORKSPACE_INDEX_FILES) {
+      workspace_index_file_t *record = (workspace_index_file_t *)(data + sections[i].offset);
+      record->path_length += 1000;
+      write_bytes(bad_path, data, length);
+      assert(!workspace_index_open(&index, bad_path, root));
+      record->path_length -= 1000;
+    }
+  }
+
+  // directives pointing outside of their section are not taken, the rest is
+  for (uint32_t i = 0; i < header->num_sections; i++) {
+    if (sections[i].kind == WORKSPACE_INDEX_DIRECTIVES) {
+      workspace_index_directives_t *record = (workspace_index_directives_t *)(data + sections[i].offset);
+      record->offset += 1000;
+      write_bytes(bad_path, data, length);
+      assert(workspace_index_open(&index, bad_path, root));
+      assert(index.directives == NULL && index.num_files == 1);
+      workspace_index_close(&index);
+      record->offset -= 1000;
+    }
+  }
+
+  // sections of later versions are skipped
+  write_bytes(bad_path, data, length);
+  assert(workspace_index_open(&index, bad_path, root));
+  workspace_index_close(&index);
+  sections[0].kind = 99;
+  write_bytes(bad_path, data, length);
+  assert(!workspace_index_open(&index, bad_path, root)); // (but those that are needed are missing)
+
+  free(data);
+}
+
+void workspace_index_where(const char *root) {
+  char buffer[FILE_URI_MAX];
+  char expected[FILE_URI_MAX];
+
+  char cache[FILE_URI_MAX];
+  snprintf(cache, sizeof(cache), "%s/cache", root);
+  setenv("XDG_CACHE_HOME", cache, 1);
+  assert(workspace_index_location("/some/workspace", buffer, sizeof(buffer)));
+  snprintf(expected, sizeof(expected), "%s/xatsls/%016llx.idx", cache, (unsigned long long)xxh64("/some/workspace", 15, 0));
+  assert(!strcmp(buffer, expected));
+  struct stat st;
+  snprintf(expected, sizeof(expected), "%s/xatsls", cache);
+  assert(stat(expected, &st) == 0 && S_ISDIR(st.st_mode));
+
+  // one per workspace
+  char other[FILE_URI_MAX];
+  assert(workspace_index_location("/some/other", other, sizeof(other)));
+  assert(strcmp(buffer, other));
+
+  // relative: ignored
+  setenv("XDG_CACHE_HOME", "relative", 1);
+  setenv("HOME", root, 1);
+  assert(workspace_index_location("/some/workspace", buffer, sizeof(buffer)));
+  snprintf(expected, sizeof(expected), "%s/.cache/xatsls/", root);
+  assert(!strncmp(buffer, expected, strlen(expected)));
+
+  unsetenv("XDG_CACHE_HOME");
+  unsetenv("HOME");
+  assert(!workspace_index_location("/some/workspace", buffer, sizeof(buffer)));
+  // too small
+  setenv("HOME", root, 1);
+  assert(!workspace_index_location("/some/workspace", buffer, 16));
+}
+
+int main(int argc, char **argv) {
+  char root[] = "/tmp/workspace_index_tests_XXXXXX";
+  assert(mkdtemp(root) != NULL);
+
+  workspace_index_roundtrip(root);
+  workspace_index_directives_kept(root);
+  workspace_index_corrupt(root);
+  workspace_index_where(root);
+
+  remove_tree(root);
+  return 0;
+}